@@ -17,6 +17,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
  *****************************************************************************/
 
+/**
+ * \file
+ * Actor.
+ */
+
 #ifndef _M_ACTOR_H_
 #define _M_ACTOR_H_
 
@@ -26,22 +31,152 @@ extern "C" {
 
 #include "m_types.h"
 #include "m_list.h"
+#include "m_mpsc.h"
 #include "m_thread.h"
+#include "m_gc.h"
 
+/**Call stack record.*/
 typedef struct M_Stack_s M_Stack;
 
+/**Value stack chunk.*/
+typedef struct M_StackChunk_s M_StackChunk;
+
+/**Message in an actor's mailbox.*/
+typedef struct M_Message_s M_Message;
+
+/**Default size of a value stack chunk in bytes.*/
+#ifndef M_ACTOR_CHUNK_SIZE
+	#define M_ACTOR_CHUNK_SIZE (64*1024)
+#endif
+
+/**
+ * Call stack record.
+ * Each running byte code function has a record in the actor's call stack.
+ * The record is followed by the function's frame and its values in the
+ * actor's value stack.
+ */
 struct M_Stack_s {
-	M_Stack   *bottom;
-	M_SList    slist;
-	M_Frame   *frame;
-	uint16_t   ip;
-	uint16_t   sp;
+	M_Stack   *bottom; /**< The entry record of the m_actor_call.*/
+	M_SList    slist;  /**< Node in the actor's call stack.*/
+	M_Frame   *frame;  /**< The function's value frame.*/
+	uint16_t   ip;     /**< Offset of the next instruction.*/
+	uint16_t   sp;     /**< Value stack pointer.*/
+	uint8_t    ret;    /**< The caller's register receiving the result.*/
 };
 
+/**
+ * Value stack chunk.
+ * The chunks are never moved, so the frames' addresses are stable.
+ */
+struct M_StackChunk_s {
+	M_StackChunk *prev;  /**< The previous chunk.*/
+	uint8_t      *top;   /**< Allocation position.*/
+	uint8_t      *end;   /**< End of the chunk.*/
+	uint32_t      size;  /**< Chunk size in bytes.*/
+};
+
+/**Number of messages the actor moves out of the queue at a time.*/
+#ifndef M_ACTOR_FETCH_BATCH
+	#define M_ACTOR_FETCH_BATCH 16
+#endif
+
+/**Message in an actor's mailbox.*/
+struct M_Message_s {
+	M_SList node; /**< Node in the mailbox.*/
+	M_Value v;    /**< The message value.*/
+};
+
+/**
+ * Actor's mailbox.
+ * The messages sent by each sender are handled in the order they are sent.
+ * Only the sender changing the actor from idle to runnable schedules it.
+ */
+typedef struct {
+	M_MpscQueue queue; /**< The sent messages.*/
+	M_SList     batch; /**< Messages moved out of the queue, not handled yet.*/
+	uint32_t    sched; /**< The actor is in a run queue or running.*/
+} M_Mailbox;
+
+/**Actor.*/
 struct M_Actor_s {
-	M_SList    stack;
+	M_List        node;    /**< Node in the actors list.*/
+	M_SList       stack;   /**< Call stack, the top record is the running one.*/
+	M_StackChunk *chunk;   /**< The value stack's top chunk.*/
+	M_StackChunk *spare;   /**< An empty chunk kept for reuse.*/
+	M_Value       retv;    /**< Result of the last finished call.*/
+	M_Value       behav;   /**< Behaviour function invoked for each message.*/
+	M_Mailbox     mbox;    /**< The mailbox.*/
+	M_Actor      *rq_next; /**< The next actor in the global run queue.*/
 };
 
+/** \cond */
+#define M_GC_STACK_FLAGS M_GC_BUF_FL_PTR
+#define M_GC_ACTOR_FLAGS M_GC_BUF_FL_PTR
+#define M_GC_MSG_FLAGS   M_GC_BUF_FL_PTR
+
+extern M_List m_actor_list;
+
+extern void m_actor_startup (void);
+extern void m_actor_shutdown (void);
+
+static inline M_Stack*
+m_actor_top (M_Actor *actor)
+{
+	return m_node_value(actor->stack.next, M_Stack, slist);
+}
+
+extern M_Stack* m_actor_push (M_Actor *actor, M_Closure *clos, uint16_t nv);
+extern void     m_actor_pop (M_Actor *actor);
+extern M_Result m_actor_fetch (M_Actor *actor, M_Value *msg);
+/** \endcond */
+
+/**
+ * Create a new actor.
+ * \return The new actor.
+ */
+extern M_Actor* m_actor_new (void);
+
+/**
+ * Create a new actor running under the scheduler.
+ * The behaviour function is invoked with each message the actor receives.
+ * \param bv The behaviour function value, must be a closure.
+ * \return The new actor.
+ */
+extern M_Actor* m_actor_spawn (M_Value bv);
+
+/**
+ * Free an actor.
+ * A spawned actor can be freed after it becomes idle.
+ * \param[in] actor The actor.
+ */
+extern void     m_actor_free (M_Actor *actor);
+
+/**
+ * Send a message to an actor.
+ * An idle actor is scheduled to handle the message.
+ * A frozen message is passed by reference, a mutable one is copied by
+ * m_value_share(). Only a ming thread can send a mutable message, other
+ * threads can send the frozen values.
+ * \param[in] actor The receiver actor.
+ * \param msg The message.
+ */
+extern void     m_actor_send (M_Actor *actor, M_Value msg);
+
+/**
+ * Prepare to call a function value in the actor.
+ * The function runs when m_interp_run() is invoked.
+ * A native function is invoked immediately.
+ * \param[in] actor The actor.
+ * \param fv The function value, must be a closure.
+ * \param argc The number of arguments.
+ * \param[in] argv The arguments.
+ * \retval M_OK The byte code function is ready to run.
+ * \retval M_NONE The native function has finished, its result is in retv.
+ * \retval M_ERR_TYPE The value is not a function.
+ */
+extern M_Result m_actor_call (M_Actor *actor, M_Value fv, uint32_t argc,
+			const M_Value *argv);
+
 /**
  * Get the current actor.
  * \return The current actor.
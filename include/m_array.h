@@ -30,10 +30,201 @@ extern "C" {
 #endif
 
 #include "m_types.h"
+#include "m_hash.h"
+#include "m_gc.h"
 
+/**Array element kind.*/
+typedef enum {
+	M_ARRAY_KIND_SMI,    /**< Small integers stored as int32_t.*/
+	M_ARRAY_KIND_DOUBLE, /**< Unboxed double precision numbers.*/
+	M_ARRAY_KIND_VALUE,  /**< Generic values.*/
+	M_ARRAY_KIND_SPARSE  /**< Elements with holes stored in a hash table.*/
+} M_ArrayKind;
+
+/**
+ * The array and all the values in it never change.
+ * A frozen array can be shared between actors.
+ */
+#define M_ARRAY_FL_FROZEN 1
+
+/**Maximum length of an array, the largest index is M_ARRAY_MAX_LEN - 1.*/
+#define M_ARRAY_MAX_LEN UINT32_MAX
+
+/**Element of the sparse array.*/
+typedef struct {
+	M_HashNode node;  /**< Hash table node.*/
+	uintptr_t  index; /**< The element's index.*/
+	M_Value    v;     /**< The element's value.*/
+} M_ArrayElem;
+
+/**
+ * Array.
+ * Dense arrays store the elements contiguously. The element kind only
+ * becomes more general: small integers are widened to doubles, numbers are
+ * boxed to values, and an array with holes falls back to sparse storage.
+ * A sparse array whose holes are all filled is packed again in the most
+ * specific dense kind.
+ */
 struct M_Array_s {
+	union {
+		int32_t  *ints;    /**< Small integer elements.*/
+		double   *doubles; /**< Double elements.*/
+		M_Value  *values;  /**< Value elements.*/
+		M_Hash    hash;    /**< Sparse elements.*/
+	} e;
+	uint32_t  len;   /**< The array's length.*/
+	uint32_t  cap;   /**< The dense buffer's capacity.*/
+	uint8_t   kind;  /**< The element kind.*/
+	uint8_t   flags; /**< The array's flags.*/
 };
 
+/** \cond */
+#define M_GC_ARRBUF_FLAGS  M_GC_BUF_FL_PTR
+
+extern void m_array_release (M_Array *arr);
+/** \endcond */
+
+/**
+ * Create a new array.
+ * \param cap The initial capacity.
+ * \return The new array.
+ */
+extern M_Array* m_array_new (uint32_t cap);
+
+/**
+ * Get the array's length.
+ * \param[in] arr The array.
+ * \return The length.
+ */
+static inline uint32_t
+m_array_length (M_Array *arr)
+{
+	assert(arr);
+
+	return arr->len;
+}
+
+/**
+ * Get the array's element kind.
+ * \param[in] arr The array.
+ * \return The element kind.
+ */
+static inline M_ArrayKind
+m_array_kind (M_Array *arr)
+{
+	assert(arr);
+
+	return arr->kind;
+}
+
+/**
+ * Get the small integer element buffer.
+ * Loops over numeric arrays use the buffer directly.
+ * \param[in] arr The array.
+ * \return The element buffer.
+ */
+static inline int32_t*
+m_array_ints (M_Array *arr)
+{
+	assert(arr && (arr->kind == M_ARRAY_KIND_SMI));
+
+	return arr->e.ints;
+}
+
+/**
+ * Get the double element buffer.
+ * Loops over numeric arrays use the buffer directly.
+ * \param[in] arr The array.
+ * \return The element buffer.
+ */
+static inline double*
+m_array_doubles (M_Array *arr)
+{
+	assert(arr && (arr->kind == M_ARRAY_KIND_DOUBLE));
+
+	return arr->e.doubles;
+}
+
+/**
+ * Get an element of the array.
+ * Double elements which are not integers are boxed.
+ * \param[in] arr The array.
+ * \param idx The element's index.
+ * \param[out] pv Return the element's value.
+ * \retval M_TRUE The element is found.
+ * \retval M_FALSE The index is out of range or the element is a hole.
+ */
+extern M_Bool   m_array_get (M_Array *arr, uint32_t idx, M_Value *pv);
+
+/**
+ * Get a numeric element of the array without boxing.
+ * \param[in] arr The array.
+ * \param idx The element's index.
+ * \param[out] pd Return the element's number.
+ * \retval M_TRUE The element is a number.
+ * \retval M_FALSE The element is not found or it is not a number.
+ */
+extern M_Bool   m_array_get_number (M_Array *arr, uint32_t idx, double *pd);
+
+/**
+ * Set an element of the array.
+ * Setting an element beyond the length makes holes and changes
+ * the array to sparse storage.
+ * \param[in] arr The array.
+ * \param idx The element's index.
+ * \param v The element's value.
+ * \retval M_OK The element is set.
+ * \retval M_FAILED The array is frozen or the index is M_ARRAY_MAX_LEN.
+ */
+extern M_Result m_array_set (M_Array *arr, uint32_t idx, M_Value v);
+
+/**
+ * Set a numeric element of the array without boxing.
+ * \param[in] arr The array.
+ * \param idx The element's index.
+ * \param d The element's number.
+ * \retval M_OK The element is set.
+ * \retval M_FAILED The array is frozen or the index is M_ARRAY_MAX_LEN.
+ */
+extern M_Result m_array_set_number (M_Array *arr, uint32_t idx, double d);
+
+/**
+ * Append an element to the array.
+ * \param[in] arr The array.
+ * \param v The element's value.
+ * \retval M_OK The element is appended.
+ * \retval M_FAILED The array is frozen or full.
+ */
+static inline M_Result
+m_array_push (M_Array *arr, M_Value v)
+{
+	return m_array_set(arr, m_array_length(arr), v);
+}
+
+/**
+ * Append a numeric element to the array without boxing.
+ * \param[in] arr The array.
+ * \param d The element's number.
+ * \retval M_OK The element is appended.
+ * \retval M_FAILED The array is frozen or full.
+ */
+static inline M_Result
+m_array_push_number (M_Array *arr, double d)
+{
+	return m_array_set_number(arr, m_array_length(arr), d);
+}
+
+/**
+ * Set the array's length.
+ * Shrinking drops the elements behind the length. Growing makes holes,
+ * the array is packed again when they are filled.
+ * \param[in] arr The array.
+ * \param len The new length.
+ * \retval M_OK The length is set.
+ * \retval M_FAILED The array is frozen.
+ */
+extern M_Result m_array_set_length (M_Array *arr, uint32_t len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -31,11 +31,99 @@ extern "C" {
 
 #include "m_types.h"
 
+/**
+ * \name Memory order aware operations
+ * The operations below take an explicit memory order, and work on any
+ * integer or pointer type up to the machine word.
+ * Prefer them to the full barrier "m_atomic_get_XXX" and
+ * "m_atomic_set_XXX" macros. A flag polled in a loop only needs a relaxed
+ * or acquire load, and a value published to other threads only needs
+ * a release store.
+ * @{
+ */
+
+/**No ordering, only atomicity.*/
+#define M_ATOMIC_RELAXED __ATOMIC_RELAXED
+/**Later accesses cannot move before the load.*/
+#define M_ATOMIC_ACQUIRE __ATOMIC_ACQUIRE
+/**Earlier accesses cannot move after the store.*/
+#define M_ATOMIC_RELEASE __ATOMIC_RELEASE
+/**Both acquire and release, for read-modify-write operations.*/
+#define M_ATOMIC_ACQ_REL __ATOMIC_ACQ_REL
+/**Sequentially consistent, a single total order of all such operations.*/
+#define M_ATOMIC_SEQ_CST __ATOMIC_SEQ_CST
+
+/**Atomic load.*/
+#define m_atomic_load(p, order)        __atomic_load_n(p, order)
+/**Atomic store.*/
+#define m_atomic_store(p, v, order)    __atomic_store_n(p, v, order)
+/**Atomic load without ordering.*/
+#define m_atomic_load_relaxed(p)       m_atomic_load(p, M_ATOMIC_RELAXED)
+/**Atomic load with acquire ordering.*/
+#define m_atomic_load_acquire(p)       m_atomic_load(p, M_ATOMIC_ACQUIRE)
+/**Atomic store without ordering.*/
+#define m_atomic_store_relaxed(p, v)   m_atomic_store(p, v, M_ATOMIC_RELAXED)
+/**Atomic store with release ordering.*/
+#define m_atomic_store_release(p, v)   m_atomic_store(p, v, M_ATOMIC_RELEASE)
+/**Atomic exchange and return the origin value.*/
+#define m_atomic_xchg(p, v, order)     __atomic_exchange_n(p, v, order)
+/**Atomic add and return the origin value.*/
+#define m_atomic_fetch_add(p, v, order) __atomic_fetch_add(p, v, order)
+/**Atomic sub and return the origin value.*/
+#define m_atomic_fetch_sub(p, v, order) __atomic_fetch_sub(p, v, order)
+/**Atomic and and return the origin value.*/
+#define m_atomic_fetch_and(p, v, order) __atomic_fetch_and(p, v, order)
+/**Atomic or and return the origin value.*/
+#define m_atomic_fetch_or(p, v, order)  __atomic_fetch_or(p, v, order)
+/**Memory fence.*/
+#define m_atomic_fence(order)          __atomic_thread_fence(order)
+/**Compiler only fence, orders the accesses as seen by the current thread.*/
+#define m_atomic_signal_fence(order)   __atomic_signal_fence(order)
+
+/**\cond*/
+/*A failed CAS is a load, it cannot have release ordering.*/
+#define M_ATOMIC_FAIL_ORDER(order)\
+	(((order) == M_ATOMIC_RELEASE) ? M_ATOMIC_RELAXED :\
+	((order) == M_ATOMIC_ACQ_REL) ? M_ATOMIC_ACQUIRE : (order))
+/**\endcond*/
+
+/**
+ * Atomic compare and swap, which may fail spuriously. Use it in loops.
+ * \a pold points to the expected value, and is updated to the current value
+ * on failure. Return M_TRUE if \a n is stored.
+ */
+#define m_atomic_cas_weak(p, pold, n, order)\
+	__atomic_compare_exchange_n(p, pold, n, M_TRUE, order,\
+				M_ATOMIC_FAIL_ORDER(order))
+/**
+ * Atomic compare and swap.
+ * \a pold points to the expected value, and is updated to the current value
+ * on failure. Return M_TRUE if \a n is stored.
+ */
+#define m_atomic_cas_strong(p, pold, n, order)\
+	__atomic_compare_exchange_n(p, pold, n, M_FALSE, order,\
+				M_ATOMIC_FAIL_ORDER(order))
+
+#if defined(__SIZEOF_INT128__) && defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+/**The 128 bits compare and swap is supported (e.g. x86-64 with -mcx16).*/
+#define M_ATOMIC_HAVE_INT128_CAS 1
+/**
+ * Atomic compare and swap operation to a 128 bits integer, with full
+ * barrier. \a p must be 16 bytes aligned.
+ * The "__atomic" builtins call libatomic for 16 bytes, so "__sync" is used.
+ */
+#define m_atomic_int128_cas(p, o, n)\
+	__sync_bool_compare_and_swap((unsigned __int128*)(p),\
+				(unsigned __int128)(o), (unsigned __int128)(n))
+#endif
+
+/** @} */
+
 /**Atomic read an integer.*/
 #define m_atomic_get_int(p)\
 	({\
 	 __sync_synchronize ();\
-	 (int)*();\
+	 (int)*(p);\
 	 })
 /**Atomic read a 32 bits integer.*/
 #define m_atomic_get_int32(p)\
@@ -144,6 +232,9 @@ extern "C" {
 /**Atomic xor operation to a pointer and return the origin value.*/
 #define m_atomic_ptr_xor(p, v)   __sync_fetch_and_xor(p, v)
 
+/**Atomic exchange a pointer and return the origin value.*/
+#define m_atomic_ptr_xchg(p, v)  __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST)
+
 /**Atomic compare and swap operation to an integer.*/
 #define m_atomic_int_cas(p, o, n)   __sync_bool_compare_and_swap(p, o, n)
 /**Atomic compare and swap operation to a 32 bits integer.*/
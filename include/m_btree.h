@@ -0,0 +1,397 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+/**
+ * \file
+ * B+ tree ordered map.
+ * The keys are 64 bits unsigned integers and the values are pointers.
+ * Each node stores up to M_BTREE_ORDER keys in an array, so a lookup
+ * touches a few cache lines per level instead of one node per key.
+ * The leaves are linked in key order for range traversal.
+ */
+
+#ifndef _M_BTREE_H_
+#define _M_BTREE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "m_types.h"
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+#elif defined(__SSE4_2__)
+	#include <nmmintrin.h>
+#endif
+
+/**Maximum keys count in a node, must be an even number >= 4.*/
+#ifndef M_BTREE_ORDER
+	#define M_BTREE_ORDER 16
+#endif
+
+/**Maximum height of the tree.*/
+#define M_BTREE_MAX_HEIGHT 32
+
+/**B+ tree key.*/
+typedef uint64_t M_BTreeKey;
+
+/**B+ tree node header.*/
+typedef struct {
+	uint32_t    n;                    /**< Keys count.*/
+	M_Bool      leaf;                 /**< It is a leaf node.*/
+	/**Keys, the unused ones are filled with the maximum value.*/
+	M_BTreeKey  keys[M_BTREE_ORDER];
+} M_BTreeNode;
+
+/**B+ tree internal node.*/
+typedef struct {
+	M_BTreeNode  node;                          /**< Node header.*/
+	M_BTreeNode *children[M_BTREE_ORDER + 1];   /**< Child nodes.*/
+} M_BTreeInner;
+
+/**B+ tree leaf node.*/
+typedef struct M_BTreeLeaf_s M_BTreeLeaf;
+/**B+ tree leaf node.*/
+struct M_BTreeLeaf_s {
+	M_BTreeNode  node;                   /**< Node header.*/
+	void        *values[M_BTREE_ORDER];  /**< Values.*/
+	M_BTreeLeaf *next;                   /**< The next leaf in key order.*/
+};
+
+/**B+ tree.*/
+typedef struct {
+	M_BTreeNode *root;   /**< The root node.*/
+	M_BTreeLeaf *first;  /**< The first leaf.*/
+	size_t       size;   /**< Keys count.*/
+	uint32_t     height; /**< Levels count.*/
+} M_BTree;
+
+/**
+ * B+ tree iterator.
+ * An iterator is invalid after the tree is modified.
+ */
+typedef struct {
+	M_BTreeLeaf *leaf;   /**< Current leaf, NULL at the end.*/
+	uint32_t     pos;    /**< Current position in the leaf.*/
+} M_BTreeIter;
+
+/**
+ * Traverse all the entries in the B+ tree in key order.
+ * \a iter is an M_BTreeIter.
+ * \a tree is the tree's pointer.
+ * \code{.c}
+ * M_BTreeIter iter;
+ *
+ * m_btree_foreach(&iter, &tree) {
+ *		printf("%"PRIu64"\n", m_btree_iter_key(&iter));
+ * }
+ * \endcode
+ */
+#define m_btree_foreach(iter, tree)\
+	for (m_btree_first(tree, iter);\
+				m_btree_iter_valid(iter);\
+				m_btree_iter_next(iter))
+
+/**
+ * Traverse the entries with keys in [\a lo, \a hi) in key order.
+ * \a iter is an M_BTreeIter.
+ * \a tree is the tree's pointer.
+ * \a lo is the lowest key.
+ * \a hi is the upper bound key.
+ */
+#define m_btree_foreach_range(iter, tree, lo, hi)\
+	for (m_btree_seek(tree, lo, iter);\
+				m_btree_iter_valid(iter) && (m_btree_iter_key(iter) < (hi));\
+				m_btree_iter_next(iter))
+
+/**\cond*/
+/*Count the keys less than "key" in a node, including the unused ones.*/
+static inline uint32_t
+m_btree_count_less (const M_BTreeNode *node, M_BTreeKey key)
+{
+	uint32_t i, n = 0;
+
+#if defined(__AVX2__) && !(M_BTREE_ORDER & 3)
+	/*Flip the sign bits to compare unsigned numbers by signed compare.*/
+	const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+	const __m256i k = _mm256_xor_si256(_mm256_set1_epi64x(key), sign);
+
+	for (i = 0; i < M_BTREE_ORDER; i += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(node->keys + i));
+
+		v = _mm256_xor_si256(v, sign);
+		n += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(
+					_mm256_cmpgt_epi64(k, v))));
+	}
+#elif defined(__SSE4_2__)
+	const __m128i sign = _mm_set1_epi64x(INT64_MIN);
+	const __m128i k = _mm_xor_si128(_mm_set1_epi64x(key), sign);
+
+	for (i = 0; i < M_BTREE_ORDER; i += 2) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(node->keys + i));
+
+		v = _mm_xor_si128(v, sign);
+		n += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(
+					_mm_cmpgt_epi64(k, v))));
+	}
+#else
+	/*Branchless, so the search has no mispredicted jumps.*/
+	for (i = 0; i < M_BTREE_ORDER; i ++)
+		n += (node->keys[i] < key);
+#endif
+
+	return n;
+}
+
+/*Get the child index of the key in an internal node.*/
+static inline uint32_t
+m_btree_child_index (const M_BTreeNode *node, M_BTreeKey key)
+{
+	uint32_t n;
+
+	if (key == UINT64_MAX)
+		return node->n;
+
+	n = m_btree_count_less(node, key + 1);
+
+	return M_MIN(n, node->n);
+}
+
+/*Get the leaf which may contain the key.*/
+static inline M_BTreeLeaf*
+m_btree_find_leaf (M_BTree *tree, M_BTreeKey key)
+{
+	M_BTreeNode *node = tree->root;
+
+	while (!node->leaf) {
+		M_BTreeInner *inner = (M_BTreeInner*)node;
+
+		node = inner->children[m_btree_child_index(node, key)];
+	}
+
+	return (M_BTreeLeaf*)node;
+}
+/**\endcond*/
+
+/**
+ * B+ tree structure initialize.
+ * \param[in] tree The tree.
+ */
+static inline void
+m_btree_init (M_BTree *tree)
+{
+	assert(tree);
+
+	tree->root   = NULL;
+	tree->first  = NULL;
+	tree->size   = 0;
+	tree->height = 0;
+}
+
+/**
+ * Get the keys count in the B+ tree.
+ * \param[in] tree The tree.
+ * \return The keys count.
+ */
+static inline size_t
+m_btree_size (M_BTree *tree)
+{
+	assert(tree);
+
+	return tree->size;
+}
+
+/**
+ * Lookup a key in the B+ tree.
+ * \param[in] tree The tree.
+ * \param key The key.
+ * \param[out] pvalue If \a pvalue is not NULL, store the value in it.
+ * \retval M_TRUE The key is in the tree.
+ * \retval M_FALSE Cannot find the key.
+ */
+static inline M_Bool
+m_btree_lookup (M_BTree *tree, M_BTreeKey key, void **pvalue)
+{
+	M_BTreeLeaf *leaf;
+	uint32_t pos;
+
+	assert(tree);
+
+	if (!tree->size)
+		return M_FALSE;
+
+	leaf = m_btree_find_leaf(tree, key);
+	pos  = m_btree_count_less(&leaf->node, key);
+
+	if ((pos >= leaf->node.n) || (leaf->node.keys[pos] != key))
+		return M_FALSE;
+
+	if (pvalue)
+		*pvalue = leaf->values[pos];
+
+	return M_TRUE;
+}
+
+/**
+ * Set the iterator to the first entry of the B+ tree.
+ * \param[in] tree The tree.
+ * \param[out] iter The iterator.
+ */
+static inline void
+m_btree_first (M_BTree *tree, M_BTreeIter *iter)
+{
+	assert(tree && iter);
+
+	iter->leaf = tree->size ? tree->first : NULL;
+	iter->pos  = 0;
+}
+
+/**
+ * Set the iterator to the first entry whose key is not less than \a key.
+ * \param[in] tree The tree.
+ * \param key The key.
+ * \param[out] iter The iterator.
+ */
+static inline void
+m_btree_seek (M_BTree *tree, M_BTreeKey key, M_BTreeIter *iter)
+{
+	M_BTreeLeaf *leaf;
+	uint32_t pos;
+
+	assert(tree && iter);
+
+	if (!tree->size) {
+		iter->leaf = NULL;
+		iter->pos  = 0;
+		return;
+	}
+
+	leaf = m_btree_find_leaf(tree, key);
+	pos  = m_btree_count_less(&leaf->node, key);
+
+	if (pos >= leaf->node.n) {
+		leaf = leaf->next;
+		pos  = 0;
+	}
+
+	iter->leaf = leaf;
+	iter->pos  = pos;
+}
+
+/**
+ * Check if the iterator points to an entry.
+ * \param[in] iter The iterator.
+ * \retval M_TRUE The iterator points to an entry.
+ * \retval M_FALSE The iterator is at the end.
+ */
+static inline M_Bool
+m_btree_iter_valid (M_BTreeIter *iter)
+{
+	return iter->leaf ? M_TRUE : M_FALSE;
+}
+
+/**
+ * Get the key of the iterator's entry.
+ * \param[in] iter The iterator.
+ * \return The key.
+ */
+static inline M_BTreeKey
+m_btree_iter_key (M_BTreeIter *iter)
+{
+	assert(iter->leaf);
+
+	return iter->leaf->node.keys[iter->pos];
+}
+
+/**
+ * Get the value of the iterator's entry.
+ * \param[in] iter The iterator.
+ * \return The value.
+ */
+static inline void*
+m_btree_iter_value (M_BTreeIter *iter)
+{
+	assert(iter->leaf);
+
+	return iter->leaf->values[iter->pos];
+}
+
+/**
+ * Move the iterator to the next entry.
+ * \param[in] iter The iterator.
+ */
+static inline void
+m_btree_iter_next (M_BTreeIter *iter)
+{
+	assert(iter->leaf);
+
+	if (++ iter->pos >= iter->leaf->node.n) {
+		iter->leaf = iter->leaf->next;
+		iter->pos  = 0;
+	}
+}
+
+/**
+ * Clear the B+ tree.
+ * \param[in] tree The tree.
+ * \param[in] free_value If it is not NULL, invoke it to free each value.
+ */
+extern void m_btree_deinit (M_BTree *tree, void (*free_value)(void *value));
+
+/**
+ * Add a key to the B+ tree.
+ * \param[in] tree The tree.
+ * \param key The key.
+ * \param[in] value The value.
+ * \retval M_OK On success.
+ * \retval M_NONE The key is already in the tree, the old value is kept.
+ * \retval M_ERR_NO_MEM Not enough memory, the tree is not changed.
+ */
+extern M_Result m_btree_insert (M_BTree *tree, M_BTreeKey key, void *value);
+
+/**
+ * Remove a key from the B+ tree.
+ * \param[in] tree The tree.
+ * \param key The key.
+ * \param[out] pvalue If \a pvalue is not NULL, store the value in it.
+ * \retval M_OK On success.
+ * \retval M_NONE Cannot find the key.
+ */
+extern M_Result m_btree_remove (M_BTree *tree, M_BTreeKey key,
+			void **pvalue);
+
+/**
+ * Build the B+ tree from the sorted entries in O(n).
+ * The tree must be empty.
+ * \param[in] tree The tree.
+ * \param[in] keys The keys in strictly ascending order.
+ * \param[in] values The values. If it is NULL, all the values are NULL.
+ * \param n Number of the entries.
+ * \retval M_OK On success.
+ * \retval M_ERR_NO_MEM Not enough memory, the tree is still empty.
+ */
+extern M_Result m_btree_build (M_BTree *tree, const M_BTreeKey *keys,
+			void * const *values, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,193 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+/**
+ * \file
+ * Concurrent hash table.
+ * Lookups take no lock. Insertions and removals lock one of the stripe
+ * locks selected by the key value, and resizing locks all of them.
+ * Unlinked lists buffers are freed with epoch based reclamation, so a
+ * lookup never reads freed memory.
+ * The nodes and the operation functions are the same as M_Hash's.
+ * "alloc_buf" and "free_buf" are not used.
+ */
+
+#ifndef _M_CHASH_H_
+#define _M_CHASH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sched.h>
+
+#include "m_types.h"
+#include "m_atomic.h"
+#include "m_hash.h"
+#include "m_ohash.h"
+#include "m_epoch.h"
+
+/**Number of the stripe locks in a concurrent hash table, must be 2^N.*/
+#ifndef M_CHASH_NLOCK
+	#define M_CHASH_NLOCK 16
+#endif
+
+/**Cache line size, the lookups do not share a line with the writers.*/
+#ifndef M_CHASH_CACHE_LINE
+	#define M_CHASH_CACHE_LINE 64
+#endif
+
+/**Lists buffer of a concurrent hash table.*/
+typedef struct {
+	uint32_t    nlist;   /**< Number of lists, 2^N.*/
+	M_HashNode *lists[]; /**< Node lists.*/
+} M_CHashTable;
+
+/**Concurrent hash table.*/
+typedef struct {
+	M_CHashTable   *table; /**< The current lists buffer.*/
+	uint32_t        seq;   /**< Resize sequence, odd when moving nodes.*/
+	/**Nodes count in the hash table.*/
+	uint32_t        size __attribute__((aligned(M_CHASH_CACHE_LINE)));
+	pthread_mutex_t locks[M_CHASH_NLOCK]; /**< Stripe locks.*/
+} M_CHash;
+
+/**
+ * Get the nodes count in the concurrent hash table.
+ * \param[in] hash The hash table.
+ * \return The nodes count.
+ */
+static inline uint32_t
+m_chash_size (M_CHash *hash)
+{
+	assert(hash);
+
+	return m_atomic_load_relaxed(&hash->size);
+}
+
+/**
+ * Concurrent hash table structure initialize.
+ * \param[in] hash The hash table.
+ */
+extern void m_chash_init (M_CHash *hash);
+
+/**
+ * Clear the concurrent hash table structure.
+ * No other thread can access the hash table at the same time.
+ * \param[in] hash The hash table.
+ * \param[in] ops The hash table operation functions.
+ */
+extern void m_chash_deinit (M_CHash *hash, const M_HashOps *ops);
+
+/**
+ * Lookup a node in the concurrent hash table.
+ * The node is protected only while the caller is in an epoch critical
+ * region. Call m_epoch_enter() before it if the node can be removed
+ * by other threads.
+ * \param[in] hash The hash table.
+ * \param[in] key The key of the node.
+ * \param[in] ops The hash table operation functions.
+ * \return The node with the key find in the hash table.
+ * \retval NULL Cannot find the node with the key.
+ */
+static __always_inline M_HashNode*
+m_chash_lookup (M_CHash *hash, void *key, const M_HashOps *ops)
+{
+	M_CHashTable *t;
+	M_HashNode *node;
+	uint32_t kv, seq;
+
+	assert(hash && ops && ops->get_key && ops->kv && ops->equal);
+
+	kv = m_ohash_mix(ops->kv(key));
+
+	m_epoch_enter();
+
+	while (1) {
+		seq = m_atomic_load_acquire(&hash->seq);
+		if (seq & 1) {
+			sched_yield();
+			continue;
+		}
+
+		t = m_atomic_load_acquire(&hash->table);
+		if (!t) {
+			node = NULL;
+			break;
+		}
+
+		node = m_atomic_load_acquire(&t->lists[kv & (t->nlist - 1)]);
+		while (node) {
+			if (ops->equal(key, ops->get_key(node)))
+				break;
+
+			node = m_atomic_load_acquire(&node->next);
+		}
+
+		/*
+		 * A lookup running on the old lists may follow a moved node into
+		 * a new list and miss its key, so it retries when "seq" changes.
+		 */
+		if (node)
+			break;
+
+		/*Order the lists' loads before the second load of "seq".*/
+		m_atomic_fence(M_ATOMIC_ACQUIRE);
+		if (m_atomic_load_relaxed(&hash->seq) == seq)
+			break;
+	}
+
+	m_epoch_leave();
+
+	return node;
+}
+
+/**
+ * Insert a node to the concurrent hash table if its key is not in it.
+ * The hash table is resized automatically.
+ * \param[in] hash The hash table.
+ * \param[in] node The node to be added.
+ * \param[in] ops The hash table operation functions.
+ * \param[out] pold If \a pold is not NULL, store the node with
+ * the same key in it.
+ * \retval M_OK The node is added.
+ * \retval M_NONE A node with the same key is already in the hash table.
+ * \retval M_ERR_NO_MEM Not enough memory to allocate the lists buffer.
+ */
+extern M_Result m_chash_insert (M_CHash *hash, M_HashNode *node,
+			const M_HashOps *ops, M_HashNode **pold);
+
+/**
+ * Remove a node from the concurrent hash table.
+ * Other threads may still be reading the node, so it should be freed
+ * with m_epoch_retire().
+ * \param[in] hash The hash table.
+ * \param[in] key The key of the node.
+ * \param[in] ops The hash table operation functions.
+ * \return The node removed.
+ * \retval NULL Cannot find the node with the key.
+ */
+extern M_HashNode* m_chash_remove (M_CHash *hash, void *key,
+			const M_HashOps *ops);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -25,17 +25,91 @@ extern "C" {
 #endif
 
 #include "m_types.h"
+#include "m_gc.h"
+#include "m_function.h"
 
-#define M_CLOS_FL_INDEP 1
+/**The closure does not capture any variable.*/
+#define M_CLOS_FL_INDEP  1
+/**The closure has no boxes and all its captured values are frozen.*/
+#define M_CLOS_FL_FROZEN 2
 
-/**Closure.*/
+/**
+ * Box of a captured variable modified after the capture.
+ * The box is open while the defining frame is running, the value is still
+ * in the frame. When the function returns, the value is moved into the box.
+ */
+struct M_Box_s {
+	M_Value *pv;   /**< The value's pointer.*/
+	M_Value  v;    /**< The value after the box is closed.*/
+	M_Box   *next; /**< The next open box of the frame.*/
+};
+
+/**Captured variable.*/
+typedef union {
+	M_Value  v;   /**< The copied value.*/
+	M_Box   *box; /**< The box, if the variable is boxed.*/
+} M_UpVal;
+
+/**
+ * Closure.
+ * A closure is flat: it holds the captured variables, not the frames
+ * defining them.
+ */
 struct M_Closure_s {
 	M_Function *func;   /**< The function.*/
-	M_Frame   **frames; /**< Value frames array.*/
+	M_UpVal    *upvs;   /**< Captured variables.*/
 	uint16_t    flags;  /**< Closure's flags.*/
-	uint8_t     nframe; /**< The number of value frames.*/
+	uint8_t     nupv;   /**< The number of captured variables.*/
 };
 
+/** \cond */
+#define M_GC_CLOSBUF_FLAGS M_GC_BUF_FL_PTR
+
+extern void m_closure_release (M_Closure *clos);
+/** \endcond */
+
+/**
+ * Create a new closure.
+ * The captured variables are copied from the defining frame and the
+ * defining closure as the function's M_UpValInfo describe.
+ * \param[in] func The function.
+ * \param[in] frame The frame the closure is created in.
+ * \param[in] parent The closure the frame belongs to.
+ * \return The new closure.
+ */
+extern M_Closure* m_closure_new (M_Function *func, M_Frame *frame,
+			M_Closure *parent);
+
+/**
+ * Convert the module's closures to flat closures.
+ * Find the variables captured by the nested functions and the ones
+ * modified after the capture, fill the functions' M_UpValInfo and rewrite
+ * GETUP and SETUP to GETUPV, GETBOX and SETBOX.
+ * It must be invoked once, before the module's code runs.
+ * \param[in] module The module.
+ * \retval M_OK On success.
+ * \retval M_FAILED The module's code is malformed.
+ * \retval M_ERR_NO_MEM Not enough memory.
+ */
+extern M_Result   m_closure_convert (M_Module *module);
+
+/**
+ * Get the value of a captured variable.
+ * \param[in] clos The closure.
+ * \param id The captured variable's index.
+ * \return The value.
+ */
+static inline M_Value
+m_closure_get (M_Closure *clos, uint8_t id)
+{
+	assert(clos && (id < clos->nupv));
+
+	if (clos->func->f.bc.upvs[id].flags & M_UPV_FL_BOX)
+		return *clos->upvs[id].box->pv;
+
+	return clos->upvs[id].v;
+}
+
 #ifdef __cplusplus
 }
 #endif
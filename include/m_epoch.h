@@ -0,0 +1,79 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+/**
+ * \file
+ * Epoch based memory reclamation.
+ * A reader enters an epoch before it reads a shared lock-free structure
+ * and leaves it afterwards. A writer unlinks a block from the structure
+ * and retires it. The block is freed only after every thread has left the
+ * epochs in which it could still see the block.
+ */
+
+#ifndef _M_EPOCH_H_
+#define _M_EPOCH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "m_types.h"
+
+/**Retired blocks count to trigger a reclamation.*/
+#ifndef M_EPOCH_RECLAIM_COUNT
+	#define M_EPOCH_RECLAIM_COUNT 64
+#endif
+
+/** \cond */
+extern void m_epoch_startup (void);
+extern void m_epoch_shutdown (void);
+/** \endcond */
+
+/**
+ * Enter the epoch critical region in the current thread.
+ * The blocks reachable in the region are not freed until the thread leaves
+ * the region. The regions can be nested.
+ */
+extern void m_epoch_enter (void);
+
+/**
+ * Leave the epoch critical region in the current thread.
+ */
+extern void m_epoch_leave (void);
+
+/**
+ * Retire a block which has been unlinked from a shared structure.
+ * The block is freed with \a free_fn after all the threads
+ * which could see it have left their epoch critical regions.
+ * \param[in] ptr The block's pointer.
+ * \param[in] free_fn The function to free the block.
+ */
+extern void m_epoch_retire (void *ptr, void (*free_fn)(void *ptr));
+
+/**
+ * Try to advance the global epoch and free the retired blocks
+ * which cannot be seen by any thread.
+ */
+extern void m_epoch_reclaim (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -25,7 +25,9 @@ extern "C" {
 #endif
 
 #include "m_types.h"
+#include "m_gc.h"
 
+/**The frame is in the actor's value stack, it is not a GC object.*/
 #define M_FRAME_FL_IN_STACK 1
 
 /**Value frame.*/
@@ -34,8 +36,42 @@ struct M_Frame_s {
 	uint16_t   nv;      /**< Number of values.*/
 	M_Value   *v;       /**< Values.*/
 	M_Closure *closure; /**< The closure.*/
+	M_Box     *boxes;   /**< Open boxes of the values.*/
 };
 
+/** \cond */
+#define M_GC_FRAMEBUF_FLAGS M_GC_BUF_FL_PTR
+
+extern void m_frame_release (M_Frame *frame);
+/** \endcond */
+
+/**
+ * Create a new value frame in the GC heap.
+ * The call frames are allocated in the actors' value stacks,
+ * see m_actor_push().
+ * The values are initialized as null.
+ * \param[in] clos The closure the frame belongs to.
+ * \param nv The number of values.
+ * \return The new frame.
+ */
+extern M_Frame* m_frame_new (M_Closure *clos, uint16_t nv);
+
+/**
+ * Get the box of a value in the frame.
+ * The closures capturing the same value share the box.
+ * \param[in] frame The frame.
+ * \param id The value's index.
+ * \return The open box of the value.
+ */
+extern M_Box*   m_frame_box (M_Frame *frame, uint16_t id);
+
+/**
+ * Close the frame's boxes when its function returns.
+ * The boxed values are moved into the boxes.
+ * \param[in] frame The frame.
+ */
+extern void     m_frame_close (M_Frame *frame);
+
 #ifdef __cplusplus
 }
 #endif
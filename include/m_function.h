@@ -26,6 +26,7 @@ extern "C" {
 
 #include "m_types.h"
 #include "m_hash.h"
+#include "m_ic.h"
 
 /**Variant type.*/
 typedef enum {
@@ -41,6 +42,18 @@ typedef struct {
 	uint16_t   type;  /**< The variant type.*/
 } M_VarInfo;
 
+/**The captured variable is a register of the defining frame.
+ * Otherwise it is a captured variable of the defining closure.*/
+#define M_UPV_FL_REG 1
+/**The captured variable is modified after the capture, it is boxed.*/
+#define M_UPV_FL_BOX 2
+
+/**Captured variable information.*/
+typedef struct {
+	uint8_t  flags; /**< Flags.*/
+	uint8_t  id;    /**< The register or captured variable index.*/
+} M_UpValInfo;
+
 /**Native function.*/
 #define M_FUNC_FL_NATIVE 1
 
@@ -50,10 +63,17 @@ struct M_Function_s {
 	uint32_t   flags;    /**< The function's flags.*/
 	union {
 		struct {
-			M_Hash    var_hash; /**< The variant hash table.*/
-			uint8_t   nframe;   /**< Operated frame count.*/
-			uint16_t  bc_len;   /**< Byte code length.*/
-			uint8_t  *bc;       /**< Byte code buffer.*/
+			M_Hash         var_hash; /**< The variant hash table.*/
+			uint8_t        nupv;     /**< Number of captured variables.*/
+			M_UpValInfo   *upvs;     /**< Captured variables.*/
+			uint8_t        narg;     /**< Number of arguments.*/
+			uint8_t        nreg;     /**< Number of registers.*/
+			uint16_t       bc_len;   /**< Byte code length.*/
+			uint8_t       *bc;       /**< Byte code buffer.*/
+			uint16_t       nic;      /**< Number of inline caches.*/
+			M_InlineCache *ics;      /**< Property access sites' inline caches.*/
+			uint32_t       hot;      /**< Calls and loop iterations count.*/
+			M_JitCode     *jit;      /**< The compiled machine code.*/
 		} bc;
 		/**Native function.*/
 		M_Result (*native)(M_Value thisv, uint32_t argc, const M_Value *argv,
@@ -61,6 +81,15 @@ struct M_Function_s {
 	} f;
 };
 
+/**
+ * Release the runtime data of a byte code function: the captured variables
+ * information built by m_closure_convert() and the machine code.
+ * The byte code and the inline caches belong to the function's creator.
+ * No closure of the function may run any more.
+ * \param[in] func The function.
+ */
+extern void m_function_deinit (M_Function *func);
+
 #ifdef __cplusplus
 }
 #endif
@@ -33,13 +33,19 @@ extern "C" {
 #include "m_thread.h"
 
 /**The object contains pointer.*/
-#define M_GC_OBJ_FL_PTR   1
+#define M_GC_OBJ_FL_PTR        1
+/**
+ * The object's finalizer only releases buffers owned by the object, so
+ * the sweeping threads can run it at the same time. Finalizers without
+ * this flag run in the GC thread alone.
+ */
+#define M_GC_OBJ_FL_PAR_FINAL  2
 
 /**The buffer contains pointer.*/
 #define M_GC_BUF_FL_PTR        1
 /**The buffer is a permanent buffer.*/
 #define M_GC_BUF_FL_PERMANENT  2
-/**Executable code buffer.*/
+/**Executable code buffer, writable until m_gc_exec_buf() is called.*/
 #define M_GC_BUF_FL_EXECUTABLE 4
 
 /**GC managed object type.*/
@@ -65,6 +71,8 @@ enum M_GCObjType_e {
 	M_GC_OBJ_CLOSURE,  /**< Closure.*/
 	M_GC_OBJ_ARRAY,    /**< Array.*/
 	M_GC_OBJ_FRAME,    /**< Value frame.*/
+	M_GC_OBJ_SHAPE,    /**< Object shape.*/
+	M_GC_OBJ_BOX,      /**< Captured variable box.*/
 	M_GC_OBJ_COUNT     /**< Count of the object types.*/
 };
 
@@ -73,6 +81,14 @@ extern pthread_mutex_t m_gc_lock;
 
 extern void m_gc_startup (void);
 extern void m_gc_shutdown (void);
+
+/*
+ * Join the running parallel GC phase as a worker.
+ * A paused thread invokes it with m_gc_lock locked, never from a signal
+ * handler: it locks, waits and allocates.
+ * Return M_FALSE if there is no phase to join.
+ */
+extern M_Bool m_gc_help (void);
 /** \endcond */
 
 /**
@@ -162,6 +178,16 @@ extern void* m_gc_realloc_buf (void *ptr, size_t old_size,
  */
 extern void  m_gc_free_buf (void *ptr, uint32_t size, uint32_t flags);
 
+/**
+ * Make an executable buffer's code runnable.
+ * The buffer is not writable any more.
+ * \param[in] ptr The pointer of the buffer.
+ * \param size The buffer size in bytes.
+ * \retval M_OK On success.
+ * \retval M_FAILED The buffer cannot be made executable.
+ */
+extern M_Result m_gc_exec_buf (void *ptr, uint32_t size);
+
 /**
  * Make the object as root object.
  * \param ptr The root object's pointer.
@@ -40,9 +40,12 @@ struct M_HashNode_s {
 
 /**Hash table.*/
 typedef struct {
-	M_HashNode **lists; /**< Node lists buffer.*/
-	uint32_t     size;  /**< Nodes count in the hash table.*/
-	uint32_t     nlist; /**< Number of lists.*/
+	M_HashNode **lists;  /**< Node lists buffer.*/
+	M_HashNode **olists; /**< Old lists buffer still being migrated.*/
+	uint32_t     size;   /**< Nodes count in the hash table.*/
+	uint32_t     nlist;  /**< Number of lists.*/
+	uint32_t     nolist; /**< Number of old lists.*/
+	uint32_t     opos;   /**< The next old list to be migrated.*/
 } M_Hash;
 
 /**Hash table operation functions.*/
@@ -61,6 +64,18 @@ typedef struct {
 	void     (*free_buf)(void *ptr, size_t size);
 } M_HashOps;
 
+/**\cond*/
+/*Get the list pointer of the traverse position.*/
+static inline M_HashNode**
+m_hash_list (M_Hash *hash, uint32_t pos)
+{
+	if (pos < hash->nlist)
+		return &hash->lists[pos];
+
+	return &hash->olists[pos - hash->nlist];
+}
+/**\endcond*/
+
 /**
  * Traverse the nodes in the hash table.
  * \a node is M_HashNode pointer pointed to each node.
@@ -80,8 +95,8 @@ typedef struct {
  * \endcode
  */
 #define m_hash_foreach(node, pos, hash)\
-	for (pos = 0; pos < (hash)->nlist; (pos) ++)\
-		for (node = (hash)->lists[pos]; node; node = (node)->next)
+	for (pos = 0; pos < (hash)->nlist + (hash)->nolist; (pos) ++)\
+		for (node = *m_hash_list((hash), pos); node; node = (node)->next)
 
 /**
  * Traverse the nodes in the hash table safely.
@@ -106,8 +121,8 @@ typedef struct {
  * \endcode
  */
 #define m_hash_foreach_safe(node, nnext, pos, hash)\
-	for (pos = 0; pos < (hash)->nlist; (pos) ++)\
-		for (node = (hash)->lists[pos];\
+	for (pos = 0; pos < (hash)->nlist + (hash)->nolist; (pos) ++)\
+		for (node = *m_hash_list((hash), pos);\
 					nnext = node ? (node)->next : NULL, node;\
 					node = nnext)
 
@@ -134,8 +149,8 @@ typedef struct {
  * \endcode
  */
 #define m_hash_foreach_prev(node, pnode, pos, hash)\
-	for (pos = 0; pos < (hash)->nlist; (pos) ++)\
-		for (pnode = &(hash)->lists[pos];\
+	for (pos = 0; pos < (hash)->nlist + (hash)->nolist; (pos) ++)\
+		for (pnode = m_hash_list((hash), pos);\
 					node = *(pnode);\
 					pnode = (*(pnode) == node) ? &(node)->next : pnode)
 
@@ -165,8 +180,9 @@ typedef struct {
  * \endcode
  */
 #define m_hash_foreach_value(val, pos, hash, member)\
-	for (pos = 0; pos < (hash)->nlist; (pos) ++)\
-		for (val = m_node_value((hash)->lists[pos], typeof(*(val)), member);\
+	for (pos = 0; pos < (hash)->nlist + (hash)->nolist; (pos) ++)\
+		for (val = m_node_value(*m_hash_list((hash), pos),\
+						typeof(*(val)), member);\
 					val;\
 					val = m_node_value((val)->member.next,\
 						typeof(*(val)), member))
@@ -203,8 +219,9 @@ typedef struct {
  * \endcode
  */
 #define m_hash_foreach_value_safe(val, nval, pos, hash, member)\
-	for (pos = 0; pos < (hash)->nlist; (pos) ++)\
-		for (val = m_node_value((hash)->lists[pos], typeof(*(val)), member);\
+	for (pos = 0; pos < (hash)->nlist + (hash)->nolist; (pos) ++)\
+		for (val = m_node_value(*m_hash_list((hash), pos),\
+						typeof(*(val)), member);\
 					nval = (val) ? M_CONTAINER_OF((val)->member.next,\
 						typeof(*(val)), member) : NULL,\
 					val;\
@@ -243,8 +260,8 @@ typedef struct {
  *\endcode
  */
 #define m_hash_foreach_value_prev(val, pnode, pos, hash, member)\
-	for (pos = 0; pos < (hash)->nlist; (pos) ++)\
-		for (pnode = &(hash)->lists[pos];\
+	for (pos = 0; pos < (hash)->nlist + (hash)->nolist; (pos) ++)\
+		for (pnode = m_hash_list((hash), pos);\
 					val = *(pnode) ? M_CONTAINER_OF(*(pnode),\
 						typeof(*(val)), member) : NULL;\
 					pnode = (*(pnode) == &(val)->member) ? &(val)->member.next : pnode)
@@ -271,9 +288,12 @@ m_hash_init (M_Hash *hash)
 {
 	assert(hash);
 
-	hash->lists = NULL;
-	hash->size  = 0;
-	hash->nlist = 0;
+	hash->lists  = NULL;
+	hash->olists = NULL;
+	hash->size   = 0;
+	hash->nlist  = 0;
+	hash->nolist = 0;
+	hash->opos   = 0;
 }
 
 /**
@@ -297,6 +317,10 @@ m_hash_deinit (M_Hash *hash, const M_HashOps *ops)
 		}
 
 		ops->free_buf(hash->lists, sizeof(M_HashNode*) * hash->nlist);
+
+		if (hash->olists)
+			ops->free_buf(hash->olists,
+						sizeof(M_HashNode*) * hash->nolist);
 	}
 }
 
@@ -333,6 +357,16 @@ m_hash_lookup_with_kv (M_Hash *hash, void *key, const M_HashOps *ops,
 
 			node = node->next;
 		}
+
+		if (hash->olists) {
+			node = hash->olists[kv % hash->nolist];
+			while (node) {
+				if (ops->equal(key, ops->get_key(node)))
+					return node;
+
+				node = node->next;
+			}
+		}
 	}
 
 	return NULL;
@@ -375,6 +409,21 @@ m_hash_lookup_with_prev (M_Hash *hash, void *key, const M_HashOps *ops,
 			prev = &node->next;
 			node = *prev;
 		}
+
+		if (hash->olists) {
+			prev = &hash->olists[kv % hash->nolist];
+			node = *prev;
+			while (node) {
+				if (ops->equal(key, ops->get_key(node))) {
+					if (pprev)
+						*pprev = prev;
+					return node;
+				}
+
+				prev = &node->next;
+				node = *prev;
+			}
+		}
 	}
 
 	return NULL;
@@ -407,28 +456,14 @@ static __always_inline M_HashNode*
 m_hash_remove (M_Hash *hash, void *key, const M_HashOps *ops)
 {
 	M_HashNode *node, **pnode;
-	uint32_t pos;
 
-	assert(hash && ops && ops->get_key && ops->kv && ops->equal);
-
-	if (hash->size) {
-		pos = ops->kv(key) % hash->nlist;
-
-		pnode = &hash->lists[pos];
-		while (*pnode) {
-			node = *pnode;
-
-			if (ops->equal(key, ops->get_key(node))) {
-				*pnode = node->next;
-				hash->size --;
-				return node;
-			}
-
-			pnode = &node->next;
-		}
+	node = m_hash_lookup_with_prev(hash, key, ops, &pnode);
+	if (node) {
+		*pnode = node->next;
+		hash->size --;
 	}
 
-	return NULL;
+	return node;
 }
 
 /**
@@ -527,8 +562,44 @@ m_hash_insert (M_Hash *hash, M_HashNode *node, const M_HashOps *ops)
 	m_hash_insert_with_kv(hash, node, kv, ops);
 }
 
+/**\cond*/
+/**Old lists migrated in each "m_hash_resize_incr" invocation.*/
+#define M_HASH_MIGRATE_STEP 4
+
+/*Move up to n old lists into the new list buffer.*/
+static __always_inline void
+m_hash_migrate (M_Hash *hash, const M_HashOps *ops, uint32_t n)
+{
+	uint32_t end = M_MIN(hash->opos + n, hash->nolist);
+
+	for (; hash->opos < end; hash->opos ++) {
+		M_HashNode *node, *next;
+
+		for (node = hash->olists[hash->opos]; node; node = next) {
+			uint32_t i = ops->kv(ops->get_key(node)) % hash->nlist;
+
+			next = node->next;
+			node->next = hash->lists[i];
+			hash->lists[i] = node;
+		}
+
+		hash->olists[hash->opos] = NULL;
+	}
+
+	if (hash->opos == hash->nolist) {
+		ops->free_buf(hash->olists, sizeof(M_HashNode*) * hash->nolist);
+
+		hash->olists = NULL;
+		hash->nolist = 0;
+		hash->opos   = 0;
+	}
+}
+/**\endcond*/
+
 /**
  * Check and extend the list buffer size in the hash table.
+ * All the nodes are rehashed at once, and any pending incremental
+ * migration is finished first.
  * \param[in] hash The hash table.
  * \param[in] ops The hash table operation functions.
  * \retval M_OK On success.
@@ -540,6 +611,9 @@ m_hash_resize (M_Hash *hash, const M_HashOps *ops)
 	assert(hash && ops->alloc_buf && ops->free_buf && ops->get_key
 				&& ops->kv);
 
+	if (hash->olists)
+		m_hash_migrate(hash, ops, hash->nolist);
+
 	if (hash->nlist * 3 <= hash->size) {
 		M_HashNode **nbuf;
 		uint32_t nsize, pos;
@@ -569,6 +643,180 @@ m_hash_resize (M_Hash *hash, const M_HashOps *ops)
 	return M_OK;
 }
 
+/**
+ * Check and extend the list buffer size in the hash table incrementally.
+ * It can be used in place of "m_hash_resize". When the table must grow,
+ * a new list buffer is allocated, but the nodes stay in the old one.
+ * Each invocation then moves a few old lists into the new buffer, so
+ * no single insertion pays for rehashing the whole table. Lookups check
+ * both buffers while the migration is pending and never move nodes.
+ * \param[in] hash The hash table.
+ * \param[in] ops The hash table operation functions.
+ * \retval M_OK On success.
+ * \retval M_ERR_NO_MEM Not enough memory to extend the list buffer.
+ */
+static __always_inline M_Result
+m_hash_resize_incr (M_Hash *hash, const M_HashOps *ops)
+{
+	assert(hash && ops->alloc_buf && ops->free_buf && ops->get_key
+				&& ops->kv);
+
+	if (hash->olists)
+		m_hash_migrate(hash, ops, M_HASH_MIGRATE_STEP);
+
+	if (hash->nlist * 3 <= hash->size) {
+		M_HashNode **nbuf;
+		uint32_t nsize;
+
+		/*The migration normally ends long before the table is full again.*/
+		if (hash->olists)
+			m_hash_migrate(hash, ops, hash->nolist);
+
+		nsize = M_MAX(hash->size, 9);
+		nbuf  = ops->alloc_buf(sizeof(M_HashNode*) * nsize);
+		if (!nbuf)
+			return M_ERR_NO_MEM;
+
+		memset(nbuf, 0, sizeof(M_HashNode*) * nsize);
+
+		if (hash->lists) {
+			hash->olists = hash->lists;
+			hash->nolist = hash->nlist;
+			hash->opos   = 0;
+		}
+
+		hash->lists = nbuf;
+		hash->nlist = nsize;
+
+		if (hash->olists)
+			m_hash_migrate(hash, ops, M_HASH_MIGRATE_STEP);
+	}
+
+	return M_OK;
+}
+
+/**
+ * Define the hash table functions specialized for a key type.
+ * The generated functions work on a normal M_Hash, but invoke
+ * \a get_key_fn, \a kv_fn and \a equal_fn directly instead of through
+ * M_HashOps, so they are inlined even when no constant ops structure is
+ * visible. "m_hash_resize", "m_hash_deinit" and the traverse macros are
+ * still used with an M_HashOps, and must use the same key functions.
+ * The following functions are generated:
+ * - name##_lookup_with_kv (M_Hash *hash, key_type key, uint32_t *pkv)
+ * - name##_lookup (M_Hash *hash, key_type key)
+ * - name##_insert_with_kv (M_Hash *hash, M_HashNode *node, uint32_t kv)
+ * - name##_insert (M_Hash *hash, M_HashNode *node)
+ * - name##_remove (M_Hash *hash, key_type key)
+ *
+ * \code{.c}
+ * static inline int
+ * my_get_key (const M_HashNode *node)
+ * {
+ *		return M_CONTAINER_OF(node, MyHashValue, hash_node)->my_key;
+ * }
+ *
+ * static inline uint32_t my_kv (int key) { return key; }
+ * static inline M_Bool my_equal (int k1, int k2) { return k1 == k2; }
+ *
+ * M_DEFINE_HASH(my_hash, int, my_get_key, my_kv, my_equal)
+ *
+ * node = my_hash_lookup(&hash, 100);
+ * \endcode
+ * \a name is the prefix of the generated functions.
+ * \a key_type is the key's type.
+ * \a get_key_fn gets the key from a node.
+ * \a kv_fn calculates the key value of a key.
+ * \a equal_fn checks if 2 keys are equal.
+ */
+#define M_DEFINE_HASH(name, key_type, get_key_fn, kv_fn, equal_fn)\
+static __always_inline M_HashNode**\
+name##_find (M_Hash *hash, key_type key, uint32_t kv)\
+{\
+	M_HashNode **prev;\
+\
+	if (!hash->size)\
+		return NULL;\
+\
+	for (prev = &hash->lists[kv % hash->nlist]; *prev;\
+				prev = &(*prev)->next) {\
+		if (equal_fn(key, get_key_fn(*prev)))\
+			return prev;\
+	}\
+\
+	if (hash->olists) {\
+		for (prev = &hash->olists[kv % hash->nolist]; *prev;\
+					prev = &(*prev)->next) {\
+			if (equal_fn(key, get_key_fn(*prev)))\
+				return prev;\
+		}\
+	}\
+\
+	return NULL;\
+}\
+\
+static __always_inline M_HashNode*\
+name##_lookup_with_kv (M_Hash *hash, key_type key, uint32_t *pkv)\
+{\
+	M_HashNode **prev;\
+	uint32_t kv;\
+\
+	assert(hash);\
+\
+	kv = kv_fn(key);\
+	if (pkv)\
+		*pkv = kv;\
+\
+	prev = name##_find(hash, key, kv);\
+\
+	return prev ? *prev : NULL;\
+}\
+\
+static __always_inline M_HashNode*\
+name##_lookup (M_Hash *hash, key_type key)\
+{\
+	return name##_lookup_with_kv(hash, key, NULL);\
+}\
+\
+static __always_inline void \
+name##_insert_with_kv (M_Hash *hash, M_HashNode *node, uint32_t kv)\
+{\
+	uint32_t pos;\
+\
+	assert(hash && node && hash->nlist);\
+\
+	pos = kv % hash->nlist;\
+\
+	node->next = hash->lists[pos];\
+	hash->lists[pos] = node;\
+\
+	hash->size ++;\
+}\
+\
+static __always_inline void \
+name##_insert (M_Hash *hash, M_HashNode *node)\
+{\
+	name##_insert_with_kv(hash, node, kv_fn(get_key_fn(node)));\
+}\
+\
+static __always_inline M_HashNode*\
+name##_remove (M_Hash *hash, key_type key)\
+{\
+	M_HashNode **prev, *node;\
+\
+	assert(hash);\
+\
+	prev = name##_find(hash, key, kv_fn(key));\
+	if (!prev)\
+		return NULL;\
+\
+	node  = *prev;\
+	*prev = node->next;\
+	hash->size --;\
+\
+	return node;\
+}
+
 /**
  * Integer number key value calculate function.
  * \param[in] key Integer key.
@@ -0,0 +1,198 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+/**
+ * \file
+ * Property access inline cache.
+ */
+
+#ifndef _M_IC_H_
+#define _M_IC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "m_types.h"
+#include "m_object.h"
+#include "m_atomic.h"
+
+/**Number of shapes an inline cache can hold.*/
+#ifndef M_IC_WAYS
+	#define M_IC_WAYS 4
+#endif
+
+/**Inline cache state.*/
+typedef enum {
+	M_IC_UNINIT, /**< No shape has been seen.*/
+	M_IC_MONO,   /**< Monomorphic, one shape is cached.*/
+	M_IC_POLY,   /**< Polymorphic, up to M_IC_WAYS shapes are cached.*/
+	M_IC_MEGA    /**< Megamorphic, the site is not cached any more.*/
+} M_ICState;
+
+/** \cond */
+/**The bit of M_InlineCache.n set while a thread is updating the cache.*/
+#define M_IC_BUSY 0x80
+
+#if M_IC_WAYS >= M_IC_BUSY
+	#error "M_IC_WAYS is too big"
+#endif
+/** \endcond */
+
+/**Inline cache entry.*/
+typedef struct {
+	M_Shape  *shape; /**< The cached shape.*/
+	uint16_t  id;    /**< The property's slot index in the shape.*/
+} M_ICEntry;
+
+/**
+ * Inline cache of a property access site in the byte code.
+ * Each site accesses a fixed property name, so a shared shape always maps
+ * to the same slot index. Shared shapes are immutable: an object changing
+ * its layout moves to another shape and misses the cache. Dictionary shapes
+ * are modified in place and are never cached.
+ * A cache is used either by m_ic_get() or by m_ic_set(), not both.
+ */
+typedef struct {
+	M_ICEntry entries[M_IC_WAYS]; /**< Cached entries.*/
+	uint32_t  epoch;              /**< Shape epoch the entries belong to.*/
+	uint8_t   n;                  /**< Number of used entries.*/
+	uint8_t   state;              /**< The cache state.*/
+	uint16_t  misses;             /**< Number of misses.*/
+} M_InlineCache;
+
+/** \cond */
+extern M_Bool   m_ic_get_miss (M_InlineCache *ic, M_Object *obj,
+			M_Quark quark, M_Value *pv);
+extern M_Result m_ic_set_miss (M_InlineCache *ic, M_Object *obj,
+			M_Quark quark, M_Value v);
+/** \endcond */
+
+/**
+ * Initialize an inline cache.
+ * \param[in] ic The inline cache.
+ */
+static inline void
+m_ic_init (M_InlineCache *ic)
+{
+	assert(ic);
+
+	memset(ic, 0, sizeof(M_InlineCache));
+}
+
+/**
+ * Lookup the slot index of a shape in the inline cache.
+ * \param[in] ic The inline cache.
+ * \param[in] shape The object's shape.
+ * \param[out] pid Return the slot index.
+ * \retval M_TRUE The shape is cached.
+ * \retval M_FALSE The cache is missed.
+ */
+static inline M_Bool
+m_ic_lookup (M_InlineCache *ic, M_Shape *shape, uint16_t *pid)
+{
+	M_ICEntry *ent;
+	uint32_t i, n;
+
+	/*A freed shape's address may be reused by a new shape.*/
+	if (m_atomic_load_acquire(&ic->epoch) != m_shape_epoch)
+		return M_FALSE;
+
+	n = m_atomic_load_acquire(&ic->n) & ~M_IC_BUSY;
+
+	for (i = 0, ent = ic->entries; i < n; i ++, ent ++) {
+		if (m_atomic_load_acquire(&ent->shape) == shape) {
+			*pid = m_atomic_load_relaxed(&ent->id);
+
+			/*The entry may be replaced by another thread.*/
+			m_atomic_fence(M_ATOMIC_ACQUIRE);
+			if (m_atomic_load_relaxed(&ent->shape) == shape)
+				return M_TRUE;
+
+			return M_FALSE;
+		}
+	}
+
+	return M_FALSE;
+}
+
+/**
+ * Add a shape's slot index to the inline cache after a miss.
+ * \param[in] ic The inline cache.
+ * \param[in] shape The object's shape.
+ * \param id The property's slot index.
+ */
+extern void      m_ic_update (M_InlineCache *ic, M_Shape *shape, uint16_t id);
+
+/**
+ * Get a property's value through the inline cache.
+ * Missed lookups fall back to m_object_get() and fill the cache when the
+ * property is an own property of a shared shape.
+ * \param[in] ic The inline cache.
+ * \param[in] obj The object.
+ * \param quark The property's name.
+ * \param[out] pv Return the property's value.
+ * \retval M_TRUE The property is found.
+ * \retval M_FALSE Cannot find the property.
+ */
+static inline M_Bool
+m_ic_get (M_InlineCache *ic, M_Object *obj, M_Quark quark, M_Value *pv)
+{
+	uint16_t id;
+
+	assert(ic && obj && pv);
+
+	if (m_ic_lookup(ic, obj->shape, &id)) {
+		*pv = obj->v[id];
+		return M_TRUE;
+	}
+
+	return m_ic_get_miss(ic, obj, quark, pv);
+}
+
+/**
+ * Set an existed writable property's value through the inline cache.
+ * Missed lookups fall back to m_object_set().
+ * \param[in] ic The inline cache.
+ * \param[in] obj The object.
+ * \param quark The property's name.
+ * \param v The property's value.
+ * \retval M_OK On success.
+ * \retval M_FAILED The object is not mutable or the property is not writable.
+ */
+static inline M_Result
+m_ic_set (M_InlineCache *ic, M_Object *obj, M_Quark quark, M_Value v)
+{
+	uint16_t id;
+
+	assert(ic && obj);
+
+	if ((obj->flags & M_OBJ_FL_MUTABLE) && m_ic_lookup(ic, obj->shape, &id)) {
+		obj->v[id] = v;
+		return M_OK;
+	}
+
+	return m_ic_set_miss(ic, obj, quark, v);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
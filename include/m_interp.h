@@ -0,0 +1,60 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+/**
+ * \file
+ * Byte code interpreter.
+ */
+
+#ifndef _M_INTERP_H_
+#define _M_INTERP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "m_types.h"
+#include "m_opcode.h"
+
+/**
+ * Run the actor's byte code until the called function returns.
+ * The budget is consumed by backward jumps and calls. When it runs out,
+ * the state is saved in the actor's call stack and the next invocation
+ * resumes from there.
+ * \param[in] actor The actor.
+ * \param budget The budget of the run.
+ * \retval M_OK The function returned, the result is in the actor's retv.
+ * \retval M_NONE The budget ran out.
+ * \retval M_ERR_TYPE The code operated a value with wrong type,
+ * the call is abandoned.
+ */
+extern M_Result m_interp_run (M_Actor *actor, uint32_t budget);
+
+/**
+ * Rewrite the function's quickened instructions back to the generic ones.
+ * The function must not be running.
+ * \param[in] func The byte code function.
+ */
+extern void     m_interp_unquicken (M_Function *func);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,127 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+/**
+ * \file
+ * Baseline just-in-time compiler.
+ *
+ * A hot byte code function is translated to x86-64 machine code by
+ * stitching a template for each instruction. The templates run the integer
+ * fast paths. When a guard fails or an instruction has no template, the
+ * code exits and the interpreter resumes at that instruction. The
+ * interpreter enters the code again at loop heads, function entries and
+ * call returns.
+ */
+
+#ifndef _M_JIT_H_
+#define _M_JIT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "m_types.h"
+#include "m_function.h"
+#include "m_atomic.h"
+#include "m_thread.h"
+
+/*The compiler only emits x86-64 code, its back edges poll the page.*/
+#if defined(__x86_64__) && defined(M_THREAD_POLL_PAGE) &&\
+			!defined(M_JIT_DISABLE)
+	#define M_JIT_ENABLE
+#endif
+
+/**Hotness a function reaches to be compiled.*/
+#ifndef M_JIT_THRESHOLD
+	#define M_JIT_THRESHOLD 1000
+#endif
+
+/**Guard failures after which the code is not entered any more.*/
+#ifndef M_JIT_MAX_BAILS
+	#define M_JIT_MAX_BAILS 1000
+#endif
+
+/**The code exited because a guard failed.*/
+#define M_JIT_EXIT_BAIL 0x80000000
+
+/**
+ * Machine code entry.
+ * \param[in] regs The registers of the frame.
+ * \param[in] consts The module's const values.
+ * \param[in] target The instruction's code address to start from.
+ * \param[in,out] budget The run budget, decreased at backward jumps.
+ * \return The byte code offset the interpreter resumes at, ORed with
+ * M_JIT_EXIT_BAIL when a guard failed.
+ */
+typedef uint32_t (*M_JitEntry) (M_Value *regs, M_Value *consts,
+			void *target, uint32_t *budget);
+
+/**Compiled machine code of a function.*/
+struct M_JitCode_s {
+	M_JitEntry  entry; /**< The code entry.*/
+	uint8_t    *code;  /**< The executable buffer.*/
+	uint32_t    size;  /**< The buffer's size in bytes.*/
+	uint32_t    bails; /**< Guard failures count.*/
+	/**Code offsets of the instructions, 0 means it cannot be entered.*/
+	uint32_t   *addrs;
+};
+
+/**
+ * Compile the byte code function.
+ * \param[in] func The function.
+ * \retval M_OK On success.
+ * \retval M_FAILED The compiler is not available.
+ * \retval M_ERR_NO_MEM Not enough memory.
+ */
+extern M_Result m_jit_compile (M_Function *func);
+
+/**
+ * Stop entering the function's machine code.
+ * The code may be running in other threads, it exits at its next bail.
+ * \param[in] func The function.
+ */
+extern void     m_jit_disable (M_Function *func);
+
+/**
+ * Free the function's machine code.
+ * The code must not be running.
+ * \param[in] func The function.
+ */
+extern void     m_jit_release (M_Function *func);
+
+/**
+ * Get the code address of an instruction.
+ * \param[in] jit The machine code.
+ * \param off The instruction's byte code offset.
+ * \return The instruction's code address.
+ * \retval NULL The code cannot be entered at the instruction.
+ */
+static inline void*
+m_jit_addr (M_JitCode *jit, uint32_t off)
+{
+	uint32_t a = m_atomic_load_relaxed(&jit->addrs[off]);
+
+	return a ? jit->code + a : NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
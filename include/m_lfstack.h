@@ -0,0 +1,236 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+/**
+ * \file
+ * Lock-free intrusive stack (Treiber stack).
+ * The nodes are M_SList embedded in the elements.
+ * The top pointer carries a modification tag, so a node popped and pushed
+ * again between another thread's load and compare-and-swap cannot be
+ * mistaken for the old top (the ABA problem).
+ * A popping thread may still read the "next" field of a node which has
+ * been popped by others, so the nodes' memory must stay readable while
+ * other threads may pop, e.g. cells of a pool, or freed with m_epoch_retire.
+ */
+
+#ifndef _M_LFSTACK_H_
+#define _M_LFSTACK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "m_types.h"
+#include "m_list.h"
+#include "m_atomic.h"
+
+/**\cond*/
+#if defined(M_ATOMIC_HAVE_INT128_CAS)
+/*Double width word, the tag is in the upper 64 bits.*/
+typedef unsigned __int128 M_LFTagged;
+#define M_LF_TAG_SHIFT 64
+#elif __SIZEOF_POINTER__ == 8
+/*User space addresses fit in 48 bits, the tag is in the upper 16 bits.*/
+typedef uint64_t M_LFTagged;
+#define M_LF_TAG_SHIFT 48
+#else
+typedef uint64_t M_LFTagged;
+#define M_LF_TAG_SHIFT 32
+#endif
+
+#define M_LF_PTR_MASK  ((((M_LFTagged)1) << M_LF_TAG_SHIFT) - 1)
+
+static inline M_SList*
+m_lf_tagged_ptr (M_LFTagged t)
+{
+	return (M_SList*)(uintptr_t)(t & M_LF_PTR_MASK);
+}
+
+/*Make a new tagged pointer from the old one, increasing the tag.*/
+static inline M_LFTagged
+m_lf_tagged_make (M_SList *node, M_LFTagged old)
+{
+	assert(((M_LFTagged)(uintptr_t)node & ~M_LF_PTR_MASK) == 0);
+
+	return (M_LFTagged)(uintptr_t)node |
+				(((old >> M_LF_TAG_SHIFT) + 1) << M_LF_TAG_SHIFT);
+}
+
+static inline M_LFTagged
+m_lf_tagged_load (M_LFTagged *p, int order)
+{
+#ifdef M_ATOMIC_HAVE_INT128_CAS
+	/*Load the halves separately, a torn value only makes the CAS fail.*/
+	uint64_t *w = (uint64_t*)p;
+	uint64_t lo, hi;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	lo = m_atomic_load(&w[0], order);
+	hi = m_atomic_load_relaxed(&w[1]);
+#else
+	lo = m_atomic_load(&w[1], order);
+	hi = m_atomic_load_relaxed(&w[0]);
+#endif
+
+	return ((M_LFTagged)hi << 64) | lo;
+#else
+	return m_atomic_load(p, order);
+#endif
+}
+
+/*Weak CAS, the current value is loaded to "pold" on failure.*/
+static inline M_Bool
+m_lf_tagged_cas (M_LFTagged *p, M_LFTagged *pold, M_LFTagged nv, int order)
+{
+#ifdef M_ATOMIC_HAVE_INT128_CAS
+	if (m_atomic_int128_cas(p, *pold, nv))
+		return M_TRUE;
+
+	*pold = m_lf_tagged_load(p, M_ATOMIC_ACQUIRE);
+	return M_FALSE;
+#else
+	return m_atomic_cas_weak(p, pold, nv, order);
+#endif
+}
+/**\endcond*/
+
+/**Lock-free stack.*/
+typedef struct {
+	/**Tagged pointer of the top node.*/
+	M_LFTagged top __attribute__((aligned(sizeof(M_LFTagged))));
+} M_LFStack;
+
+/**
+ * Initialize a stack.
+ * \param[in] s The stack.
+ */
+static inline void
+m_lfstack_init (M_LFStack *s)
+{
+	assert(s);
+
+	s->top = 0;
+}
+
+/**
+ * Check if the stack is empty.
+ * \param[in] s The stack.
+ * \retval M_TRUE The stack is empty.
+ * \retval M_FALSE The stack is not empty.
+ */
+static inline M_Bool
+m_lfstack_empty (M_LFStack *s)
+{
+	assert(s);
+
+	return !m_lf_tagged_ptr(m_lf_tagged_load(&s->top, M_ATOMIC_RELAXED));
+}
+
+/**
+ * Push a linked list of nodes to the stack.
+ * \a first will be the top node.
+ * \param[in] s The stack.
+ * \param[in] first The first node of the list.
+ * \param[in] last The last node of the list.
+ */
+static inline void
+m_lfstack_push_list (M_LFStack *s, M_SList *first, M_SList *last)
+{
+	M_LFTagged old, t;
+
+	assert(s && first && last);
+
+	old = m_lf_tagged_load(&s->top, M_ATOMIC_RELAXED);
+
+	do {
+		m_atomic_store_relaxed(&last->next, m_lf_tagged_ptr(old));
+		t = m_lf_tagged_make(first, old);
+	} while (!m_lf_tagged_cas(&s->top, &old, t, M_ATOMIC_RELEASE));
+}
+
+/**
+ * Push a node to the stack.
+ * \param[in] s The stack.
+ * \param[in] node The node.
+ */
+static inline void
+m_lfstack_push (M_LFStack *s, M_SList *node)
+{
+	m_lfstack_push_list(s, node, node);
+}
+
+/**
+ * Pop the top node from the stack.
+ * \param[in] s The stack.
+ * \return The popped node.
+ * \retval NULL The stack is empty.
+ */
+static inline M_SList*
+m_lfstack_pop (M_LFStack *s)
+{
+	M_SList *node, *next;
+	M_LFTagged old, t;
+
+	assert(s);
+
+	old = m_lf_tagged_load(&s->top, M_ATOMIC_ACQUIRE);
+
+	do {
+		node = m_lf_tagged_ptr(old);
+		if (!node)
+			return NULL;
+
+		/*The node may be popped by others, the tag makes the CAS fail then.*/
+		next = m_atomic_load_relaxed(&node->next);
+		t = m_lf_tagged_make(next, old);
+	} while (!m_lf_tagged_cas(&s->top, &old, t, M_ATOMIC_ACQUIRE));
+
+	return node;
+}
+
+/**
+ * Pop all the nodes from the stack.
+ * \param[in] s The stack.
+ * \return The top node, the others are linked after it.
+ * \retval NULL The stack is empty.
+ */
+static inline M_SList*
+m_lfstack_pop_all (M_LFStack *s)
+{
+	M_LFTagged old, t;
+
+	assert(s);
+
+	old = m_lf_tagged_load(&s->top, M_ATOMIC_ACQUIRE);
+
+	do {
+		if (!m_lf_tagged_ptr(old))
+			return NULL;
+
+		t = m_lf_tagged_make(NULL, old);
+	} while (!m_lf_tagged_cas(&s->top, &old, t, M_ATOMIC_ACQUIRE));
+
+	return m_lf_tagged_ptr(old);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
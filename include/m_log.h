@@ -30,6 +30,7 @@ extern "C" {
 #endif
 
 #include "m_types.h"
+#include "m_atomic.h"
 
 /**Log output level.*/
 typedef enum {
@@ -42,13 +43,99 @@ typedef enum {
 	M_LOG_LEVEL_NONE    /**< Do not output any message.*/
 } M_LogLevel;
 
+/**
+ * Lowest level compiled in. Messages below it are removed by the compiler
+ * and their arguments are never evaluated. Build with, for example,
+ * -DM_LOG_MIN_LEVEL=M_LOG_LEVEL_INFO to remove the debug messages.
+ */
+#ifndef M_LOG_MIN_LEVEL
+	#define M_LOG_MIN_LEVEL M_LOG_LEVEL_ALL
+#endif
+
+/** \cond */
+/**The tag's mask has been computed.*/
+#define M_LOG_TAG_READY 0x80
+
+/**Runtime filter of a log tag, one per source file.*/
+typedef struct M_LogTag_s M_LogTag;
+struct M_LogTag_s {
+	const char *name; /**< Tag name.*/
+	uint32_t    mask; /**< Bit n is set if level n is enabled.*/
+	M_LogTag   *next; /**< Next tag in the registry.*/
+};
+
+extern M_Bool m_log_tag_init (M_LogTag *tag, M_LogLevel level);
+
+#ifdef M_LOG_TAG
+static M_LogTag m_log_tag __attribute__((unused)) = {M_LOG_TAG, 0, NULL};
+#endif
+/** \endcond */
+
+/**
+ * Check if the level is enabled for the tag.
+ * The first check registers the tag and computes its mask.
+ * \param tag The tag.
+ * \param level Output level.
+ * \retval M_TRUE The level is enabled.
+ * \retval M_FALSE The level is disabled.
+ */
+static inline M_Bool
+m_log_tag_enabled (M_LogTag *tag, M_LogLevel level)
+{
+	uint32_t mask = m_atomic_load_relaxed(&tag->mask);
+
+	if (!(mask & M_LOG_TAG_READY))
+		return m_log_tag_init(tag, level);
+
+	return (mask >> level) & 1;
+}
+
+/**
+ * Check if a message of the level from this source file would be output.
+ * Use it to skip preparing the arguments of an expensive debug message.
+ */
+#define M_LOG_ENABLED(level)\
+	(((level) >= M_LOG_MIN_LEVEL) && m_log_tag_enabled(&m_log_tag, level))
+
+/**
+ * Set the output level of a tag.
+ * \param[in] tag The tag name, NULL sets the default level of the tags
+ * without their own level.
+ * \param level Output level.
+ * \retval M_OK On success.
+ * \retval M_ERR_NO_MEM Not enough memory.
+ */
+extern M_Result m_log_set_level (const char *tag, M_LogLevel level);
+
+/**Counters of the asynchronous log backend.*/
+typedef struct {
+	uint64_t written; /**< Messages written by the writer thread.*/
+	uint64_t bytes;   /**< Bytes written by the writer thread.*/
+	uint64_t dropped; /**< Messages dropped because a thread's ring was full.*/
+	uint64_t blocked; /**< Messages whose thread had to wait for ring space.*/
+} M_LogStats;
+
 /** \cond */
 extern void m_log_startup (void);
 extern void m_log_shutdown (void);
 /** \endcond */
 
+/**
+ * Wait until all the messages logged so far have been written.
+ * With the synchronous backend this only flushes the log file.
+ */
+extern void m_log_flush (void);
+
+/**
+ * Get the counters of the asynchronous log backend.
+ * \param[out] stats Return the counters.
+ */
+extern void m_log_get_stats (M_LogStats *stats);
+
 /**
  * Output log message.
+ * The message is not filtered, M_DEBUG and the other macros check the level
+ * before calling it.
  * \param level Output level.
  * \param[in] tag Message tag.
  * \param[in] file File which generate this meesage.
@@ -64,21 +151,23 @@ extern void m_log (M_LogLevel level,
 		const char *fmt,
 		...);
 
+/** \cond */
+#define M_LOG(level, a...)\
+	(M_LOG_ENABLED(level) ?\
+		m_log(level, M_LOG_TAG, __FILE__, __FUNCTION__, __LINE__, a) :\
+		(void)0)
+/** \endcond */
+
 /**Output debug message.*/
-#define M_DEBUG(a...)\
-	m_log(M_LOG_LEVEL_DEBUG, M_LOG_TAG, __FILE__, __FUNCTION__, __LINE__, a)
+#define M_DEBUG(a...)   M_LOG(M_LOG_LEVEL_DEBUG, a)
 /**Output information.*/
-#define M_INFO(a...)\
-	m_log(M_LOG_LEVEL_INFO, M_LOG_TAG, __FILE__, __FUNCTION__, __LINE__, a)
+#define M_INFO(a...)    M_LOG(M_LOG_LEVEL_INFO, a)
 /**Output warning message.*/
-#define M_WARNING(a...)\
-	m_log(M_LOG_LEVEL_WARNING, M_LOG_TAG, __FILE__, __FUNCTION__, __LINE__, a)
+#define M_WARNING(a...) M_LOG(M_LOG_LEVEL_WARNING, a)
 /**Output error message.*/
-#define M_ERROR(a...)\
-	m_log(M_LOG_LEVEL_ERROR, M_LOG_TAG, __FILE__, __FUNCTION__, __LINE__, a)
+#define M_ERROR(a...)   M_LOG(M_LOG_LEVEL_ERROR, a)
 /**Output fatal error message.*/
-#define M_FATAL(a...)\
-	m_log(M_LOG_LEVEL_FATAL, M_LOG_TAG, __FILE__, __FUNCTION__, __LINE__, a)
+#define M_FATAL(a...)   M_LOG(M_LOG_LEVEL_FATAL, a)
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,209 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+/**
+ * \file
+ * Lock-free bounded multi-producer multi-consumer queue.
+ * The queue is a ring of cells. Every cell has a sequence number telling
+ * which round of push or pop may use it next, so a stale position can
+ * never match a reused cell and the queue has no ABA problem.
+ * The queue stores M_SList nodes embedded in the elements, the nodes'
+ * "next" fields are not used.
+ */
+
+#ifndef _M_MPMC_H_
+#define _M_MPMC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "m_types.h"
+#include "m_list.h"
+#include "m_malloc.h"
+#include "m_atomic.h"
+
+/**Cache line size used to separate the producers' and consumers' data.*/
+#ifndef M_MPMC_CACHE_LINE
+	#define M_MPMC_CACHE_LINE 64
+#endif
+
+/**\cond*/
+typedef struct {
+	size_t   seq;  /*Sequence number.*/
+	M_SList *node; /*The stored node.*/
+} M_MpmcCell;
+/**\endcond*/
+
+/**Multi-producer multi-consumer queue.*/
+typedef struct {
+	M_MpmcCell *cells;  /**< Cells ring.*/
+	size_t      mask;   /**< Cells count - 1.*/
+	/**Push position.*/
+	size_t      head __attribute__((aligned(M_MPMC_CACHE_LINE)));
+	/**Pop position.*/
+	size_t      tail __attribute__((aligned(M_MPMC_CACHE_LINE)));
+} M_MpmcQueue;
+
+/**
+ * Initialize a queue.
+ * \param[in] q The queue.
+ * \param size The capacity of the queue. It must be a power of 2.
+ * \retval M_OK On success.
+ * \retval M_ERR_NO_MEM Not enough memory.
+ */
+static inline M_Result
+m_mpmc_init (M_MpmcQueue *q, size_t size)
+{
+	size_t i;
+
+	assert(q && size && !(size & (size - 1)));
+
+	q->cells = m_malloc(sizeof(M_MpmcCell) * size);
+	if (!q->cells)
+		return M_ERR_NO_MEM;
+
+	for (i = 0; i < size; i ++)
+		q->cells[i].seq = i;
+
+	q->mask = size - 1;
+	q->head = 0;
+	q->tail = 0;
+
+	return M_OK;
+}
+
+/**
+ * Release a queue.
+ * The nodes in the queue are not freed.
+ * \param[in] q The queue.
+ */
+static inline void
+m_mpmc_deinit (M_MpmcQueue *q)
+{
+	assert(q);
+
+	if (q->cells)
+		m_free(q->cells);
+}
+
+/**
+ * Push a node to the queue's tail.
+ * Any thread can push and pop nodes at the same time.
+ * \param[in] q The queue.
+ * \param[in] node The node.
+ * \retval M_TRUE The node is pushed.
+ * \retval M_FALSE The queue is full.
+ */
+static inline M_Bool
+m_mpmc_push (M_MpmcQueue *q, M_SList *node)
+{
+	M_MpmcCell *cell;
+	size_t pos, seq;
+	intptr_t diff;
+
+	assert(q && node);
+
+	pos = m_atomic_load_relaxed(&q->head);
+
+	while (1) {
+		cell = &q->cells[pos & q->mask];
+		seq  = m_atomic_load_acquire(&cell->seq);
+		diff = (intptr_t)seq - (intptr_t)pos;
+
+		if (diff == 0) {
+			if (m_atomic_cas_weak(&q->head, &pos, pos + 1, M_ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			/*The cell is not popped in the last round.*/
+			return M_FALSE;
+		} else {
+			pos = m_atomic_load_relaxed(&q->head);
+		}
+	}
+
+	cell->node = node;
+	m_atomic_store_release(&cell->seq, pos + 1);
+
+	return M_TRUE;
+}
+
+/**
+ * Pop a node from the queue's head.
+ * \param[in] q The queue.
+ * \return The popped node.
+ * \retval NULL The queue is empty.
+ */
+static inline M_SList*
+m_mpmc_pop (M_MpmcQueue *q)
+{
+	M_MpmcCell *cell;
+	M_SList *node;
+	size_t pos, seq;
+	intptr_t diff;
+
+	assert(q);
+
+	pos = m_atomic_load_relaxed(&q->tail);
+
+	while (1) {
+		cell = &q->cells[pos & q->mask];
+		seq  = m_atomic_load_acquire(&cell->seq);
+		diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+		if (diff == 0) {
+			if (m_atomic_cas_weak(&q->tail, &pos, pos + 1, M_ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			/*The cell is not pushed in this round.*/
+			return NULL;
+		} else {
+			pos = m_atomic_load_relaxed(&q->tail);
+		}
+	}
+
+	node = cell->node;
+	m_atomic_store_release(&cell->seq, pos + q->mask + 1);
+
+	return node;
+}
+
+/**
+ * Get the approximate count of the nodes in the queue.
+ * \param[in] q The queue.
+ * \return The nodes count.
+ */
+static inline size_t
+m_mpmc_size (M_MpmcQueue *q)
+{
+	size_t head, tail;
+
+	assert(q);
+
+	tail = m_atomic_load_relaxed(&q->tail);
+	head = m_atomic_load_relaxed(&q->head);
+
+	return (head > tail) ? head - tail : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,185 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+/**
+ * \file
+ * Lock-free multi-producer single-consumer queue.
+ * The queue is intrusive, the nodes are embedded in the elements.
+ * A producer only exchanges the head pointer, the consumer owns the tail.
+ */
+
+#ifndef _M_MPSC_H_
+#define _M_MPSC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "m_types.h"
+#include "m_list.h"
+#include "m_atomic.h"
+
+/**Multi-producer single-consumer queue.*/
+typedef struct {
+	M_SList *head; /**< The last pushed node.*/
+	M_SList *tail; /**< The next node to pop, only used by the consumer.*/
+	M_SList  stub; /**< Stub node keeps the queue linked when it is empty.*/
+} M_MpscQueue;
+
+/**
+ * Initialize a queue.
+ * \param[in] q The queue.
+ */
+static inline void
+m_mpsc_init (M_MpscQueue *q)
+{
+	assert(q);
+
+	q->stub.next = NULL;
+	q->head = &q->stub;
+	q->tail = &q->stub;
+}
+
+/**
+ * Push a node to the queue.
+ * Any thread can push nodes at the same time.
+ * \param[in] q The queue.
+ * \param[in] node The node.
+ */
+static inline void
+m_mpsc_push (M_MpscQueue *q, M_SList *node)
+{
+	M_SList *prev;
+
+	assert(q && node);
+
+	node->next = NULL;
+	prev = m_atomic_xchg(&q->head, node, M_ATOMIC_ACQ_REL);
+
+	/*The consumer cannot reach the node until it is linked here.*/
+	m_atomic_store_release(&prev->next, node);
+}
+
+/**
+ * Pop the first node from the queue.
+ * Only the consumer thread can invoke it.
+ * \param[in] q The queue.
+ * \return The first node.
+ * \retval NULL The queue is empty, or the first node is still being linked.
+ */
+static inline M_SList*
+m_mpsc_pop (M_MpscQueue *q)
+{
+	M_SList *tail, *next;
+
+	assert(q);
+
+	tail = q->tail;
+	next = m_atomic_load_acquire(&tail->next);
+
+	if (tail == &q->stub) {
+		if (!next)
+			return NULL;
+
+		q->tail = next;
+		tail = next;
+		next = m_atomic_load_acquire(&next->next);
+	}
+
+	if (next) {
+		q->tail = next;
+		return tail;
+	}
+
+	/*A producer has exchanged the head but not linked the node yet.*/
+	if (tail != m_atomic_load_acquire(&q->head))
+		return NULL;
+
+	/*The last node is kept in the queue until the stub is linked after it.*/
+	m_mpsc_push(q, &q->stub);
+
+	next = m_atomic_load_acquire(&tail->next);
+	if (next) {
+		q->tail = next;
+		return tail;
+	}
+
+	return NULL;
+}
+
+/**
+ * Pop at most n nodes and link them to a single linked list
+ * in the queue's order.
+ * Only the consumer thread can invoke it.
+ * \param[in] q The queue.
+ * \param[out] list The empty single linked list head.
+ * \param n Maximum number of the popped nodes.
+ * \return The number of the popped nodes.
+ */
+static inline uint32_t
+m_mpsc_pop_batch (M_MpscQueue *q, M_SList *list, uint32_t n)
+{
+	M_SList *last = list, *node;
+	uint32_t i;
+
+	assert(q && list && m_slist_empty(list));
+
+	for (i = 0; i < n; i ++) {
+		node = m_mpsc_pop(q);
+		if (!node)
+			break;
+
+		last->next = node;
+		last = node;
+	}
+
+	last->next = NULL;
+
+	return i;
+}
+
+/**
+ * Check if the queue is empty.
+ * Only the consumer thread can invoke it. A node being pushed makes
+ * the queue not empty.
+ * \param[in] q The queue.
+ * \retval M_TRUE The queue is empty.
+ * \retval M_FALSE The queue is not empty.
+ */
+static inline M_Bool
+m_mpsc_empty (M_MpscQueue *q)
+{
+	assert(q);
+
+	return (q->tail == &q->stub) && (m_atomic_load_acquire(&q->head) == &q->stub);
+}
+
+/**
+ * Traverse the linked nodes in the queue.
+ * The producers and the consumer must be paused.
+ */
+#define m_mpsc_foreach(node, q)\
+	for (node = (q)->tail; node; node = (node)->next)\
+		if (node != &(q)->stub)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
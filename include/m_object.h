@@ -17,6 +17,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
  *****************************************************************************/
 
+/**
+ * \file
+ * Object.
+ */
+
 #ifndef _M_OBJECT_H_
 #define _M_OBJECT_H_
 
@@ -26,6 +31,7 @@ extern "C" {
 
 #include "m_types.h"
 #include "m_hash.h"
+#include "m_gc.h"
 
 /**The property is an accessor.*/
 #define M_PROP_FL_ACCESSOR   1
@@ -33,6 +39,8 @@ extern "C" {
 #define M_PROP_FL_WRITABLE   2
 /**The property is enumerable.*/
 #define M_PROP_FL_ENUMERABLE 4
+/**Default flags of the property added by assignment.*/
+#define M_PROP_FL_DEFAULT    (M_PROP_FL_WRITABLE | M_PROP_FL_ENUMERABLE)
 
 /**Property.*/
 typedef struct {
@@ -42,20 +50,204 @@ typedef struct {
 	uint16_t   flags; /**< The property's flags.*/
 } M_Property;
 
+/**The shape is a dictionary shape owned by only one object.*/
+#define M_SHAPE_FL_DICT 1
+
+/**
+ * The properties are looked up through the hash table when the shape has
+ * more properties than this.
+ */
+#ifndef M_SHAPE_LINEAR_MAX
+	#define M_SHAPE_LINEAR_MAX 8
+#endif
+
+/**
+ * The object is changed to dictionary mode when it has more
+ * properties than this.
+ */
+#ifndef M_SHAPE_PROP_MAX
+	#define M_SHAPE_PROP_MAX   128
+#endif
+
+/**Shape transition key.*/
+typedef struct {
+	M_Quark    quark; /**< The name of the added property.*/
+	uint32_t   flags; /**< The flags of the added property.*/
+} M_ShapeKey;
+
+/**
+ * Object shape.
+ * Objects with the same properties added in the same order share one
+ * shape. A shared shape is immutable, adding a property moves the object
+ * to the child shape through the transition table.
+ * The transitions are weak, a child shape no object uses is collected and
+ * removed from its parent's table.
+ * A dictionary shape is owned by one object and modified in place.
+ */
+struct M_Shape_s {
+	M_Shape    *parent;     /**< The shape transitioned from.*/
+	M_ShapeKey  key;        /**< The transition key from the parent.*/
+	M_HashNode  trans_node; /**< Node in the parent's transition table.*/
+	M_Hash      trans_hash; /**< Transitions to the child shapes.*/
+	M_Hash      prop_hash;  /**< Properties lookup table.*/
+	M_Property *props;      /**< Properties array indexed by the slot.*/
+	uint16_t    nprop;      /**< Number of properties.*/
+	uint16_t    nslot;      /**< Number of allocated value slots.*/
+	uint16_t    flags;      /**< The shape's flags.*/
+};
+
 /**The object is configurable.*/
 #define M_OBJ_FL_CONFIGURABLE 1
 /**The object is mutable.*/
 #define M_OBJ_FL_MUTABLE      2
+/**
+ * The object and all the values reachable from it never change.
+ * A frozen object can be shared between actors.
+ */
+#define M_OBJ_FL_FROZEN       4
 
 /**Object.*/
 struct M_Object_s {
-	M_Hash   prop_hash; /**< The properties hash table.*/
-	M_Value  protov;    /**< The prototype value.*/
-	M_Value *v;         /**< The property values.*/
-	uint16_t nv;        /**< The number of property values.*/
-	uint16_t flags;     /**< The object's flags.*/
+	M_Shape  *shape;    /**< The object's shape.*/
+	M_Value   protov;   /**< The prototype value.*/
+	M_Value  *v;        /**< The property values.*/
+	uint16_t  nv;       /**< The number of property values.*/
+	uint16_t  flags;    /**< The object's flags.*/
 };
 
+/** \cond */
+#define M_GC_SHAPEBUF_FLAGS M_GC_BUF_FL_PTR
+#define M_GC_OBJBUF_FLAGS   M_GC_BUF_FL_PTR
+
+extern uint32_t m_shape_epoch;
+
+extern void m_object_startup (void);
+extern void m_object_shutdown (void);
+extern void m_shape_release (M_Shape *shape);
+extern void m_object_release (M_Object *obj);
+/** \endcond */
+
+/**
+ * Get the value buffer capacity for a number of values.
+ * \param nv The number of values.
+ * \return The capacity of the value buffer.
+ */
+static inline uint32_t
+m_object_value_cap (uint32_t nv)
+{
+	uint32_t cap = 4;
+
+	while (cap < nv)
+		cap <<= 1;
+
+	return nv ? cap : 0;
+}
+
+/**
+ * Lookup an own property in the shape.
+ * \param[in] shape The shape.
+ * \param quark The property's name.
+ * \return The property.
+ * \retval NULL Cannot find the property.
+ */
+extern const M_Property* m_shape_lookup (M_Shape *shape, M_Quark quark);
+
+/**
+ * Create a new object.
+ * \param protov The prototype value.
+ * \return The new object.
+ */
+extern M_Object* m_object_new (M_Value protov);
+
+/**
+ * Lookup an own property of the object.
+ * \param[in] obj The object.
+ * \param quark The property's name.
+ * \return The property.
+ * \retval NULL Cannot find the property.
+ */
+static inline const M_Property*
+m_object_lookup (M_Object *obj, M_Quark quark)
+{
+	assert(obj);
+
+	return m_shape_lookup(obj->shape, quark);
+}
+
+/**
+ * Get the value in a property slot.
+ * \param[in] obj The object.
+ * \param id The slot index.
+ * \return The value.
+ */
+static inline M_Value
+m_object_get_slot (M_Object *obj, uint16_t id)
+{
+	assert(obj && (id < obj->nv));
+
+	return obj->v[id];
+}
+
+/**
+ * Set the value in a property slot.
+ * \param[in] obj The object.
+ * \param id The slot index.
+ * \param v The value.
+ */
+static inline void
+m_object_set_slot (M_Object *obj, uint16_t id, M_Value v)
+{
+	assert(obj && (id < obj->nv));
+
+	obj->v[id] = v;
+}
+
+/**
+ * Get a property's value of the object.
+ * The prototype chain is searched if the object has not the property.
+ * \param[in] obj The object.
+ * \param quark The property's name.
+ * \param[out] pv Return the property's value.
+ * \retval M_TRUE The property is found.
+ * \retval M_FALSE Cannot find the property.
+ */
+extern M_Bool    m_object_get (M_Object *obj, M_Quark quark, M_Value *pv);
+
+/**
+ * Define an own property of the object.
+ * If the property exists, its value and flags are replaced.
+ * \param[in] obj The object.
+ * \param quark The property's name.
+ * \param flags The property's flags.
+ * \param v The property's value.
+ * \retval M_OK On success.
+ * \retval M_FAILED The object is not mutable.
+ */
+extern M_Result  m_object_define (M_Object *obj, M_Quark quark,
+			uint16_t flags, M_Value v);
+
+/**
+ * Set a property's value of the object.
+ * A new property is added if the object has not the property.
+ * \param[in] obj The object.
+ * \param quark The property's name.
+ * \param v The property's value.
+ * \retval M_OK On success.
+ * \retval M_FAILED The object is not mutable or the property is not writable.
+ */
+extern M_Result  m_object_set (M_Object *obj, M_Quark quark, M_Value v);
+
+/**
+ * Remove an own property of the object.
+ * The object is changed to dictionary mode.
+ * \param[in] obj The object.
+ * \param quark The property's name.
+ * \retval M_OK On success.
+ * \retval M_NONE The object has not the property.
+ * \retval M_FAILED The object is not configurable.
+ */
+extern M_Result  m_object_remove (M_Object *obj, M_Quark quark);
+
 #ifdef __cplusplus
 }
 #endif
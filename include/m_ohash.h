@@ -0,0 +1,459 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+/**
+ * \file
+ * Open addressing hash table.
+ *
+ * M_OHash stores the node pointers in a flat slot array with one control
+ * byte per slot. The control bytes are scanned 16 at a time, and each slot
+ * keeps its full 32-bit hash next to the node pointer, so the "equal" function is only invoked for
+ * real candidates. The capacity is always a power of 2.
+ * The nodes and the operation functions are the same as M_Hash's,
+ * but the "next" field of M_HashNode is not used.
+ */
+
+#ifndef _M_OHASH_H_
+#define _M_OHASH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <m_types.h>
+#include <m_hash.h>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+/**Open addressing hash table slot.*/
+typedef struct {
+	uint32_t    kv;     /**< The mixed hash value of the key.*/
+	M_HashNode *node;   /**< The node.*/
+} M_OHashSlot;
+
+/**Open addressing hash table.*/
+typedef struct {
+	M_OHashSlot *slots; /**< Slots buffer.*/
+	uint8_t     *ctrl;  /**< Slots' control bytes.*/
+	uint32_t     size;  /**< Nodes count in the hash table.*/
+	uint32_t     ndel;  /**< Deleted slots count.*/
+	uint32_t     cap;   /**< Number of slots.*/
+} M_OHash;
+
+/**\cond*/
+#define M_OHASH_GROUP   16
+#define M_OHASH_EMPTY   0x80
+#define M_OHASH_DELETED 0xFE
+
+static inline uint32_t
+m_ohash_mix (uint32_t kv)
+{
+	kv ^= kv >> 16;
+	kv *= 0x85ebca6b;
+	kv ^= kv >> 13;
+	kv *= 0xc2b2ae35;
+	kv ^= kv >> 16;
+
+	return kv;
+}
+
+static inline uint8_t
+m_ohash_h2 (uint32_t h)
+{
+	return h >> 25;
+}
+
+static inline uint32_t
+m_ohash_group_match (const uint8_t *ctrl, uint8_t v)
+{
+#ifdef __SSE2__
+	__m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(v)));
+#else
+	uint32_t i, mask = 0;
+
+	for (i = 0; i < M_OHASH_GROUP; i ++) {
+		if (ctrl[i] == v)
+			mask |= 1 << i;
+	}
+
+	return mask;
+#endif
+}
+
+/*Empty or deleted slots' mask.*/
+static inline uint32_t
+m_ohash_group_free (const uint8_t *ctrl)
+{
+#ifdef __SSE2__
+	__m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+
+	return _mm_movemask_epi8(g);
+#else
+	uint32_t i, mask = 0;
+
+	for (i = 0; i < M_OHASH_GROUP; i ++) {
+		if (ctrl[i] & 0x80)
+			mask |= 1 << i;
+	}
+
+	return mask;
+#endif
+}
+
+static inline size_t
+m_ohash_buf_size (uint32_t cap)
+{
+	return (sizeof(M_OHashSlot) + 1) * cap;
+}
+
+/*Find a free slot for the hash value.*/
+static inline uint32_t
+m_ohash_find_free (M_OHash *hash, uint32_t h)
+{
+	uint32_t gmask = hash->cap / M_OHASH_GROUP - 1;
+	uint32_t g = h & gmask;
+	uint32_t step = 0;
+
+	while (1) {
+		uint32_t mask = m_ohash_group_free(hash->ctrl + g * M_OHASH_GROUP);
+
+		if (mask)
+			return g * M_OHASH_GROUP + __builtin_ctz(mask);
+
+		step ++;
+		g = (g + step) & gmask;
+	}
+}
+
+/*Find the slot of the key.*/
+static __always_inline int32_t
+m_ohash_find (M_OHash *hash, void *key, uint32_t h, const M_HashOps *ops)
+{
+	uint32_t gmask, g, step;
+	uint8_t h2;
+
+	if (!hash->size)
+		return -1;
+
+	gmask = hash->cap / M_OHASH_GROUP - 1;
+	g     = h & gmask;
+	step  = 0;
+	h2    = m_ohash_h2(h);
+
+	while (1) {
+		const uint8_t *ctrl = hash->ctrl + g * M_OHASH_GROUP;
+		uint32_t mask = m_ohash_group_match(ctrl, h2);
+
+		while (mask) {
+			uint32_t i = g * M_OHASH_GROUP + __builtin_ctz(mask);
+
+			if ((hash->slots[i].kv == h)
+						&& ops->equal(key, ops->get_key(hash->slots[i].node)))
+				return i;
+
+			mask &= mask - 1;
+		}
+
+		if (m_ohash_group_match(ctrl, M_OHASH_EMPTY))
+			return -1;
+
+		step ++;
+		g = (g + step) & gmask;
+	}
+}
+/**\endcond*/
+
+/**
+ * Traverse the nodes in the open addressing hash table.
+ * You can remove current node in the traverse block.
+ * \a node is M_HashNode pointer pointed to each node.
+ * \a pos is an integer to store the slot index.
+ * \a hash is the hash table's pointer.
+ */
+#define m_ohash_foreach(node, pos, hash)\
+	for (pos = 0; pos < (hash)->cap; (pos) ++)\
+		if (!((hash)->ctrl[pos] & 0x80) && ((node) = (hash)->slots[pos].node, 1))
+
+/**
+ * Traverse each value in the open addressing hash table.
+ * You can remove current value in the traverse block.
+ * \a val is value structure pointer pointed to each value.
+ * \a pos is an integer to store the slot index.
+ * \a hash is the hash table's pointer.
+ * \a member is the member name of the hash node in the value structure.
+ */
+#define m_ohash_foreach_value(val, pos, hash, member)\
+	for (pos = 0; pos < (hash)->cap; (pos) ++)\
+		if (!((hash)->ctrl[pos] & 0x80) &&\
+					((val) = M_CONTAINER_OF((hash)->slots[pos].node,\
+						typeof(*(val)), member), 1))
+
+/**
+ * Get the nodes count in the open addressing hash table.
+ * \param[in] hash The hash table.
+ * \return The nodes count.
+ */
+static inline uint32_t
+m_ohash_size (M_OHash *hash)
+{
+	assert(hash);
+
+	return hash->size;
+}
+
+/**
+ * Open addressing hash table structure initialize.
+ * \param[in] hash The hash table.
+ */
+static inline void
+m_ohash_init (M_OHash *hash)
+{
+	assert(hash);
+
+	hash->slots = NULL;
+	hash->ctrl  = NULL;
+	hash->size  = 0;
+	hash->ndel  = 0;
+	hash->cap   = 0;
+}
+
+/**
+ * Clear the open addressing hash table structure.
+ * \param[in] hash The hash table.
+ * \param[in] ops The hash table operation functions.
+ */
+static __always_inline void
+m_ohash_deinit (M_OHash *hash, const M_HashOps *ops)
+{
+	assert(hash && ops && ops->free_buf);
+
+	if (hash->slots) {
+		M_HashNode *node;
+		uint32_t pos;
+
+		if (ops->free_node) {
+			m_ohash_foreach(node, pos, hash) {
+				ops->free_node(node);
+			}
+		}
+
+		ops->free_buf(hash->slots, m_ohash_buf_size(hash->cap));
+	}
+}
+
+/**
+ * Lookup a node in the open addressing hash table.
+ * \param[in] hash The hash table.
+ * \param[in] key The key of the node.
+ * \param[in] ops The hash table operation functions.
+ * \param[out] pkv If \a pkv is not NULL, store the key value in it.
+ * \return The node with the key find in the hash table.
+ * \retval NULL Cannot find the node with the key.
+ */
+static __always_inline M_HashNode*
+m_ohash_lookup_with_kv (M_OHash *hash, void *key, const M_HashOps *ops,
+			uint32_t *pkv)
+{
+	uint32_t kv;
+	int32_t i;
+
+	assert(hash && ops && ops->get_key && ops->kv && ops->equal);
+
+	kv = ops->kv(key);
+	if (pkv)
+		*pkv = kv;
+
+	i = m_ohash_find(hash, key, m_ohash_mix(kv), ops);
+
+	return (i < 0) ? NULL : hash->slots[i].node;
+}
+
+/**
+ * Lookup a node in the open addressing hash table.
+ * \param[in] hash The hash table.
+ * \param[in] key The key of the node.
+ * \param[in] ops The hash table operation functions.
+ * \return The node with the key find in the hash table.
+ * \retval NULL Cannot find the node with the key.
+ */
+static __always_inline M_HashNode*
+m_ohash_lookup (M_OHash *hash, void *key, const M_HashOps *ops)
+{
+	return m_ohash_lookup_with_kv(hash, key, ops, NULL);
+}
+
+/**
+ * Remove a node from the open addressing hash table.
+ * This function do not invoke ops->free_node to free the node.
+ * \param[in] hash The hash table.
+ * \param[in] key The key of the node.
+ * \param[in] ops The hash table operation functions.
+ * \return The node removed.
+ * \retval NULL Cannot find the node with the key.
+ */
+static __always_inline M_HashNode*
+m_ohash_remove (M_OHash *hash, void *key, const M_HashOps *ops)
+{
+	int32_t i;
+
+	assert(hash && ops && ops->get_key && ops->kv && ops->equal);
+
+	i = m_ohash_find(hash, key, m_ohash_mix(ops->kv(key)), ops);
+	if (i < 0)
+		return NULL;
+
+	/*
+	 * Lookups stop at the first group with an empty slot, so if this group
+	 * has one, no probe sequence runs through it and the slot can be
+	 * marked empty instead of deleted.
+	 */
+	if (m_ohash_group_match(hash->ctrl + (i & ~(M_OHASH_GROUP - 1)),
+				M_OHASH_EMPTY)) {
+		hash->ctrl[i] = M_OHASH_EMPTY;
+	} else {
+		hash->ctrl[i] = M_OHASH_DELETED;
+		hash->ndel ++;
+	}
+
+	hash->size --;
+
+	return hash->slots[i].node;
+}
+
+/**
+ * Insert a node to the open addressing hash table.
+ * Like "m_hash_insert_with_kv", the key should be unique and
+ * "m_ohash_resize" should be invoked before inserting.
+ * \code{.c}
+ * uint32_t kv;
+ * M_HashNode *node;
+ *
+ * node = m_ohash_lookup_with_kv(hash, M_SIZE_TO_PTR(100), &my_hash_ops, &kv);
+ * if (!node) {
+ *		m_ohash_resize(hash, &my_hash_ops);
+ *		m_ohash_insert_with_kv(hash, new_node, kv, &my_hash_ops);
+ * }
+ * \endcode
+ * \param[in] hash The hash table.
+ * \param[in] node The node to be added.
+ * \param kv The key value of the node.
+ * \param[in] ops The hash table operation functions.
+ */
+static __always_inline void
+m_ohash_insert_with_kv (M_OHash *hash, M_HashNode *node, uint32_t kv,
+			const M_HashOps *ops)
+{
+	uint32_t h, i;
+
+	assert(hash && node && ops);
+
+	assert((hash->size + hash->ndel) * 8 < hash->cap * 7);
+
+	h = m_ohash_mix(kv);
+	i = m_ohash_find_free(hash, h);
+
+	if (hash->ctrl[i] == M_OHASH_DELETED)
+		hash->ndel --;
+
+	hash->ctrl[i]       = m_ohash_h2(h);
+	hash->slots[i].kv   = h;
+	hash->slots[i].node = node;
+	hash->size ++;
+}
+
+/**
+ * Insert a node to the open addressing hash table.
+ * \param[in] hash The hash table.
+ * \param[in] node The node to be added.
+ * \param[in] ops The hash table operation functions.
+ */
+static __always_inline void
+m_ohash_insert (M_OHash *hash, M_HashNode *node, const M_HashOps *ops)
+{
+	assert(ops && ops->get_key && ops->kv);
+
+	m_ohash_insert_with_kv(hash, node, ops->kv(ops->get_key(node)), ops);
+}
+
+/**
+ * Check and rebuild the slot buffer of the open addressing hash table.
+ * The buffer is rebuilt when one more node would push the used slots
+ * (including the deleted ones) over 7/8 of the capacity. The stored hash
+ * values are reused, so the key functions are not invoked.
+ * \param[in] hash The hash table.
+ * \param[in] ops The hash table operation functions.
+ * \retval M_OK On success.
+ * \retval M_ERR_NO_MEM Not enough memory to allocate the slot buffer.
+ */
+static __always_inline M_Result
+m_ohash_resize (M_OHash *hash, const M_HashOps *ops)
+{
+	assert(hash && ops->alloc_buf && ops->free_buf);
+
+	if ((hash->size + hash->ndel + 1) * 8 >= hash->cap * 7) {
+		M_OHash nhash;
+		uint32_t ncap, pos;
+		void *buf;
+
+		ncap = M_OHASH_GROUP;
+		while (ncap * 7 < (hash->size + 1) * 16)
+			ncap <<= 1;
+
+		buf = ops->alloc_buf(m_ohash_buf_size(ncap));
+		if (!buf)
+			return M_ERR_NO_MEM;
+
+		nhash.slots = buf;
+		nhash.ctrl  = (uint8_t*)(nhash.slots + ncap);
+		nhash.size  = hash->size;
+		nhash.ndel  = 0;
+		nhash.cap   = ncap;
+
+		memset(nhash.ctrl, M_OHASH_EMPTY, ncap);
+
+		for (pos = 0; pos < hash->cap; pos ++) {
+			uint32_t i;
+
+			if (hash->ctrl[pos] & 0x80)
+				continue;
+
+			i = m_ohash_find_free(&nhash, hash->slots[pos].kv);
+
+			nhash.ctrl[i]  = hash->ctrl[pos];
+			nhash.slots[i] = hash->slots[pos];
+		}
+
+		if (hash->slots)
+			ops->free_buf(hash->slots, m_ohash_buf_size(hash->cap));
+
+		*hash = nhash;
+	}
+
+	return M_OK;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
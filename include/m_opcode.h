@@ -0,0 +1,187 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+/**
+ * \file
+ * Byte code instructions.
+ *
+ * The virtual machine is register based. A register is a value in the
+ * current frame. An instruction is an opcode byte followed by its operands:
+ * - a, b, c: register index, 1 byte.
+ * - k: const value index in the module, 2 bytes.
+ * - s: signed immediate number or jump offset, 2 bytes.
+ * - i: signed immediate number, 1 byte.
+ * - d: frame depth in the closure, 1 byte.
+ * - n: arguments count, 1 byte.
+ * - c16: inline cache or function index, 2 bytes.
+ * - u: captured variable index, 2 bytes.
+ *
+ * Multiple bytes operands are stored in little endian.
+ * Jump offsets are relative to the jump instruction's first byte.
+ *
+ * GETUP and SETUP address an outer variable by its frame depth and
+ * register. m_closure_convert() rewrites them to GETUPV, GETBOX and SETBOX
+ * which address the closure's captured variables, they cannot run before.
+ */
+
+#ifndef _M_OPCODE_H_
+#define _M_OPCODE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "m_types.h"
+#include "m_atomic.h"
+
+/**
+ * Instructions table.
+ * M_OP(name, generic, length, operands)
+ *
+ * The instructions after RET are quickened variants. The interpreter
+ * rewrites a generic opcode in place to a variant after observing its
+ * operands' types, and rewrites it to the "_G" variant when the types
+ * change. A "_G" instruction is never quickened again.
+ * A fused variant covers the following instruction too: only its first
+ * opcode byte is rewritten, so the following instruction is still valid
+ * as a jump target and after deoptimization.
+ * Threads running the same function share its byte code, so an opcode byte
+ * is read with m_bc_get_op() and rewritten with a single m_bc_set_op().
+ * The operands are never rewritten, every variant is valid with them.
+ */
+#define M_OPCODES\
+	M_OP(NOP,      NOP,      1, "")\
+	M_OP(MOVE,     MOVE,     3, "a b")\
+	M_OP(LOADK,    LOADK,    4, "a k")\
+	M_OP(LOADI,    LOADI,    4, "a s")\
+	M_OP(LOADNULL, LOADNULL, 2, "a")\
+	M_OP(LOADBOOL, LOADBOOL, 3, "a i")\
+	M_OP(GETUP,    GETUP,    4, "a d b")\
+	M_OP(SETUP,    SETUP,    4, "d a b")\
+	M_OP(GETUPV,   GETUPV,   4, "a u")\
+	M_OP(GETBOX,   GETBOX,   4, "a u")\
+	M_OP(SETBOX,   SETBOX,   4, "u b")\
+	M_OP(ADD,      ADD,      4, "a b c")\
+	M_OP(SUB,      SUB,      4, "a b c")\
+	M_OP(MUL,      MUL,      4, "a b c")\
+	M_OP(DIV,      DIV,      4, "a b c")\
+	M_OP(MOD,      MOD,      4, "a b c")\
+	M_OP(ADDI,     ADDI,     4, "a b i")\
+	M_OP(LT,       LT,       4, "a b c")\
+	M_OP(LE,       LE,       4, "a b c")\
+	M_OP(EQ,       EQ,       4, "a b c")\
+	M_OP(NE,       NE,       4, "a b c")\
+	M_OP(NOT,      NOT,      3, "a b")\
+	M_OP(JMP,      JMP,      3, "s")\
+	M_OP(JMPT,     JMPT,     4, "a s")\
+	M_OP(JMPF,     JMPF,     4, "a s")\
+	M_OP(NEWOBJ,   NEWOBJ,   2, "a")\
+	M_OP(GETPROP,  GETPROP,  7, "a b k c16")\
+	M_OP(SETPROP,  SETPROP,  7, "a k b c16")\
+	M_OP(NEWARR,   NEWARR,   2, "a")\
+	M_OP(GETELEM,  GETELEM,  4, "a b c")\
+	M_OP(SETELEM,  SETELEM,  4, "a b c")\
+	M_OP(CLOSURE,  CLOSURE,  4, "a c16")\
+	M_OP(CALL,     CALL,     4, "a b n")\
+	M_OP(RET,      RET,      2, "a")\
+	M_OP(ADD_II,   ADD,      4, "a b c")\
+	M_OP(ADD_DD,   ADD,      4, "a b c")\
+	M_OP(ADD_G,    ADD,      4, "a b c")\
+	M_OP(SUB_II,   SUB,      4, "a b c")\
+	M_OP(SUB_DD,   SUB,      4, "a b c")\
+	M_OP(SUB_G,    SUB,      4, "a b c")\
+	M_OP(MUL_II,   MUL,      4, "a b c")\
+	M_OP(MUL_DD,   MUL,      4, "a b c")\
+	M_OP(MUL_G,    MUL,      4, "a b c")\
+	M_OP(LT_II,    LT,       4, "a b c")\
+	M_OP(LT_G,     LT,       4, "a b c")\
+	M_OP(LE_II,    LE,       4, "a b c")\
+	M_OP(LE_G,     LE,       4, "a b c")\
+	M_OP(LTJF_II,  LT,       8, "a b c JMPF a s")\
+	M_OP(LEJF_II,  LE,       8, "a b c JMPF a s")
+
+/**Opcode.*/
+typedef enum {
+#define M_OP(name, gen, len, ops) M_OP_##name,
+	M_OPCODES
+#undef M_OP
+	M_OP_COUNT /**< Count of the opcodes.*/
+} M_Opcode;
+
+/**Instructions' length in bytes.*/
+extern const uint8_t m_opcode_lengths[M_OP_COUNT];
+
+/**Instructions' names.*/
+extern const char*   m_opcode_names[M_OP_COUNT];
+
+/**Generic instructions of the quickened variants.*/
+extern const uint8_t m_opcode_generics[M_OP_COUNT];
+
+/**Expand to the bytes of a 16 bits operand.*/
+#define M_BC_16(n) ((uint8_t)(n)), ((uint8_t)(((uint16_t)(n)) >> 8))
+
+/**
+ * Read a 16 bits unsigned operand.
+ * \param[in] p The operand's pointer.
+ * \return The operand's value.
+ */
+static inline uint16_t
+m_bc_get_u16 (const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+/**
+ * Read a 16 bits signed operand.
+ * \param[in] p The operand's pointer.
+ * \return The operand's value.
+ */
+static inline int16_t
+m_bc_get_s16 (const uint8_t *p)
+{
+	return (int16_t)m_bc_get_u16(p);
+}
+
+/**
+ * Read an opcode which may be rewritten by another thread.
+ * \param[in] ip The instruction's pointer.
+ * \return The opcode.
+ */
+static inline uint8_t
+m_bc_get_op (const uint8_t *ip)
+{
+	return m_atomic_load_relaxed(ip);
+}
+
+/**
+ * Rewrite an opcode in place.
+ * \param[in] ip The instruction's pointer.
+ * \param op The new opcode, a variant of the same generic instruction.
+ */
+static inline void
+m_bc_set_op (uint8_t *ip, uint8_t op)
+{
+	m_atomic_store_relaxed(ip, op);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
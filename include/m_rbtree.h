@@ -308,15 +308,102 @@ m_rbt_set_parent_color (M_RBNode *node, M_RBNode *parent, int color)
 	node->pcolor = M_PTR_TO_SIZE(parent) | color;
 }
 
+/*Free the nodes without recursion, rotating the left children up.*/
 static inline void
 m_rbt_free_node (M_RBNode *node, void(*func)(void *node))
 {
-	if (node->left)
-		m_rbt_free_node(node->left, func);
+	M_RBNode *left, *right;
+
+	while (node) {
+		left = node->left;
+
+		if (left) {
+			node->left  = left->right;
+			left->right = node;
+			node = left;
+		} else {
+			right = node->right;
+			func(node);
+			node = right;
+		}
+	}
+}
+
+/*
+ * Flatten the tree into a list linked by "right" in key order.
+ * Parents and colors are left stale.
+ */
+static inline M_RBNode*
+m_rbt_vine (M_RBNode *root, size_t *pn)
+{
+	M_RBNode head, *tail = &head, *rest = root, *left;
+	size_t n = 0;
+
+	head.right = root;
+
+	while (rest) {
+		left = rest->left;
+
+		if (left) {
+			rest->left  = left->right;
+			left->right = rest;
+			rest = left;
+			tail->right = left;
+		} else {
+			tail = rest;
+			rest = rest->right;
+			n ++;
+		}
+	}
+
+	if (pn)
+		*pn = n;
+
+	return head.right;
+}
+
+/*Build a size balanced subtree from the first "n" nodes of the list.*/
+static inline M_RBNode*
+m_rbt_build_sub (M_RBNode **plist, size_t n, int depth, int red_depth)
+{
+	M_RBNode *node, *left;
+
+	if (!n)
+		return NULL;
+
+	left = m_rbt_build_sub(plist, n / 2, depth + 1, red_depth);
+
+	node   = *plist;
+	*plist = node->right;
+
+	node->left  = left;
+	node->right = m_rbt_build_sub(plist, n - n / 2 - 1, depth + 1, red_depth);
+
+	if (left)
+		m_rbt_set_parent(left, node);
 	if (node->right)
-		m_rbt_free_node(node->right, func);
+		m_rbt_set_parent(node->right, node);
 
-	func(node);
+	/*
+	 * All the NULL leaves are in the last 2 levels, so only the deepest
+	 * level is red and the black heights match.
+	 */
+	m_rbt_set_parent_color(node, NULL,
+				(depth == red_depth) ? M_RB_RED : M_RB_BLACK);
+
+	return node;
+}
+
+/*Rebuild the tree from a sorted list with "n" nodes.*/
+static inline void
+m_rbt_from_vine (M_RBTree *tree, M_RBNode *list, size_t n)
+{
+	int depth = 0;
+
+	while (n >> (depth + 1))
+		depth ++;
+
+	*tree = m_rbt_build_sub(&list, n, 0, depth ? depth : -1);
 }
 
 /** \endcond */
@@ -510,9 +597,10 @@ m_rbt_lookup (M_RBTree *tree, void *key, const M_RBTreeOps *ops)
  * \param[in] tree The RB tree.
  * \param[in] key The key value.
  * \param[in] ops The RB tree operation functions.
- * \param[out] parent If cannot find the node, return the parent node pointer
- * where to insert a new node.
- * \param[out] pos If cannot find the node, return the 
+ * \param[out] parent Return the parent node pointer where to insert a new node.
+ * If the node is found, return the found node's parent.
+ * \param[out] pos Return the link pointer where to insert a new node.
+ * If the node is found, return the link pointing to the found node.
  * \return The node find in the tree.
  * \retval NULL Cannot find the node with the key.
  */
@@ -520,30 +608,32 @@ static __always_inline M_RBNode*
 m_rbt_lookup_insert (M_RBTree *tree, void *key, const M_RBTreeOps *ops,
 			M_RBNode **parent, M_RBNode ***pos)
 {
-	M_RBNode **pn, *node = NULL;
+	M_RBNode **pn, *node, *pnode = NULL;
 	int v;
 
 	assert(tree && ops && ops->get_key && ops->cmp && parent && pos);
 
 	pn = tree;
 
-	while (*pn) {
-		node = *pn;
+	while ((node = *pn)) {
 		v = ops->cmp(key, ops->get_key(node));
 
-		if (v == 0) {
-			return node;
-		} else if (v < 0) {
+		if (v == 0)
+			break;
+
+		pnode = node;
+
+		if (v < 0) {
 			pn = &node->left;
 		} else {
 			pn = &node->right;
 		}
 	}
 
-	*parent = node;
+	*parent = pnode;
 	*pos = pn;
 
-	return NULL;
+	return node;
 }
 
 /** \cond */
@@ -677,7 +767,7 @@ m_rbt_insert (M_RBTree *tree, M_RBNode *parent, M_RBNode **pos,
 static __always_inline void
 m_rbt_remove_rebalance (M_RBTree *tree, M_RBNode *node)
 {
-	M_RBNode *parent, *gparent, *sibling, *sleft, *sright;
+	M_RBNode *parent, *sibling, *sleft, *sright;
 	int scol, slcol, srcol, pcol;
 
 	while (1) {
@@ -761,7 +851,7 @@ static inline void
 m_rbt_remove (M_RBTree *tree, M_RBNode *node)
 {
 	M_RBNode *succ, *child, *parent;
-	M_Bool is_left;
+	M_Bool is_left = M_FALSE;
 
 	assert(tree && node);
 
@@ -842,6 +932,202 @@ m_rbt_remove (M_RBTree *tree, M_RBNode *node)
 	}
 }
 
+/**
+ * Build the RB tree from nodes sorted by their keys in O(n) time.
+ * The keys must be unique.
+ * \param[in] tree The RB tree. It must be empty.
+ * \param[in] nodes The nodes in ascending key order.
+ * \param n Count of the nodes.
+ */
+static inline void
+m_rbt_build (M_RBTree *tree, M_RBNode **nodes, size_t n)
+{
+	size_t i;
+
+	assert(tree && !*tree && (nodes || !n));
+
+	for (i = 0; i < n; i ++)
+		nodes[i]->right = (i + 1 < n) ? nodes[i + 1] : NULL;
+
+	m_rbt_from_vine(tree, n ? nodes[0] : NULL, n);
+}
+
+/**
+ * Move all the nodes of the RB tree \a src into the RB tree \a tree
+ * in O(n + m) time.
+ * When a key is in both of the trees, the node of \a src is left in it.
+ * \param[in] tree The RB tree to merge into.
+ * \param[in] src The source RB tree.
+ * \param[in] ops The RB tree operation functions.
+ */
+static inline void
+m_rbt_merge (M_RBTree *tree, M_RBTree *src, const M_RBTreeOps *ops)
+{
+	M_RBNode *a, *b, head, *tail = &head, dhead, *dtail = &dhead;
+	size_t n = 0, ndup = 0;
+	int v;
+
+	assert(tree && src && ops && ops->get_key && ops->cmp);
+
+	a = m_rbt_vine(*tree, NULL);
+	b = m_rbt_vine(*src, NULL);
+
+	while (a || b) {
+		if (!a)
+			v = 1;
+		else if (!b)
+			v = -1;
+		else
+			v = ops->cmp(ops->get_key(a), ops->get_key(b));
+
+		if (v <= 0) {
+			tail->right = a;
+			tail = a;
+			a = a->right;
+			n ++;
+		}
+
+		if (v > 0) {
+			tail->right = b;
+			tail = b;
+			b = b->right;
+			n ++;
+		} else if (v == 0) {
+			dtail->right = b;
+			dtail = b;
+			b = b->right;
+			ndup ++;
+		}
+	}
+
+	tail->right  = NULL;
+	dtail->right = NULL;
+
+	m_rbt_from_vine(tree, head.right, n);
+	m_rbt_from_vine(src, dhead.right, ndup);
+}
+
+/**
+ * Split the RB tree in O(n) time.
+ * The nodes with keys not less than \a key are moved to \a right.
+ * \param[in] tree The RB tree to be split.
+ * \param[in] key The key value.
+ * \param[in] ops The RB tree operation functions.
+ * \param[out] right The RB tree receives the upper part. It must be empty.
+ */
+static inline void
+m_rbt_split (M_RBTree *tree, void *key, const M_RBTreeOps *ops,
+			M_RBTree *right)
+{
+	M_RBNode head, *tail = &head, *node;
+	size_t n, nleft = 0;
+
+	assert(tree && right && !*right && ops && ops->get_key && ops->cmp);
+
+	head.right = m_rbt_vine(*tree, &n);
+
+	for (node = head.right; node; node = node->right) {
+		if (ops->cmp(ops->get_key(node), key) >= 0)
+			break;
+
+		tail = node;
+		nleft ++;
+	}
+
+	tail->right = NULL;
+
+	m_rbt_from_vine(tree, head.right, nleft);
+	m_rbt_from_vine(right, node, n - nleft);
+}
+
+/**
+ * Define the red-black tree lookup functions specialized for a key type.
+ * The generated functions invoke \a get_key_fn and \a cmp_fn directly
+ * instead of through M_RBTreeOps, so they are inlined even when no
+ * constant ops structure is visible. The found position can be passed to
+ * "m_rbt_insert" as usual. Like "m_rbt_lookup_insert", \a parent and
+ * \a pos are always set.
+ * The following functions are generated:
+ * - name##_lookup (M_RBTree *tree, key_type key)
+ * - name##_lookup_insert (M_RBTree *tree, key_type key,
+ *   M_RBNode **parent, M_RBNode ***pos)
+ *
+ * \code{.c}
+ * static inline int
+ * my_get_key (const M_RBNode *node)
+ * {
+ *		return M_CONTAINER_OF(node, MyValue, rb_node)->my_key;
+ * }
+ *
+ * static inline int my_cmp (int k1, int k2) { return k1 - k2; }
+ *
+ * M_DEFINE_RBTREE(my_tree, int, my_get_key, my_cmp)
+ *
+ * node = my_tree_lookup_insert(&tree, 100, &parent, &pos);
+ * if (!node)
+ *		m_rbt_insert(&tree, parent, pos, new_node);
+ * \endcode
+ * \a name is the prefix of the generated functions.
+ * \a key_type is the key's type.
+ * \a get_key_fn gets the key from a node.
+ * \a cmp_fn compares 2 keys.
+ */
+#define M_DEFINE_RBTREE(name, key_type, get_key_fn, cmp_fn)\
+static __always_inline M_RBNode*\
+name##_lookup (M_RBTree *tree, key_type key)\
+{\
+	M_RBNode *node;\
+	int v;\
+\
+	assert(tree);\
+\
+	node = *tree;\
+\
+	while (node) {\
+		v = cmp_fn(key, get_key_fn(node));\
+\
+		if (v == 0)\
+			return node;\
+		else if (v < 0)\
+			node = node->left;\
+		else\
+			node = node->right;\
+	}\
+\
+	return NULL;\
+}\
+\
+static __always_inline M_RBNode*\
+name##_lookup_insert (M_RBTree *tree, key_type key, M_RBNode **parent,\
+			M_RBNode ***pos)\
+{\
+	M_RBNode **pn, *node, *pnode = NULL;\
+	int v;\
+\
+	assert(tree && parent && pos);\
+\
+	pn = tree;\
+\
+	while ((node = *pn)) {\
+		v = cmp_fn(key, get_key_fn(node));\
+\
+		if (v == 0)\
+			break;\
+\
+		pnode = node;\
+\
+		if (v < 0)\
+			pn = &node->left;\
+		else\
+			pn = &node->right;\
+	}\
+\
+	*parent = pnode;\
+	*pos    = pn;\
+\
+	return node;\
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,93 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+/**
+ * \file
+ * Actor scheduler.
+ * Each worker thread has a local run queue. The owner puts and takes
+ * actors at its ends without locking, idle threads steal half of the
+ * actors from the other queues. A full local queue overflows half of
+ * its actors into the global run queue.
+ */
+
+#ifndef _M_SCHED_H_
+#define _M_SCHED_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "m_types.h"
+
+/**Local run queue size, must be power of 2.*/
+#ifndef M_SCHED_RUNQ_SIZE
+	#define M_SCHED_RUNQ_SIZE 256
+#endif
+
+/**Budget of an actor's message before it is preempted.*/
+#ifndef M_SCHED_QUANTUM
+	#define M_SCHED_QUANTUM 1000
+#endif
+
+/**Number of messages an actor handles before it is requeued.*/
+#ifndef M_SCHED_BATCH
+	#define M_SCHED_BATCH 64
+#endif
+
+/**Maximum number of worker threads.*/
+#ifndef M_SCHED_MAX_WORKERS
+	#define M_SCHED_MAX_WORKERS 256
+#endif
+
+/**Rounds an idle thread looks for actors before it is parked.*/
+#ifndef M_SCHED_SPIN
+	#define M_SCHED_SPIN 64
+#endif
+
+/**
+ * Local run queue of a worker thread.
+ * Only the owner writes the tail, the owner and the thieves take actors
+ * from the head by compare and swap.
+ */
+struct M_RunQueue_s {
+	uint32_t  head;                     /**< The first actor's index.*/
+	uint32_t  tail;                     /**< The next free slot's index.*/
+	M_Actor  *buf[M_SCHED_RUNQ_SIZE];   /**< Actors' ring buffer.*/
+};
+
+/** \cond */
+extern void m_sched_startup (void);
+extern void m_sched_shutdown (void);
+extern void m_sched_stop (void);
+extern void m_sched_worker (void);
+extern void m_sched_add (M_Actor *actor);
+/** \endcond */
+
+/**
+ * Run the actors in the current thread until all the actors are idle.
+ * The worker threads created by m_thread_create() run actors at
+ * the same time.
+ */
+extern void m_sched_run (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
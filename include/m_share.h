@@ -0,0 +1,92 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+/**
+ * \file
+ * Values shared between actors.
+ * A frozen value and all the values reachable from it never change, so it
+ * is passed to another actor by reference. A mutable value is copied when
+ * it is sent.
+ */
+
+#ifndef _M_SHARE_H_
+#define _M_SHARE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "m_types.h"
+#include "m_value.h"
+#include "m_string.h"
+#include "m_array.h"
+#include "m_object.h"
+#include "m_closure.h"
+
+/**
+ * Check if the value is frozen.
+ * Numbers, booleans and null are always frozen.
+ * \param v The value.
+ * \retval M_TRUE The value never changes.
+ * \retval M_FALSE The value is mutable.
+ */
+static inline M_Bool
+m_value_is_frozen (M_Value v)
+{
+	if (m_value_is_string(v))
+		return m_string_is_frozen(m_value_get_string(v));
+	if (m_value_is_object(v))
+		return (m_value_get_object(v)->flags & M_OBJ_FL_FROZEN) ?
+					M_TRUE : M_FALSE;
+	if (m_value_is_array(v))
+		return (m_value_get_array(v)->flags & M_ARRAY_FL_FROZEN) ?
+					M_TRUE : M_FALSE;
+	if (m_value_is_closure(v))
+		return (m_value_get_closure(v)->flags & M_CLOS_FL_FROZEN) ?
+					M_TRUE : M_FALSE;
+
+	return M_TRUE;
+}
+
+/**
+ * Freeze the value and all the values reachable from it.
+ * Rope strings are flattened. Objects' prototypes are frozen too.
+ * Only the actor owning the values can freeze them.
+ * \param v The value.
+ * \retval M_OK The value is frozen.
+ * \retval M_FAILED A closure reached has boxed variables, no object,
+ * array or closure is frozen.
+ */
+extern M_Result m_value_freeze (M_Value v);
+
+/**
+ * Get the value to be passed to another actor.
+ * A frozen value is returned directly. A mutable value is deep copied,
+ * the frozen values in it are shared by the copy. The boxed variables of
+ * a closure are copied to new boxes.
+ * \param v The value.
+ * \return The shared value or the copy.
+ */
+extern M_Value  m_value_share (M_Value v);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -30,14 +30,299 @@ extern "C" {
 #endif
 
 #include "m_types.h"
+#include "m_atomic.h"
 
+/**UTF-16 character.*/
 typedef uint16_t M_UChar;
 
+/**String type mask.*/
+#define M_STRING_TYPE_MASK  3
+/**Flat string, the characters are stored in a continuous buffer.*/
+#define M_STRING_TYPE_FLAT  0
+/**Rope string, the concatenation of 2 strings.*/
+#define M_STRING_TYPE_ROPE  1
+/**Slice string, a substring of a flat string.*/
+#define M_STRING_TYPE_SLICE 2
+
+/**
+ * All the characters are in Latin-1 range and are stored as bytes.
+ * The flag is decided when the string is created and never changes.
+ */
+#define M_STRING_FL_LATIN1  4
+
+/**
+ * The string's storage never changes, so it can be shared between actors.
+ * Flat strings and slices are frozen when they are created, a rope string
+ * is frozen when it is flattened.
+ */
+#define M_STRING_FL_FROZEN  8
+
+/** \cond */
+/**A thread is replacing the rope's children with the flattened buffer.*/
+#define M_STRING_FL_BUSY    16
+/** \endcond */
+
+/**
+ * The concatenation result shorter than this is copied to a flat string
+ * instead of creating a rope node.
+ */
+#ifndef M_STRING_ROPE_MIN_LEN
+	#define M_STRING_ROPE_MIN_LEN  32
+#endif
+
+/**
+ * Maximum depth of a rope tree. A concatenation deeper than this is copied
+ * to a flat string, so walking a rope always fits in a small local stack.
+ */
+#ifndef M_STRING_ROPE_MAX_DEPTH
+	#define M_STRING_ROPE_MAX_DEPTH 32
+#endif
+
+/**
+ * The substring shorter than this is copied to a flat string
+ * instead of referencing its parent.
+ */
+#ifndef M_STRING_SLICE_MIN_LEN
+	#define M_STRING_SLICE_MIN_LEN 16
+#endif
+
+/** \cond */
+#define M_GC_STRBUF_FLAGS 0
+/** \endcond */
+
+/**String.*/
 struct M_String_s {
-	size_t   len;
-	M_UChar *chars;
+	size_t   len;    /**< Length in characters.*/
+	uint32_t flags;  /**< String type and flags.*/
+	uint32_t depth;  /**< Depth of the rope tree.*/
+	union {
+		/**Characters buffer of a flat string.*/
+		M_UChar *chars;
+		/**Latin-1 characters buffer of a flat string.*/
+		uint8_t *lchars;
+		struct {
+			M_String *left;   /**< Left part of a rope string.*/
+			M_String *right;  /**< Right part of a rope string.*/
+		};
+		struct {
+			M_String *parent; /**< The flat string contains the slice.*/
+			size_t    offset; /**< Offset of the slice in its parent.*/
+		};
+	};
 };
 
+/**
+ * Get the type of the string.
+ * \param[in] str The string.
+ * \return The string's type.
+ */
+static inline uint32_t
+m_string_type (const M_String *str)
+{
+	assert(str);
+
+	return m_atomic_load_acquire(&str->flags) & M_STRING_TYPE_MASK;
+}
+
+/**
+ * Get the length of the string.
+ * \param[in] str The string.
+ * \return The length in characters.
+ */
+static inline size_t
+m_string_length (const M_String *str)
+{
+	assert(str);
+
+	return str->len;
+}
+
+/**
+ * Check if the string's characters are stored as Latin-1 bytes.
+ * \param[in] str The string.
+ * \retval M_TRUE The characters are stored as bytes.
+ * \retval M_FALSE The characters are stored as M_UChar.
+ */
+static inline M_Bool
+m_string_is_latin1 (const M_String *str)
+{
+	assert(str);
+
+	return (m_atomic_load_relaxed(&str->flags) & M_STRING_FL_LATIN1) ?
+			M_TRUE : M_FALSE;
+}
+
+/**
+ * Check if the string is frozen.
+ * \param[in] str The string.
+ * \retval M_TRUE The string never changes.
+ * \retval M_FALSE The string is a rope which may be flattened in place.
+ */
+static inline M_Bool
+m_string_is_frozen (const M_String *str)
+{
+	assert(str);
+
+	return (m_atomic_load_acquire(&str->flags) & M_STRING_FL_FROZEN) ?
+			M_TRUE : M_FALSE;
+}
+
+/**
+ * Flatten a rope string.
+ * The characters in the rope tree are copied to a new buffer, and the string
+ * is changed to a flat string in place. Other threads may read the rope
+ * at the same time, they see either the rope or the flat string.
+ * \param[in] str The string.
+ */
+extern void      m_string_flatten (M_String *str);
+
+/**
+ * Get the characters buffer of the string.
+ * A rope string is flattened at its first random access.
+ * The buffer is an uint8_t array if the string is a Latin-1 string,
+ * or else it is an M_UChar array.
+ * \param[in] str The string.
+ * \return The characters buffer.
+ */
+static inline const void*
+m_string_buffer (M_String *str)
+{
+	assert(str);
+
+	switch (m_string_type(str)) {
+		case M_STRING_TYPE_ROPE:
+			m_string_flatten(str);
+			return str->chars;
+		case M_STRING_TYPE_FLAT:
+		default:
+			return str->chars;
+		case M_STRING_TYPE_SLICE:
+			if (m_string_is_latin1(str))
+				return str->parent->lchars + str->offset;
+			else
+				return str->parent->chars + str->offset;
+	}
+}
+
+/**
+ * Get the characters buffer of a string not in Latin-1 storage.
+ * \param[in] str The string.
+ * \return The characters buffer.
+ */
+static inline const M_UChar*
+m_string_chars (M_String *str)
+{
+	assert(!m_string_is_latin1(str));
+
+	return (const M_UChar*)m_string_buffer(str);
+}
+
+/**
+ * Get the characters buffer of a string in Latin-1 storage.
+ * \param[in] str The string.
+ * \return The characters buffer.
+ */
+static inline const uint8_t*
+m_string_latin1_chars (M_String *str)
+{
+	assert(m_string_is_latin1(str));
+
+	return (const uint8_t*)m_string_buffer(str);
+}
+
+/**
+ * Get a character in the string.
+ * \param[in] str The string.
+ * \param pos The character's index.
+ * \return The character.
+ */
+static inline M_UChar
+m_string_char_at (M_String *str, size_t pos)
+{
+	const void *buf;
+
+	assert(str && (pos < str->len));
+
+	buf = m_string_buffer(str);
+
+	if (m_string_is_latin1(str))
+		return ((const uint8_t*)buf)[pos];
+	else
+		return ((const M_UChar*)buf)[pos];
+}
+
+/**
+ * Create a new flat string.
+ * If all the characters are in Latin-1 range, the string is stored as bytes.
+ * \param[in] chars The characters.
+ * \param len The length in characters.
+ * \return The new string.
+ */
+extern M_String* m_string_from_uchars (const M_UChar *chars, size_t len);
+
+/**
+ * Create a new flat string from a C string.
+ * Each byte in the C string is treated as a Latin-1 character.
+ * \param[in] cstr The C string.
+ * \return The new string.
+ */
+extern M_String* m_string_from_cstr (const char *cstr);
+
+/**
+ * Concatenate 2 strings.
+ * The characters are not copied, a rope node is created to reference
+ * the 2 parts unless the result is very short.
+ * \param[in] s1 The left part.
+ * \param[in] s2 The right part.
+ * \return The concatenation result.
+ */
+extern M_String* m_string_concat (M_String *s1, M_String *s2);
+
+/**
+ * Get a substring.
+ * The characters are not copied, a slice referencing the flat parent string
+ * is created unless the substring is very short.
+ * \param[in] str The string.
+ * \param start The start index of the substring.
+ * \param len The length of the substring.
+ * \return The substring.
+ */
+extern M_String* m_string_slice (M_String *str, size_t start, size_t len);
+
+/**
+ * Copy the characters of the string to a buffer.
+ * The string is not flattened, and Latin-1 characters are widened.
+ * \param[in] str The string.
+ * \param[out] buf The output buffer, its size must be \a str->len at least.
+ */
+extern void      m_string_get_uchars (M_String *str, M_UChar *buf);
+
+/**
+ * Check if 2 strings are equal.
+ * \param[in] s1 String 1.
+ * \param[in] s2 String 2.
+ * \retval M_TRUE The strings are equal.
+ * \retval M_FALSE The strings are not equal.
+ */
+extern M_Bool    m_string_equal (M_String *s1, M_String *s2);
+
+/**
+ * Compare 2 strings.
+ * \param[in] s1 String 1.
+ * \param[in] s2 String 2.
+ * \retval 0 s1 == s2.
+ * \retval <0 s1 < s2.
+ * \retval >0 s1 > s2.
+ */
+extern int       m_string_cmp (M_String *s1, M_String *s2);
+
+/**
+ * Calculate the hash key value of the string.
+ * \param[in] str The string.
+ * \return The key value.
+ */
+extern uint32_t  m_string_hash (M_String *str);
+
 #ifdef __cplusplus
 }
 #endif
@@ -32,14 +32,26 @@ extern "C" {
 
 /**Thread related data.*/
 struct M_Thread_s {
-	M_List     node;     /**< List node.*/
-	M_Actor   *actor;    /**< Current running actor in this thread.*/
-	uintptr_t *nb_stack; /**< New borned object stack.*/
-	uint32_t   nb_size;  /**< New borned object stack size.*/
-	uint32_t   nb_top;   /**< Top of the new borned object stack.*/
-	uint32_t   flags;    /**< The thread's flags.*/
+	M_List      node;     /**< List node.*/
+	M_Actor    *actor;    /**< Current running actor in this thread.*/
+	M_RunQueue *runq;     /**< Local run queue, NULL if not a worker.*/
+	uintptr_t  *nb_stack; /**< New borned object stack.*/
+	uint32_t    nb_size;  /**< New borned object stack size.*/
+	uint32_t    nb_top;   /**< Top of the new borned object stack.*/
+	uint32_t    flags;    /**< The thread's flags.*/
+	uint32_t    gc_claim; /**< A GC worker has claimed the new borned stack.*/
+	M_GCWorker *gc_worker;/**< GC worker data, NULL if never joined the GC.*/
 };
 
+/**
+ * Safe point polls load from a page protected while pausing. The SIGSEGV
+ * handler must redirect the faulting thread to a stub, which is only
+ * written for x86-64 Linux. Other systems poll the pause flag.
+ */
+#if defined(__x86_64__) && defined(__linux__)
+	#define M_THREAD_POLL_PAGE
+#endif
+
 /** \cond */
 #define M_GC_NBSTK_FLAGS  (M_GC_BUF_FL_PERMANENT | M_GC_BUF_FL_PTR)
 
@@ -48,10 +60,13 @@ extern pthread_key_t   m_thread_key;
 extern pthread_mutex_t m_thread_lock;
 extern uint32_t        m_thread_num;
 extern uint32_t        m_paused_thread_num;
+extern M_Bool          m_thread_pause_flag;
+extern volatile uint32_t *m_thread_poll_page;
 
 extern void m_thread_startup (void);
 extern void m_thread_shutdown (void);
 extern void m_thread_check_nl (void);
+extern void m_thread_wake_paused (uint32_t n);
 /** \endcond */
 
 /**
@@ -95,6 +110,23 @@ extern void  m_thread_enter (void);
  */
 extern void  m_thread_check (void);
 
+/**
+ * Safe point poll.
+ * It is only a load from the polling page. The page is protected when the
+ * threads are paused, so the load faults and the thread is paused after
+ * the SIGSEGV handler returns. Loops in the interpreter invoke it as a
+ * safe point.
+ */
+static inline void
+m_thread_poll (void)
+{
+#ifdef M_THREAD_POLL_PAGE
+	(void)*m_thread_poll_page;
+#else
+	m_thread_check();
+#endif
+}
+
 /**
  * Create a new thread to run actors.
  */
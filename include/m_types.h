@@ -62,20 +62,30 @@ typedef M_String*           M_Quark;
 typedef struct M_Array_s    M_Array;
 /**Object.*/
 typedef struct M_Object_s   M_Object;
+/**Object shape.*/
+typedef struct M_Shape_s    M_Shape;
 /**Function.*/
 typedef struct M_Function_s M_Function;
 /**Module.*/
 typedef struct M_Module_s   M_Module;
+/**Compiled machine code of a function.*/
+typedef struct M_JitCode_s  M_JitCode;
 /**Closure.*/
 typedef struct M_Closure_s  M_Closure;
 /**Value stack frame.*/
 typedef struct M_Frame_s    M_Frame;
+/**Box of a captured variable.*/
+typedef struct M_Box_s      M_Box;
 /**Actor.*/
 typedef struct M_Actor_s    M_Actor;
 /**General value.*/
 typedef uintptr_t           M_Value;
 /**Thread related data.*/
 typedef struct M_Thread_s   M_Thread;
+/**Actors run queue.*/
+typedef struct M_RunQueue_s M_RunQueue;
+/**Parallel GC worker.*/
+typedef struct M_GCWorker_s M_GCWorker;
 
 #ifdef __cplusplus
 }
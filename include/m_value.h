@@ -34,7 +34,7 @@ extern "C" {
 	#define M_VALUE_TRUE  0x7FFFFFFF
 	#define M_VALUE_FALSE 0x80000003
 	#define M_VALUE_INT_MAX 0x1FFFFFFE
-	#define M_VALUE_INT_MIN 0x20000001
+	#define M_VALUE_INT_MIN (-0x1FFFFFFE)
 #else  /*__SIZEOF_POINTER__ == 8*/
 	#define M_VALUE_TYPE_SHIFT 3
 	#define M_VALUE_DATA_MASK  0xFFFFFFFFFFFFFFF8l
@@ -246,7 +246,7 @@ m_value_get_int (M_Value v)
 {
 	assert(m_value_is_int(v));
 
-	return ((int32_t)v) >> M_VALUE_TYPE_SHIFT;
+	return (int)(((intptr_t)v) >> M_VALUE_TYPE_SHIFT);
 }
 
 /**
@@ -391,7 +391,7 @@ m_value_from_double (double d)
 
 	/*m_gc_add_obj(id);*/
 
-	return (M_Value)pd;
+	return ((M_Value)pd) | M_VALUE_TYPE_DOUBLE;
 }
 
 /**
@@ -402,13 +402,19 @@ m_value_from_double (double d)
 static inline M_Value
 m_value_from_number (double d)
 {
-	int i = (int)d;
+	int i;
 
-	if ((double)i == d) {
+	/*Converting an out of range number to int is undefined.*/
+	if ((d >= INT_MIN) && (d <= INT_MAX)) {
+		i = (int)d;
+
+		/*Keep negative zero as double.*/
+		if (((double)i == d) && (i || (1 / d > 0))) {
 #if __SIZEOF_POINTER__ == 4
-		if ((i >= M_VALUE_INT_MIN) && (i <= M_VALUE_INT_MAX));
+			if ((i >= M_VALUE_INT_MIN) && (i <= M_VALUE_INT_MAX))
 #endif
-		return m_value_from_int(i);
+				return m_value_from_int(i);
+		}
 	}
 
 	return m_value_from_double(d);
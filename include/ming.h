@@ -32,15 +32,33 @@ extern "C" {
 #include <m_malloc.h>
 #include <m_startup.h>
 #include <m_hash.h>
+#include <m_ohash.h>
 #include <m_rbtree.h>
+#include <m_btree.h>
 #include <m_list.h>
+#include <m_mpsc.h>
+#include <m_lfstack.h>
+#include <m_mpmc.h>
 #include <m_cmp.h>
 #include <m_atomic.h>
+#include <m_epoch.h>
+#include <m_chash.h>
 #include <m_value.h>
 #include <m_gc.h>
 #include <m_thread.h>
 #include <m_string.h>
 #include <m_array.h>
+#include <m_object.h>
+#include <m_ic.h>
+#include <m_function.h>
+#include <m_module.h>
+#include <m_frame.h>
+#include <m_closure.h>
+#include <m_share.h>
+#include <m_actor.h>
+#include <m_sched.h>
+#include <m_interp.h>
+#include <m_jit.h>
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,309 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "actor"
+
+#include <m_log.h>
+#include <m_malloc.h>
+#include <m_gc.h>
+#include <m_value.h>
+#include <m_function.h>
+#include <m_closure.h>
+#include <m_frame.h>
+#include <m_actor.h>
+#include <m_sched.h>
+#include <m_atomic.h>
+#include <m_share.h>
+
+/**All the actors, protected by m_gc_lock.*/
+M_List m_actor_list;
+
+void
+m_actor_startup (void)
+{
+	m_list_init(&m_actor_list);
+}
+
+void
+m_actor_shutdown (void)
+{
+}
+
+/**Free a value stack chunk.*/
+static void
+stack_chunk_free (M_StackChunk *chunk)
+{
+	m_gc_free_buf(chunk, chunk->size, M_GC_STACK_FLAGS);
+}
+
+/**Add a chunk having "size" bytes free on the top of the value stack.*/
+static M_StackChunk*
+stack_grow (M_Actor *actor, size_t size)
+{
+	M_StackChunk *chunk = actor->spare;
+
+	if (chunk && (chunk->end - chunk->top >= size)) {
+		actor->spare = NULL;
+	} else {
+		uint32_t csize;
+
+		csize = M_MAX(M_ACTOR_CHUNK_SIZE, sizeof(M_StackChunk) + size);
+
+		chunk = m_gc_alloc_buf(csize, M_GC_STACK_FLAGS);
+		m_assert_alloc(chunk);
+
+		chunk->size = csize;
+		chunk->top  = (uint8_t*)(chunk + 1);
+		chunk->end  = ((uint8_t*)chunk) + csize;
+	}
+
+	chunk->prev  = actor->chunk;
+	actor->chunk = chunk;
+
+	return chunk;
+}
+
+M_Stack*
+m_actor_push (M_Actor *actor, M_Closure *clos, uint16_t nv)
+{
+	M_StackChunk *chunk = actor->chunk;
+	M_Stack *rec;
+	M_Frame *frame;
+	size_t size;
+
+	size = sizeof(M_Stack) + sizeof(M_Frame) + sizeof(M_Value) * nv;
+
+	if (!chunk || (chunk->end - chunk->top < size))
+		chunk = stack_grow(actor, size);
+
+	rec   = (M_Stack*)chunk->top;
+	frame = (M_Frame*)(rec + 1);
+
+	chunk->top += size;
+
+	frame->flags   = M_FRAME_FL_IN_STACK;
+	frame->nv      = nv;
+	frame->v       = (M_Value*)(frame + 1);
+	frame->closure = clos;
+	frame->boxes   = NULL;
+
+	memset(frame->v, 0, sizeof(M_Value) * nv);
+
+	rec->bottom = NULL;
+	rec->frame  = frame;
+	rec->ip     = 0;
+	rec->sp     = 0;
+	rec->ret    = 0;
+
+	m_slist_push(&actor->stack, &rec->slist);
+
+	return rec;
+}
+
+void
+m_actor_pop (M_Actor *actor)
+{
+	M_StackChunk *chunk = actor->chunk;
+	M_SList *node;
+	M_Stack *rec;
+
+	node = m_slist_pop(&actor->stack);
+	assert(node);
+
+	rec = m_node_value(node, M_Stack, slist);
+
+	/*Move the boxed values out of the stack.*/
+	m_frame_close(rec->frame);
+
+	assert(((uint8_t*)rec >= (uint8_t*)(chunk + 1)) &&
+				((uint8_t*)rec < chunk->top));
+
+	chunk->top = (uint8_t*)rec;
+
+	if ((chunk->top == (uint8_t*)(chunk + 1)) && chunk->prev) {
+		actor->chunk = chunk->prev;
+
+		if (actor->spare)
+			stack_chunk_free(actor->spare);
+		actor->spare = chunk;
+	}
+}
+
+M_Actor*
+m_actor_new (void)
+{
+	M_Actor *actor;
+
+	actor = m_gc_alloc_buf(sizeof(M_Actor), M_GC_ACTOR_FLAGS);
+	m_assert_alloc(actor);
+
+	m_slist_init(&actor->stack);
+	actor->chunk = NULL;
+	actor->spare = NULL;
+	actor->retv  = 0;
+	actor->behav = 0;
+
+	actor->rq_next = NULL;
+
+	m_mpsc_init(&actor->mbox.queue);
+	m_slist_init(&actor->mbox.batch);
+	actor->mbox.sched = 0;
+
+	pthread_mutex_lock(&m_gc_lock);
+	m_list_append(&m_actor_list, &actor->node);
+	pthread_mutex_unlock(&m_gc_lock);
+
+	return actor;
+}
+
+void
+m_actor_free (M_Actor *actor)
+{
+	M_StackChunk *chunk, *prev;
+	M_SList *node;
+
+	assert(actor && !actor->mbox.sched);
+
+	pthread_mutex_lock(&m_gc_lock);
+	m_list_remove(&actor->node);
+	pthread_mutex_unlock(&m_gc_lock);
+
+	for (chunk = actor->chunk; chunk; chunk = prev) {
+		prev = chunk->prev;
+		stack_chunk_free(chunk);
+	}
+
+	if (actor->spare)
+		stack_chunk_free(actor->spare);
+
+	while ((node = m_slist_pop(&actor->mbox.batch)) ||
+				(node = m_mpsc_pop(&actor->mbox.queue)))
+		m_gc_free_buf(node, sizeof(M_Message), M_GC_MSG_FLAGS);
+
+	m_gc_free_buf(actor, sizeof(M_Actor), M_GC_ACTOR_FLAGS);
+}
+
+M_Result
+m_actor_call (M_Actor *actor, M_Value fv, uint32_t argc, const M_Value *argv)
+{
+	M_Closure *clos;
+	M_Function *func;
+	M_Stack *rec;
+	uint32_t i;
+
+	assert(actor && (!argc || argv));
+
+	if (!m_value_is_closure(fv))
+		return M_ERR_TYPE;
+
+	clos = m_value_get_closure(fv);
+	func = clos->func;
+
+	if (func->flags & M_FUNC_FL_NATIVE) {
+		actor->retv = 0;
+		func->f.native(0, argc, argv, 1, &actor->retv);
+		return M_NONE;
+	}
+
+	rec = m_actor_push(actor, clos, func->f.bc.nreg);
+	rec->bottom = rec;
+
+	argc = M_MIN(argc, func->f.bc.narg);
+	for (i = 0; i < argc; i ++)
+		rec->frame->v[i] = argv[i];
+
+	return M_OK;
+}
+
+M_Actor*
+m_actor_spawn (M_Value bv)
+{
+	M_Actor *actor;
+
+	assert(m_value_is_closure(bv));
+
+	actor = m_actor_new();
+	actor->behav = bv;
+
+	return actor;
+}
+
+void
+m_actor_send (M_Actor *actor, M_Value msg)
+{
+	M_Message *m;
+
+	assert(actor && actor->behav);
+
+	msg = m_value_share(msg);
+
+	m = m_gc_alloc_buf(sizeof(M_Message), M_GC_MSG_FLAGS);
+	m_assert_alloc(m);
+
+	m->v = msg;
+
+	m_mpsc_push(&actor->mbox.queue, &m->node);
+
+	/*
+	 * Only the sender changing the actor from idle to runnable schedules it.
+	 * The push is ordered before the load, as the actor clears "sched"
+	 * before checking the queue again.
+	 */
+	m_atomic_fence(M_ATOMIC_SEQ_CST);
+	if (!m_atomic_load_relaxed(&actor->mbox.sched) &&
+				m_atomic_int32_cas(&actor->mbox.sched, 0, 1))
+		m_sched_add(actor);
+}
+
+/**
+ * Get the next message from the mailbox.
+ * Only the thread running the actor invokes it.
+ * \retval M_OK Got a message.
+ * \retval M_NONE The mailbox is empty and the actor becomes idle.
+ * \retval M_FAILED A message is being sent, try again later.
+ */
+M_Result
+m_actor_fetch (M_Actor *actor, M_Value *msg)
+{
+	M_Mailbox *mb = &actor->mbox;
+	M_Message *m;
+
+	if (m_slist_empty(&mb->batch) &&
+				!m_mpsc_pop_batch(&mb->queue, &mb->batch, M_ACTOR_FETCH_BATCH)) {
+		if (!m_mpsc_empty(&mb->queue))
+			return M_FAILED;
+
+		m_atomic_store_relaxed(&mb->sched, 0);
+		m_atomic_fence(M_ATOMIC_SEQ_CST);
+
+		/*A message sent before the actor became idle did not wake it.*/
+		if (m_mpsc_empty(&mb->queue) ||
+					!m_atomic_int32_cas(&mb->sched, 0, 1))
+			return M_NONE;
+
+		return M_FAILED;
+	}
+
+	m = m_node_value(m_slist_pop(&mb->batch), M_Message, node);
+
+	*msg = m->v;
+	m_gc_free_buf(m, sizeof(M_Message), M_GC_MSG_FLAGS);
+
+	return M_OK;
+}
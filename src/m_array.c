@@ -0,0 +1,524 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "array"
+
+#include <math.h>
+#include <m_log.h>
+#include <m_malloc.h>
+#include <m_value.h>
+#include <m_array.h>
+
+/**Minimum capacity of the dense buffer.*/
+#define ARRAY_MIN_CAP 8
+
+static inline void*
+elem_get_key (const M_HashNode *node)
+{
+	return M_SIZE_TO_PTR(m_node_value(node, M_ArrayElem, node)->index);
+}
+
+static inline void
+elem_free_node (void *node)
+{
+	m_gc_free_buf(m_node_value(node, M_ArrayElem, node),
+				sizeof(M_ArrayElem), M_GC_ARRBUF_FLAGS);
+}
+
+static inline void*
+elem_alloc_buf (size_t size)
+{
+	return m_gc_alloc_buf(size, M_GC_ARRBUF_FLAGS);
+}
+
+static inline void
+elem_free_buf (void *ptr, size_t size)
+{
+	m_gc_free_buf(ptr, size, M_GC_ARRBUF_FLAGS);
+}
+
+/**Sparse elements hash table functions.*/
+static const M_HashOps
+elem_hash_ops = {
+get_key:   elem_get_key,
+kv:        m_int_hash_kv_func,
+equal:     m_int_hash_equal_func,
+free_node: elem_free_node,
+alloc_buf: elem_alloc_buf,
+free_buf:  elem_free_buf
+};
+
+/**Get the element size of the dense kind.*/
+static inline size_t
+kind_elem_size (M_ArrayKind kind)
+{
+	switch (kind) {
+		case M_ARRAY_KIND_SMI:
+			return sizeof(int32_t);
+		case M_ARRAY_KIND_DOUBLE:
+			return sizeof(double);
+		default:
+			return sizeof(M_Value);
+	}
+}
+
+/**Check if the double number can be stored as a small integer.*/
+static inline M_Bool
+double_to_smi (double d, int32_t *pi)
+{
+	int32_t i;
+
+	if (!((d >= INT32_MIN) && (d <= INT32_MAX)))
+		return M_FALSE;
+
+	i = (int32_t)d;
+	if ((double)i != d)
+		return M_FALSE;
+
+	if ((i == 0) && signbit(d))
+		return M_FALSE;
+
+	*pi = i;
+	return M_TRUE;
+}
+
+/**Get the most specific kind can store the value.*/
+static inline M_ArrayKind
+value_kind (M_Value v)
+{
+	int32_t i;
+
+	if (m_value_is_int(v))
+		return M_ARRAY_KIND_SMI;
+
+	if (m_value_is_double(v))
+		return double_to_smi(m_value_get_double(v), &i) ?
+					M_ARRAY_KIND_SMI : M_ARRAY_KIND_DOUBLE;
+
+	return M_ARRAY_KIND_VALUE;
+}
+
+/**Make sure the dense buffer can store n elements.*/
+static void
+array_reserve (M_Array *arr, uint32_t n)
+{
+	size_t esize;
+	uint32_t ncap;
+	void *buf;
+
+	if (n <= arr->cap)
+		return;
+
+	ncap = M_MAX(arr->cap * 2, ARRAY_MIN_CAP);
+	while (ncap < n)
+		ncap *= 2;
+
+	esize = kind_elem_size(arr->kind);
+	buf   = m_gc_realloc_buf(arr->e.values, esize * arr->cap, esize * ncap,
+				M_GC_ARRBUF_FLAGS);
+	m_assert_alloc(buf);
+
+	arr->e.values = buf;
+	arr->cap      = ncap;
+}
+
+/**Widen the dense array's element kind.*/
+static void
+array_to_kind (M_Array *arr, M_ArrayKind kind)
+{
+	void *buf = NULL;
+	uint32_t i;
+
+	assert(kind > arr->kind);
+
+	if (arr->cap) {
+		buf = m_gc_alloc_buf(kind_elem_size(kind) * arr->cap,
+					M_GC_ARRBUF_FLAGS);
+		m_assert_alloc(buf);
+	}
+
+	if (kind == M_ARRAY_KIND_DOUBLE) {
+		double *d = buf;
+
+		for (i = 0; i < arr->len; i ++)
+			d[i] = arr->e.ints[i];
+	} else if (arr->kind == M_ARRAY_KIND_SMI) {
+		M_Value *v = buf;
+
+		for (i = 0; i < arr->len; i ++)
+			v[i] = m_value_from_int(arr->e.ints[i]);
+	} else {
+		M_Value *v = buf;
+
+		/*The boxed numbers stay in the new borned stack until the
+		 *array's kind is changed.*/
+		for (i = 0; i < arr->len; i ++)
+			v[i] = m_value_from_number(arr->e.doubles[i]);
+	}
+
+	if (arr->cap)
+		m_gc_free_buf(arr->e.values, kind_elem_size(arr->kind) * arr->cap,
+					M_GC_ARRBUF_FLAGS);
+
+	M_DEBUG("array %p changed from kind %d to %d", arr, arr->kind, kind);
+
+	arr->e.values = buf;
+	arr->kind     = kind;
+}
+
+/**Change the array to sparse storage.*/
+static void
+array_to_sparse (M_Array *arr)
+{
+	M_Value *values;
+	M_ArrayElem *elem;
+	uint32_t i;
+
+	if (arr->kind != M_ARRAY_KIND_VALUE)
+		array_to_kind(arr, M_ARRAY_KIND_VALUE);
+
+	values = arr->e.values;
+
+	m_hash_init(&arr->e.hash);
+	arr->kind = M_ARRAY_KIND_SPARSE;
+
+	for (i = 0; i < arr->len; i ++) {
+		elem = m_gc_alloc_buf(sizeof(M_ArrayElem), M_GC_ARRBUF_FLAGS);
+		m_assert_alloc(elem);
+
+		elem->index = i;
+		elem->v     = values[i];
+
+		if (m_hash_resize_incr(&arr->e.hash, &elem_hash_ops) != M_OK)
+			m_assert_alloc(NULL);
+
+		m_hash_insert(&arr->e.hash, &elem->node, &elem_hash_ops);
+	}
+
+	if (arr->cap)
+		m_gc_free_buf(values, sizeof(M_Value) * arr->cap, M_GC_ARRBUF_FLAGS);
+
+	arr->cap = 0;
+
+	M_DEBUG("array %p changed to sparse", arr);
+}
+
+/**Pack the sparse array without holes to the most specific dense kind.*/
+static void
+array_from_sparse (M_Array *arr)
+{
+	M_ArrayKind kind = M_ARRAY_KIND_SMI;
+	M_ArrayElem *elem;
+	uint32_t pos;
+	void *buf = NULL;
+
+	assert(arr->e.hash.size == arr->len);
+
+	m_hash_foreach_value(elem, pos, &arr->e.hash, node) {
+		kind = M_MAX(kind, value_kind(elem->v));
+	}
+
+	/*The array is still sparse if the allocation runs GC.*/
+	if (arr->len) {
+		buf = m_gc_alloc_buf(kind_elem_size(kind) * arr->len,
+					M_GC_ARRBUF_FLAGS);
+		m_assert_alloc(buf);
+	}
+
+	m_hash_foreach_value(elem, pos, &arr->e.hash, node) {
+		M_Value v = elem->v;
+
+		switch (kind) {
+			case M_ARRAY_KIND_SMI:
+				((int32_t*)buf)[elem->index] = m_value_is_int(v) ?
+						m_value_get_int(v) :
+						(int32_t)m_value_get_double(v);
+				break;
+			case M_ARRAY_KIND_DOUBLE:
+				((double*)buf)[elem->index] = m_value_get_number(v);
+				break;
+			default:
+				((M_Value*)buf)[elem->index] = v;
+				break;
+		}
+	}
+
+	m_hash_deinit(&arr->e.hash, &elem_hash_ops);
+
+	arr->e.values = buf;
+	arr->cap      = arr->len;
+	arr->kind     = kind;
+
+	M_DEBUG("array %p packed to kind %d", arr, kind);
+}
+
+/**Lookup an element of the sparse array.*/
+static inline M_ArrayElem*
+sparse_lookup (M_Array *arr, uint32_t idx)
+{
+	M_HashNode *node;
+
+	node = m_hash_lookup(&arr->e.hash, M_SIZE_TO_PTR(idx), &elem_hash_ops);
+
+	return m_node_value(node, M_ArrayElem, node);
+}
+
+/**Set an element of the sparse array.*/
+static void
+sparse_set (M_Array *arr, uint32_t idx, M_Value v)
+{
+	M_ArrayElem *elem;
+
+	elem = sparse_lookup(arr, idx);
+	if (!elem) {
+		elem = m_gc_alloc_buf(sizeof(M_ArrayElem), M_GC_ARRBUF_FLAGS);
+		m_assert_alloc(elem);
+
+		elem->index = idx;
+
+		if (m_hash_resize_incr(&arr->e.hash, &elem_hash_ops) != M_OK)
+			m_assert_alloc(NULL);
+
+		m_hash_insert(&arr->e.hash, &elem->node, &elem_hash_ops);
+	}
+
+	elem->v = v;
+
+	if (idx >= arr->len)
+		arr->len = idx + 1;
+
+	if (arr->e.hash.size == arr->len)
+		array_from_sparse(arr);
+}
+
+/**
+ * Prepare the dense buffer to store an element of the kind.
+ * Return M_FALSE if the array is sparse.
+ */
+static M_Bool
+array_prepare (M_Array *arr, uint32_t idx, M_ArrayKind kind)
+{
+	if (arr->kind == M_ARRAY_KIND_SPARSE)
+		return M_FALSE;
+
+	if (idx > arr->len) {
+		array_to_sparse(arr);
+		return M_FALSE;
+	}
+
+	if (kind > arr->kind)
+		array_to_kind(arr, kind);
+
+	if (idx == arr->len) {
+		array_reserve(arr, idx + 1);
+		arr->len ++;
+	}
+
+	return M_TRUE;
+}
+
+M_Array*
+m_array_new (uint32_t cap)
+{
+	M_Array *arr;
+	size_t id;
+
+	arr = m_gc_alloc_obj(M_GC_OBJ_ARRAY, &id);
+	m_assert_alloc(arr);
+
+	arr->e.values = NULL;
+	arr->len      = 0;
+	arr->cap      = 0;
+	arr->kind     = M_ARRAY_KIND_SMI;
+	arr->flags    = 0;
+
+	m_gc_add_obj(id);
+
+	array_reserve(arr, cap);
+
+	return arr;
+}
+
+void
+m_array_release (M_Array *arr)
+{
+	assert(arr);
+
+	if (arr->kind == M_ARRAY_KIND_SPARSE)
+		m_hash_deinit(&arr->e.hash, &elem_hash_ops);
+	else if (arr->cap)
+		m_gc_free_buf(arr->e.values, kind_elem_size(arr->kind) * arr->cap,
+					M_GC_ARRBUF_FLAGS);
+}
+
+M_Bool
+m_array_get (M_Array *arr, uint32_t idx, M_Value *pv)
+{
+	M_ArrayElem *elem;
+
+	assert(arr && pv);
+
+	if (idx >= arr->len)
+		return M_FALSE;
+
+	switch (arr->kind) {
+		case M_ARRAY_KIND_SMI:
+			*pv = m_value_from_int(arr->e.ints[idx]);
+			break;
+		case M_ARRAY_KIND_DOUBLE:
+			*pv = m_value_from_number(arr->e.doubles[idx]);
+			break;
+		case M_ARRAY_KIND_VALUE:
+			*pv = arr->e.values[idx];
+			break;
+		default:
+			elem = sparse_lookup(arr, idx);
+			if (!elem)
+				return M_FALSE;
+
+			*pv = elem->v;
+			break;
+	}
+
+	return M_TRUE;
+}
+
+M_Bool
+m_array_get_number (M_Array *arr, uint32_t idx, double *pd)
+{
+	M_Value v;
+
+	assert(arr && pd);
+
+	if (idx >= arr->len)
+		return M_FALSE;
+
+	switch (arr->kind) {
+		case M_ARRAY_KIND_SMI:
+			*pd = arr->e.ints[idx];
+			return M_TRUE;
+		case M_ARRAY_KIND_DOUBLE:
+			*pd = arr->e.doubles[idx];
+			return M_TRUE;
+		default:
+			if (!m_array_get(arr, idx, &v) || !m_value_is_number(v))
+				return M_FALSE;
+
+			*pd = m_value_get_number(v);
+			return M_TRUE;
+	}
+}
+
+M_Result
+m_array_set (M_Array *arr, uint32_t idx, M_Value v)
+{
+	M_ArrayKind kind;
+
+	assert(arr);
+
+	if ((arr->flags & M_ARRAY_FL_FROZEN) || (idx == M_ARRAY_MAX_LEN))
+		return M_FAILED;
+
+	kind = value_kind(v);
+
+	if (!array_prepare(arr, idx, kind)) {
+		sparse_set(arr, idx, v);
+		return M_OK;
+	}
+
+	switch (arr->kind) {
+		case M_ARRAY_KIND_SMI:
+			if (m_value_is_int(v))
+				arr->e.ints[idx] = m_value_get_int(v);
+			else
+				arr->e.ints[idx] = (int32_t)m_value_get_double(v);
+			break;
+		case M_ARRAY_KIND_DOUBLE:
+			arr->e.doubles[idx] = m_value_get_number(v);
+			break;
+		default:
+			arr->e.values[idx] = v;
+			break;
+	}
+
+	return M_OK;
+}
+
+M_Result
+m_array_set_number (M_Array *arr, uint32_t idx, double d)
+{
+	int32_t i;
+
+	assert(arr);
+
+	if ((arr->flags & M_ARRAY_FL_FROZEN) || (idx == M_ARRAY_MAX_LEN))
+		return M_FAILED;
+
+	if (arr->kind >= M_ARRAY_KIND_VALUE)
+		return m_array_set(arr, idx, m_value_from_number(d));
+
+	if (double_to_smi(d, &i)) {
+		if (!array_prepare(arr, idx, M_ARRAY_KIND_SMI)) {
+			sparse_set(arr, idx, m_value_from_number(d));
+		} else if (arr->kind == M_ARRAY_KIND_SMI) {
+			arr->e.ints[idx] = i;
+		} else {
+			arr->e.doubles[idx] = d;
+		}
+	} else {
+		if (!array_prepare(arr, idx, M_ARRAY_KIND_DOUBLE))
+			sparse_set(arr, idx, m_value_from_number(d));
+		else
+			arr->e.doubles[idx] = d;
+	}
+
+	return M_OK;
+}
+
+M_Result
+m_array_set_length (M_Array *arr, uint32_t len)
+{
+	M_ArrayElem *elem, *nelem;
+	uint32_t pos;
+
+	assert(arr);
+
+	if (arr->flags & M_ARRAY_FL_FROZEN)
+		return M_FAILED;
+
+	if (len > arr->len) {
+		if (arr->kind != M_ARRAY_KIND_SPARSE)
+			array_to_sparse(arr);
+	} else if (arr->kind == M_ARRAY_KIND_SPARSE) {
+		m_hash_foreach_value_safe(elem, nelem, pos, &arr->e.hash, node) {
+			if (elem->index >= len) {
+				m_hash_remove(&arr->e.hash, M_SIZE_TO_PTR(elem->index),
+							&elem_hash_ops);
+				elem_free_node(&elem->node);
+			}
+		}
+	}
+
+	arr->len = len;
+
+	if ((arr->kind == M_ARRAY_KIND_SPARSE) && (arr->e.hash.size == len))
+		array_from_sparse(arr);
+
+	return M_OK;
+}
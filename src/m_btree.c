@@ -0,0 +1,652 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "btree"
+
+#include <m_log.h>
+#include <m_malloc.h>
+#include <m_btree.h>
+
+/**Minimum keys count of a non-root leaf.*/
+#define BTREE_MIN_LEAF  (M_BTREE_ORDER / 2)
+/**Minimum keys count of a non-root internal node.*/
+#define BTREE_MIN_INNER (M_BTREE_ORDER / 2 - 1)
+
+/**Fill the unused keys with the maximum value.*/
+static inline void
+node_pad (M_BTreeNode *node)
+{
+	uint32_t i;
+
+	for (i = node->n; i < M_BTREE_ORDER; i ++)
+		node->keys[i] = UINT64_MAX;
+}
+
+static M_BTreeLeaf*
+leaf_new (void)
+{
+	M_BTreeLeaf *leaf = m_malloc(sizeof(M_BTreeLeaf));
+
+	if (!leaf)
+		return NULL;
+
+	leaf->node.n    = 0;
+	leaf->node.leaf = M_TRUE;
+	leaf->next      = NULL;
+	node_pad(&leaf->node);
+
+	return leaf;
+}
+
+static M_BTreeInner*
+inner_new (void)
+{
+	M_BTreeInner *inner = m_malloc(sizeof(M_BTreeInner));
+
+	if (!inner)
+		return NULL;
+
+	inner->node.n    = 0;
+	inner->node.leaf = M_FALSE;
+	node_pad(&inner->node);
+
+	return inner;
+}
+
+/**Free all the nodes in the subtree without recursion.*/
+static void
+nodes_free (M_BTreeNode *root, void (*free_value)(void *value))
+{
+	M_BTreeNode *stack[M_BTREE_MAX_HEIGHT * (M_BTREE_ORDER + 1)];
+	uint32_t top = 0, i;
+
+	stack[top ++] = root;
+
+	while (top) {
+		M_BTreeNode *node = stack[-- top];
+
+		if (node->leaf) {
+			M_BTreeLeaf *leaf = (M_BTreeLeaf*)node;
+
+			if (free_value) {
+				for (i = 0; i < node->n; i ++)
+					free_value(leaf->values[i]);
+			}
+		} else {
+			M_BTreeInner *inner = (M_BTreeInner*)node;
+
+			for (i = 0; i <= node->n; i ++)
+				stack[top ++] = inner->children[i];
+		}
+
+		m_free(node);
+	}
+}
+
+static inline void
+leaf_insert_at (M_BTreeLeaf *leaf, uint32_t pos, M_BTreeKey key,
+			void *value)
+{
+	uint32_t n = leaf->node.n;
+
+	memmove(leaf->node.keys + pos + 1, leaf->node.keys + pos,
+				sizeof(M_BTreeKey) * (n - pos));
+	memmove(leaf->values + pos + 1, leaf->values + pos,
+				sizeof(void*) * (n - pos));
+
+	leaf->node.keys[pos] = key;
+	leaf->values[pos]    = value;
+	leaf->node.n ++;
+}
+
+static inline void
+leaf_remove_at (M_BTreeLeaf *leaf, uint32_t pos)
+{
+	uint32_t n = leaf->node.n;
+
+	memmove(leaf->node.keys + pos, leaf->node.keys + pos + 1,
+				sizeof(M_BTreeKey) * (n - pos - 1));
+	memmove(leaf->values + pos, leaf->values + pos + 1,
+				sizeof(void*) * (n - pos - 1));
+
+	leaf->node.n --;
+	leaf->node.keys[leaf->node.n] = UINT64_MAX;
+}
+
+/**Insert a key and its right child at the position.*/
+static inline void
+inner_insert_at (M_BTreeInner *inner, uint32_t pos, M_BTreeKey key,
+			M_BTreeNode *child)
+{
+	uint32_t n = inner->node.n;
+
+	memmove(inner->node.keys + pos + 1, inner->node.keys + pos,
+				sizeof(M_BTreeKey) * (n - pos));
+	memmove(inner->children + pos + 2, inner->children + pos + 1,
+				sizeof(M_BTreeNode*) * (n - pos));
+
+	inner->node.keys[pos]   = key;
+	inner->children[pos + 1] = child;
+	inner->node.n ++;
+}
+
+/**Remove a key and its right child at the position.*/
+static inline void
+inner_remove_at (M_BTreeInner *inner, uint32_t pos)
+{
+	uint32_t n = inner->node.n;
+
+	memmove(inner->node.keys + pos, inner->node.keys + pos + 1,
+				sizeof(M_BTreeKey) * (n - pos - 1));
+	memmove(inner->children + pos + 1, inner->children + pos + 2,
+				sizeof(M_BTreeNode*) * (n - pos - 1));
+
+	inner->node.n --;
+	inner->node.keys[inner->node.n] = UINT64_MAX;
+}
+
+/**Split a full leaf and insert the entry, "right" gets the upper half.*/
+static void
+leaf_split (M_BTreeLeaf *leaf, M_BTreeLeaf *right, uint32_t pos,
+			M_BTreeKey key, void *value)
+{
+	M_BTreeKey keys[M_BTREE_ORDER + 1];
+	void *values[M_BTREE_ORDER + 1];
+	uint32_t nleft = (M_BTREE_ORDER + 1) / 2;
+	uint32_t nright = M_BTREE_ORDER + 1 - nleft;
+
+	memcpy(keys, leaf->node.keys, sizeof(M_BTreeKey) * pos);
+	memcpy(values, leaf->values, sizeof(void*) * pos);
+	keys[pos]   = key;
+	values[pos] = value;
+	memcpy(keys + pos + 1, leaf->node.keys + pos,
+				sizeof(M_BTreeKey) * (M_BTREE_ORDER - pos));
+	memcpy(values + pos + 1, leaf->values + pos,
+				sizeof(void*) * (M_BTREE_ORDER - pos));
+
+	memcpy(leaf->node.keys, keys, sizeof(M_BTreeKey) * nleft);
+	memcpy(leaf->values, values, sizeof(void*) * nleft);
+	leaf->node.n = nleft;
+	node_pad(&leaf->node);
+
+	memcpy(right->node.keys, keys + nleft, sizeof(M_BTreeKey) * nright);
+	memcpy(right->values, values + nleft, sizeof(void*) * nright);
+	right->node.n = nright;
+	node_pad(&right->node);
+
+	right->next = leaf->next;
+	leaf->next  = right;
+}
+
+/**
+ * Split a full internal node and insert the key and its right child.
+ * "right" gets the upper half, and the middle key is stored in "up".
+ */
+static void
+inner_split (M_BTreeInner *inner, M_BTreeInner *right, uint32_t pos,
+			M_BTreeKey key, M_BTreeNode *child, M_BTreeKey *up)
+{
+	M_BTreeKey keys[M_BTREE_ORDER + 1];
+	M_BTreeNode *children[M_BTREE_ORDER + 2];
+	uint32_t mid = (M_BTREE_ORDER + 1) / 2;
+	uint32_t nright = M_BTREE_ORDER - mid;
+
+	memcpy(keys, inner->node.keys, sizeof(M_BTreeKey) * pos);
+	keys[pos] = key;
+	memcpy(keys + pos + 1, inner->node.keys + pos,
+				sizeof(M_BTreeKey) * (M_BTREE_ORDER - pos));
+
+	memcpy(children, inner->children, sizeof(M_BTreeNode*) * (pos + 1));
+	children[pos + 1] = child;
+	memcpy(children + pos + 2, inner->children + pos + 1,
+				sizeof(M_BTreeNode*) * (M_BTREE_ORDER - pos));
+
+	memcpy(inner->node.keys, keys, sizeof(M_BTreeKey) * mid);
+	memcpy(inner->children, children, sizeof(M_BTreeNode*) * (mid + 1));
+	inner->node.n = mid;
+	node_pad(&inner->node);
+
+	*up = keys[mid];
+
+	memcpy(right->node.keys, keys + mid + 1, sizeof(M_BTreeKey) * nright);
+	memcpy(right->children, children + mid + 1,
+				sizeof(M_BTreeNode*) * (nright + 1));
+	right->node.n = nright;
+	node_pad(&right->node);
+}
+
+/**
+ * Refill the underflowed leaf "parent->children[i]" from a sibling.
+ * Return M_TRUE if it is merged and the parent lost a key.
+ */
+static M_Bool
+leaf_rebalance (M_BTreeInner *parent, uint32_t i)
+{
+	M_BTreeLeaf *leaf  = (M_BTreeLeaf*)parent->children[i];
+	M_BTreeLeaf *left  = i ? (M_BTreeLeaf*)parent->children[i - 1] : NULL;
+	M_BTreeLeaf *right = (i < parent->node.n) ?
+				(M_BTreeLeaf*)parent->children[i + 1] : NULL;
+
+	if (left && (left->node.n > BTREE_MIN_LEAF)) {
+		uint32_t ln = left->node.n - 1;
+
+		leaf_insert_at(leaf, 0, left->node.keys[ln], left->values[ln]);
+		leaf_remove_at(left, ln);
+
+		parent->node.keys[i - 1] = leaf->node.keys[0];
+		return M_FALSE;
+	}
+
+	if (right && (right->node.n > BTREE_MIN_LEAF)) {
+		leaf_insert_at(leaf, leaf->node.n, right->node.keys[0],
+					right->values[0]);
+		leaf_remove_at(right, 0);
+
+		parent->node.keys[i] = right->node.keys[0];
+		return M_FALSE;
+	}
+
+	/*Merge the right one of the 2 leaves into the left one.*/
+	if (left) {
+		right = leaf;
+		leaf  = left;
+		i --;
+	}
+
+	memcpy(leaf->node.keys + leaf->node.n, right->node.keys,
+				sizeof(M_BTreeKey) * right->node.n);
+	memcpy(leaf->values + leaf->node.n, right->values,
+				sizeof(void*) * right->node.n);
+	leaf->node.n += right->node.n;
+	leaf->next = right->next;
+
+	m_free(right);
+	inner_remove_at(parent, i);
+
+	return M_TRUE;
+}
+
+/**
+ * Refill the underflowed internal node "parent->children[i]" from
+ * a sibling.
+ * Return M_TRUE if it is merged and the parent lost a key.
+ */
+static M_Bool
+inner_rebalance (M_BTreeInner *parent, uint32_t i)
+{
+	M_BTreeInner *inner = (M_BTreeInner*)parent->children[i];
+	M_BTreeInner *left  = i ? (M_BTreeInner*)parent->children[i - 1] : NULL;
+	M_BTreeInner *right = (i < parent->node.n) ?
+				(M_BTreeInner*)parent->children[i + 1] : NULL;
+	uint32_t n = inner->node.n;
+
+	if (left && (left->node.n > BTREE_MIN_INNER)) {
+		uint32_t ln = left->node.n;
+
+		memmove(inner->node.keys + 1, inner->node.keys,
+					sizeof(M_BTreeKey) * n);
+		memmove(inner->children + 1, inner->children,
+					sizeof(M_BTreeNode*) * (n + 1));
+
+		inner->node.keys[0] = parent->node.keys[i - 1];
+		inner->children[0]  = left->children[ln];
+		inner->node.n ++;
+
+		parent->node.keys[i - 1] = left->node.keys[ln - 1];
+
+		left->node.n --;
+		left->node.keys[left->node.n] = UINT64_MAX;
+		return M_FALSE;
+	}
+
+	if (right && (right->node.n > BTREE_MIN_INNER)) {
+		uint32_t rn = right->node.n;
+
+		inner->node.keys[n]     = parent->node.keys[i];
+		inner->children[n + 1]  = right->children[0];
+		inner->node.n ++;
+
+		parent->node.keys[i] = right->node.keys[0];
+
+		memmove(right->node.keys, right->node.keys + 1,
+					sizeof(M_BTreeKey) * (rn - 1));
+		memmove(right->children, right->children + 1,
+					sizeof(M_BTreeNode*) * rn);
+
+		right->node.n --;
+		right->node.keys[right->node.n] = UINT64_MAX;
+		return M_FALSE;
+	}
+
+	/*Merge the right one of the 2 nodes and the separator into the left.*/
+	if (left) {
+		right = inner;
+		inner = left;
+		i --;
+	}
+
+	n = inner->node.n;
+
+	inner->node.keys[n] = parent->node.keys[i];
+	memcpy(inner->node.keys + n + 1, right->node.keys,
+				sizeof(M_BTreeKey) * right->node.n);
+	memcpy(inner->children + n + 1, right->children,
+				sizeof(M_BTreeNode*) * (right->node.n + 1));
+	inner->node.n += right->node.n + 1;
+
+	m_free(right);
+	inner_remove_at(parent, i);
+
+	return M_TRUE;
+}
+
+void
+m_btree_deinit (M_BTree *tree, void (*free_value)(void *value))
+{
+	assert(tree);
+
+	if (tree->root)
+		nodes_free(tree->root, free_value);
+}
+
+M_Result
+m_btree_insert (M_BTree *tree, M_BTreeKey key, void *value)
+{
+	M_BTreeInner *path[M_BTREE_MAX_HEIGHT];
+	M_BTreeInner *inners[M_BTREE_MAX_HEIGHT];
+	uint32_t idx[M_BTREE_MAX_HEIGHT];
+	M_BTreeNode *node, *right;
+	M_BTreeLeaf *leaf, *nleaf;
+	M_BTreeInner *root;
+	M_BTreeKey up;
+	uint32_t depth = 0, pos, ninner, i, j;
+
+	assert(tree);
+
+	if (!tree->root) {
+		leaf = leaf_new();
+		if (!leaf)
+			return M_ERR_NO_MEM;
+
+		tree->root   = &leaf->node;
+		tree->first  = leaf;
+		tree->height = 1;
+	}
+
+	node = tree->root;
+	while (!node->leaf) {
+		i = m_btree_child_index(node, key);
+
+		path[depth] = (M_BTreeInner*)node;
+		idx[depth]  = i;
+		depth ++;
+
+		node = path[depth - 1]->children[i];
+	}
+
+	leaf = (M_BTreeLeaf*)node;
+	pos  = m_btree_count_less(node, key);
+
+	if ((pos < node->n) && (node->keys[pos] == key))
+		return M_NONE;
+
+	if (node->n < M_BTREE_ORDER) {
+		leaf_insert_at(leaf, pos, key, value);
+		tree->size ++;
+		return M_OK;
+	}
+
+	/*Allocate all the nodes of the splits first, so a failure changes nothing.*/
+	ninner = 0;
+	for (i = depth; i && (path[i - 1]->node.n == M_BTREE_ORDER); i --)
+		ninner ++;
+	if (!i)
+		ninner ++;
+
+	assert(tree->height + (i ? 0 : 1) <= M_BTREE_MAX_HEIGHT);
+
+	nleaf = leaf_new();
+	if (!nleaf)
+		return M_ERR_NO_MEM;
+
+	for (j = 0; j < ninner; j ++) {
+		inners[j] = inner_new();
+		if (!inners[j]) {
+			while (j --)
+				m_free(inners[j]);
+			m_free(nleaf);
+			return M_ERR_NO_MEM;
+		}
+	}
+
+	leaf_split(leaf, nleaf, pos, key, value);
+
+	up    = nleaf->node.keys[0];
+	right = &nleaf->node;
+	j     = 0;
+
+	while (depth) {
+		M_BTreeInner *parent = path[depth - 1];
+
+		i = idx[depth - 1];
+
+		if (parent->node.n < M_BTREE_ORDER) {
+			inner_insert_at(parent, i, up, right);
+			goto end;
+		}
+
+		inner_split(parent, inners[j], i, up, right, &up);
+		right = &inners[j ++]->node;
+		depth --;
+	}
+
+	/*Grow a new root.*/
+	root = inners[j];
+	root->node.n       = 1;
+	root->node.keys[0] = up;
+	root->children[0]  = tree->root;
+	root->children[1]  = right;
+
+	tree->root = &root->node;
+	tree->height ++;
+end:
+	tree->size ++;
+	return M_OK;
+}
+
+M_Result
+m_btree_remove (M_BTree *tree, M_BTreeKey key, void **pvalue)
+{
+	M_BTreeInner *path[M_BTREE_MAX_HEIGHT];
+	uint32_t idx[M_BTREE_MAX_HEIGHT];
+	M_BTreeNode *node;
+	M_BTreeLeaf *leaf;
+	uint32_t depth = 0, pos, i;
+	M_Bool merged;
+
+	assert(tree);
+
+	if (!tree->size)
+		return M_NONE;
+
+	node = tree->root;
+	while (!node->leaf) {
+		i = m_btree_child_index(node, key);
+
+		path[depth] = (M_BTreeInner*)node;
+		idx[depth]  = i;
+		depth ++;
+
+		node = path[depth - 1]->children[i];
+	}
+
+	leaf = (M_BTreeLeaf*)node;
+	pos  = m_btree_count_less(node, key);
+
+	if ((pos >= node->n) || (node->keys[pos] != key))
+		return M_NONE;
+
+	if (pvalue)
+		*pvalue = leaf->values[pos];
+
+	leaf_remove_at(leaf, pos);
+	tree->size --;
+
+	if (!depth || (node->n >= BTREE_MIN_LEAF))
+		return M_OK;
+
+	/*
+	 * The separators need no update when a leaf's first key is removed,
+	 * they are still between the keys of their 2 children.
+	 */
+	merged = leaf_rebalance(path[depth - 1], idx[depth - 1]);
+	depth --;
+
+	while (merged) {
+		M_BTreeInner *inner = path[depth];
+
+		if (!depth) {
+			/*Shrink the root.*/
+			if (!inner->node.n) {
+				tree->root = inner->children[0];
+				tree->height --;
+				m_free(inner);
+			}
+			break;
+		}
+
+		if (inner->node.n >= BTREE_MIN_INNER)
+			break;
+
+		merged = inner_rebalance(path[depth - 1], idx[depth - 1]);
+		depth --;
+	}
+
+	return M_OK;
+}
+
+M_Result
+m_btree_build (M_BTree *tree, const M_BTreeKey *keys, void * const *values,
+			size_t n)
+{
+	M_BTreeNode **nodes;
+	M_BTreeKey *mins;
+	M_BTreeLeaf *leaf, *prev = NULL;
+	size_t nnode, level, g, pos, i;
+	uint32_t height = 1;
+
+	assert(tree && !tree->size && (keys || !n));
+
+	if (!n)
+		return M_OK;
+
+	nnode = (n + M_BTREE_ORDER - 1) / M_BTREE_ORDER;
+	nodes = m_malloc(sizeof(M_BTreeNode*) * nnode);
+	mins  = m_malloc(sizeof(M_BTreeKey) * nnode);
+	if (!nodes || !mins)
+		goto nomem;
+
+	/*Spread the entries evenly, so every leaf has at least half of them.*/
+	for (g = 0, pos = 0; g < nnode; g ++) {
+		uint32_t cnt = n / nnode + ((g < n % nnode) ? 1 : 0);
+
+		leaf = leaf_new();
+		if (!leaf) {
+			nnode = g;
+			level = g;
+			pos   = g;
+			goto fail;
+		}
+
+		for (i = 0; i < cnt; i ++, pos ++) {
+			assert(!pos || (keys[pos - 1] < keys[pos]));
+
+			leaf->node.keys[i] = keys[pos];
+			leaf->values[i]    = values ? values[pos] : NULL;
+		}
+
+		leaf->node.n = cnt;
+
+		if (prev)
+			prev->next = leaf;
+		prev = leaf;
+
+		nodes[g] = &leaf->node;
+		mins[g]  = leaf->node.keys[0];
+	}
+
+	/*Build the internal levels from the bottom.*/
+	level = nnode;
+	while (level > 1) {
+		size_t nin = (level + M_BTREE_ORDER) / (M_BTREE_ORDER + 1);
+
+		for (g = 0, pos = 0; g < nin; g ++) {
+			uint32_t cnt = level / nin + ((g < level % nin) ? 1 : 0);
+			M_BTreeInner *inner = inner_new();
+			M_BTreeKey min = mins[pos];
+
+			if (!inner) {
+				nnode = g;
+				goto fail;
+			}
+
+			for (i = 0; i < cnt; i ++, pos ++) {
+				inner->children[i] = nodes[pos];
+				if (i)
+					inner->node.keys[i - 1] = mins[pos];
+			}
+
+			inner->node.n = cnt - 1;
+
+			/*The consumed positions are never read again.*/
+			nodes[g] = &inner->node;
+			mins[g]  = min;
+		}
+
+		level = nin;
+		height ++;
+	}
+
+	if (tree->root)
+		nodes_free(tree->root, NULL);
+
+	tree->root   = nodes[0];
+	tree->first  = (M_BTreeLeaf*)nodes[0];
+	tree->size   = n;
+	tree->height = height;
+
+	while (!tree->first->node.leaf)
+		tree->first = (M_BTreeLeaf*)((M_BTreeInner*)tree->first)->children[0];
+
+	m_free(nodes);
+	m_free(mins);
+	return M_OK;
+fail:
+	/*Free the finished subtrees and the ones not consumed yet.*/
+	for (g = 0; g < nnode; g ++)
+		nodes_free(nodes[g], NULL);
+	for (g = pos; g < level; g ++)
+		nodes_free(nodes[g], NULL);
+nomem:
+	if (nodes)
+		m_free(nodes);
+	if (mins)
+		m_free(mins);
+	return M_ERR_NO_MEM;
+}
@@ -0,0 +1,242 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "chash"
+
+#include <m_log.h>
+#include <m_malloc.h>
+#include <m_atomic.h>
+#include <m_chash.h>
+
+/**
+ * The hash table grows when the average list length reaches it.
+ * Both the lists count and M_CHASH_NLOCK are 2^N, and the lists count
+ * is never less than M_CHASH_NLOCK, so all the nodes in a list are
+ * protected by the same stripe lock.
+ */
+#define CHASH_LOAD 1
+
+/**Get the mixed key value of the key.*/
+static inline uint32_t
+chash_kv (void *key, const M_HashOps *ops)
+{
+	return m_ohash_mix(ops->kv(key));
+}
+
+/**Get the stripe lock of the key value.*/
+static inline pthread_mutex_t*
+chash_lock (M_CHash *hash, uint32_t kv)
+{
+	return &hash->locks[kv & (M_CHASH_NLOCK - 1)];
+}
+
+/**Allocate a new lists buffer with all the stripe locks held.*/
+static M_Result
+chash_resize (M_CHash *hash, M_CHashTable *old, const M_HashOps *ops)
+{
+	M_CHashTable *t;
+	M_Result r = M_OK;
+	uint32_t nlist, i;
+
+	for (i = 0; i < M_CHASH_NLOCK; i ++)
+		pthread_mutex_lock(&hash->locks[i]);
+
+	/*Another thread has resized it.*/
+	if (hash->table != old) {
+		old = NULL;
+		goto end;
+	}
+
+	nlist = old ? old->nlist * 2 : M_CHASH_NLOCK;
+
+	t = m_malloc(sizeof(M_CHashTable) + sizeof(M_HashNode*) * nlist);
+	if (!t) {
+		old = NULL;
+		r   = M_ERR_NO_MEM;
+		goto end;
+	}
+
+	t->nlist = nlist;
+	memset(t->lists, 0, sizeof(M_HashNode*) * nlist);
+
+	if (old) {
+		/*Odd "seq" makes the lookups wait until the nodes are moved.*/
+		m_atomic_int32_inc(&hash->seq);
+
+		for (i = 0; i < old->nlist; i ++) {
+			M_HashNode *node, *next;
+
+			for (node = old->lists[i]; node; node = next) {
+				uint32_t pos = chash_kv(ops->get_key(node), ops) & (nlist - 1);
+
+				next = node->next;
+				/*Lookups on the old lists may follow it to the node.*/
+				m_atomic_store_release(&node->next, t->lists[pos]);
+				t->lists[pos] = node;
+			}
+		}
+	}
+
+	m_atomic_store_release(&hash->table, t);
+
+	if (old)
+		m_atomic_int32_inc(&hash->seq);
+end:
+	for (i = 0; i < M_CHASH_NLOCK; i ++)
+		pthread_mutex_unlock(&hash->locks[i]);
+
+	if (old)
+		m_epoch_retire(old, m_free);
+
+	return r;
+}
+
+void
+m_chash_init (M_CHash *hash)
+{
+	uint32_t i;
+
+	assert(hash);
+
+	hash->table = NULL;
+	hash->size  = 0;
+	hash->seq   = 0;
+
+	for (i = 0; i < M_CHASH_NLOCK; i ++)
+		pthread_mutex_init(&hash->locks[i], NULL);
+}
+
+void
+m_chash_deinit (M_CHash *hash, const M_HashOps *ops)
+{
+	M_CHashTable *t;
+	uint32_t i;
+
+	assert(hash && ops);
+
+	t = hash->table;
+	if (t) {
+		if (ops->free_node) {
+			for (i = 0; i < t->nlist; i ++) {
+				M_HashNode *node, *next;
+
+				for (node = t->lists[i]; node; node = next) {
+					next = node->next;
+					ops->free_node(node);
+				}
+			}
+		}
+
+		m_free(t);
+	}
+
+	for (i = 0; i < M_CHASH_NLOCK; i ++)
+		pthread_mutex_destroy(&hash->locks[i]);
+}
+
+M_Result
+m_chash_insert (M_CHash *hash, M_HashNode *node, const M_HashOps *ops,
+			M_HashNode **pold)
+{
+	pthread_mutex_t *lock;
+	M_CHashTable *t;
+	M_HashNode *n;
+	uint32_t kv, pos, size;
+	M_Result r;
+
+	assert(hash && node && ops && ops->get_key && ops->kv && ops->equal);
+
+	kv   = chash_kv(ops->get_key(node), ops);
+	lock = chash_lock(hash, kv);
+
+	pthread_mutex_lock(lock);
+
+	while (!(t = hash->table)) {
+		pthread_mutex_unlock(lock);
+
+		if ((r = chash_resize(hash, NULL, ops)) != M_OK)
+			return r;
+
+		pthread_mutex_lock(lock);
+	}
+
+	pos = kv & (t->nlist - 1);
+
+	for (n = t->lists[pos]; n; n = n->next) {
+		if (ops->equal(ops->get_key(node), ops->get_key(n))) {
+			pthread_mutex_unlock(lock);
+
+			if (pold)
+				*pold = n;
+			return M_NONE;
+		}
+	}
+
+	/*The node is linked before it is visible to the lookups.*/
+	m_atomic_store_relaxed(&node->next, t->lists[pos]);
+	m_atomic_store_release(&t->lists[pos], node);
+
+	size = m_atomic_int32_inc(&hash->size) + 1;
+
+	pthread_mutex_unlock(lock);
+
+	/*Failing to grow only makes the lists longer.*/
+	if (size > t->nlist * CHASH_LOAD)
+		chash_resize(hash, t, ops);
+
+	return M_OK;
+}
+
+M_HashNode*
+m_chash_remove (M_CHash *hash, void *key, const M_HashOps *ops)
+{
+	pthread_mutex_t *lock;
+	M_CHashTable *t;
+	M_HashNode *node, **prev;
+	uint32_t kv;
+
+	assert(hash && ops && ops->get_key && ops->kv && ops->equal);
+
+	kv   = chash_kv(key, ops);
+	lock = chash_lock(hash, kv);
+
+	pthread_mutex_lock(lock);
+
+	t = hash->table;
+	if (!t) {
+		node = NULL;
+		goto end;
+	}
+
+	prev = &t->lists[kv & (t->nlist - 1)];
+	while ((node = *prev)) {
+		if (ops->equal(key, ops->get_key(node))) {
+			/*The node's "next" is kept, lookups on it can go on.*/
+			m_atomic_store_release(prev, node->next);
+			m_atomic_int32_dec(&hash->size);
+			break;
+		}
+
+		prev = &node->next;
+	}
+end:
+	pthread_mutex_unlock(lock);
+
+	return node;
+}
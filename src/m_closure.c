@@ -0,0 +1,409 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "closure"
+
+#include <m_log.h>
+#include <m_malloc.h>
+#include <m_gc.h>
+#include <m_function.h>
+#include <m_module.h>
+#include <m_opcode.h>
+#include <m_frame.h>
+#include <m_closure.h>
+
+/**Maximum number of registers of a function.*/
+#define CAPTURE_MAX     256
+/**Maximum number of captured variables of a function.*/
+#define CAPTURE_UPV_MAX 255
+
+/**Bit set of registers.*/
+typedef uint32_t CaptureSet[CAPTURE_MAX / 32];
+
+/**Capture analysis data of a function.*/
+typedef struct {
+	int         parent;    /**< The defining function, -1 if none.*/
+	int32_t     first_clos;/**< Offset of the first CLOSURE.*/
+	CaptureSet  captured;  /**< Registers captured by nested functions.*/
+	CaptureSet  boxed;     /**< Captured registers need to be boxed.*/
+	uint16_t    nupv;      /**< Number of captured variables.*/
+	/**Captured variables: the defining function and the register.*/
+	uint16_t    upv_func[CAPTURE_UPV_MAX];
+	uint8_t     upv_reg[CAPTURE_UPV_MAX];
+	M_UpValInfo upvs[CAPTURE_UPV_MAX];
+} Capture;
+
+M_Closure*
+m_closure_new (M_Function *func, M_Frame *frame, M_Closure *parent)
+{
+	M_Closure *clos;
+	M_UpVal *upvs;
+	uint8_t nupv, i;
+	size_t id;
+
+	assert(func);
+
+	nupv = (func->flags & M_FUNC_FL_NATIVE) ? 0 : func->f.bc.nupv;
+
+	clos = m_gc_alloc_obj(M_GC_OBJ_CLOSURE, &id);
+	m_assert_alloc(clos);
+
+	clos->func   = func;
+	clos->upvs   = NULL;
+	clos->nupv   = 0;
+	clos->flags  = nupv ? 0 : (M_CLOS_FL_INDEP | M_CLOS_FL_FROZEN);
+
+	m_gc_add_obj(id);
+
+	if (nupv) {
+		assert(frame);
+
+		upvs = m_gc_alloc_buf(sizeof(M_UpVal) * nupv, M_GC_CLOSBUF_FLAGS);
+		m_assert_alloc(upvs);
+
+		for (i = 0; i < nupv; i ++) {
+			M_UpValInfo *info = &func->f.bc.upvs[i];
+
+			if (!(info->flags & M_UPV_FL_REG)) {
+				assert(parent && (info->id < parent->nupv));
+				upvs[i] = parent->upvs[info->id];
+			} else if (info->flags & M_UPV_FL_BOX) {
+				upvs[i].box = m_frame_box(frame, info->id);
+			} else {
+				upvs[i].v = frame->v[info->id];
+			}
+		}
+
+		clos->upvs = upvs;
+		clos->nupv = nupv;
+	}
+
+	return clos;
+}
+
+void
+m_closure_release (M_Closure *clos)
+{
+	assert(clos);
+
+	if (clos->upvs)
+		m_gc_free_buf(clos->upvs, sizeof(M_UpVal) * clos->nupv,
+					M_GC_CLOSBUF_FLAGS);
+}
+
+static inline void
+capture_set (CaptureSet set, uint8_t r)
+{
+	set[r >> 5] |= 1u << (r & 31);
+}
+
+static inline M_Bool
+capture_test (CaptureSet set, uint8_t r)
+{
+	return (set[r >> 5] >> (r & 31)) & 1;
+}
+
+/*Get the instruction's length.*/
+static inline uint32_t
+capture_inst_len (const uint8_t *ip)
+{
+	return m_opcode_lengths[m_opcode_generics[*ip]];
+}
+
+/*Get the register written by the instruction, -1 if none.*/
+static int
+capture_dest (const uint8_t *ip)
+{
+	switch (m_opcode_generics[*ip]) {
+		case M_OP_NOP:
+		case M_OP_SETUP:
+		case M_OP_SETBOX:
+		case M_OP_JMP:
+		case M_OP_JMPT:
+		case M_OP_JMPF:
+		case M_OP_SETPROP:
+		case M_OP_SETELEM:
+		case M_OP_RET:
+			return -1;
+		default:
+			return ip[1];
+	}
+}
+
+/*Get the jump target of the instruction, -1 if it is not a jump.*/
+static int32_t
+capture_jump (const uint8_t *ip, uint32_t off)
+{
+	switch (m_opcode_generics[*ip]) {
+		case M_OP_JMP:
+			return off + m_bc_get_s16(ip + 1);
+		case M_OP_JMPT:
+		case M_OP_JMPF:
+			return off + m_bc_get_s16(ip + 2);
+		default:
+			return -1;
+	}
+}
+
+/*Get the function "depth + 1" levels out.*/
+static int
+capture_owner (Capture *caps, int f, uint8_t depth)
+{
+	int i;
+
+	for (i = 0; (i <= depth) && (f != -1); i ++)
+		f = caps[f].parent;
+
+	return f;
+}
+
+/*
+ * Check if the captured register keeps its value after the closures are
+ * created. All the writes must be before the first CLOSURE and no loop
+ * may go back to them.
+ */
+static M_Bool
+capture_is_const (M_Function *func, Capture *cap, uint8_t r)
+{
+	uint8_t *bc = func->f.bc.bc;
+	uint32_t off, len = func->f.bc.bc_len;
+	int32_t last = -1, target;
+
+	for (off = 0; off < len; off += capture_inst_len(bc + off)) {
+		if (capture_dest(bc + off) == r)
+			last = off;
+	}
+
+	if (last >= cap->first_clos)
+		return M_FALSE;
+
+	for (off = 0; off < len; off += capture_inst_len(bc + off)) {
+		target = capture_jump(bc + off, off);
+
+		if ((target != -1) && ((int32_t)off > last) && (target <= last))
+			return M_FALSE;
+	}
+
+	return M_TRUE;
+}
+
+/*Get the index of the captured variable in the function, add it if needed.*/
+static int
+capture_upv (Capture *caps, int f, int owner, uint8_t r)
+{
+	Capture *cap = &caps[f];
+	M_UpValInfo info;
+	int i, pid;
+
+	for (i = 0; i < cap->nupv; i ++) {
+		if ((cap->upv_func[i] == owner) && (cap->upv_reg[i] == r))
+			return i;
+	}
+
+	info.flags = capture_test(caps[owner].boxed, r) ? M_UPV_FL_BOX : 0;
+
+	if (cap->parent == owner) {
+		info.flags |= M_UPV_FL_REG;
+		info.id     = r;
+	} else {
+		pid = capture_upv(caps, cap->parent, owner, r);
+		if (pid == -1)
+			return -1;
+		info.id = pid;
+	}
+
+	if (cap->nupv == CAPTURE_UPV_MAX)
+		return -1;
+
+	i = cap->nupv ++;
+	cap->upv_func[i] = owner;
+	cap->upv_reg[i]  = r;
+	cap->upvs[i]     = info;
+
+	return i;
+}
+
+M_Result
+m_closure_convert (M_Module *module)
+{
+	Capture *caps;
+	M_Function *func;
+	uint8_t *bc, *ip;
+	uint32_t off, len;
+	int f, child, owner, id, r;
+	M_Result ret = M_FAILED;
+
+	assert(module);
+
+	caps = m_malloc0(sizeof(Capture) * module->nfunc);
+	if (!caps)
+		return M_ERR_NO_MEM;
+
+	for (f = 0; f < module->nfunc; f ++) {
+		caps[f].parent     = -1;
+		caps[f].first_clos = INT32_MAX;
+	}
+
+	/*Find the defining functions.*/
+	for (f = 0; f < module->nfunc; f ++) {
+		func = module->funcs[f];
+		if (func->flags & M_FUNC_FL_NATIVE)
+			continue;
+
+		bc  = func->f.bc.bc;
+		len = func->f.bc.bc_len;
+
+		for (off = 0; off < len; off += capture_inst_len(bc + off)) {
+			ip = bc + off;
+
+			if (*ip >= M_OP_COUNT) {
+				M_ERROR("function %d has an illegal opcode %d at %d", f, *ip,
+							(int)off);
+				goto end;
+			}
+
+			if (m_opcode_generics[*ip] != M_OP_CLOSURE)
+				continue;
+
+			child = m_bc_get_u16(ip + 2);
+			if ((child >= module->nfunc) ||
+						((caps[child].parent != -1) &&
+						(caps[child].parent != f))) {
+				M_ERROR("function %d has multiple definitions", child);
+				goto end;
+			}
+
+			caps[child].parent = f;
+			caps[f].first_clos = M_MIN(caps[f].first_clos, (int32_t)off);
+		}
+	}
+
+	/*Find the captured registers, the modified ones are boxed.*/
+	for (f = 0; f < module->nfunc; f ++) {
+		func = module->funcs[f];
+		if (func->flags & M_FUNC_FL_NATIVE)
+			continue;
+
+		bc  = func->f.bc.bc;
+		len = func->f.bc.bc_len;
+
+		for (off = 0; off < len; off += capture_inst_len(bc + off)) {
+			ip = bc + off;
+
+			if (*ip == M_OP_GETUP) {
+				owner = capture_owner(caps, f, ip[2]);
+				r     = ip[3];
+			} else if (*ip == M_OP_SETUP) {
+				owner = capture_owner(caps, f, ip[1]);
+				r     = ip[2];
+			} else {
+				continue;
+			}
+
+			if ((owner == -1) || (r >= module->funcs[owner]->f.bc.nreg)) {
+				M_ERROR("illegal outer variable at %d of function %d", off, f);
+				goto end;
+			}
+
+			capture_set(caps[owner].captured, r);
+			if (*ip == M_OP_SETUP)
+				capture_set(caps[owner].boxed, r);
+		}
+	}
+
+	for (f = 0; f < module->nfunc; f ++) {
+		func = module->funcs[f];
+		if (func->flags & M_FUNC_FL_NATIVE)
+			continue;
+
+		for (r = 0; r < func->f.bc.nreg; r ++) {
+			if (capture_test(caps[f].captured, r) &&
+						!capture_test(caps[f].boxed, r) &&
+						!capture_is_const(func, &caps[f], r))
+				capture_set(caps[f].boxed, r);
+		}
+	}
+
+	/*Allocate the captured variables and rewrite the instructions.*/
+	for (f = 0; f < module->nfunc; f ++) {
+		func = module->funcs[f];
+		if (func->flags & M_FUNC_FL_NATIVE)
+			continue;
+
+		bc  = func->f.bc.bc;
+		len = func->f.bc.bc_len;
+
+		for (off = 0; off < len; off += capture_inst_len(bc + off)) {
+			ip = bc + off;
+
+			if (*ip == M_OP_GETUP) {
+				owner = capture_owner(caps, f, ip[2]);
+				r     = ip[3];
+			} else if (*ip == M_OP_SETUP) {
+				owner = capture_owner(caps, f, ip[1]);
+				r     = ip[2];
+			} else {
+				continue;
+			}
+
+			id = capture_upv(caps, f, owner, r);
+			if (id == -1) {
+				M_ERROR("too many captured variables in function %d", f);
+				goto end;
+			}
+
+			if (*ip == M_OP_GETUP) {
+				ip[0] = capture_test(caps[owner].boxed, r) ?
+							M_OP_GETBOX : M_OP_GETUPV;
+				ip[2] = id;
+				ip[3] = 0;
+			} else {
+				ip[0] = M_OP_SETBOX;
+				ip[1] = id;
+				ip[2] = 0;
+			}
+		}
+	}
+
+	for (f = 0; f < module->nfunc; f ++) {
+		func = module->funcs[f];
+		if (func->flags & M_FUNC_FL_NATIVE)
+			continue;
+
+		func->f.bc.nupv = caps[f].nupv;
+		func->f.bc.upvs = NULL;
+
+		if (caps[f].nupv) {
+			func->f.bc.upvs = m_malloc(sizeof(M_UpValInfo) * caps[f].nupv);
+			if (!func->f.bc.upvs) {
+				func->f.bc.nupv = 0;
+				ret = M_ERR_NO_MEM;
+				goto end;
+			}
+
+			memcpy(func->f.bc.upvs, caps[f].upvs,
+						sizeof(M_UpValInfo) * caps[f].nupv);
+		}
+	}
+
+	ret = M_OK;
+end:
+	m_free(caps);
+	return ret;
+}
@@ -0,0 +1,320 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "epoch"
+
+#include <m_log.h>
+#include <m_malloc.h>
+#include <m_atomic.h>
+#include <m_epoch.h>
+
+#include <stdlib.h>
+
+/*
+ * On Linux the reclaimer can issue the full fences on behalf of the
+ * readers with membarrier(), so entering a region needs no fence.
+ */
+#ifdef __linux__
+	#include <unistd.h>
+	#include <sys/syscall.h>
+	#include <linux/membarrier.h>
+
+	#ifdef __NR_membarrier
+		#define M_EPOCH_MEMBARRIER
+	#endif
+#endif
+
+/**Cache line size, every thread's record has its own line.*/
+#ifndef M_EPOCH_CACHE_LINE
+	#define M_EPOCH_CACHE_LINE 64
+#endif
+
+/**Epoch record of a thread.*/
+typedef struct EpochRecord_s EpochRecord;
+/**Epoch record of a thread.*/
+struct EpochRecord_s {
+	EpochRecord *next;  /**< The next record.*/
+	uint64_t     epoch; /**< The epoch entered, 0 means quiescent.*/
+	uint32_t     nest;  /**< Nested critical regions count.*/
+	M_Bool       used;  /**< The record is owned by a thread.*/
+} __attribute__((aligned(M_EPOCH_CACHE_LINE)));
+
+/**Retired block.*/
+typedef struct Retired_s Retired;
+/**Retired block.*/
+struct Retired_s {
+	Retired  *next;           /**< The next retired block.*/
+	void     *ptr;            /**< The block.*/
+	void    (*free_fn)(void*);/**< Free function.*/
+	uint64_t  epoch;          /**< The global epoch when retired.*/
+};
+
+/**Epoch data.*/
+static struct {
+	pthread_key_t   key;      /**< Thread's record key.*/
+	pthread_mutex_t lock;     /**< Records and retired list lock.*/
+	uint64_t        epoch;    /**< The global epoch.*/
+	EpochRecord    *records;  /**< All the records.*/
+	Retired        *retired;  /**< Retired blocks, the newest first.*/
+	uint32_t        nretired; /**< Retired blocks count.*/
+	M_Bool          asym;     /**< The reclaimer fences for the readers.*/
+} epoch;
+
+/**The current thread's record, cached out of the key. Initial exec model
+ * avoids calling __tls_get_addr on every enter from the shared library.*/
+static __thread EpochRecord *epoch_rec
+			__attribute__((tls_model("initial-exec")));
+
+static void
+epoch_key_destructor (void *data)
+{
+	EpochRecord *rec = data;
+
+	pthread_mutex_lock(&epoch.lock);
+
+	rec->epoch = 0;
+	rec->nest  = 0;
+	rec->used  = M_FALSE;
+
+	pthread_mutex_unlock(&epoch.lock);
+
+	epoch_rec = NULL;
+}
+
+/**Get the current thread's record.*/
+static inline EpochRecord*
+epoch_record (void)
+{
+	EpochRecord *rec = epoch_rec;
+
+	if (rec)
+		return rec;
+
+	pthread_mutex_lock(&epoch.lock);
+
+	for (rec = epoch.records; rec; rec = rec->next) {
+		if (!rec->used)
+			break;
+	}
+
+	if (!rec) {
+		/*Not m_malloc, the record must be cache line aligned.*/
+		if (posix_memalign((void**)&rec, M_EPOCH_CACHE_LINE,
+					sizeof(EpochRecord)))
+			rec = NULL;
+		m_assert_alloc(rec);
+
+		rec->next = epoch.records;
+		epoch.records = rec;
+	}
+
+	rec->epoch = 0;
+	rec->nest  = 0;
+	rec->used  = M_TRUE;
+
+	pthread_mutex_unlock(&epoch.lock);
+
+	pthread_setspecific(epoch.key, rec);
+	epoch_rec = rec;
+
+	return rec;
+}
+
+/**Order the reader's announcement before its reads.*/
+static inline void
+epoch_reader_fence (void)
+{
+	if (epoch.asym)
+		m_atomic_signal_fence(M_ATOMIC_SEQ_CST);
+	else
+		m_atomic_fence(M_ATOMIC_SEQ_CST);
+}
+
+/**Full fence in the reclaimer, and in all the readers if asymmetric.*/
+static inline void
+epoch_reclaimer_fence (void)
+{
+#ifdef M_EPOCH_MEMBARRIER
+	if (epoch.asym &&
+			!syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0))
+		return;
+#endif
+
+	m_atomic_fence(M_ATOMIC_SEQ_CST);
+}
+
+/**Free the retired blocks in the list.*/
+static void
+epoch_free_list (Retired *r)
+{
+	Retired *next;
+
+	for (; r; r = next) {
+		next = r->next;
+		r->free_fn(r->ptr);
+		m_free(r);
+	}
+}
+
+void
+m_epoch_startup (void)
+{
+	pthread_key_create(&epoch.key, epoch_key_destructor);
+	pthread_mutex_init(&epoch.lock, NULL);
+
+	epoch.epoch    = 1;
+	epoch.records  = NULL;
+	epoch.retired  = NULL;
+	epoch.nretired = 0;
+	epoch.asym     = M_FALSE;
+
+#ifdef M_EPOCH_MEMBARRIER
+	if (!syscall(__NR_membarrier,
+				MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0))
+		epoch.asym = M_TRUE;
+#endif
+}
+
+void
+m_epoch_shutdown (void)
+{
+	EpochRecord *rec, *next;
+
+	epoch_free_list(epoch.retired);
+
+	for (rec = epoch.records; rec; rec = next) {
+		next = rec->next;
+		free(rec);
+	}
+
+	epoch_rec = NULL;
+
+	pthread_key_delete(epoch.key);
+	pthread_mutex_destroy(&epoch.lock);
+}
+
+void
+m_epoch_enter (void)
+{
+	EpochRecord *rec = epoch_record();
+	uint64_t e;
+
+	if (rec->nest ++)
+		return;
+
+	/*
+	 * The announced epoch must still be the global one after it is visible,
+	 * or a reclaimer may have freed the blocks retired before it.
+	 */
+	do {
+		e = m_atomic_load_relaxed(&epoch.epoch);
+		m_atomic_store_relaxed(&rec->epoch, e);
+
+		/*Pairs with the fence in m_epoch_reclaim.*/
+		epoch_reader_fence();
+	} while (m_atomic_load_relaxed(&epoch.epoch) != e);
+}
+
+void
+m_epoch_leave (void)
+{
+	EpochRecord *rec = epoch_rec;
+
+	assert(rec && rec->nest);
+
+	if (-- rec->nest)
+		return;
+
+	m_atomic_store_release(&rec->epoch, 0);
+}
+
+void
+m_epoch_retire (void *ptr, void (*free_fn)(void *ptr))
+{
+	Retired *r;
+	M_Bool reclaim;
+
+	assert(ptr && free_fn);
+
+	r = m_malloc(sizeof(Retired));
+	m_assert_alloc(r);
+
+	r->ptr     = ptr;
+	r->free_fn = free_fn;
+
+	pthread_mutex_lock(&epoch.lock);
+
+	r->epoch = epoch.epoch;
+	r->next  = epoch.retired;
+	epoch.retired = r;
+
+	reclaim = (++ epoch.nretired >= M_EPOCH_RECLAIM_COUNT);
+
+	pthread_mutex_unlock(&epoch.lock);
+
+	if (reclaim)
+		m_epoch_reclaim();
+}
+
+void
+m_epoch_reclaim (void)
+{
+	EpochRecord *rec;
+	Retired *r, **pr, *free_list = NULL;
+	uint64_t e;
+
+	pthread_mutex_lock(&epoch.lock);
+
+	e = epoch.epoch;
+
+	/*Pairs with the fence in m_epoch_enter, the retired blocks are unlinked.*/
+	epoch_reclaimer_fence();
+
+	/*The epoch advances when all the active threads have entered it.*/
+	for (rec = epoch.records; rec; rec = rec->next) {
+		uint64_t re = m_atomic_load_acquire(&rec->epoch);
+
+		if (re && (re != e))
+			break;
+	}
+
+	if (!rec) {
+		e ++;
+		m_atomic_store_relaxed(&epoch.epoch, e);
+	}
+
+	/*A block retired in epoch n cannot be seen after epoch n + 1 ends.*/
+	pr = &epoch.retired;
+	while ((r = *pr)) {
+		if (r->epoch + 2 <= e) {
+			*pr = NULL;
+			free_list = r;
+			break;
+		}
+
+		pr = &r->next;
+	}
+
+	for (r = free_list; r; r = r->next)
+		epoch.nretired --;
+
+	pthread_mutex_unlock(&epoch.lock);
+
+	epoch_free_list(free_list);
+}
@@ -0,0 +1,109 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "frame"
+
+#include <m_log.h>
+#include <m_malloc.h>
+#include <m_gc.h>
+#include <m_frame.h>
+#include <m_closure.h>
+
+M_Frame*
+m_frame_new (M_Closure *clos, uint16_t nv)
+{
+	M_Frame *frame;
+	size_t id;
+
+	frame = m_gc_alloc_obj(M_GC_OBJ_FRAME, &id);
+	m_assert_alloc(frame);
+
+	frame->flags   = 0;
+	frame->nv      = 0;
+	frame->v       = NULL;
+	frame->closure = clos;
+	frame->boxes   = NULL;
+
+	m_gc_add_obj(id);
+
+	if (nv) {
+		frame->v = m_gc_alloc_buf(sizeof(M_Value) * nv, M_GC_FRAMEBUF_FLAGS);
+		m_assert_alloc(frame->v);
+
+		memset(frame->v, 0, sizeof(M_Value) * nv);
+		frame->nv = nv;
+	}
+
+	return frame;
+}
+
+void
+m_frame_release (M_Frame *frame)
+{
+	assert(frame);
+
+	if (frame->v && !(frame->flags & M_FRAME_FL_IN_STACK))
+		m_gc_free_buf(frame->v, sizeof(M_Value) * frame->nv,
+					M_GC_FRAMEBUF_FLAGS);
+}
+
+M_Box*
+m_frame_box (M_Frame *frame, uint16_t id)
+{
+	M_Box *box;
+	size_t oid;
+
+	assert(frame && (id < frame->nv));
+
+	for (box = frame->boxes; box; box = box->next) {
+		if (box->pv == &frame->v[id])
+			return box;
+	}
+
+	box = m_gc_alloc_obj(M_GC_OBJ_BOX, &oid);
+	m_assert_alloc(box);
+
+	box->pv   = &frame->v[id];
+	box->v    = 0;
+	box->next = frame->boxes;
+
+	frame->boxes = box;
+
+	m_gc_add_obj(oid);
+
+	return box;
+}
+
+void
+m_frame_close (M_Frame *frame)
+{
+	M_Box *box, *next;
+
+	assert(frame);
+
+	for (box = frame->boxes; box; box = next) {
+		next = box->next;
+
+		box->v    = *box->pv;
+		box->pv   = &box->v;
+		box->next = NULL;
+	}
+
+	frame->boxes = NULL;
+}
@@ -0,0 +1,43 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "function"
+
+#include <m_log.h>
+#include <m_malloc.h>
+#include <m_function.h>
+#include <m_jit.h>
+
+void
+m_function_deinit (M_Function *func)
+{
+	assert(func);
+
+	if (func->flags & M_FUNC_FL_NATIVE)
+		return;
+
+	m_jit_release(func);
+
+	if (func->f.bc.upvs) {
+		m_free(func->f.bc.upvs);
+		func->f.bc.upvs = NULL;
+	}
+
+	func->f.bc.nupv = 0;
+}
@@ -65,6 +65,10 @@ m_gc_alloc_buf (size_t size, uint32_t flags)
 
 	size = gc_size_align(size);
 
+	/*Code buffers own their pages, so they can be protected.*/
+	if (flags & M_GC_BUF_FL_EXECUTABLE)
+		return gc_mmap(size, 0);
+
 #if 0
 	pthread_mutex_lock(&m_gc_lock);
 
@@ -92,6 +96,8 @@ m_gc_realloc_buf (void *ptr, size_t old_size, size_t new_size,
 	if (new_size <= old_size)
 		return ptr;
 
+	assert(!(flags & M_GC_BUF_FL_EXECUTABLE));
+
 	old_size = gc_size_align(old_size);
 	new_size = gc_size_align(new_size);
 
@@ -115,6 +121,11 @@ m_gc_free_buf (void *ptr, uint32_t size, uint32_t flags)
 
 	size = gc_size_align(size);
 
+	if (flags & M_GC_BUF_FL_EXECUTABLE) {
+		gc_munmap(ptr, M_ALIGN_UP(size, M_PAGE_SIZE));
+		return;
+	}
+
 #if 0
 	pthread_mutex_lock(&m_gc_lock);
 
@@ -126,3 +137,10 @@ m_gc_free_buf (void *ptr, uint32_t size, uint32_t flags)
 #endif
 }
 
+M_Result
+m_gc_exec_buf (void *ptr, uint32_t size)
+{
+	assert(ptr && size);
+
+	return gc_mprotect(ptr, size, M_GC_MAP_FL_EXEC);
+}
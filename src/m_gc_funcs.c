@@ -22,6 +22,29 @@
 #include <m_frame.h>
 #include <m_string.h>
 #include <m_array.h>
+#include <m_value.h>
+#include <m_actor.h>
+
+/*Defined in "m_gc_obj.c".*/
+static inline void gc_mark (void *ptr);
+
+/**Mark the GC object referenced by the value.*/
+static inline void
+gc_mark_value (M_Value v)
+{
+	switch (v & M_VALUE_TYPE_MASK) {
+		case M_VALUE_TYPE_PTR:
+			if (v)
+				gc_mark((void*)v);
+			break;
+		case M_VALUE_TYPE_DOUBLE:
+		case M_VALUE_TYPE_STRING:
+			gc_mark((void*)(v & ~M_VALUE_TYPE_MASK));
+			break;
+		default:
+			break;
+	}
+}
 
 #define M_GC_PTR_FLAGS M_GC_OBJ_FL_PTR
 #define M_GC_PTR_SIZE  sizeof(void*)
@@ -29,6 +52,10 @@
 static inline void
 gc_ptr_scan (void *ptr)
 {
+	uintptr_t p = *(uintptr_t*)ptr & ~M_PTR_TYPE_MASK;
+
+	if (p)
+		gc_mark((void*)p);
 }
 
 #define gc_ptr_final NULL
@@ -38,63 +65,174 @@ gc_ptr_scan (void *ptr)
 #define gc_double_scan  NULL
 #define gc_double_final NULL
 
-#define M_GC_STRING_FLAGS M_GC_OBJ_FL_PTR
+#define M_GC_STRING_FLAGS (M_GC_OBJ_FL_PTR | M_GC_OBJ_FL_PAR_FINAL)
 #define M_GC_STRING_SIZE  sizeof(M_String)
 static inline void
 gc_string_scan (void *ptr)
 {
+	M_String *str = (M_String*)ptr;
+
+	switch (m_string_type(str)) {
+		case M_STRING_TYPE_ROPE:
+			gc_mark(str->left);
+			gc_mark(str->right);
+			break;
+		case M_STRING_TYPE_SLICE:
+			gc_mark(str->parent);
+			break;
+		default:
+			break;
+	}
 }
 
 static inline void
 gc_string_final (void *ptr)
 {
+	M_String *str = (M_String*)ptr;
+
+	if ((m_string_type(str) == M_STRING_TYPE_FLAT) && str->chars)
+		m_gc_free_buf(str->chars, m_string_is_latin1(str) ? str->len :
+					str->len * sizeof(M_UChar), M_GC_STRBUF_FLAGS);
 }
 
-#define M_GC_OBJECT_FLAGS M_GC_OBJ_FL_PTR
+#define M_GC_OBJECT_FLAGS (M_GC_OBJ_FL_PTR | M_GC_OBJ_FL_PAR_FINAL)
 #define M_GC_OBJECT_SIZE  sizeof(M_Object)
 static inline void
 gc_object_scan (void *ptr)
 {
+	M_Object *obj = (M_Object*)ptr;
+	uint32_t i;
+
+	gc_mark(obj->shape);
+	gc_mark_value(obj->protov);
+
+	for (i = 0; i < obj->nv; i ++)
+		gc_mark_value(obj->v[i]);
 }
 
 static inline void
 gc_object_final (void *ptr)
 {
+	m_object_release((M_Object*)ptr);
 }
 
-#define M_GC_CLOSURE_FLAGS M_GC_OBJ_FL_PTR
+#define M_GC_CLOSURE_FLAGS (M_GC_OBJ_FL_PTR | M_GC_OBJ_FL_PAR_FINAL)
 #define M_GC_CLOSURE_SIZE  sizeof(M_Closure)
 static inline void
 gc_closure_scan (void *ptr)
 {
+	M_Closure *clos = (M_Closure*)ptr;
+	uint32_t i;
+
+	for (i = 0; i < clos->nupv; i ++) {
+		if (clos->func->f.bc.upvs[i].flags & M_UPV_FL_BOX)
+			gc_mark(clos->upvs[i].box);
+		else
+			gc_mark_value(clos->upvs[i].v);
+	}
 }
 
 static inline void
 gc_closure_final (void *ptr)
 {
+	m_closure_release((M_Closure*)ptr);
 }
 
-#define M_GC_ARRAY_FLAGS M_GC_OBJ_FL_PTR
+#define M_GC_ARRAY_FLAGS (M_GC_OBJ_FL_PTR | M_GC_OBJ_FL_PAR_FINAL)
 #define M_GC_ARRAY_SIZE  sizeof(M_Array)
 static inline void
 gc_array_scan (void *ptr)
 {
+	M_Array *arr = (M_Array*)ptr;
+	M_ArrayElem *elem;
+	uint32_t i;
+
+	switch (arr->kind) {
+		case M_ARRAY_KIND_VALUE:
+			for (i = 0; i < arr->len; i ++)
+				gc_mark_value(arr->e.values[i]);
+			break;
+		case M_ARRAY_KIND_SPARSE:
+			m_hash_foreach_value(elem, i, &arr->e.hash, node) {
+				gc_mark_value(elem->v);
+			}
+			break;
+		default:
+			break;
+	}
 }
 
 static inline void
 gc_array_final (void *ptr)
 {
+	m_array_release((M_Array*)ptr);
 }
 
-#define M_GC_FRAME_FLAGS M_GC_OBJ_FL_PTR
+#define M_GC_FRAME_FLAGS (M_GC_OBJ_FL_PTR | M_GC_OBJ_FL_PAR_FINAL)
 #define M_GC_FRAME_SIZE  sizeof(M_Frame)
+/*Also scans the frames in the actors' value stacks.*/
 static inline void
 gc_frame_scan (void *ptr)
 {
+	M_Frame *frame = (M_Frame*)ptr;
+	uint32_t i;
+
+	if (frame->closure)
+		gc_mark(frame->closure);
+	if (frame->boxes)
+		gc_mark(frame->boxes);
+
+	for (i = 0; i < frame->nv; i ++)
+		gc_mark_value(frame->v[i]);
 }
 
 static inline void
 gc_frame_final (void *ptr)
 {
+	m_frame_release((M_Frame*)ptr);
+}
+
+#define M_GC_BOX_FLAGS M_GC_OBJ_FL_PTR
+#define M_GC_BOX_SIZE  sizeof(M_Box)
+static inline void
+gc_box_scan (void *ptr)
+{
+	M_Box *box = (M_Box*)ptr;
+
+	/*An open box's value is marked with its frame.*/
+	if (box->pv == &box->v)
+		gc_mark_value(box->v);
+	if (box->next)
+		gc_mark(box->next);
+}
+
+#define gc_box_final NULL
+
+#define M_GC_SHAPE_FLAGS (M_GC_OBJ_FL_PTR | M_GC_OBJ_FL_PAR_FINAL)
+#define M_GC_SHAPE_SIZE  sizeof(M_Shape)
+static inline void
+gc_shape_scan (void *ptr)
+{
+	M_Shape *shape = (M_Shape*)ptr;
+	M_Property *prop;
+	uint32_t pos;
+
+	/*Only the link to the parent is strong, the transitions to the
+	 *children are removed when the children are released.*/
+	if (shape->parent)
+		gc_mark(shape->parent);
+	if (shape->key.quark)
+		gc_mark(shape->key.quark);
+
+	if (shape->flags & M_SHAPE_FL_DICT) {
+		m_hash_foreach_value(prop, pos, &shape->prop_hash, node) {
+			gc_mark(prop->quark);
+		}
+	}
 }
 
+static inline void
+gc_shape_final (void *ptr)
+{
+	m_shape_release((M_Shape*)ptr);
+}
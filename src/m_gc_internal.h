@@ -149,6 +149,18 @@ extern void*  gc_mmap (size_t size, uint32_t flags);
  */
 extern void   gc_munmap (void *ptr, size_t size);
 
+/**
+ * Change a mapped buffer's protection.
+ * A buffer is never writable and executable at the same time.
+ * \param[in] ptr The pointer of the buffer.
+ * \param size The buffer's size in bytes.
+ * \param flags M_GC_MAP_FL_EXEC means read and execute,
+ * otherwise read and write.
+ * \retval M_OK On success.
+ * \retval M_FAILED The system refused the protection.
+ */
+extern M_Result gc_mprotect (void *ptr, size_t size, uint32_t flags);
+
 /**
  * Object manager initialize.
  */
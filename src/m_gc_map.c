@@ -37,9 +37,9 @@ sys_mmap(void *ptr, size_t size, uint32_t flags)
 	r = mmap(ptr, size, prot, MAP_PRIVATE|MAP_ANON, -1, 0);
 
 	if (r != MAP_FAILED) {
-		/*M_DEBUG("map %dB at %p", size, r);*/
+		/*M_DEBUG("map %zuB at %p", size, r);*/
 	} else {
-		M_ERROR("map %dB failed", size);
+		M_ERROR("map %zuB failed", size);
 		return NULL;
 	}
 
@@ -50,7 +50,7 @@ static inline void
 sys_munmap (void *ptr, size_t size)
 {
 	munmap(ptr, size);
-	/*M_DEBUG("unmap %dB at %p", size, ptr);*/
+	/*M_DEBUG("unmap %zuB at %p", size, ptr);*/
 }
 
 void*
@@ -64,7 +64,7 @@ gc_mmap (size_t size, uint32_t flags)
 
 	/*Try to allocate an aligned pool*/
 	pu8 = (uint8_t*)sys_mmap(NULL, size, flags);
-	if (pu8 == MAP_FAILED)
+	if (!pu8)
 		return NULL;
 
 	if (!(M_PTR_TO_SIZE(pu8) & M_PAGE_MASK))
@@ -115,3 +115,22 @@ gc_munmap (void *ptr, size_t size)
 	sys_munmap(ptr, size);
 }
 
+M_Result
+gc_mprotect (void *ptr, size_t size, uint32_t flags)
+{
+	int prot;
+
+	size = (size + M_PAGE_MASK) & ~M_PAGE_MASK;
+
+	if (flags & M_GC_MAP_FL_EXEC)
+		prot = PROT_READ|PROT_EXEC;
+	else
+		prot = PROT_READ|PROT_WRITE;
+
+	if (mprotect(ptr, size, prot) == -1) {
+		M_ERROR("protect %zuB at %p failed", size, ptr);
+		return M_FAILED;
+	}
+
+	return M_OK;
+}
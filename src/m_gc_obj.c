@@ -22,12 +22,18 @@
 #include <m_log.h>
 #include <m_thread.h>
 #include <m_malloc.h>
+#include <m_atomic.h>
 #include "m_gc_internal.h"
 
 #ifndef M_GC_GRAY_STACK_SIZE
 	#define M_GC_GRAY_STACK_SIZE 256
 #endif
 
+/**The paused threads join the collection when the heap is bigger than this.*/
+#ifndef M_GC_PARALLEL_SIZE
+	#define M_GC_PARALLEL_SIZE (1024*1024)
+#endif
+
 #ifndef M_GC_BEGIN_SIZE
 	#define M_GC_BEGIN_SIZE (128*1024)
 #endif
@@ -57,20 +63,68 @@ typedef struct {
 	void **top;          /**< The top of the stack.*/
 } GCGrayStack;
 
+/**
+ * Parallel GC worker.
+ * The thread running the GC and the paused threads joining the collection
+ * are workers. Each one has its own gray object stack.
+ */
+struct M_GCWorker_s {
+	GCGrayStack gray;    /**< The local gray object stack.*/
+	uint32_t    gen;     /**< The last phase the worker joined.*/
+};
+
+/**Parallel collection phase.*/
+typedef enum {
+	GC_PAR_NONE,         /**< No parallel work.*/
+	GC_PAR_MARK,         /**< Mark the objects.*/
+	GC_PAR_SWEEP         /**< Sweep the cell pools.*/
+} GCParPhase;
+
+/**Root marking tasks shared by the workers.*/
+enum {
+	GC_ROOT_HASH,        /**< Mark the root hash table.*/
+	GC_ROOT_ACTORS,      /**< Mark the actors.*/
+	GC_ROOT_COUNT        /**< Count of the tasks.*/
+};
+
+/**Parallel collection state.*/
+typedef struct {
+	pthread_mutex_t   lock;      /**< The state's lock.*/
+	pthread_cond_t    cond;      /**< Wait for gray objects or workers.*/
+	GCParPhase        phase;     /**< The running phase.*/
+	uint32_t          gen;       /**< Generation number of the phase.*/
+	uint32_t          nworker;   /**< Workers in the phase.*/
+	uint32_t          nmax;      /**< Maximum number of workers in the phase.*/
+	uint32_t          nidle;     /**< Workers waiting for gray objects.*/
+	M_Bool            done;      /**< No more gray objects.*/
+	void            **gray;      /**< Gray objects shared by the workers.*/
+	uint32_t          ngray;     /**< Number of the shared gray objects.*/
+	uint32_t          gray_size; /**< Size of the shared gray buffer.*/
+	uint32_t          root_task; /**< The next root marking task.*/
+	M_GCCellPool    **pools;     /**< The pools to be swept.*/
+	uint32_t          npool;     /**< Number of the pools.*/
+	uint32_t          npar;      /**< Pools swept in parallel.*/
+	uint32_t          pool_size; /**< Size of the pools buffer.*/
+	uint32_t          pool_pos;  /**< The next pool to be swept.*/
+	size_t            freed;     /**< Bytes freed by sweeping.*/
+} GCPar;
+
 /**Cell pool size in bytes.*/
 static size_t gc_cell_pool_size;
 /**Cell pool address mask.*/
 static size_t gc_cell_pool_mask;
 /**GC begin size.*/
 static size_t gc_begin_size;
-/**Gray object stack.*/
-static GCGrayStack gc_gray_stack;
+/**Size of the workers' gray object stacks.*/
+static size_t gc_gray_stack_size;
+/**Maximum number of the parallel GC workers.*/
+static uint32_t gc_max_workers;
+/**Parallel collection state.*/
+static GCPar  gc_par;
 /**GC status.*/
 static GCStatus  gc_status;
 /**Thread the GC process in running on it.*/
 static M_Thread *gc_thread;
-/**Some gray objects have not been scanned.*/
-static M_Bool    gc_need_scan_gray;
 
 #include "m_gc_funcs.c"
 #include "m_gc_descrs.c"
@@ -128,7 +182,53 @@ gc_obj_get_bitmap (M_GCCellPool *pool, int id)
 	n = id >> 4;
 	b = (id & 0xF) << 1;
 
-	return (bmp[n] >> b) & 3;
+	/*Other workers may be marking the word's other cells.*/
+	return (m_atomic_load_relaxed(&bmp[n]) >> b) & 3;
+}
+
+/**
+ * Change the white object's mark.
+ * The workers share the bitmap words, so it is changed by CAS when
+ * the collection runs in parallel.
+ * \retval M_TRUE The mark is changed.
+ * \retval M_FALSE The object has been marked by another worker.
+ */
+static inline M_Bool
+gc_obj_mark_bitmap (M_GCCellPool *pool, int id, int flags)
+{
+	uint32_t *word = &pool->bitmap[id >> 4];
+	int b = (id & 0xF) << 1;
+	uint32_t old, nv;
+
+	if (gc_par.nmax == 1) {
+		*word = (*word & ~(3u << b)) | ((uint32_t)flags << b);
+		return M_TRUE;
+	}
+
+	/*The bitmap publishes nothing, the phases are joined under the lock.*/
+	old = m_atomic_load_relaxed(word);
+
+	do {
+		if (((old >> b) & 3) != GC_MARK_WHITE)
+			return M_FALSE;
+
+		nv = (old & ~(3u << b)) | ((uint32_t)flags << b);
+	} while (!m_atomic_cas_weak(word, &old, nv, M_ATOMIC_RELAXED));
+
+	return M_TRUE;
+}
+
+/**Change the scanned gray object to black.*/
+static inline void
+gc_obj_black_bitmap (M_GCCellPool *pool, int id)
+{
+	uint32_t bit = 1u << ((id & 0xF) << 1);
+
+	/*GC_MARK_GRAY | 1 == GC_MARK_BLACK.*/
+	if (gc_par.nmax == 1)
+		pool->bitmap[id >> 4] |= bit;
+	else
+		m_atomic_fetch_or(&pool->bitmap[id >> 4], bit, M_ATOMIC_RELAXED);
 }
 
 /**Allocate a new cell pool.*/
@@ -179,22 +279,121 @@ gc_free_pool (M_GCCellPool *pool)
 	gc_munmap(pool, gc_cell_pool_size);
 }
 
+/**Get the thread's worker data.*/
+static M_GCWorker*
+gc_worker_get (M_Thread *th)
+{
+	M_GCWorker *w = th->gc_worker;
+
+	if (!w) {
+		/*The stack follows the worker, m_free frees both.*/
+		w = m_malloc(sizeof(M_GCWorker) + sizeof(void*) * gc_gray_stack_size);
+		m_assert_alloc(w);
+
+		w->gray.stack = (void**)(w + 1);
+		w->gray.top   = w->gray.stack;
+		w->gray.end   = w->gray.stack + gc_gray_stack_size;
+		w->gen        = 0;
+
+		th->gc_worker = w;
+	}
+
+	return w;
+}
+
+/**Move the bottom half of the worker's gray objects to the shared buffer.*/
+static void
+gc_share_gray (M_GCWorker *w)
+{
+	uint32_t top = w->gray.top - w->gray.stack;
+	uint32_t n   = (top + 1) / 2;
+
+	pthread_mutex_lock(&gc_par.lock);
+
+	if (gc_par.ngray + n > gc_par.gray_size) {
+		uint32_t size = M_MAX(gc_par.gray_size * 2, gc_par.ngray + n);
+
+		gc_par.gray = m_realloc(gc_par.gray, sizeof(void*) * size);
+		m_assert_alloc(gc_par.gray);
+
+		gc_par.gray_size = size;
+	}
+
+	memcpy(gc_par.gray + gc_par.ngray, w->gray.stack, sizeof(void*) * n);
+	gc_par.ngray += n;
+
+	if (gc_par.nidle)
+		pthread_cond_broadcast(&gc_par.cond);
+
+	pthread_mutex_unlock(&gc_par.lock);
+
+	memmove(w->gray.stack, w->gray.stack + n, sizeof(void*) * (top - n));
+	w->gray.top -= n;
+}
+
 /**
- * Push the object to gray stack.
- * \param[in] ptr The pointer of the object.
- * \retval M_TRUE The object is pushed.
- * \retval M_FALSE The stack is full.
+ * Take gray objects from the shared buffer.
+ * The worker waits if the buffer is empty and the other workers are busy.
+ * \retval M_TRUE Got some gray objects.
+ * \retval M_FALSE All the workers are idle, the marking is finished.
  */
-static inline M_Bool
-gc_push_gray_stack (void *ptr)
+static M_Bool
+gc_take_gray (M_GCWorker *w)
 {
-	if (gc_gray_stack.top == gc_gray_stack.end) {
-		gc_need_scan_gray = M_TRUE;
-		return M_FALSE;
-	} else {
-		*gc_gray_stack.top ++ = ptr;
-		return M_TRUE;
+	uint32_t n;
+	M_Bool r;
+
+	pthread_mutex_lock(&gc_par.lock);
+
+	while (1) {
+		if (gc_par.ngray) {
+			n = M_MAX((w->gray.end - w->gray.stack) / 2, 1);
+			n = M_MIN(n, gc_par.ngray);
+
+			gc_par.ngray -= n;
+			memcpy(w->gray.stack, gc_par.gray + gc_par.ngray,
+						sizeof(void*) * n);
+			w->gray.top = w->gray.stack + n;
+
+			r = M_TRUE;
+			break;
+		}
+
+		if (gc_par.done) {
+			r = M_FALSE;
+			break;
+		}
+
+		if (gc_par.nidle + 1 == gc_par.nworker) {
+			/*All the other workers are waiting, no gray object left.*/
+			gc_par.done = M_TRUE;
+			pthread_cond_broadcast(&gc_par.cond);
+
+			r = M_FALSE;
+			break;
+		}
+
+		/*Read by the marking workers without the lock.*/
+		m_atomic_store_relaxed(&gc_par.nidle, gc_par.nidle + 1);
+		pthread_cond_wait(&gc_par.cond, &gc_par.lock);
+		m_atomic_store_relaxed(&gc_par.nidle, gc_par.nidle - 1);
 	}
+
+	pthread_mutex_unlock(&gc_par.lock);
+
+	return r;
+}
+
+/**Push the object to the current worker's gray stack.*/
+static inline void
+gc_push_gray_stack (void *ptr)
+{
+	M_GCWorker *w = m_thread_self()->gc_worker;
+
+	if (w->gray.top == w->gray.end)
+		gc_share_gray(w);
+
+	*w->gray.top ++ = ptr;
 }
 
 /**Mark the object with color.*/
@@ -209,16 +408,16 @@ gc_mark_with_color (void *ptr, int set_flags)
 	descr = gc_obj_get_descr(pool->type);
 	id    = gc_obj_get_id(descr, pool, ptr);
 
-	flags = gc_obj_get_bitmap(pool, id);
-	if (flags == GC_MARK_WHITE) {
-		if ((set_flags == GC_MARK_BLACK) || !(descr->flags & M_GC_OBJ_FL_PTR))
-			flags = GC_MARK_BLACK;
+	if (gc_obj_get_bitmap(pool, id) != GC_MARK_WHITE)
+		return;
 
-		gc_obj_set_bitmap(pool, id, flags);
+	if ((set_flags == GC_MARK_BLACK) || !(descr->flags & M_GC_OBJ_FL_PTR))
+		flags = GC_MARK_BLACK;
+	else
+		flags = GC_MARK_GRAY;
 
-		if (flags == GC_MARK_GRAY)
-			gc_push_gray_stack(ptr);
-	}
+	if (gc_obj_mark_bitmap(pool, id, flags) && (flags == GC_MARK_GRAY))
+		gc_push_gray_stack(ptr);
 }
 
 /**Mark the object as gray.*/
@@ -228,29 +427,25 @@ gc_mark (void *ptr)
 	gc_mark_with_color(ptr, GC_MARK_GRAY);
 }
 
-/**Mark threads' new borned object stack.*/
+/**Mark the thread's new borned object stack.*/
 static void
-gc_mark_nb_stacks (void)
+gc_mark_nb_stack (M_Thread *th)
 {
-	M_Thread *th;
-
-	m_list_foreach_value(th, &m_thread_list, node) {
-		uintptr_t *pptr, *pend;
-		void *ptr;
+	uintptr_t *pptr, *pend;
+	void *ptr;
 
-		pptr = th->nb_stack;
-		pend = pptr + th->nb_top;
+	pptr = th->nb_stack;
+	pend = pptr + th->nb_top;
 
-		while (pptr < pend) {
-			if (*pptr & GC_NB_FL_NO_PTR) {
-				ptr = M_SIZE_TO_PTR(*pptr & ~GC_NB_FL_NO_PTR);
-				gc_mark_with_color(ptr, GC_MARK_BLACK);
-			} else {
-				ptr = M_SIZE_TO_PTR(*pptr);
-				gc_mark(ptr);
-			}
-			pptr ++;
+	while (pptr < pend) {
+		if (*pptr & GC_NB_FL_NO_PTR) {
+			ptr = M_SIZE_TO_PTR(*pptr & ~GC_NB_FL_NO_PTR);
+			gc_mark_with_color(ptr, GC_MARK_BLACK);
+		} else {
+			ptr = M_SIZE_TO_PTR(*pptr);
+			gc_mark(ptr);
 		}
+		pptr ++;
 	}
 }
 
@@ -266,121 +461,97 @@ gc_mark_root_hash (void)
 	}
 }
 
-/**Mark root objcets.*/
+/**Mark the frames in the actors' call stacks and the messages.*/
 static void
-gc_mark_root (void)
+gc_mark_actors (void)
 {
-	M_DEBUG("mark root objects");
-
-	gc_need_scan_gray = M_FALSE;
-	gc_mark_nb_stacks();
-	gc_mark_root_hash();
-}
-
-/**Scan gray objects in the pool.*/
-static M_Bool
-gc_scan_pool_gray (M_GCCellPool *pool)
-{
-	const M_GCObjDescr *descr;
-	M_GCPoolStub *stub;
-	uint32_t *bmp, *bend;
-	int id;
-
-	descr = gc_obj_get_descr(pool->type);
-	stub  = &gc_obj_stubs[pool->type];
-	bmp   = pool->bitmap;
-	bend  = (uint32_t*)(((uint8_t*)bmp) + stub->bitmap_size);
-	id    = 0;
-
-	while (bmp < bend) {
-		if (*bmp) {
-			uint32_t flags = *bmp;
-			uint8_t *ptr = pool->begin + id * descr->size;
-			int mark;
+	M_Actor *actor;
+	M_Stack *rec;
+	M_SList *node;
+
+	m_list_foreach_value(actor, &m_actor_list, node) {
+		m_slist_foreach_value(rec, &actor->stack, slist) {
+			/*Frames in the value stack are not GC objects.*/
+			if (rec->frame->flags & M_FRAME_FL_IN_STACK)
+				gc_frame_scan(rec->frame);
+			else
+				gc_mark(rec->frame);
+		}
 
-			while (1) {
-				mark = flags & 3;
-				if (mark == GC_MARK_GRAY) {
-					if (!gc_push_gray_stack(ptr))
-						return M_FALSE;
-				}
+		m_slist_foreach(node, &actor->mbox.batch)
+			gc_mark_value(m_node_value(node, M_Message, node)->v);
+		m_mpsc_foreach(node, &actor->mbox.queue)
+			gc_mark_value(m_node_value(node, M_Message, node)->v);
 
-				flags >>= 2;
-				if (!flags)
-					break;
-
-				ptr += descr->size;
-			}
-		}
-		bmp ++;
-		id += 16;
+		gc_mark_value(actor->retv);
+		gc_mark_value(actor->behav);
 	}
-
-	return M_TRUE;
 }
 
-/**Scan gray objects.*/
+/**
+ * Mark root objcets.
+ * The worker marks its own thread's new borned stack first, then it
+ * claims the other root tasks.
+ */
 static void
-gc_scan_gray (void)
+gc_mark_root (M_Thread *self)
 {
-	M_GCPoolStub *stub;
-	M_GCCellPool *pool;
-	M_GCObjType type;
-
-	assert(gc_need_scan_gray);
-
-	M_DEBUG("scan gray objects");
-
-	gc_need_scan_gray = M_FALSE;
+	M_Thread *th;
+	uint32_t task;
 
-	for (type = 0; type < M_GC_OBJ_COUNT; type ++) {
-		stub = &gc_obj_stubs[type];
+	if (m_atomic_int32_cas(&self->gc_claim, 0, 1))
+		gc_mark_nb_stack(self);
 
-		m_slist_foreach_value(pool, &stub->full_pools, node) {
-			if (!gc_scan_pool_gray(pool))
-				return;
-		}
+	while ((task = m_atomic_int32_inc(&gc_par.root_task)) < GC_ROOT_COUNT) {
+		if (task == GC_ROOT_HASH)
+			gc_mark_root_hash();
+		else
+			gc_mark_actors();
+	}
 
-		m_slist_foreach_value(pool, &stub->usable_pools, node) {
-			if (!gc_scan_pool_gray(pool))
-				return;
-		}
+	m_list_foreach_value(th, &m_thread_list, node) {
+		if (m_atomic_int32_cas(&th->gc_claim, 0, 1))
+			gc_mark_nb_stack(th);
 	}
 }
 
-/**Mark objects.*/
-static M_Bool
-gc_mark_objs (void)
+/**Mark objects until all the workers run out of gray objects.*/
+static void
+gc_mark_objs (M_GCWorker *w)
 {
+	const M_GCObjDescr *descr;
 	M_GCCellPool *pool;
 	void *ptr;
 
-	if (gc_gray_stack.top == gc_gray_stack.stack) {
-		if (!gc_need_scan_gray)
-			return M_TRUE;
-
-		gc_scan_gray();
-	}
-
-	assert(gc_gray_stack.top > gc_gray_stack.stack);
-
-	M_DEBUG("mark objects");
-
 	do {
-		ptr = *(--gc_gray_stack.top);
-		pool  = gc_obj_get_pool(ptr);
-		gc_scan(pool->type, ptr);
-	} while (gc_gray_stack.top > gc_gray_stack.stack);
-
-	return !gc_need_scan_gray;
+		while (w->gray.top > w->gray.stack) {
+			ptr   = *(--w->gray.top);
+			pool  = gc_obj_get_pool(ptr);
+			descr = gc_obj_get_descr(pool->type);
+
+			gc_obj_black_bitmap(pool, gc_obj_get_id(descr, pool, ptr));
+			gc_scan(pool->type, ptr);
+
+			/*Feed the waiting workers.*/
+			if (m_atomic_load_relaxed(&gc_par.nidle) &&
+						(w->gray.top - w->gray.stack > 1))
+				gc_share_gray(w);
+		}
+	} while (gc_take_gray(w));
 }
 
-/**Sweep unused object in pool.*/
-static void
-gc_sweep_pool (const M_GCObjDescr *descr, M_GCPoolStub *stub, M_GCCellPool *pool)
+/**
+ * Sweep unused object in pool.
+ * \return Bytes freed.
+ */
+static size_t
+gc_sweep_pool (M_GCCellPool *pool)
 {
+	const M_GCObjDescr *descr = gc_obj_get_descr(pool->type);
+	M_GCPoolStub *stub = &gc_obj_stubs[pool->type];
 	M_Bool have_black = M_FALSE;
 	uint32_t *bmp, *bend;
+	size_t freed = 0;
 	int id;
 
 	bmp   = pool->bitmap;
@@ -404,8 +575,7 @@ gc_sweep_pool (const M_GCObjDescr *descr, M_GCPoolStub *stub, M_GCCellPool *pool
 					m_slist_push(&pool->free_cells, &cell->node);
 					*bmp &= ~(3 << shift);
 
-					/*Update total allocated size.*/
-					gc_allocated_size -= descr->size;
+					freed += descr->size;
 				} else if (mark == GC_MARK_BLACK) {
 					/*Inuse object.*/
 					*bmp &= ~(3 << shift);
@@ -429,53 +599,186 @@ gc_sweep_pool (const M_GCObjDescr *descr, M_GCPoolStub *stub, M_GCCellPool *pool
 
 	if (have_black) {
 		/*Add the pool to the stub's list.*/
+		pthread_mutex_lock(&gc_par.lock);
+
 		if (m_slist_empty(&pool->free_cells)) {
 			m_slist_push(&stub->full_pools, &pool->node);
 		} else {
 			m_slist_push(&stub->usable_pools, &pool->node);
 		}
+
+		pthread_mutex_unlock(&gc_par.lock);
 	} else {
 		/*Free the empty pool.*/
 		gc_free_pool(pool);
 	}
+
+	return freed;
+}
+
+/**Sweep the pools claimed by the worker.*/
+static void
+gc_sweep_pools (void)
+{
+	size_t freed = 0;
+	uint32_t i;
+
+	while ((i = m_atomic_int32_inc(&gc_par.pool_pos)) < gc_par.npar)
+		freed += gc_sweep_pool(gc_par.pools[i]);
+
+	pthread_mutex_lock(&gc_par.lock);
+	gc_par.freed += freed;
+	pthread_mutex_unlock(&gc_par.lock);
+}
+
+/**Add the pools in the list to the sweep buffer.*/
+static void
+gc_add_sweep_pools (M_SList *list)
+{
+	M_GCCellPool *pool, *npool;
+
+	m_slist_foreach_value_safe(pool, npool, list, node) {
+		if (gc_par.npool == gc_par.pool_size) {
+			uint32_t size = M_MAX(gc_par.pool_size * 2, 64);
+
+			gc_par.pools = m_realloc(gc_par.pools,
+						sizeof(M_GCCellPool*) * size);
+			m_assert_alloc(gc_par.pools);
+
+			gc_par.pool_size = size;
+		}
+
+		gc_par.pools[gc_par.npool ++] = pool;
+	}
+
+	m_slist_init(list);
+}
+
+/**Do the work of the parallel phase and leave it.*/
+static void
+gc_par_work (M_Thread *th, GCParPhase phase)
+{
+	if (phase == GC_PAR_MARK) {
+		M_GCWorker *w = gc_worker_get(th);
+
+		gc_mark_root(th);
+		gc_mark_objs(w);
+	} else {
+		gc_sweep_pools();
+	}
+
+	pthread_mutex_lock(&gc_par.lock);
+
+	if (!-- gc_par.nworker)
+		pthread_cond_broadcast(&gc_par.cond);
+
+	pthread_mutex_unlock(&gc_par.lock);
+}
+
+/**
+ * Run a parallel phase in the GC thread.
+ * The paused threads are woken up to join it as workers.
+ */
+static void
+gc_par_run (GCParPhase phase)
+{
+	pthread_mutex_lock(&gc_par.lock);
+
+	/*A small heap is collected by the GC thread alone.*/
+	gc_par.nmax    = (gc_allocated_size >= M_GC_PARALLEL_SIZE) ?
+				gc_max_workers : 1;
+	gc_par.nworker = 1;
+	m_atomic_store_relaxed(&gc_par.phase, phase);
+	m_atomic_store_relaxed(&gc_par.nidle, 0);
+	gc_par.done    = M_FALSE;
+	gc_par.gen ++;
+
+	pthread_mutex_unlock(&gc_par.lock);
+
+	/*Only wake up the threads can join.*/
+	if (gc_par.nmax > 1) {
+		pthread_mutex_lock(&m_gc_lock);
+		m_thread_wake_paused(gc_par.nmax - 1);
+		pthread_mutex_unlock(&m_gc_lock);
+	}
+
+	gc_par_work(gc_thread, phase);
+
+	/*Wait for the workers joined.*/
+	pthread_mutex_lock(&gc_par.lock);
+
+	while (gc_par.nworker)
+		pthread_cond_wait(&gc_par.cond, &gc_par.lock);
+
+	m_atomic_store_relaxed(&gc_par.phase, GC_PAR_NONE);
+
+	pthread_mutex_unlock(&gc_par.lock);
+}
+
+/**Mark objects.*/
+static void
+gc_do_mark (void)
+{
+	M_Thread *th;
+
+	M_DEBUG("mark objects");
+
+	m_list_foreach_value(th, &m_thread_list, node) {
+		th->gc_claim = 0;
+	}
+
+	gc_par.root_task = 0;
+
+	gc_par_run(GC_PAR_MARK);
 }
 
 /**Sweep unused objects.*/
 static void
-gc_sweep (void)
+gc_sweep (uint32_t flags)
 {
-	const M_GCObjDescr *descr;
 	M_GCPoolStub *stub;
-	M_GCCellPool *pool;
 	M_GCObjType type;
-	size_t old_size = gc_allocated_size;
+	int serial;
 
 	M_DEBUG("sweep objects");
 
-	for (type = 0; type < M_GC_OBJ_COUNT; type ++) {
-		M_SList full_pools, usable_pools;
-		M_GCCellPool *npool;
+	gc_par.npool    = 0;
+	gc_par.pool_pos = 0;
+	gc_par.freed    = 0;
 
-		descr = gc_obj_get_descr(type);
-		stub  = &gc_obj_stubs[type];
+	/*The pools whose finalizers must not run at the same time are put
+	 *after the others.*/
+	for (serial = 0; serial < 2; serial ++) {
+		for (type = 0; type < M_GC_OBJ_COUNT; type ++) {
+			const M_GCObjDescr *descr = gc_obj_get_descr(type);
 
-		full_pools   = stub->full_pools;
-		usable_pools = stub->usable_pools;
+			if (serial != (descr->final &&
+						!(descr->flags & M_GC_OBJ_FL_PAR_FINAL)))
+				continue;
 
-		m_slist_init(&stub->full_pools);
-		m_slist_init(&stub->usable_pools);
+			stub = &gc_obj_stubs[type];
 
-		m_slist_foreach_value_safe(pool, npool, &full_pools, node) {
-			gc_sweep_pool(descr, stub, pool);
+			gc_add_sweep_pools(&stub->full_pools);
+			gc_add_sweep_pools(&stub->usable_pools);
 		}
 
-		m_slist_foreach_value_safe(pool, npool, &usable_pools, node) {
-			gc_sweep_pool(descr, stub, pool);
-		}
+		if (!serial)
+			gc_par.npar = gc_par.npool;
 	}
 
-	M_DEBUG("collect %d bytes", old_size - gc_allocated_size);
+	/*No thread is running when clearing.*/
+	if (!(flags & M_GC_COLLECT_FL_CLEAR)) {
+		gc_par_run(GC_PAR_SWEEP);
+
+		gc_par.pool_pos = gc_par.npar;
+	}
+
+	gc_par.npar = gc_par.npool;
+	gc_sweep_pools();
+
+	M_DEBUG("collect %zu bytes", gc_par.freed);
 
+	gc_allocated_size -= gc_par.freed;
 	gc_last_allocated_size = gc_allocated_size;
 }
 
@@ -483,34 +786,19 @@ gc_sweep (void)
 static M_Bool
 gc_do_collect (uint32_t flags)
 {
-	M_Bool b;
-
 	switch (gc_status) {
 		case GC_STATUS_IDLE:
 			gc_status = GC_STATUS_MARK_ROOT;
 		case GC_STATUS_MARK_ROOT:
-			if (!(flags & M_GC_COLLECT_FL_CLEAR)) {
-				gc_mark_root();
-				gc_status = GC_STATUS_MARK_OBJ;
-				if (flags & M_GC_COLLECT_FL_INCREMENT)
-					return M_FALSE;
-			} else {
-				gc_status = GC_STATUS_MARK_OBJ;
-			}
 		case GC_STATUS_MARK_OBJ:
-			if (!(flags & M_GC_COLLECT_FL_CLEAR)) {
-				do {
-					b = gc_mark_objs();
-					if (b)
-						gc_status = GC_STATUS_SWEEP;
-					if (flags & M_GC_COLLECT_FL_INCREMENT)
-						return M_FALSE;
-				} while (!b);
-			} else {
-				gc_status = GC_STATUS_SWEEP;
-			}
+			/*The workers mark the roots and the objects in one phase.*/
+			if (!(flags & M_GC_COLLECT_FL_CLEAR))
+				gc_do_mark();
+			gc_status = GC_STATUS_SWEEP;
+			if (flags & M_GC_COLLECT_FL_INCREMENT)
+				return M_FALSE;
 		case GC_STATUS_SWEEP:
-			gc_sweep();
+			gc_sweep(flags);
 			gc_status = GC_STATUS_COMPACT;
 			if (flags & M_GC_COLLECT_FL_INCREMENT)
 				return M_FALSE;
@@ -705,10 +993,22 @@ gc_obj_startup (void)
 	}
 	M_INFO("gc gray stack size:%d", size);
 
-	gc_gray_stack.stack = M_NEW(void*, size);
-	m_assert_alloc(gc_gray_stack.stack);
-	gc_gray_stack.top = gc_gray_stack.stack;
-	gc_gray_stack.end = gc_gray_stack.stack + size;
+	gc_gray_stack_size = M_MAX(size, 2);
+
+	/*Get the maximum number of the parallel workers.*/
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	val = getenv("M_GC_WORKERS");
+	if (val)
+		n = strtol(val, NULL, 0);
+
+	gc_max_workers = ((n > 0) && (n != LONG_MAX)) ? n : 1;
+	M_INFO("gc max workers:%d", gc_max_workers);
+
+	/*Initialize the parallel collection state.*/
+	memset(&gc_par, 0, sizeof(gc_par));
+	pthread_mutex_init(&gc_par.lock, NULL);
+	pthread_cond_init(&gc_par.cond, NULL);
 
 	/*Stubs initialize.*/
 	for (type = 0; type < M_GC_OBJ_COUNT; type ++) {
@@ -749,8 +1049,14 @@ gc_obj_shutdown (void)
 	M_DEBUG("clear objcets");
 	gc_do_collect(M_GC_COLLECT_FL_CLEAR);
 
-	/*Free gray stack.*/
-	m_free(gc_gray_stack.stack);
+	/*Release the parallel collection state.*/
+	if (gc_par.gray)
+		m_free(gc_par.gray);
+	if (gc_par.pools)
+		m_free(gc_par.pools);
+
+	pthread_mutex_destroy(&gc_par.lock);
+	pthread_cond_destroy(&gc_par.cond);
 }
 
 void*
@@ -779,3 +1085,38 @@ m_gc_run (uint32_t flags)
 	pthread_mutex_unlock(&m_gc_lock);
 }
 
+M_Bool
+m_gc_help (void)
+{
+	M_Thread *th = m_thread_self();
+	GCParPhase phase;
+	M_GCWorker *w;
+
+	/*Checked again under the lock.*/
+	if (m_atomic_load_relaxed(&gc_par.phase) == GC_PAR_NONE)
+		return M_FALSE;
+
+	w = gc_worker_get(th);
+
+	pthread_mutex_lock(&gc_par.lock);
+
+	phase = gc_par.phase;
+	if ((phase == GC_PAR_NONE) || gc_par.done || (w->gen == gc_par.gen) ||
+				(gc_par.nworker >= gc_par.nmax)) {
+		pthread_mutex_unlock(&gc_par.lock);
+		return M_FALSE;
+	}
+
+	w->gen = gc_par.gen;
+	gc_par.nworker ++;
+
+	pthread_mutex_unlock(&gc_par.lock);
+
+	pthread_mutex_unlock(&m_gc_lock);
+
+	gc_par_work(th, phase);
+
+	pthread_mutex_lock(&m_gc_lock);
+
+	return M_TRUE;
+}
@@ -31,13 +31,13 @@ M_Hash gc_root_hash;
 static inline void*
 gc_root_get_key (const M_HashNode *node)
 {
-	return m_node_value(node, M_GCRootNode, node);
+	return m_node_value(node, M_GCRootNode, node)->ptr;
 }
 
 static inline void
-gc_root_free_node (void *ptr)
+gc_root_free_node (void *node)
 {
-	m_gc_free_buf(m_node_value(ptr, M_GCRootNode, node),
+	m_gc_free_buf(m_node_value(node, M_GCRootNode, node),
 				sizeof(M_GCRootNode), M_GC_RNODE_FLAGS);
 }
 
@@ -99,7 +99,7 @@ m_gc_add_root (void *ptr)
 		rn->ref = 1;
 		rn->ptr = ptr;
 
-		if (m_hash_resize(&gc_root_hash, &gc_root_hash_ops) != M_OK)
+		if (m_hash_resize_incr(&gc_root_hash, &gc_root_hash_ops) != M_OK)
 			m_assert_alloc(NULL);
 
 		m_hash_insert_with_kv(&gc_root_hash, &rn->node, kv,
@@ -0,0 +1,112 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "ic"
+
+#include <m_log.h>
+#include <m_ic.h>
+
+void
+m_ic_update (M_InlineCache *ic, M_Shape *shape, uint16_t id)
+{
+	M_ICEntry *ent;
+	uint32_t epoch;
+	uint8_t n;
+
+	assert(ic && shape);
+
+	m_atomic_fetch_add(&ic->misses, 1, M_ATOMIC_RELAXED);
+
+	if (shape->flags & M_SHAPE_FL_DICT)
+		return;
+
+	/*
+	 * Only the thread setting the busy bit changes the cache, so a slot
+	 * is never filled by 2 threads. A thread losing the race leaves the
+	 * cache to the winner and takes the slow path this time.
+	 */
+	n = m_atomic_load_relaxed(&ic->n);
+	if ((n & M_IC_BUSY) || !m_atomic_cas_strong(&ic->n, &n, n | M_IC_BUSY,
+				M_ATOMIC_ACQUIRE))
+		return;
+
+	epoch = m_shape_epoch;
+
+	if (ic->epoch != epoch) {
+		/*Drop the entries of the freed shapes.*/
+		n = 0;
+		m_atomic_store_release(&ic->n, M_IC_BUSY);
+		m_atomic_store_release(&ic->epoch, epoch);
+		m_atomic_store_relaxed(&ic->state, M_IC_UNINIT);
+	}
+
+	if (ic->state == M_IC_MEGA)
+		goto end;
+
+	if (n == M_IC_WAYS) {
+		M_DEBUG("inline cache %p is megamorphic", ic);
+		m_atomic_store_relaxed(&ic->state, M_IC_MEGA);
+		goto end;
+	}
+
+	ent = &ic->entries[n];
+
+	/*Readers recheck the shape after loading the index.*/
+	m_atomic_store_release(&ent->shape, NULL);
+	m_atomic_store_relaxed(&ent->id, id);
+	m_atomic_store_release(&ent->shape, shape);
+
+	n ++;
+	m_atomic_store_relaxed(&ic->state, (n == 1) ? M_IC_MONO : M_IC_POLY);
+end:
+	m_atomic_store_release(&ic->n, n);
+}
+
+M_Bool
+m_ic_get_miss (M_InlineCache *ic, M_Object *obj, M_Quark quark, M_Value *pv)
+{
+	const M_Property *prop;
+
+	prop = m_object_lookup(obj, quark);
+	if (prop) {
+		m_ic_update(ic, obj->shape, prop->id);
+		*pv = obj->v[prop->id];
+		return M_TRUE;
+	}
+
+	return m_object_get(obj, quark, pv);
+}
+
+M_Result
+m_ic_set_miss (M_InlineCache *ic, M_Object *obj, M_Quark quark, M_Value v)
+{
+	const M_Property *prop;
+
+	if (!(obj->flags & M_OBJ_FL_MUTABLE))
+		return M_FAILED;
+
+	prop = m_object_lookup(obj, quark);
+	if (prop && (prop->flags & M_PROP_FL_WRITABLE)) {
+		m_ic_update(ic, obj->shape, prop->id);
+		obj->v[prop->id] = v;
+		return M_OK;
+	}
+
+	return m_object_set(obj, quark, v);
+}
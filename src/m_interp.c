@@ -0,0 +1,727 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "interp"
+
+#include <math.h>
+#include <m_log.h>
+#include <m_malloc.h>
+#include <m_gc.h>
+#include <m_thread.h>
+#include <m_value.h>
+#include <m_string.h>
+#include <m_object.h>
+#include <m_array.h>
+#include <m_ic.h>
+#include <m_function.h>
+#include <m_module.h>
+#include <m_closure.h>
+#include <m_frame.h>
+#include <m_actor.h>
+#include <m_interp.h>
+#include <m_jit.h>
+
+/*Use "&&label" dispatch when the compiler supports it.*/
+#if defined(__GNUC__) && !defined(M_INTERP_SWITCH)
+	#define INTERP_COMPUTED_GOTO
+#endif
+
+const uint8_t m_opcode_lengths[M_OP_COUNT] = {
+#define M_OP(name, gen, len, ops) len,
+	M_OPCODES
+#undef M_OP
+};
+
+const char* m_opcode_names[M_OP_COUNT] = {
+#define M_OP(name, gen, len, ops) #name,
+	M_OPCODES
+#undef M_OP
+};
+
+const uint8_t m_opcode_generics[M_OP_COUNT] = {
+#define M_OP(name, gen, len, ops) M_OP_##gen,
+	M_OPCODES
+#undef M_OP
+};
+
+/**Create a value from a 64 bits integer.*/
+static inline M_Value
+value_from_int64 (int64_t i)
+{
+	if ((i >= INT_MIN) && (i <= INT_MAX))
+		return m_value_from_int((int)i);
+
+	return m_value_from_double((double)i);
+}
+
+/**Convert the value to boolean.*/
+static inline M_Bool
+value_to_bool (M_Value v)
+{
+	if (v == M_VALUE_TRUE)
+		return M_TRUE;
+	if (v == M_VALUE_FALSE)
+		return M_FALSE;
+
+	if (m_value_is_int(v))
+		return m_value_get_int(v) != 0;
+
+	if (m_value_is_double(v)) {
+		double d = m_value_get_double(v);
+
+		return (d != 0) && !isnan(d);
+	}
+
+	if (m_value_is_string(v))
+		return m_string_length(m_value_get_string(v)) != 0;
+
+	return !m_value_is_null(v);
+}
+
+/**Check if two values are equal.*/
+static M_Bool
+value_equal (M_Value v1, M_Value v2)
+{
+	if (v1 == v2)
+		return M_TRUE;
+
+	if (m_value_is_number(v1) && m_value_is_number(v2))
+		return m_value_get_number(v1) == m_value_get_number(v2);
+
+	if (m_value_is_string(v1) && m_value_is_string(v2))
+		return m_string_equal(m_value_get_string(v1), m_value_get_string(v2));
+
+	if (m_value_is_null(v1) || m_value_is_null(v2))
+		return m_value_is_null(v1) && m_value_is_null(v2);
+
+	if (m_value_is_ptr(v1) && m_value_is_ptr(v2))
+		return m_value_get_ptr(v1) == m_value_get_ptr(v2);
+
+	return M_FALSE;
+}
+
+/**Arithmetic operation slow path.*/
+static M_Result
+arith_op (M_Opcode op, M_Value v1, M_Value v2, M_Value *pr)
+{
+	double d1, d2, r;
+
+	if ((op == M_OP_ADD) && m_value_is_string(v1) && m_value_is_string(v2)) {
+		*pr = m_value_from_string(m_string_concat(m_value_get_string(v1),
+					m_value_get_string(v2)));
+		return M_OK;
+	}
+
+	if (!m_value_is_number(v1) || !m_value_is_number(v2))
+		return M_ERR_TYPE;
+
+	d1 = m_value_get_number(v1);
+	d2 = m_value_get_number(v2);
+
+	switch (op) {
+		case M_OP_ADD:
+			r = d1 + d2;
+			break;
+		case M_OP_SUB:
+			r = d1 - d2;
+			break;
+		case M_OP_MUL:
+			r = d1 * d2;
+			break;
+		case M_OP_DIV:
+			r = d1 / d2;
+			break;
+		default:
+			r = fmod(d1, d2);
+			break;
+	}
+
+	*pr = m_value_from_number(r);
+	return M_OK;
+}
+
+/**Compare operation slow path.*/
+static M_Result
+compare_op (M_Opcode op, M_Value v1, M_Value v2, M_Value *pr)
+{
+	M_Bool b;
+
+	if (m_value_is_number(v1) && m_value_is_number(v2)) {
+		double d1 = m_value_get_number(v1);
+		double d2 = m_value_get_number(v2);
+
+		b = (op == M_OP_LT) ? (d1 < d2) : (d1 <= d2);
+	} else if (m_value_is_string(v1) && m_value_is_string(v2)) {
+		int r = m_string_cmp(m_value_get_string(v1), m_value_get_string(v2));
+
+		b = (op == M_OP_LT) ? (r < 0) : (r <= 0);
+	} else {
+		return M_ERR_TYPE;
+	}
+
+	*pr = m_value_from_bool(b);
+	return M_OK;
+}
+
+/**Operands.*/
+#define A        ip[1]
+#define B        ip[2]
+#define C        ip[3]
+#define R(n)     regs[n]
+#define K(n)     consts[n]
+#define U16(off) m_bc_get_u16(ip + (off))
+#define S16(off) m_bc_get_s16(ip + (off))
+
+/**Load the hot state from the call stack record.*/
+#define LOAD_STATE()\
+	do {\
+		frame  = rec->frame;\
+		clos   = frame->closure;\
+		func   = clos->func;\
+		bc     = func->f.bc.bc;\
+		ip     = bc + rec->ip;\
+		regs   = frame->v;\
+		consts = func->module ? func->module->cv : NULL;\
+		ics    = func->f.bc.ics;\
+	} while (0)
+
+/**Save the instruction pointer to the call stack record.*/
+#define SAVE_STATE()\
+	do {\
+		rec->ip = ip - bc;\
+	} while (0)
+
+#ifdef INTERP_COMPUTED_GOTO
+	#define OP(name)       L_##name:
+	#define DISPATCH()     goto *labels[m_bc_get_op(ip)]
+	#define SWITCH_BEGIN()
+	#define SWITCH_END()
+#else
+	#define OP(name)       case M_OP_##name:
+	#define DISPATCH()     goto dispatch
+	#define SWITCH_BEGIN() dispatch: switch (m_bc_get_op(ip)) {
+	#define SWITCH_END()   default: goto op_error; }
+#endif
+
+/**Go to the next instruction.*/
+#define NEXT(len)\
+	do {\
+		ip += (len);\
+		DISPATCH();\
+	} while (0)
+
+#ifdef M_JIT_ENABLE
+/**
+ * Count a call or a loop iteration, compile the function when it is hot.
+ * The threads running the function may lose some counts, a failed
+ * compilation is not retried and the function stays interpreted.
+ */
+#define JIT_HOT()\
+	do {\
+		if (!m_atomic_load_relaxed(&func->f.bc.jit)) {\
+			uint32_t hot_ = m_atomic_load_relaxed(&func->f.bc.hot) + 1;\
+			m_atomic_store_relaxed(&func->f.bc.hot, hot_);\
+			if (hot_ == M_JIT_THRESHOLD)\
+				m_jit_compile(func);\
+		}\
+	} while (0)
+
+/**
+ * Run the machine code from the current instruction if it is compiled.
+ * The code stores the values in frames and allocates nothing.
+ */
+#define JIT_ENTER()\
+	do {\
+		M_JitCode *jit_ = m_atomic_load_acquire(&func->f.bc.jit);\
+		void *addr_;\
+		uint32_t b_, off_;\
+		if (jit_ && (addr_ = m_jit_addr(jit_, ip - bc))) {\
+			b_   = budget;\
+			off_ = jit_->entry(regs, consts, addr_, &b_);\
+			budget = b_;\
+			ip = bc + (off_ & ~M_JIT_EXIT_BAIL);\
+			if ((off_ & M_JIT_EXIT_BAIL) &&\
+						(m_atomic_fetch_add(&jit_->bails, 1, M_ATOMIC_RELAXED)\
+						== M_JIT_MAX_BAILS - 1)) {\
+				M_DEBUG("too many guard failures, stop entering the code");\
+				m_jit_disable(func);\
+			}\
+			if (!budget)\
+				goto yield;\
+		}\
+	} while (0)
+#else
+	#define JIT_HOT()
+	#define JIT_ENTER()
+#endif
+
+/**
+ * Jump to the offset.
+ * Backward jumps are the loops' safe points. The values are all in frames
+ * here, so the new borned objects can be dropped.
+ */
+#define JUMP(off)\
+	do {\
+		int16_t o_ = (off);\
+		ip += o_;\
+		if (o_ <= 0) {\
+			th->nb_top = nb_level;\
+			m_thread_poll();\
+			if (!-- budget)\
+				goto yield;\
+			JIT_HOT();\
+			JIT_ENTER();\
+		}\
+		DISPATCH();\
+	} while (0)
+
+/**Generic arithmetic operation.*/
+#define ARITH_GENERIC(name, int_expr)\
+	do {\
+		M_Value v1 = R(B), v2 = R(C);\
+		if (m_value_is_int(v1) && m_value_is_int(v2)) {\
+			int64_t i1 = m_value_get_int(v1);\
+			int64_t i2 = m_value_get_int(v2);\
+			R(A) = value_from_int64(int_expr);\
+		} else if (arith_op(M_OP_##name, v1, v2, &R(A)) != M_OK) {\
+			goto type_error;\
+		}\
+		NEXT(4);\
+	} while (0)
+
+/**Arithmetic instruction and its quickened variants.*/
+#define ARITH_OP(name, int_expr, dop)\
+	OP(name) {\
+		M_Value t1 = R(B), t2 = R(C);\
+		if (m_value_is_int(t1) && m_value_is_int(t2))\
+			m_bc_set_op(ip, M_OP_##name##_II);\
+		else if (m_value_is_double(t1) && m_value_is_double(t2))\
+			m_bc_set_op(ip, M_OP_##name##_DD);\
+		ARITH_GENERIC(name, int_expr);\
+	}\
+	OP(name##_II) {\
+		M_Value v1 = R(B), v2 = R(C);\
+		int64_t i1, i2;\
+		if (!m_value_is_int(v1) || !m_value_is_int(v2)) {\
+			m_bc_set_op(ip, M_OP_##name##_G);\
+			DISPATCH();\
+		}\
+		i1 = m_value_get_int(v1);\
+		i2 = m_value_get_int(v2);\
+		R(A) = value_from_int64(int_expr);\
+		NEXT(4);\
+	}\
+	OP(name##_DD) {\
+		M_Value v1 = R(B), v2 = R(C);\
+		if (!m_value_is_double(v1) || !m_value_is_double(v2)) {\
+			m_bc_set_op(ip, M_OP_##name##_G);\
+			DISPATCH();\
+		}\
+		R(A) = m_value_from_number(m_value_get_double(v1) dop\
+					m_value_get_double(v2));\
+		NEXT(4);\
+	}\
+	OP(name##_G) {\
+		ARITH_GENERIC(name, int_expr);\
+	}
+
+/**Generic compare operation.*/
+#define COMPARE_GENERIC(name, cop)\
+	do {\
+		M_Value v1 = R(B), v2 = R(C);\
+		if (m_value_is_int(v1) && m_value_is_int(v2)) {\
+			R(A) = m_value_from_bool(m_value_get_int(v1) cop m_value_get_int(v2));\
+		} else if (compare_op(M_OP_##name, v1, v2, &R(A)) != M_OK) {\
+			goto type_error;\
+		}\
+		NEXT(4);\
+	} while (0)
+
+/**
+ * Compare instruction and its quickened variants.
+ * A compare followed by a JMPF testing its result is fused.
+ */
+#define COMPARE_OP(name, cop)\
+	OP(name) {\
+		if (m_value_is_int(R(B)) && m_value_is_int(R(C))) {\
+			if ((ip + 8 <= bc + func->f.bc.bc_len) &&\
+						(m_bc_get_op(ip + 4) == M_OP_JMPF) && (ip[5] == A))\
+				m_bc_set_op(ip, M_OP_##name##JF_II);\
+			else\
+				m_bc_set_op(ip, M_OP_##name##_II);\
+		}\
+		COMPARE_GENERIC(name, cop);\
+	}\
+	OP(name##_II) {\
+		M_Value v1 = R(B), v2 = R(C);\
+		if (!m_value_is_int(v1) || !m_value_is_int(v2)) {\
+			m_bc_set_op(ip, M_OP_##name##_G);\
+			DISPATCH();\
+		}\
+		R(A) = m_value_from_bool(m_value_get_int(v1) cop m_value_get_int(v2));\
+		NEXT(4);\
+	}\
+	OP(name##_G) {\
+		COMPARE_GENERIC(name, cop);\
+	}\
+	OP(name##JF_II) {\
+		M_Value v1 = R(B), v2 = R(C);\
+		if (!m_value_is_int(v1) || !m_value_is_int(v2)) {\
+			m_bc_set_op(ip, M_OP_##name##_G);\
+			DISPATCH();\
+		}\
+		if (m_value_get_int(v1) cop m_value_get_int(v2)) {\
+			R(A) = M_VALUE_TRUE;\
+			NEXT(8);\
+		}\
+		R(A) = M_VALUE_FALSE;\
+		ip += 4;\
+		JUMP(S16(2));\
+	}
+
+M_Result
+m_interp_run (M_Actor *actor, uint32_t budget)
+{
+#ifdef INTERP_COMPUTED_GOTO
+	/*One entry for every byte value so an unknown opcode goes to op_error,
+	 *like the default case of the switch build.*/
+	static const void *labels[256] = {
+#define M_OP(name, gen, len, ops) &&L_##name,
+		M_OPCODES
+#undef M_OP
+		[M_OP_COUNT ... 255] = &&op_error
+	};
+#endif
+	M_Thread *th;
+	M_Stack *rec;
+	M_Frame *frame;
+	M_Closure *clos;
+	M_Function *func;
+	M_InlineCache *ics;
+	M_Value *regs, *consts;
+	uint8_t *bc, *ip;
+	size_t nb_level;
+
+	assert(actor && !m_slist_empty(&actor->stack));
+
+	th       = m_thread_self();
+	nb_level = th->nb_top;
+	rec      = m_actor_top(actor);
+
+	LOAD_STATE();
+	JIT_ENTER();
+	DISPATCH();
+
+	SWITCH_BEGIN()
+
+	OP(NOP) {
+		NEXT(1);
+	}
+
+	OP(MOVE) {
+		R(A) = R(B);
+		NEXT(3);
+	}
+
+	OP(LOADK) {
+		R(A) = K(U16(2));
+		NEXT(4);
+	}
+
+	OP(LOADI) {
+		R(A) = m_value_from_int(S16(2));
+		NEXT(4);
+	}
+
+	OP(LOADNULL) {
+		R(A) = 0;
+		NEXT(2);
+	}
+
+	OP(LOADBOOL) {
+		R(A) = m_value_from_bool(B ? M_TRUE : M_FALSE);
+		NEXT(3);
+	}
+
+	OP(GETUP)
+	OP(SETUP) {
+		/*Not converted by m_closure_convert().*/
+		goto op_error;
+	}
+
+	OP(GETUPV) {
+		R(A) = clos->upvs[U16(2)].v;
+		NEXT(4);
+	}
+
+	OP(GETBOX) {
+		R(A) = *clos->upvs[U16(2)].box->pv;
+		NEXT(4);
+	}
+
+	OP(SETBOX) {
+		*clos->upvs[U16(1)].box->pv = R(C);
+		NEXT(4);
+	}
+
+	ARITH_OP(ADD, i1 + i2, +)
+	ARITH_OP(SUB, i1 - i2, -)
+	ARITH_OP(MUL, i1 * i2, *)
+
+	OP(DIV) {
+		if (arith_op(M_OP_DIV, R(B), R(C), &R(A)) != M_OK)
+			goto type_error;
+		NEXT(4);
+	}
+
+	OP(MOD) {
+		M_Value v1 = R(B), v2 = R(C);
+
+		if (m_value_is_int(v1) && m_value_is_int(v2) && m_value_get_int(v2)) {
+			int64_t i1 = m_value_get_int(v1);
+			int64_t i2 = m_value_get_int(v2);
+
+			R(A) = value_from_int64(i1 % i2);
+		} else if (arith_op(M_OP_MOD, v1, v2, &R(A)) != M_OK) {
+			goto type_error;
+		}
+		NEXT(4);
+	}
+
+	OP(ADDI) {
+		M_Value v = R(B);
+		int8_t i = (int8_t)C;
+
+		if (m_value_is_int(v))
+			R(A) = value_from_int64((int64_t)m_value_get_int(v) + i);
+		else if (arith_op(M_OP_ADD, v, m_value_from_int(i), &R(A)) != M_OK)
+			goto type_error;
+		NEXT(4);
+	}
+
+	COMPARE_OP(LT, <)
+	COMPARE_OP(LE, <=)
+
+	OP(EQ) {
+		R(A) = m_value_from_bool(value_equal(R(B), R(C)));
+		NEXT(4);
+	}
+
+	OP(NE) {
+		R(A) = m_value_from_bool(!value_equal(R(B), R(C)));
+		NEXT(4);
+	}
+
+	OP(NOT) {
+		R(A) = m_value_from_bool(!value_to_bool(R(B)));
+		NEXT(3);
+	}
+
+	OP(JMP) {
+		JUMP(S16(1));
+	}
+
+	OP(JMPT) {
+		if (value_to_bool(R(A)))
+			JUMP(S16(2));
+		NEXT(4);
+	}
+
+	OP(JMPF) {
+		if (!value_to_bool(R(A)))
+			JUMP(S16(2));
+		NEXT(4);
+	}
+
+	OP(NEWOBJ) {
+		R(A) = m_value_from_object(m_object_new(0));
+		NEXT(2);
+	}
+
+	OP(GETPROP) {
+		M_Value ov = R(B);
+
+		if (!m_value_is_object(ov))
+			goto type_error;
+
+		if (!m_ic_get(&ics[U16(5)], m_value_get_object(ov),
+					m_value_get_string(K(U16(3))), &R(A)))
+			R(A) = 0;
+		NEXT(7);
+	}
+
+	OP(SETPROP) {
+		M_Value ov = R(A);
+
+		if (!m_value_is_object(ov))
+			goto type_error;
+
+		m_ic_set(&ics[U16(5)], m_value_get_object(ov),
+					m_value_get_string(K(U16(2))), R(ip[4]));
+		NEXT(7);
+	}
+
+	OP(NEWARR) {
+		R(A) = m_value_from_array(m_array_new(0));
+		NEXT(2);
+	}
+
+	OP(GETELEM) {
+		M_Value av = R(B), iv = R(C);
+
+		if (!m_value_is_array(av) || !m_value_is_int(iv) ||
+					(m_value_get_int(iv) < 0))
+			goto type_error;
+
+		if (!m_array_get(m_value_get_array(av), m_value_get_int(iv), &R(A)))
+			R(A) = 0;
+		NEXT(4);
+	}
+
+	OP(SETELEM) {
+		M_Value av = R(A), iv = R(B);
+
+		if (!m_value_is_array(av) || !m_value_is_int(iv) ||
+					(m_value_get_int(iv) < 0))
+			goto type_error;
+
+		m_array_set(m_value_get_array(av), m_value_get_int(iv), R(C));
+		NEXT(4);
+	}
+
+	OP(CLOSURE) {
+		M_Closure *nclos;
+
+		nclos = m_closure_new(func->module->funcs[U16(2)], frame, clos);
+		R(A)  = m_value_from_closure(nclos);
+		NEXT(4);
+	}
+
+	OP(CALL) {
+		M_Value fv = R(B);
+		M_Closure *nclos;
+		M_Function *nfunc;
+		M_Frame *nframe;
+		M_Stack *nrec;
+		uint32_t i, n;
+
+		if (!m_value_is_closure(fv))
+			goto type_error;
+
+		nclos = m_value_get_closure(fv);
+		nfunc = nclos->func;
+
+		if (nfunc->flags & M_FUNC_FL_NATIVE) {
+			M_Value r = 0;
+
+			nfunc->f.native(0, C, &R(B + 1), 1, &r);
+			R(A) = r;
+			NEXT(4);
+		}
+
+		rec->ip = ip + 4 - bc;
+
+		nrec   = m_actor_push(actor, nclos, nfunc->f.bc.nreg);
+		nframe = nrec->frame;
+
+		n = M_MIN(C, nfunc->f.bc.narg);
+		for (i = 0; i < n; i ++)
+			nframe->v[i] = R(B + 1 + i);
+
+		nrec->bottom = rec->bottom;
+		nrec->ret    = A;
+
+		rec = nrec;
+		LOAD_STATE();
+
+		if (!-- budget)
+			goto yield;
+
+		JIT_HOT();
+		JIT_ENTER();
+		DISPATCH();
+	}
+
+	OP(RET) {
+		M_Value r = R(A);
+		M_Bool last = (rec == rec->bottom);
+		uint8_t ret = rec->ret;
+
+		m_actor_pop(actor);
+
+		if (last) {
+			actor->retv = r;
+			th->nb_top  = nb_level;
+			return M_OK;
+		}
+
+		rec = m_actor_top(actor);
+		LOAD_STATE();
+
+		R(ret) = r;
+		th->nb_top = nb_level;
+		JIT_ENTER();
+		DISPATCH();
+	}
+
+	SWITCH_END()
+
+op_error:
+	M_DEBUG("illegal opcode %d at %d", m_bc_get_op(ip), (int)(ip - bc));
+	goto abandon;
+type_error:
+	M_DEBUG("%s type error at %d", m_opcode_names[m_bc_get_op(ip)],
+				(int)(ip - bc));
+abandon:
+	/*Abandon the call.*/
+	while (1) {
+		M_Stack *top = m_actor_top(actor);
+		M_Bool last = (top == top->bottom);
+
+		m_actor_pop(actor);
+
+		if (last)
+			break;
+	}
+
+	th->nb_top = nb_level;
+	return M_ERR_TYPE;
+yield:
+	SAVE_STATE();
+	th->nb_top = nb_level;
+	return M_NONE;
+}
+
+void
+m_interp_unquicken (M_Function *func)
+{
+	uint8_t *ip, *end;
+
+	assert(func && !(func->flags & M_FUNC_FL_NATIVE));
+
+	ip  = func->f.bc.bc;
+	end = ip + func->f.bc.bc_len;
+
+	while (ip < end) {
+		uint8_t op = m_opcode_generics[m_bc_get_op(ip)];
+
+		m_bc_set_op(ip, op);
+		ip += m_opcode_lengths[op];
+	}
+}
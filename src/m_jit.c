@@ -0,0 +1,729 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "jit"
+
+#include <m_log.h>
+#include <m_malloc.h>
+#include <m_gc.h>
+#include <m_thread.h>
+#include <m_atomic.h>
+#include <m_value.h>
+#include <m_opcode.h>
+#include <m_jit.h>
+
+#ifdef M_JIT_ENABLE
+
+/*x86-64 registers.*/
+enum {
+	RAX = 0,
+	RCX = 1,
+	RDX = 2,
+	RBX = 3,
+	RBP = 5,
+	RSI = 6,
+	RDI = 7,
+	R14 = 14
+};
+
+/*Registers holding the entry's arguments.*/
+#define REGS   RBX
+#define CONSTS RBP
+#define BUDGET R14
+
+/*Condition codes.*/
+enum {
+	CC_E  = 0x4,
+	CC_NE = 0x5,
+	CC_L  = 0xC,
+	CC_GE = 0xD,
+	CC_LE = 0xE,
+	CC_G  = 0xF
+};
+
+/*Opcode extensions in the ModRM reg field.*/
+enum {
+	EXT_ADD  = 0,
+	EXT_OR   = 1,
+	EXT_DEC  = 1,
+	EXT_SHL  = 4,
+	EXT_AND  = 4,
+	EXT_SAR  = 7,
+	EXT_CMP  = 7,
+	EXT_IDIV = 7
+};
+
+/*Code offset of the epilogue.*/
+#define EPILOGUE 15
+
+/**Jump patch type.*/
+typedef enum {
+	PATCH_INST, /**< Jump to an instruction.*/
+	PATCH_BACK, /**< Backward jump to an instruction through the budget check.*/
+	PATCH_BAIL  /**< Exit from a failed guard.*/
+} JitPatchType;
+
+/**Jump to be patched.*/
+typedef struct {
+	uint32_t pos;    /**< Position of the 32 bits displacement.*/
+	uint32_t target; /**< The target instruction's offset.*/
+	uint32_t type;   /**< Patch type.*/
+} JitPatch;
+
+/**Compiler state.*/
+typedef struct {
+	M_Function *func;     /**< The function.*/
+	uint8_t    *buf;      /**< Code buffer.*/
+	uint32_t    len;      /**< Code length.*/
+	uint32_t    cap;      /**< Code buffer's size.*/
+	uint32_t   *addrs;    /**< Instructions' code offsets.*/
+	uint8_t    *targets;  /**< The instruction is a jump target.*/
+	JitPatch   *patches;  /**< Jumps to be patched.*/
+	uint32_t    npatch;   /**< Number of patches.*/
+	uint32_t    patch_cap;/**< Patch buffer's size.*/
+	M_Bool      oom;      /**< An allocation failed, the code is dropped.*/
+} JitState;
+
+/*After an allocation failed, the code is only measured, not stored.*/
+static void
+jit_byte (JitState *s, uint8_t b)
+{
+	if ((s->len >= s->cap) && !s->oom) {
+		uint32_t cap = M_MAX(s->cap * 2, 256);
+		uint8_t *buf;
+
+		buf = m_realloc(s->buf, cap);
+		if (buf) {
+			s->buf = buf;
+			s->cap = cap;
+		} else {
+			s->oom = M_TRUE;
+		}
+	}
+
+	if (s->oom) {
+		s->len ++;
+		return;
+	}
+
+	s->buf[s->len ++] = b;
+}
+
+static void
+jit_u32 (JitState *s, uint32_t v)
+{
+	jit_byte(s, v);
+	jit_byte(s, v >> 8);
+	jit_byte(s, v >> 16);
+	jit_byte(s, v >> 24);
+}
+
+static void
+jit_set_u32 (JitState *s, uint32_t pos, uint32_t v)
+{
+	if (s->oom)
+		return;
+
+	s->buf[pos]     = v;
+	s->buf[pos + 1] = v >> 8;
+	s->buf[pos + 2] = v >> 16;
+	s->buf[pos + 3] = v >> 24;
+}
+
+/*Opcode with an optional 0x0F prefix.*/
+static void
+jit_op (JitState *s, uint32_t op)
+{
+	if (op > 0xFF)
+		jit_byte(s, op >> 8);
+	jit_byte(s, op);
+}
+
+static void
+jit_rex (JitState *s, int w, int reg, int rm)
+{
+	uint8_t rex = 0x40 | (w ? 8 : 0) | ((reg & 8) >> 1) | ((rm & 8) >> 3);
+
+	if (rex != 0x40)
+		jit_byte(s, rex);
+}
+
+/*Register to register instruction.*/
+static void
+jit_rr (JitState *s, int w, uint32_t op, int reg, int rm)
+{
+	jit_rex(s, w, reg, rm);
+	jit_op(s, op);
+	jit_byte(s, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/*Register and memory instruction, the memory is [base + disp].*/
+static void
+jit_mem (JitState *s, int w, uint32_t op, int reg, int base, int32_t disp)
+{
+	uint8_t modrm = ((reg & 7) << 3) | (base & 7);
+
+	assert((base & 7) != 4);
+
+	jit_rex(s, w, reg, base);
+	jit_op(s, op);
+
+	if (!disp && ((base & 7) != 5)) {
+		jit_byte(s, modrm);
+	} else if ((disp >= -128) && (disp <= 127)) {
+		jit_byte(s, 0x40 | modrm);
+		jit_byte(s, disp);
+	} else {
+		jit_byte(s, 0x80 | modrm);
+		jit_u32(s, disp);
+	}
+}
+
+/*Register with 8 bits immediate instruction.*/
+static void
+jit_ri8 (JitState *s, int w, uint32_t op, int ext, int rm, int8_t imm)
+{
+	jit_rr(s, w, op, ext, rm);
+	jit_byte(s, imm);
+}
+
+/*reg = R(n)*/
+static void
+jit_load (JitState *s, int reg, uint32_t n)
+{
+	jit_mem(s, 1, 0x8B, reg, REGS, n * sizeof(M_Value));
+}
+
+/*R(n) = reg*/
+static void
+jit_store (JitState *s, uint32_t n, int reg)
+{
+	jit_mem(s, 1, 0x89, reg, REGS, n * sizeof(M_Value));
+}
+
+/*R(n) = v, v is a sign extended 32 bits value.*/
+static void
+jit_store_imm (JitState *s, uint32_t n, M_Value v)
+{
+	jit_mem(s, 1, 0xC7, 0, REGS, n * sizeof(M_Value));
+	jit_u32(s, v);
+}
+
+static void
+jit_add_patch (JitState *s, uint32_t pos, uint32_t target, JitPatchType type)
+{
+	JitPatch *p;
+
+	if (s->oom)
+		return;
+
+	if (s->npatch == s->patch_cap) {
+		uint32_t cap = M_MAX(s->patch_cap * 2, 16);
+
+		p = m_realloc(s->patches, cap * sizeof(JitPatch));
+		if (!p) {
+			s->oom = M_TRUE;
+			return;
+		}
+
+		s->patches   = p;
+		s->patch_cap = cap;
+	}
+
+	p = &s->patches[s->npatch ++];
+	p->pos    = pos;
+	p->target = target;
+	p->type   = type;
+}
+
+/*Conditional jump, cc < 0 means always.*/
+static uint32_t
+jit_jcc (JitState *s, int cc)
+{
+	if (cc < 0) {
+		jit_byte(s, 0xE9);
+	} else {
+		jit_byte(s, 0x0F);
+		jit_byte(s, 0x80 | cc);
+	}
+
+	jit_u32(s, 0);
+	return s->len - 4;
+}
+
+/*Jump to the byte code offset "target" from the instruction at "off".*/
+static void
+jit_jump (JitState *s, int cc, uint32_t off, uint32_t target)
+{
+	uint32_t pos = jit_jcc(s, cc);
+
+	jit_add_patch(s, pos, target, (target <= off) ? PATCH_BACK : PATCH_INST);
+}
+
+/*Exit to the interpreter at the instruction at "off" if cc holds.*/
+static void
+jit_bail (JitState *s, int cc, uint32_t off)
+{
+	jit_add_patch(s, jit_jcc(s, cc), off, PATCH_BAIL);
+}
+
+/*Return the value to the interpreter.*/
+static void
+jit_exit (JitState *s, uint32_t v)
+{
+	uint32_t pos;
+
+	jit_byte(s, 0xB8);
+	jit_u32(s, v);
+	pos = jit_jcc(s, -1);
+	jit_set_u32(s, pos, EPILOGUE - (pos + 4));
+}
+
+/*Bail out if the value in rax is not an integer.*/
+static void
+jit_guard_int (JitState *s, uint32_t off)
+{
+	jit_rr(s, 0, 0x89, RAX, RCX);
+	jit_ri8(s, 0, 0x83, EXT_AND, RCX, M_VALUE_TYPE_MASK);
+	jit_ri8(s, 0, 0x83, EXT_CMP, RCX, M_VALUE_TYPE_INT);
+	jit_bail(s, CC_NE, off);
+}
+
+/*
+ * Load R(b) to rax and R(c) to rdx, bail out if any of them is not an
+ * integer. No other type's tag has both the integer tag's bits.
+ */
+static void
+jit_guard_int2 (JitState *s, uint32_t off, uint32_t b, uint32_t c)
+{
+	jit_load(s, RAX, b);
+	jit_load(s, RDX, c);
+	jit_rr(s, 0, 0x89, RAX, RCX);
+	jit_rr(s, 0, 0x21, RDX, RCX);
+	jit_ri8(s, 0, 0x83, EXT_AND, RCX, M_VALUE_TYPE_MASK);
+	jit_ri8(s, 0, 0x83, EXT_CMP, RCX, M_VALUE_TYPE_INT);
+	jit_bail(s, CC_NE, off);
+}
+
+/*Untag the integers in rax and rdx.*/
+static void
+jit_untag2 (JitState *s)
+{
+	jit_ri8(s, 1, 0xC1, EXT_SAR, RAX, M_VALUE_TYPE_SHIFT);
+	jit_ri8(s, 1, 0xC1, EXT_SAR, RDX, M_VALUE_TYPE_SHIFT);
+}
+
+/*Tag rax and store it to R(a), the value must be in "int" range.*/
+static void
+jit_tag_store (JitState *s, uint32_t a)
+{
+	jit_ri8(s, 1, 0xC1, EXT_SHL, RAX, M_VALUE_TYPE_SHIFT);
+	jit_ri8(s, 1, 0x83, EXT_OR, RAX, M_VALUE_TYPE_INT);
+	jit_store(s, a, RAX);
+}
+
+/*
+ * Tag rax and store it to R(a). The interpreter converts the results out
+ * of "int" range to double precision numbers.
+ */
+static void
+jit_check_tag_store (JitState *s, uint32_t off, uint32_t a)
+{
+	jit_rr(s, 1, 0x63, RCX, RAX);
+	jit_rr(s, 1, 0x39, RAX, RCX);
+	jit_bail(s, CC_NE, off);
+	jit_tag_store(s, a);
+}
+
+/*Integer comparison, R(a) = rax cc rdx.*/
+static void
+jit_compare (JitState *s, uint32_t off, int cc)
+{
+	uint8_t *ip = s->func->f.bc.bc + off;
+
+	jit_guard_int2(s, off, ip[2], ip[3]);
+	/*Tagged integers have the same order as their values.*/
+	jit_rr(s, 1, 0x39, RDX, RAX);
+	jit_rr(s, 0, 0x0F90 | cc, 0, RCX);
+	jit_rr(s, 0, 0x0FB6, RCX, RCX);
+	jit_ri8(s, 0, 0xC1, EXT_SHL, RCX, M_VALUE_TYPE_SHIFT);
+	jit_ri8(s, 0, 0x83, EXT_OR, RCX, M_VALUE_FALSE);
+	jit_store(s, ip[1], RCX);
+}
+
+/*Check if the instruction at "off" can be fused with the following JMPF.*/
+static M_Bool
+jit_can_fuse (JitState *s, uint32_t off)
+{
+	uint8_t *ip = s->func->f.bc.bc + off;
+
+	return (off + 8 <= s->func->f.bc.bc_len) &&
+				(m_opcode_generics[m_bc_get_op(ip + 4)] == M_OP_JMPF) &&
+				(ip[5] == ip[1]) && !s->targets[off + 4];
+}
+
+/*Operands.*/
+#define A ip[1]
+#define B ip[2]
+#define C ip[3]
+
+/*Emit the instruction's template, return its length in byte code.*/
+static uint32_t
+jit_inst (JitState *s, uint32_t off)
+{
+	uint8_t *ip = s->func->f.bc.bc + off;
+	uint8_t op = m_opcode_generics[m_bc_get_op(ip)];
+
+	switch (op) {
+		case M_OP_NOP:
+			break;
+		case M_OP_MOVE:
+			jit_load(s, RAX, B);
+			jit_store(s, A, RAX);
+			break;
+		case M_OP_LOADK:
+			jit_mem(s, 1, 0x8B, RAX, CONSTS,
+						m_bc_get_u16(ip + 2) * sizeof(M_Value));
+			jit_store(s, A, RAX);
+			break;
+		case M_OP_LOADI:
+			jit_store_imm(s, A, m_value_from_int(m_bc_get_s16(ip + 2)));
+			break;
+		case M_OP_LOADNULL:
+			jit_store_imm(s, A, 0);
+			break;
+		case M_OP_LOADBOOL:
+			jit_store_imm(s, A, B ? M_VALUE_TRUE : M_VALUE_FALSE);
+			break;
+		case M_OP_ADD:
+		case M_OP_SUB:
+		case M_OP_MUL:
+			jit_guard_int2(s, off, B, C);
+			jit_untag2(s);
+			if (op == M_OP_ADD)
+				jit_rr(s, 1, 0x01, RDX, RAX);
+			else if (op == M_OP_SUB)
+				jit_rr(s, 1, 0x29, RDX, RAX);
+			else
+				jit_rr(s, 1, 0x0FAF, RAX, RDX);
+			jit_check_tag_store(s, off, A);
+			break;
+		case M_OP_MOD:
+			jit_guard_int2(s, off, B, C);
+			jit_untag2(s);
+			jit_rr(s, 1, 0x85, RDX, RDX);
+			jit_bail(s, CC_E, off);
+			jit_rr(s, 1, 0x89, RDX, RCX);
+			jit_byte(s, 0x48);
+			jit_byte(s, 0x99);
+			jit_rr(s, 1, 0xF7, EXT_IDIV, RCX);
+			jit_rr(s, 1, 0x89, RDX, RAX);
+			jit_tag_store(s, A);
+			break;
+		case M_OP_ADDI:
+			jit_load(s, RAX, B);
+			jit_guard_int(s, off);
+			jit_ri8(s, 1, 0xC1, EXT_SAR, RAX, M_VALUE_TYPE_SHIFT);
+			jit_ri8(s, 1, 0x83, EXT_ADD, RAX, (int8_t)C);
+			jit_check_tag_store(s, off, A);
+			break;
+		case M_OP_LT:
+		case M_OP_LE:
+			jit_compare(s, off, (op == M_OP_LT) ? CC_L : CC_LE);
+			if (jit_can_fuse(s, off)) {
+				/*Branch on the flags of the comparison.*/
+				jit_rr(s, 1, 0x39, RDX, RAX);
+				jit_jump(s, (op == M_OP_LT) ? CC_GE : CC_G, off + 4,
+							off + 4 + m_bc_get_s16(ip + 6));
+				return 8;
+			}
+			break;
+		case M_OP_JMP:
+			jit_jump(s, -1, off, off + m_bc_get_s16(ip + 1));
+			break;
+		case M_OP_JMPT:
+		case M_OP_JMPF:
+			jit_load(s, RAX, A);
+			jit_ri8(s, 1, 0x83, EXT_CMP, RAX,
+						(op == M_OP_JMPT) ? M_VALUE_TRUE : M_VALUE_FALSE);
+			jit_jump(s, CC_E, off, off + m_bc_get_s16(ip + 2));
+			jit_ri8(s, 1, 0x83, EXT_CMP, RAX,
+						(op == M_OP_JMPT) ? M_VALUE_FALSE : M_VALUE_TRUE);
+			jit_bail(s, CC_NE, off);
+			break;
+		default:
+			/*Let the interpreter run it.*/
+			jit_exit(s, off);
+			break;
+	}
+
+	return m_opcode_lengths[op];
+#undef A
+#undef B
+#undef C
+}
+
+/*Mark the jump targets.*/
+static void
+jit_scan_targets (JitState *s)
+{
+	uint8_t *bc = s->func->f.bc.bc;
+	uint32_t off, len = s->func->f.bc.bc_len;
+	int32_t target;
+	uint8_t op;
+
+	for (off = 0; off < len; off += m_opcode_lengths[op]) {
+		op = m_opcode_generics[m_bc_get_op(bc + off)];
+
+		switch (op) {
+			case M_OP_JMP:
+				target = off + m_bc_get_s16(bc + off + 1);
+				break;
+			case M_OP_JMPT:
+			case M_OP_JMPF:
+				target = off + m_bc_get_s16(bc + off + 2);
+				break;
+			default:
+				continue;
+		}
+
+		if ((target >= 0) && ((uint32_t)target < len))
+			s->targets[target] = 1;
+	}
+}
+
+/*Emit the exit stubs and patch the jumps.*/
+static void
+jit_patch (JitState *s)
+{
+	uint32_t len = s->func->f.bc.bc_len;
+	uint32_t *bail_stubs, *back_stubs;
+	uint32_t i, dest;
+
+	bail_stubs = m_malloc0(len * sizeof(uint32_t));
+	back_stubs = m_malloc0(len * sizeof(uint32_t));
+	if (!bail_stubs || !back_stubs) {
+		s->oom = M_TRUE;
+		goto end;
+	}
+
+	for (i = 0; i < s->npatch; i ++) {
+		JitPatch *p = &s->patches[i];
+		uint32_t t = p->target;
+
+		if (t >= len) {
+			dest = s->len;
+			jit_exit(s, t);
+		} else if (p->type == PATCH_BAIL) {
+			if (!bail_stubs[t]) {
+				bail_stubs[t] = s->len;
+				jit_exit(s, t | M_JIT_EXIT_BAIL);
+			}
+			dest = bail_stubs[t];
+		} else if (!s->addrs[t]) {
+			dest = s->len;
+			jit_exit(s, t);
+		} else if (p->type == PATCH_INST) {
+			dest = s->addrs[t];
+		} else {
+			if (!back_stubs[t]) {
+				uintptr_t page = (uintptr_t)m_thread_poll_page;
+				uint32_t budget_pos, pos;
+
+				back_stubs[t] = s->len;
+
+				/*if (!-- *budget) exit*/
+				jit_mem(s, 0, 0xFF, EXT_DEC, BUDGET, 0);
+				budget_pos = jit_jcc(s, CC_E);
+
+				/*Safe point poll: mov eax, [m_thread_poll_page]*/
+				jit_byte(s, 0x48);
+				jit_byte(s, 0xB8 | RAX);
+				jit_u32(s, page);
+				jit_u32(s, ((uint64_t)page) >> 32);
+				jit_mem(s, 0, 0x8B, RAX, RAX, 0);
+
+				pos = jit_jcc(s, -1);
+				jit_set_u32(s, pos, s->addrs[t] - (pos + 4));
+
+				jit_set_u32(s, budget_pos, s->len - (budget_pos + 4));
+				jit_exit(s, t);
+			}
+			dest = back_stubs[t];
+		}
+
+		jit_set_u32(s, p->pos, dest - (p->pos + 4));
+	}
+
+end:
+	m_free(bail_stubs);
+	m_free(back_stubs);
+}
+
+M_Result
+m_jit_compile (M_Function *func)
+{
+	JitState s;
+	M_JitCode *jit = NULL;
+	uint32_t off, len;
+	M_Result r = M_ERR_NO_MEM;
+
+	assert(func && !(func->flags & M_FUNC_FL_NATIVE));
+
+	if (m_atomic_load_acquire(&func->f.bc.jit))
+		return M_OK;
+
+	len = func->f.bc.bc_len;
+
+	memset(&s, 0, sizeof(s));
+	s.func    = func;
+	s.addrs   = m_malloc0(len * sizeof(uint32_t));
+	s.targets = m_malloc0(len);
+	if (!s.addrs || !s.targets)
+		goto end;
+
+	jit_scan_targets(&s);
+
+	/*push rbx; push rbp; push r14*/
+	jit_byte(&s, 0x53);
+	jit_byte(&s, 0x55);
+	jit_byte(&s, 0x41);
+	jit_byte(&s, 0x56);
+	/*mov rbx, rdi; mov rbp, rsi; mov r14, rcx*/
+	jit_rr(&s, 1, 0x89, RDI, REGS);
+	jit_rr(&s, 1, 0x89, RSI, CONSTS);
+	jit_rr(&s, 1, 0x89, RCX, BUDGET);
+	/*jmp rdx*/
+	jit_byte(&s, 0xFF);
+	jit_byte(&s, 0xE2);
+
+	/*pop r14; pop rbp; pop rbx; ret*/
+	assert(s.len == EPILOGUE);
+	jit_byte(&s, 0x41);
+	jit_byte(&s, 0x5E);
+	jit_byte(&s, 0x5D);
+	jit_byte(&s, 0x5B);
+	jit_byte(&s, 0xC3);
+
+	for (off = 0; off < len; ) {
+		s.addrs[off] = s.len;
+		off += jit_inst(&s, off);
+	}
+
+	jit_patch(&s);
+
+	if (s.oom)
+		goto end;
+
+	jit = m_malloc0(sizeof(M_JitCode));
+	if (!jit)
+		goto end;
+
+	jit->code = m_gc_alloc_buf(s.len, M_GC_BUF_FL_EXECUTABLE);
+	if (!jit->code)
+		goto end;
+
+	jit->size = s.len;
+	memcpy(jit->code, s.buf, s.len);
+
+	if ((r = m_gc_exec_buf(jit->code, s.len)) != M_OK)
+		goto end;
+
+	jit->entry = (M_JitEntry)jit->code;
+	jit->addrs = s.addrs;
+	s.addrs    = NULL;
+
+	/*Another thread may compile the function at the same time.*/
+	if (m_atomic_ptr_cas(&func->f.bc.jit, NULL, jit)) {
+		M_DEBUG("compiled %uB byte code to %uB machine code", len, s.len);
+		jit = NULL;
+	}
+
+	r = M_OK;
+end:
+	if (r != M_OK)
+		M_DEBUG("compile failed: %d, keep interpreting", r);
+
+	if (jit) {
+		if (jit->code)
+			m_gc_free_buf(jit->code, jit->size, M_GC_BUF_FL_EXECUTABLE);
+		m_free(jit->addrs);
+		m_free(jit);
+	}
+
+	m_free(s.addrs);
+	m_free(s.buf);
+	m_free(s.targets);
+	m_free(s.patches);
+	return r;
+}
+
+void
+m_jit_disable (M_Function *func)
+{
+	M_JitCode *jit;
+	uint32_t i;
+
+	assert(func && !(func->flags & M_FUNC_FL_NATIVE));
+
+	jit = m_atomic_load_acquire(&func->f.bc.jit);
+	if (!jit)
+		return;
+
+	for (i = 0; i < func->f.bc.bc_len; i ++)
+		m_atomic_store_relaxed(&jit->addrs[i], 0);
+}
+
+void
+m_jit_release (M_Function *func)
+{
+	M_JitCode *jit;
+
+	assert(func && !(func->flags & M_FUNC_FL_NATIVE));
+
+	jit = m_atomic_load_acquire(&func->f.bc.jit);
+	if (!jit)
+		return;
+
+	m_atomic_store_relaxed(&func->f.bc.jit, NULL);
+
+	m_gc_free_buf(jit->code, jit->size, M_GC_BUF_FL_EXECUTABLE);
+	m_free(jit->addrs);
+	m_free(jit);
+}
+
+#else /*!M_JIT_ENABLE*/
+
+M_Result
+m_jit_compile (M_Function *func)
+{
+	return M_FAILED;
+}
+
+void
+m_jit_disable (M_Function *func)
+{
+}
+
+void
+m_jit_release (M_Function *func)
+{
+}
+
+#endif /*M_JIT_ENABLE*/
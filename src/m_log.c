@@ -19,7 +19,49 @@
 
 #define M_LOG_TAG "log"
 
+#include <errno.h>
+#include <stddef.h>
 #include <m_log.h>
+#include <m_atomic.h>
+
+/**Default size in bytes of a thread's asynchronous log ring.*/
+#ifndef M_LOG_ASYNC_RING_SIZE
+	#define M_LOG_ASYNC_RING_SIZE (64 * 1024)
+#endif
+
+/**Maximum size in bytes of an asynchronous log record.*/
+#ifndef M_LOG_ASYNC_REC_MAX
+	#define M_LOG_ASYNC_REC_MAX 1024
+#endif
+
+/**Maximum length of a tag, file or function name stored in a record.*/
+#ifndef M_LOG_ASYNC_NAME_MAX
+	#define M_LOG_ASYNC_NAME_MAX 128
+#endif
+
+#if M_LOG_ASYNC_REC_MAX > 0xffff
+	#error "M_LOG_ASYNC_REC_MAX must fit in the 16 bits string offsets"
+#endif
+
+/**Size in bytes of the writer thread's output batch.*/
+#ifndef M_LOG_ASYNC_BATCH
+	#define M_LOG_ASYNC_BATCH (64 * 1024)
+#endif
+
+/**Maximum length of a formatted message line.*/
+#ifndef M_LOG_ASYNC_LINE_MAX
+	#define M_LOG_ASYNC_LINE_MAX 4096
+#endif
+
+/**Milliseconds the writer thread sleeps when all the rings are empty.*/
+#ifndef M_LOG_ASYNC_PERIOD
+	#define M_LOG_ASYNC_PERIOD 10
+#endif
+
+/**Cache line size used to separate a ring's read and write positions.*/
+#ifndef M_LOG_CACHE_LINE
+	#define M_LOG_CACHE_LINE 64
+#endif
 
 #define M_LOG_FL_TAG   1
 #define M_LOG_FL_FILE  2
@@ -31,97 +73,254 @@
 #define M_LOG_FL_LEVEL 128
 #define M_LOG_FL_ALL  0xffffffff
 
+/**Asynchronous backend mode.*/
+typedef enum {
+	LOG_ASYNC_OFF,  /**< Write on the calling thread.*/
+	LOG_ASYNC_DROP, /**< Drop the message when the ring is full.*/
+	LOG_ASYNC_BLOCK /**< Wait for the writer when the ring is full.*/
+} LogAsync;
+
+/**Log record type.*/
+typedef enum {
+	LOG_REC_PAD,  /**< Unused space at the end of the ring.*/
+	LOG_REC_ARGS, /**< Format string and binary arguments.*/
+	LOG_REC_TEXT  /**< Message formatted by the calling thread.*/
+} LogRecType;
+
+/**
+ * Log record header in a ring.
+ * The caller's strings may be freed before the writer thread formats the
+ * record, so they are copied after the arguments and referenced by their
+ * offsets from the record start. Offset 0 is a NULL string.
+ */
+typedef struct {
+	uint32_t        size;  /**< Record size in bytes.*/
+	uint16_t        type;  /**< Record type.*/
+	uint16_t        level; /**< Output level.*/
+	int             line;  /**< Line number.*/
+	uint16_t        tag;   /**< Offset of the message tag.*/
+	uint16_t        file;  /**< Offset of the file name.*/
+	uint16_t        func;  /**< Offset of the function name.*/
+	uint16_t        fmt;   /**< Offset of the format string.*/
+	struct timespec ts;    /**< Time the message was logged.*/
+} LogRec;
+
+/**Size of the record header, records and arguments are 8 bytes aligned.*/
+#define LOG_REC_HEAD M_ALIGN_UP(sizeof(LogRec), 8)
+
+/**Get a string stored in the record.*/
+#define LOG_REC_STR(rec, off) ((off) ? (const char*)(rec) + (off) : NULL)
+
+/**Argument class of a conversion specification.*/
+typedef enum {
+	LOG_ARG_NONE,    /**< "%%".*/
+	LOG_ARG_INT,     /**< int.*/
+	LOG_ARG_LONG,    /**< long.*/
+	LOG_ARG_LLONG,   /**< long long.*/
+	LOG_ARG_INTMAX,  /**< intmax_t.*/
+	LOG_ARG_SIZE,    /**< size_t.*/
+	LOG_ARG_PTRDIFF, /**< ptrdiff_t.*/
+	LOG_ARG_DOUBLE,  /**< double.*/
+	LOG_ARG_LDOUBLE, /**< long double.*/
+	LOG_ARG_PTR,     /**< Pointer.*/
+	LOG_ARG_STR,     /**< String, copied into the record.*/
+	LOG_ARG_BAD      /**< Not supported, format on the calling thread.*/
+} LogArg;
+
+/**Maximum length of a conversion specification.*/
+#define LOG_SPEC_MAX 32
+
+/**Conversion specification.*/
+typedef struct {
+	const char *start;      /**< The '%' character.*/
+	const char *end;        /**< The character after the conversion.*/
+	M_Bool      width_star; /**< The width is an argument.*/
+	M_Bool      prec_star;  /**< The precision is an argument.*/
+	LogArg      arg;        /**< Argument class.*/
+} LogSpec;
+
+/**Per thread single producer single consumer ring.*/
+typedef struct LogRing_s LogRing;
+struct LogRing_s {
+	LogRing  *next;    /**< Next ring in the list.*/
+	uint8_t  *buf;     /**< Ring buffer.*/
+	size_t    size;    /**< Buffer size, power of 2.*/
+	int       used;    /**< The ring is owned by a thread.*/
+	uint64_t  dropped; /**< Dropped messages count.*/
+	uint64_t  blocked; /**< Blocked messages count.*/
+	uint64_t  noticed; /**< Dropped messages already reported.*/
+	size_t    chead;   /**< Write position seen by the writer.*/
+	size_t    ctail;   /**< Read position of the writer.*/
+	/**Write position, only changed by the owner thread.*/
+	size_t    head __attribute__((aligned(M_LOG_CACHE_LINE)));
+	/**Read position, published by the writer after the data is written.*/
+	size_t    tail __attribute__((aligned(M_LOG_CACHE_LINE)));
+};
+
+/**Output buffer.*/
+typedef struct {
+	char     *buf;  /**< Buffer.*/
+	size_t    size; /**< Buffer size.*/
+	size_t    len;  /**< Length of the data.*/
+	time_t    sec;  /**< Second of the cached local time.*/
+	struct tm date; /**< Cached local time.*/
+} LogOut;
+
+/**Output level set for a tag name.*/
+typedef struct LogTagLevel_s LogTagLevel;
+struct LogTagLevel_s {
+	LogTagLevel *next;   /**< Next level in the list.*/
+	M_LogLevel   level;  /**< Output level.*/
+	char         name[]; /**< Tag name.*/
+};
+
 static pthread_mutex_t lock;
 static FILE      *log_fp;
 static M_LogLevel log_level;
 static uint32_t   log_flags;
 
-void
-m_log_startup (void)
-{
-	const char *val;
+static pthread_mutex_t log_tag_lock = PTHREAD_MUTEX_INITIALIZER;
+static M_LogTag       *log_tags;
+static LogTagLevel    *log_tag_levels;
 
-	/*Mutex initialize.*/
-	pthread_mutex_init(&lock, NULL);
+static LogAsync        log_async;
+static size_t          log_ring_size;
+static LogRing        *log_rings;
+static pthread_key_t   log_key;
+static pthread_t       log_writer;
+static pthread_mutex_t log_wait_lock;
+static pthread_cond_t  log_wait_cond;
+static int             log_writer_sleep;
+static int             log_writer_stop;
+static char            log_batch[M_LOG_ASYNC_BATCH];
+static LogOut          log_batch_out = {.buf = log_batch,
+						.size = sizeof(log_batch)};
+static uint64_t        log_written;
+static uint64_t        log_bytes;
 
-	/*Open log file.*/
-	val = getenv("M_LOG_FILE");
-	if (val) {
-		log_fp = fopen(val, "ab");
-	} else {
-		log_fp = NULL;
+/**Parse the name of a log level.*/
+static M_LogLevel
+log_level_parse (const char *val)
+{
+#define LOG_LEVEL_CHECK(name)\
+	if (!strcasecmp(val, #name)) {\
+		return M_LOG_LEVEL_##name;\
 	}
 
-	if (!log_fp) {
-		log_fp = stdout;
-	}
+	LOG_LEVEL_CHECK(ALL)
+	LOG_LEVEL_CHECK(DEBUG)
+	LOG_LEVEL_CHECK(INFO)
+	LOG_LEVEL_CHECK(WARNING)
+	LOG_LEVEL_CHECK(ERROR)
+	LOG_LEVEL_CHECK(FATAL)
+	LOG_LEVEL_CHECK(NONE)
 
-	/*Get log level.*/
-	val = getenv("M_LOG_LEVEL");
-	if (val) {
-#define LOG_LEVEL_CHECK(name)\
-		if (!strcasecmp(val, #name)) {\
-			log_level = M_LOG_LEVEL_##name;\
-		} else
-
-		LOG_LEVEL_CHECK(ALL)
-		LOG_LEVEL_CHECK(DEBUG)
-		LOG_LEVEL_CHECK(INFO)
-		LOG_LEVEL_CHECK(WARNING)
-		LOG_LEVEL_CHECK(ERROR)
-		LOG_LEVEL_CHECK(FATAL)
-		LOG_LEVEL_CHECK(NONE)
-		{
-			log_level = M_LOG_LEVEL_ALL;
+	return M_LOG_LEVEL_ALL;
+}
+
+/**Compute the enable mask of a tag, the tag lock must be held.*/
+static void
+log_tag_update (M_LogTag *tag)
+{
+	M_LogLevel level = log_level;
+	LogTagLevel *tl;
+	uint32_t mask;
+
+	for (tl = log_tag_levels; tl; tl = tl->next) {
+		if (!strcmp(tl->name, tag->name)) {
+			level = tl->level;
+			break;
 		}
-	} else {
-		log_level = M_LOG_LEVEL_NONE;
 	}
 
-	/*Get log pattern.*/
-	val = getenv("M_LOG_PATTERN");
-	if (val) {
-		log_flags = 0;
+	mask = ((1 << M_LOG_LEVEL_NONE) - 1) & ~((1 << level) - 1);
 
-#define LOG_FLAG_CHECK(name, ch)\
-		if (strchr(val, ch)) {\
-			log_flags |= M_LOG_FL_##name;\
-		}
+	m_atomic_store_relaxed(&tag->mask, mask | M_LOG_TAG_READY);
+}
 
-		LOG_FLAG_CHECK(TAG,  'T')
-		LOG_FLAG_CHECK(LEVEL,'L')
-		LOG_FLAG_CHECK(FILE, 'F')
-		LOG_FLAG_CHECK(FUNC, 'f')
-		LOG_FLAG_CHECK(LINE, 'l')
-		LOG_FLAG_CHECK(DATE, 'd')
-		LOG_FLAG_CHECK(TIME, 't')
-		LOG_FLAG_CHECK(USEC, 'u')
-	} else {
-		log_flags = M_LOG_FL_ALL;
+M_Bool
+m_log_tag_init (M_LogTag *tag, M_LogLevel level)
+{
+	uint32_t mask;
+
+	pthread_mutex_lock(&log_tag_lock);
+
+	if (!(tag->mask & M_LOG_TAG_READY)) {
+		log_tag_update(tag);
+		tag->next = log_tags;
+		log_tags  = tag;
 	}
+
+	mask = tag->mask;
+
+	pthread_mutex_unlock(&log_tag_lock);
+
+	return (mask >> level) & 1;
 }
 
-void
-m_log_shutdown (void)
+M_Result
+m_log_set_level (const char *tag, M_LogLevel level)
 {
-	if (log_fp && (log_fp != stdout)) {
-		fclose(log_fp);
+	LogTagLevel *tl = NULL;
+	M_LogTag *t;
+
+	pthread_mutex_lock(&log_tag_lock);
+
+	if (!tag) {
+		log_level = level;
+	} else {
+		for (tl = log_tag_levels; tl; tl = tl->next) {
+			if (!strcmp(tl->name, tag))
+				break;
+		}
+
+		if (!tl) {
+			tl = malloc(sizeof(LogTagLevel) + strlen(tag) + 1);
+			if (!tl) {
+				pthread_mutex_unlock(&log_tag_lock);
+				return M_ERR_NO_MEM;
+			}
+
+			strcpy(tl->name, tag);
+			tl->next = log_tag_levels;
+			log_tag_levels = tl;
+		}
+
+		tl->level = level;
 	}
 
-	pthread_mutex_destroy(&lock);
+	for (t = log_tags; t; t = t->next)
+		log_tag_update(t);
+
+	pthread_mutex_unlock(&log_tag_lock);
+
+	return M_OK;
 }
 
-void
-m_log (M_LogLevel level, const char *tag, const char *file, const char *func,
-		int line, const char *fmt, ...)
+/**Append formatted text to the output buffer, truncate if it is full.*/
+static void
+log_out (LogOut *out, const char *fmt, ...)
 {
+	size_t left = out->size - out->len;
 	va_list ap;
-	M_Bool sep = M_FALSE;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(out->buf + out->len, left, fmt, ap);
+	va_end(ap);
 
-	if (level < log_level)
+	if (n < 0)
 		return;
 
-	pthread_mutex_lock(&lock);
+	out->len += M_MIN((size_t)n, left - 1);
+}
+
+/**Format the message prefix selected by the log pattern.*/
+static void
+log_prefix (LogOut *out, M_LogLevel level, const char *tag, const char *file,
+		const char *func, int line, const struct timespec *ts)
+{
+	M_Bool sep = M_FALSE;
 
 	/*Output level information.*/
 	if (log_flags & M_LOG_FL_LEVEL) {
@@ -146,97 +345,1059 @@ m_log (M_LogLevel level, const char *tag, const char *file, const char *func,
 				break;
 		}
 
-		fprintf(log_fp, "%c", ch);
+		log_out(out, "%c", ch);
 		sep = M_TRUE;
 	}
 
 	/*Output tag.*/
 	if (log_flags & M_LOG_FL_TAG) {
 		if (sep)
-			fprintf(log_fp, "/");
+			log_out(out, "/");
 
-		fprintf(log_fp, "%8s", tag);
+		log_out(out, "%8s", tag);
 		sep = M_TRUE;
 	}
 
 	/*Output filename.*/
 	if (log_flags & M_LOG_FL_FILE) {
 		if (sep)
-			fprintf(log_fp, ":");
+			log_out(out, ":");
 
-		fprintf(log_fp, "\"%15s\"", file);
+		log_out(out, "\"%15s\"", file);
 		sep = M_TRUE;
 	}
 
 	/*Output function name.*/
 	if (log_flags & M_LOG_FL_FUNC) {
 		if (sep)
-			fprintf(log_fp, " ");
+			log_out(out, " ");
 
-		fprintf(log_fp, "(%10s)", func);
+		log_out(out, "(%10s)", func);
 		sep = M_TRUE;
 	}
 
 	/*Output line number*/
 	if (log_flags & M_LOG_FL_LINE) {
 		if (sep)
-			fprintf(log_fp, " ");
+			log_out(out, " ");
 
-		fprintf(log_fp, "%5d", line);
+		log_out(out, "%5d", line);
 		sep = M_TRUE;
 	}
 
 	/*Output date and time.*/
 	if (log_flags & (M_LOG_FL_DATE | M_LOG_FL_TIME | M_LOG_FL_USEC)) {
-		struct timespec ts;
-		struct tm *date;
+		struct tm *date = &out->date;
 
 		if (sep)
-			fprintf(log_fp, " ");
-
-		clock_gettime(CLOCK_REALTIME, &ts);
+			log_out(out, " ");
 
 		if (log_flags & (M_LOG_FL_DATE | M_LOG_FL_TIME)) {
-			date = localtime(&ts.tv_sec);
+			/*The writer thread converts the time once per second.*/
+			if (out->sec != ts->tv_sec) {
+				localtime_r(&ts->tv_sec, date);
+				out->sec = ts->tv_sec;
+			}
 
 			if (log_flags & M_LOG_FL_DATE) {
-				fprintf(log_fp, "%04d-%02d-%02d", date->tm_year + 1900,
+				log_out(out, "%04d-%02d-%02d", date->tm_year + 1900,
 							date->tm_mon + 1,
 							date->tm_mday);
 			}
 
 			if (log_flags & M_LOG_FL_TIME) {
 				if (log_flags & M_LOG_FL_DATE)
-					fprintf(log_fp, " ");
+					log_out(out, " ");
 
-				fprintf(log_fp, "%02d:%02d:%02d", date->tm_hour,
+				log_out(out, "%02d:%02d:%02d", date->tm_hour,
 							date->tm_min,
 							date->tm_sec);
 			}
 		}
 
 		if (log_flags & M_LOG_FL_TIME) {
-			fprintf(log_fp, ".%06d", ts.tv_nsec / 1000);
+			log_out(out, ".%06d", (int)(ts->tv_nsec / 1000));
 		} else {
 			if (log_flags & M_LOG_FL_DATE)
-				fprintf(log_fp, " ");
+				log_out(out, " ");
 
-			fprintf(log_fp, "%10u", ts.tv_nsec / 1000 + ts.tv_sec * 1000000);
+			log_out(out, "%10u",
+					(unsigned)(ts->tv_nsec / 1000 + ts->tv_sec * 1000000));
 		}
 
 		sep = M_TRUE;
 	}
 
 	if (sep)
-		fprintf(log_fp, ": ");
+		log_out(out, ": ");
+}
+
+/**
+ * Parse a conversion specification.
+ * \param p The character after '%'.
+ * \param[out] spec Return the specification.
+ */
+static void
+log_spec_parse (const char *p, LogSpec *spec)
+{
+	int len = 0;
+
+	spec->start      = p - 1;
+	spec->width_star = M_FALSE;
+	spec->prec_star  = M_FALSE;
+
+	if (*p == '%') {
+		spec->arg = LOG_ARG_NONE;
+		spec->end = p + 1;
+		return;
+	}
+
+	while (*p && strchr("-+ #0'", *p))
+		p ++;
+
+	if (*p == '*') {
+		spec->width_star = M_TRUE;
+		p ++;
+	} else {
+		while (isdigit(*p))
+			p ++;
+	}
+
+	if (*p == '.') {
+		p ++;
+
+		if (*p == '*') {
+			spec->prec_star = M_TRUE;
+			p ++;
+		} else {
+			while (isdigit(*p))
+				p ++;
+		}
+	}
+
+	switch (*p) {
+		case 'h':
+			len = *p ++;
+			if (*p == 'h')
+				p ++;
+			break;
+		case 'l':
+			len = *p ++;
+			if (*p == 'l') {
+				len = 'q';
+				p ++;
+			}
+			break;
+		case 'q':
+		case 'j':
+		case 'z':
+		case 't':
+		case 'L':
+			len = *p ++;
+			break;
+	}
+
+	switch (*p) {
+		case 'd':
+		case 'i':
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+			switch (len) {
+				case 0:
+				case 'h':
+					spec->arg = LOG_ARG_INT;
+					break;
+				case 'l':
+					spec->arg = LOG_ARG_LONG;
+					break;
+				case 'q':
+					spec->arg = LOG_ARG_LLONG;
+					break;
+				case 'j':
+					spec->arg = LOG_ARG_INTMAX;
+					break;
+				case 'z':
+					spec->arg = LOG_ARG_SIZE;
+					break;
+				case 't':
+					spec->arg = LOG_ARG_PTRDIFF;
+					break;
+				default:
+					spec->arg = LOG_ARG_BAD;
+					break;
+			}
+			break;
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			if (len == 'L')
+				spec->arg = LOG_ARG_LDOUBLE;
+			else if ((len == 0) || (len == 'l'))
+				spec->arg = LOG_ARG_DOUBLE;
+			else
+				spec->arg = LOG_ARG_BAD;
+			break;
+		case 'c':
+			spec->arg = len ? LOG_ARG_BAD : LOG_ARG_INT;
+			break;
+		case 's':
+			spec->arg = len ? LOG_ARG_BAD : LOG_ARG_STR;
+			break;
+		case 'p':
+			spec->arg = len ? LOG_ARG_BAD : LOG_ARG_PTR;
+			break;
+		default:
+			/*"%n", "%m", wide characters and broken specifications.*/
+			spec->arg = LOG_ARG_BAD;
+			return;
+	}
+
+	spec->end = p + 1;
+
+	if (spec->end - spec->start > LOG_SPEC_MAX)
+		spec->arg = LOG_ARG_BAD;
+}
+
+/**Store an argument in the record buffer.*/
+#define LOG_PUT(type, v)\
+	do {\
+		type _v = (v);\
+		if (pos + M_ALIGN_UP(sizeof(type), 8) > size)\
+			return (size_t)-1;\
+		memcpy(buf + pos, &_v, sizeof(type));\
+		pos += M_ALIGN_UP(sizeof(type), 8);\
+	} while (0)
+
+/**Load an argument from the record buffer.*/
+#define LOG_GET(type, v)\
+	do {\
+		memcpy(&(v), buf + pos, sizeof(type));\
+		pos += M_ALIGN_UP(sizeof(type), 8);\
+	} while (0)
+
+/**
+ * Store the arguments of a message in binary form.
+ * \return The size of the arguments, or (size_t)-1 if the format
+ * string is not supported or the arguments are too big.
+ */
+static size_t
+log_encode (uint8_t *buf, size_t size, const char *fmt, va_list ap)
+{
+	const char *p = fmt;
+	size_t pos = 0;
+	LogSpec spec;
+
+	while ((p = strchr(p, '%'))) {
+		log_spec_parse(p + 1, &spec);
+		p = spec.end;
+
+		if (spec.arg == LOG_ARG_BAD)
+			return (size_t)-1;
+		if (spec.width_star)
+			LOG_PUT(int, va_arg(ap, int));
+		if (spec.prec_star)
+			LOG_PUT(int, va_arg(ap, int));
+
+		switch (spec.arg) {
+			case LOG_ARG_INT:
+				LOG_PUT(int, va_arg(ap, int));
+				break;
+			case LOG_ARG_LONG:
+				LOG_PUT(long, va_arg(ap, long));
+				break;
+			case LOG_ARG_LLONG:
+				LOG_PUT(long long, va_arg(ap, long long));
+				break;
+			case LOG_ARG_INTMAX:
+				LOG_PUT(intmax_t, va_arg(ap, intmax_t));
+				break;
+			case LOG_ARG_SIZE:
+				LOG_PUT(size_t, va_arg(ap, size_t));
+				break;
+			case LOG_ARG_PTRDIFF:
+				LOG_PUT(ptrdiff_t, va_arg(ap, ptrdiff_t));
+				break;
+			case LOG_ARG_DOUBLE:
+				LOG_PUT(double, va_arg(ap, double));
+				break;
+			case LOG_ARG_LDOUBLE:
+				LOG_PUT(long double, va_arg(ap, long double));
+				break;
+			case LOG_ARG_PTR:
+				LOG_PUT(void*, va_arg(ap, void*));
+				break;
+			case LOG_ARG_STR: {
+				const char *s = va_arg(ap, const char*);
+				uint32_t len;
+
+				/*NULL is stored as length 0xffffffff, long strings are truncated.*/
+				if (!s) {
+					LOG_PUT(uint32_t, 0xffffffff);
+				} else {
+					if (pos + 8 >= size)
+						return (size_t)-1;
+
+					len = M_MIN(strlen(s), size - pos - 8);
+					LOG_PUT(uint32_t, len);
+					memcpy(buf + pos, s, len);
+					pos += M_ALIGN_UP(len, 8);
+				}
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	return pos;
+}
+
+/**Format a message from its format string and binary arguments.*/
+static void
+log_decode (LogOut *out, const char *fmt, const uint8_t *buf)
+{
+	const char *p = fmt, *pc;
+	size_t pos = 0;
+	char sbuf[LOG_SPEC_MAX + 32];
+	LogOut sout = {.buf = sbuf, .size = sizeof(sbuf)};
+	LogSpec spec;
+
+	while ((pc = strchr(p, '%'))) {
+		if (pc != p)
+			log_out(out, "%.*s", (int)(pc - p), p);
+
+		log_spec_parse(pc + 1, &spec);
+		p = spec.end;
+
+		if (spec.arg == LOG_ARG_NONE) {
+			log_out(out, "%%");
+			continue;
+		}
+
+		/*Rebuild the specification with the "*" values filled in.*/
+		sout.len = 0;
+
+		for (pc = spec.start; pc < spec.end; pc ++) {
+			int v;
+
+			if (*pc != '*') {
+				sbuf[sout.len ++] = *pc;
+				continue;
+			}
+
+			LOG_GET(int, v);
+
+			if ((pc[-1] == '.') && (v < 0)) {
+				/*Negative precision is taken as if it was omitted.*/
+				sout.len --;
+			} else {
+				log_out(&sout, "%d", v);
+			}
+		}
+
+		sbuf[sout.len] = 0;
+
+		switch (spec.arg) {
+			case LOG_ARG_INT: {
+				int v;
+				LOG_GET(int, v);
+				log_out(out, sbuf, v);
+				break;
+			}
+			case LOG_ARG_LONG: {
+				long v;
+				LOG_GET(long, v);
+				log_out(out, sbuf, v);
+				break;
+			}
+			case LOG_ARG_LLONG: {
+				long long v;
+				LOG_GET(long long, v);
+				log_out(out, sbuf, v);
+				break;
+			}
+			case LOG_ARG_INTMAX: {
+				intmax_t v;
+				LOG_GET(intmax_t, v);
+				log_out(out, sbuf, v);
+				break;
+			}
+			case LOG_ARG_SIZE: {
+				size_t v;
+				LOG_GET(size_t, v);
+				log_out(out, sbuf, v);
+				break;
+			}
+			case LOG_ARG_PTRDIFF: {
+				ptrdiff_t v;
+				LOG_GET(ptrdiff_t, v);
+				log_out(out, sbuf, v);
+				break;
+			}
+			case LOG_ARG_DOUBLE: {
+				double v;
+				LOG_GET(double, v);
+				log_out(out, sbuf, v);
+				break;
+			}
+			case LOG_ARG_LDOUBLE: {
+				long double v;
+				LOG_GET(long double, v);
+				log_out(out, sbuf, v);
+				break;
+			}
+			case LOG_ARG_PTR: {
+				void *v;
+				LOG_GET(void*, v);
+				log_out(out, sbuf, v);
+				break;
+			}
+			case LOG_ARG_STR: {
+				uint32_t len;
+				char str[M_LOG_ASYNC_REC_MAX];
+
+				LOG_GET(uint32_t, len);
+
+				if (len == 0xffffffff) {
+					log_out(out, sbuf, NULL);
+				} else {
+					memcpy(str, buf + pos, len);
+					str[len] = 0;
+					pos += M_ALIGN_UP(len, 8);
+					log_out(out, sbuf, str);
+				}
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	log_out(out, "%s", p);
+}
+
+/**Write the output batch and release the ring space it was formatted from.*/
+static void
+log_batch_write (void)
+{
+	int fd = fileno(log_fp);
+	size_t off = 0;
+	LogRing *r;
+
+	while (off < log_batch_out.len) {
+		ssize_t n = write(fd, log_batch + off, log_batch_out.len - off);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		off += n;
+	}
+
+	m_atomic_store_relaxed(&log_bytes, log_bytes + off);
+	log_batch_out.len = 0;
+
+	for (r = m_atomic_load_acquire(&log_rings); r; r = r->next) {
+		if (r->tail != r->ctail)
+			m_atomic_store_release(&r->tail, r->ctail);
+	}
+}
+
+/**Get the next message record of the ring, skip the padding.*/
+static LogRec*
+log_ring_peek (LogRing *r)
+{
+	LogRec *rec;
+
+	for (;;) {
+		if (r->ctail == r->chead) {
+			r->chead = m_atomic_load_acquire(&r->head);
+
+			if (r->ctail == r->chead)
+				return NULL;
+		}
+
+		rec = (LogRec*)(r->buf + (r->ctail & (r->size - 1)));
+		if (rec->type != LOG_REC_PAD)
+			return rec;
+
+		r->ctail += rec->size;
+	}
+}
+
+/**Check if the timestamp "a" is earlier than "b".*/
+static inline M_Bool
+log_ts_before (const struct timespec *a, const struct timespec *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec < b->tv_sec;
+
+	return a->tv_nsec < b->tv_nsec;
+}
+
+/**
+ * Write out all the records in the rings.
+ * The rings are merged by timestamp so the threads' messages interleave
+ * in the order they were logged.
+ * \return The number of messages written.
+ */
+static size_t
+log_drain (void)
+{
+	LogRing *r, *best;
+	LogRec *rec, *brec = NULL;
+	size_t n = 0;
+
+	for (r = m_atomic_load_acquire(&log_rings); r; r = r->next) {
+		uint64_t dropped = m_atomic_load_relaxed(&r->dropped);
+		struct timespec ts;
+
+		if (dropped == r->noticed)
+			continue;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		log_prefix(&log_batch_out, M_LOG_LEVEL_WARNING, M_LOG_TAG, __FILE__,
+				__FUNCTION__, __LINE__, &ts);
+		log_out(&log_batch_out, "%"PRIu64" messages dropped\n",
+				dropped - r->noticed);
+		r->noticed = dropped;
+	}
+
+	for (;;) {
+		best = NULL;
+
+		for (r = m_atomic_load_acquire(&log_rings); r; r = r->next) {
+			rec = log_ring_peek(r);
+
+			if (rec && (!best || log_ts_before(&rec->ts, &brec->ts))) {
+				best = r;
+				brec = rec;
+			}
+		}
+
+		if (!best)
+			break;
+
+		if (log_batch_out.size - log_batch_out.len < M_LOG_ASYNC_LINE_MAX)
+			log_batch_write();
+
+		log_prefix(&log_batch_out, brec->level, LOG_REC_STR(brec, brec->tag),
+				LOG_REC_STR(brec, brec->file),
+				LOG_REC_STR(brec, brec->func), brec->line, &brec->ts);
+
+		if (brec->type == LOG_REC_TEXT)
+			log_out(&log_batch_out, "%s", (char*)brec + LOG_REC_HEAD);
+		else
+			log_decode(&log_batch_out, LOG_REC_STR(brec, brec->fmt),
+					(uint8_t*)brec + LOG_REC_HEAD);
+
+		log_out(&log_batch_out, "\n");
+
+		best->ctail += brec->size;
+		n ++;
+	}
+
+	log_batch_write();
+
+	m_atomic_store_relaxed(&log_written, log_written + n);
+
+	return n;
+}
+
+/**Writer thread.*/
+static void*
+log_writer_entry (void *arg)
+{
+	for (;;) {
+		M_Bool stop = m_atomic_load_acquire(&log_writer_stop);
+		struct timespec ts;
+
+		if (log_drain())
+			continue;
+
+		if (stop)
+			break;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += M_LOG_ASYNC_PERIOD * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec ++;
+			ts.tv_nsec -= 1000000000;
+		}
+
+		pthread_mutex_lock(&log_wait_lock);
+		m_atomic_store_relaxed(&log_writer_sleep, 1);
+		if (!m_atomic_load_relaxed(&log_writer_stop))
+			pthread_cond_timedwait(&log_wait_cond, &log_wait_lock, &ts);
+		m_atomic_store_relaxed(&log_writer_sleep, 0);
+		pthread_mutex_unlock(&log_wait_lock);
+	}
+
+	return NULL;
+}
+
+/**Wake up the writer thread if it is sleeping.*/
+static void
+log_writer_wake (void)
+{
+	if (m_atomic_load_relaxed(&log_writer_sleep)) {
+		pthread_mutex_lock(&log_wait_lock);
+		pthread_cond_signal(&log_wait_cond);
+		pthread_mutex_unlock(&log_wait_lock);
+	}
+}
+
+/**Release the ring when its thread exits, the writer still drains it.*/
+static void
+log_key_destructor (void *data)
+{
+	LogRing *r = data;
+
+	m_atomic_store_release(&r->used, 0);
+}
+
+/**Get the current thread's ring.*/
+static LogRing*
+log_ring_get (void)
+{
+	LogRing *r = pthread_getspecific(log_key);
+
+	if (r)
+		return r;
+
+	/*Reuse a ring released by an exited thread.*/
+	for (r = m_atomic_load_acquire(&log_rings); r; r = r->next) {
+		int unused = 0;
+
+		if (!m_atomic_load_relaxed(&r->used)
+				&& m_atomic_cas_strong(&r->used, &unused, 1,
+					M_ATOMIC_ACQUIRE))
+			break;
+	}
+
+	/*Allocate a new ring. The logger does not use m_malloc as the
+	 *allocator itself outputs log messages.*/
+	if (!r) {
+		LogRing *head;
+
+		if (posix_memalign((void**)&r, M_LOG_CACHE_LINE, sizeof(LogRing)))
+			return NULL;
+
+		memset(r, 0, sizeof(LogRing));
+
+		r->size = log_ring_size;
+		r->used = 1;
+		r->buf  = malloc(r->size);
+		if (!r->buf) {
+			free(r);
+			return NULL;
+		}
+
+		head = m_atomic_load_relaxed(&log_rings);
+		do {
+			r->next = head;
+		} while (!m_atomic_cas_weak(&log_rings, &head, r, M_ATOMIC_RELEASE));
+	}
+
+	pthread_setspecific(log_key, r);
+
+	return r;
+}
+
+/**
+ * Copy a string to the end of a record.
+ * \param rec The record.
+ * \param pos The position in the record to store the string.
+ * \param max Maximum length of the string, longer strings are truncated.
+ * \param[out] off Return the string's offset in the record.
+ * \param s The string.
+ * \return The position after the string.
+ */
+static size_t
+log_rec_put_str (LogRec *rec, size_t pos, size_t max, uint16_t *off,
+		const char *s)
+{
+	size_t len;
+
+	if (!s) {
+		*off = 0;
+		return pos;
+	}
+
+	len = strnlen(s, max);
+	memcpy((char*)rec + pos, s, len);
+	((char*)rec)[pos + len] = 0;
+	*off = pos;
+
+	return pos + len + 1;
+}
+
+/**
+ * Store a message in the current thread's ring.
+ * \retval M_OK The message is queued.
+ * \retval M_NONE The message is dropped.
+ * \retval M_FAILED The ring is not available, output the message directly.
+ */
+static M_Result
+log_async_put (M_LogLevel level, const char *tag, const char *file,
+		const char *func, int line, const char *fmt, va_list ap)
+{
+	uint64_t rbuf[M_LOG_ASYNC_REC_MAX / 8];
+	LogRec *rec = (LogRec*)rbuf;
+	uint8_t *args = (uint8_t*)rbuf + LOG_REC_HEAD;
+	size_t nsize = 3 * (M_LOG_ASYNC_NAME_MAX + 1);
+	size_t asize = sizeof(rbuf) - LOG_REC_HEAD - nsize;
+	size_t flen = strlen(fmt) + 1;
+	size_t size, head, off, pad, used;
+	M_Bool blocked = M_FALSE;
+	LogRing *r;
+	va_list aq;
+
+	if (!(r = log_ring_get()))
+		return M_FAILED;
+
+	clock_gettime(CLOCK_REALTIME, &rec->ts);
+	rec->type  = LOG_REC_ARGS;
+	rec->level = level;
+	rec->line  = line;
+	rec->fmt   = 0;
+
+	/*The format string is stored with the arguments, a long one is
+	 *formatted here instead.*/
+	size = (size_t)-1;
+	if (flen < asize) {
+		va_copy(aq, ap);
+		size = log_encode(args, asize - flen, fmt, aq);
+		va_end(aq);
+	}
+
+	if (size == (size_t)-1) {
+		/*Format the message here, it is truncated if it is too long.*/
+		int n = vsnprintf((char*)args, asize, fmt, ap);
+
+		size = (n < 0) ? 0 : M_MIN((size_t)n, asize - 1);
+		args[size ++] = 0;
+		size += LOG_REC_HEAD;
+		rec->type = LOG_REC_TEXT;
+	} else {
+		size += LOG_REC_HEAD;
+		size = log_rec_put_str(rec, size, flen - 1, &rec->fmt, fmt);
+	}
+
+	size = log_rec_put_str(rec, size, M_LOG_ASYNC_NAME_MAX, &rec->tag, tag);
+	size = log_rec_put_str(rec, size, M_LOG_ASYNC_NAME_MAX, &rec->file, file);
+	size = log_rec_put_str(rec, size, M_LOG_ASYNC_NAME_MAX, &rec->func, func);
+
+	size = M_ALIGN_UP(size, 8);
+	rec->size = size;
+
+	/*A record never wraps around, the rest of the ring is padded.*/
+	head = r->head;
+	off  = head & (r->size - 1);
+	pad  = (r->size - off < size) ? r->size - off : 0;
+
+	for (;;) {
+		used = head - m_atomic_load_acquire(&r->tail);
+
+		if (used + pad + size <= r->size)
+			break;
+
+		if (m_atomic_load_relaxed(&log_async) == LOG_ASYNC_DROP) {
+			m_atomic_store_relaxed(&r->dropped, r->dropped + 1);
+			log_writer_wake();
+			return M_NONE;
+		}
+
+		if (!blocked) {
+			m_atomic_store_relaxed(&r->blocked, r->blocked + 1);
+			blocked = M_TRUE;
+		}
+
+		log_writer_wake();
+		sched_yield();
+	}
+
+	if (pad) {
+		LogRec *prec = (LogRec*)(r->buf + off);
+
+		prec->size = pad;
+		prec->type = LOG_REC_PAD;
+		off = 0;
+	}
+
+	memcpy(r->buf + off, rbuf, size);
+	m_atomic_store_release(&r->head, head + pad + size);
+
+	if (used + pad + size > r->size / 2)
+		log_writer_wake();
+
+	return M_OK;
+}
+
+/**Start the asynchronous backend.*/
+static void
+log_async_startup (void)
+{
+	const char *val;
+
+	val = getenv("M_LOG_ASYNC");
+	if (!val) {
+		log_async = LOG_ASYNC_OFF;
+		return;
+	}
+
+	if (!strcasecmp(val, "block"))
+		log_async = LOG_ASYNC_BLOCK;
+	else if (!strcasecmp(val, "drop") || !strcmp(val, "1"))
+		log_async = LOG_ASYNC_DROP;
+	else
+		log_async = LOG_ASYNC_OFF;
+
+	if (log_async == LOG_ASYNC_OFF)
+		return;
+
+	/*Ring size is rounded up to a power of 2.*/
+	log_ring_size = M_LOG_ASYNC_RING_SIZE;
+
+	val = getenv("M_LOG_ASYNC_SIZE");
+	if (val)
+		log_ring_size = strtoul(val, NULL, 0);
+
+	log_ring_size = M_MAX(log_ring_size, M_LOG_ASYNC_REC_MAX * 4);
+	while (log_ring_size & (log_ring_size - 1))
+		log_ring_size = (log_ring_size | (log_ring_size - 1)) + 1;
+
+	pthread_key_create(&log_key, log_key_destructor);
+	pthread_mutex_init(&log_wait_lock, NULL);
+	pthread_cond_init(&log_wait_cond, NULL);
+
+	log_rings        = NULL;
+	log_writer_sleep = 0;
+	log_writer_stop  = 0;
+
+	if (pthread_create(&log_writer, NULL, log_writer_entry, NULL)) {
+		pthread_key_delete(log_key);
+		pthread_mutex_destroy(&log_wait_lock);
+		pthread_cond_destroy(&log_wait_cond);
+		log_async = LOG_ASYNC_OFF;
+	}
+}
+
+/**Stop the writer thread after it has written all the messages.*/
+static void
+log_async_shutdown (void)
+{
+	LogRing *r, *next;
+
+	if (log_async == LOG_ASYNC_OFF)
+		return;
+
+	pthread_mutex_lock(&log_wait_lock);
+	m_atomic_store_release(&log_writer_stop, 1);
+	pthread_cond_signal(&log_wait_cond);
+	pthread_mutex_unlock(&log_wait_lock);
+
+	pthread_join(log_writer, NULL);
+
+	m_atomic_store_relaxed(&log_async, LOG_ASYNC_OFF);
+
+	for (r = log_rings; r; r = next) {
+		next = r->next;
+		free(r->buf);
+		free(r);
+	}
+
+	log_rings = NULL;
+
+	pthread_key_delete(log_key);
+	pthread_mutex_destroy(&log_wait_lock);
+	pthread_cond_destroy(&log_wait_cond);
+}
+
+void
+m_log_startup (void)
+{
+	const char *val;
+
+	/*Mutex initialize.*/
+	pthread_mutex_init(&lock, NULL);
+
+	/*Open log file.*/
+	val = getenv("M_LOG_FILE");
+	if (val) {
+		log_fp = fopen(val, "ab");
+	} else {
+		log_fp = NULL;
+	}
+
+	if (!log_fp) {
+		log_fp = stdout;
+	}
+
+	/*Get log level.*/
+	val = getenv("M_LOG_LEVEL");
+	log_level = val ? log_level_parse(val) : M_LOG_LEVEL_NONE;
+
+	/*Get log pattern.*/
+	val = getenv("M_LOG_PATTERN");
+	if (val) {
+		log_flags = 0;
+
+#define LOG_FLAG_CHECK(name, ch)\
+		if (strchr(val, ch)) {\
+			log_flags |= M_LOG_FL_##name;\
+		}
+
+		LOG_FLAG_CHECK(TAG,  'T')
+		LOG_FLAG_CHECK(LEVEL,'L')
+		LOG_FLAG_CHECK(FILE, 'F')
+		LOG_FLAG_CHECK(FUNC, 'f')
+		LOG_FLAG_CHECK(LINE, 'l')
+		LOG_FLAG_CHECK(DATE, 'd')
+		LOG_FLAG_CHECK(TIME, 't')
+		LOG_FLAG_CHECK(USEC, 'u')
+	} else {
+		log_flags = M_LOG_FL_ALL;
+	}
+
+	/*Get the levels of the tags, "tag=LEVEL,tag=LEVEL...".*/
+	val = getenv("M_LOG_TAGS");
+	if (val) {
+		char *str = strdup(val), *item, *save, *eq;
+
+		for (item = str ? strtok_r(str, ",", &save) : NULL; item;
+					item = strtok_r(NULL, ",", &save)) {
+			eq = strchr(item, '=');
+			if (eq)
+				*eq = 0;
+
+			m_log_set_level(item,
+					eq ? log_level_parse(eq + 1) : M_LOG_LEVEL_ALL);
+		}
+
+		free(str);
+	}
+
+	/*Update the tags registered before startup.*/
+	m_log_set_level(NULL, log_level);
+
+	/*Start the asynchronous backend.*/
+	fflush(log_fp);
+	log_async_startup();
+}
+
+void
+m_log_shutdown (void)
+{
+	LogTagLevel *tl, *next;
+
+	log_async_shutdown();
+
+	pthread_mutex_lock(&log_tag_lock);
+	for (tl = log_tag_levels; tl; tl = next) {
+		next = tl->next;
+		free(tl);
+	}
+	log_tag_levels = NULL;
+	pthread_mutex_unlock(&log_tag_lock);
+
+	if (log_fp && (log_fp != stdout)) {
+		fclose(log_fp);
+	}
+
+	pthread_mutex_destroy(&lock);
+}
+
+void
+m_log (M_LogLevel level, const char *tag, const char *file, const char *func,
+		int line, const char *fmt, ...)
+{
+	char pbuf[256];
+	LogOut pout = {.buf = pbuf, .size = sizeof(pbuf)};
+	struct timespec ts;
+	va_list ap;
+
+	if (m_atomic_load_relaxed(&log_async) != LOG_ASYNC_OFF) {
+		M_Result r;
+
+		va_start(ap, fmt);
+		r = log_async_put(level, tag, file, func, line, fmt, ap);
+		va_end(ap);
+
+		if (r != M_FAILED) {
+			/*A fatal message must reach the file before the process dies.*/
+			if (level >= M_LOG_LEVEL_FATAL)
+				m_log_flush();
+			return;
+		}
+	}
+
+	if (log_flags & (M_LOG_FL_DATE | M_LOG_FL_TIME | M_LOG_FL_USEC))
+		clock_gettime(CLOCK_REALTIME, &ts);
+
+	log_prefix(&pout, level, tag, file, func, line, &ts);
+
+	pthread_mutex_lock(&lock);
+
+	fputs(pbuf, log_fp);
 
 	/*Output message.*/
 	va_start(ap, fmt);
 	vfprintf(log_fp, fmt, ap);
 	va_end(ap);
 
-	fprintf(log_fp, "\n");
+	fputc('\n', log_fp);
 
 	pthread_mutex_unlock(&lock);
 }
 
+void
+m_log_flush (void)
+{
+	LogRing *r;
+
+	if (m_atomic_load_relaxed(&log_async) == LOG_ASYNC_OFF) {
+		pthread_mutex_lock(&lock);
+		fflush(log_fp);
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+
+	/*Wait until the writer has written the records queued so far.*/
+	for (r = m_atomic_load_acquire(&log_rings); r; r = r->next) {
+		size_t head = m_atomic_load_acquire(&r->head);
+
+		while ((ssize_t)(head - m_atomic_load_acquire(&r->tail)) > 0) {
+			log_writer_wake();
+			sched_yield();
+		}
+	}
+}
+
+void
+m_log_get_stats (M_LogStats *stats)
+{
+	LogRing *r;
+
+	stats->written = m_atomic_load_relaxed(&log_written);
+	stats->bytes   = m_atomic_load_relaxed(&log_bytes);
+	stats->dropped = 0;
+	stats->blocked = 0;
+
+	if (m_atomic_load_relaxed(&log_async) == LOG_ASYNC_OFF)
+		return;
+
+	for (r = m_atomic_load_acquire(&log_rings); r; r = r->next) {
+		stats->dropped += m_atomic_load_relaxed(&r->dropped);
+		stats->blocked += m_atomic_load_relaxed(&r->blocked);
+	}
+}
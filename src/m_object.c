@@ -0,0 +1,529 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "object"
+
+#include <m_log.h>
+#include <m_malloc.h>
+#include <m_gc.h>
+#include <m_value.h>
+#include <m_atomic.h>
+#include <m_object.h>
+
+/**The empty shape all the objects begin with.*/
+static M_Shape *root_shape;
+/**Lock of the shared shapes' transition tables.*/
+static pthread_mutex_t shape_lock = PTHREAD_MUTEX_INITIALIZER;
+/**Increased when a shape is freed, see M_InlineCache.*/
+uint32_t m_shape_epoch;
+
+static inline void*
+shape_alloc_buf (size_t size)
+{
+	return m_gc_alloc_buf(size, M_GC_SHAPEBUF_FLAGS);
+}
+
+static inline void
+shape_free_buf (void *ptr, size_t size)
+{
+	m_gc_free_buf(ptr, size, M_GC_SHAPEBUF_FLAGS);
+}
+
+static inline void*
+prop_get_key (const M_HashNode *node)
+{
+	return m_node_value(node, M_Property, node)->quark;
+}
+
+static inline uint32_t
+prop_kv (const void *key)
+{
+	return M_PTR_TO_SIZE(key) >> 3;
+}
+
+static inline void
+prop_free_node (void *node)
+{
+	shape_free_buf(m_node_value(node, M_Property, node), sizeof(M_Property));
+}
+
+/**Property table functions specialized for quark keys.*/
+M_DEFINE_HASH(prop_hash, M_Quark, prop_get_key, prop_kv,
+			m_ptr_hash_equal_func)
+
+/**Property table functions of the shared shape.*/
+static const M_HashOps
+prop_hash_ops = {
+get_key:   prop_get_key,
+kv:        prop_kv,
+equal:     m_ptr_hash_equal_func,
+free_node: NULL,
+alloc_buf: shape_alloc_buf,
+free_buf:  shape_free_buf
+};
+
+/**Property table functions of the dictionary shape.*/
+static const M_HashOps
+dict_hash_ops = {
+get_key:   prop_get_key,
+kv:        prop_kv,
+equal:     m_ptr_hash_equal_func,
+free_node: prop_free_node,
+alloc_buf: shape_alloc_buf,
+free_buf:  shape_free_buf
+};
+
+static inline void*
+trans_get_key (const M_HashNode *node)
+{
+	return &m_node_value(node, M_Shape, trans_node)->key;
+}
+
+static inline uint32_t
+trans_kv (const void *key)
+{
+	const M_ShapeKey *k = (const M_ShapeKey*)key;
+
+	return (M_PTR_TO_SIZE(k->quark) >> 3) ^ k->flags;
+}
+
+static inline M_Bool
+trans_equal (const void *key1, const void *key2)
+{
+	const M_ShapeKey *k1 = (const M_ShapeKey*)key1;
+	const M_ShapeKey *k2 = (const M_ShapeKey*)key2;
+
+	return (k1->quark == k2->quark) && (k1->flags == k2->flags);
+}
+
+/**Transition table functions.*/
+static const M_HashOps
+trans_hash_ops = {
+get_key:   trans_get_key,
+kv:        trans_kv,
+equal:     trans_equal,
+free_node: NULL,
+alloc_buf: shape_alloc_buf,
+free_buf:  shape_free_buf
+};
+
+/**Allocate a new empty shape.*/
+static M_Shape*
+shape_alloc (uint16_t flags)
+{
+	M_Shape *shape;
+	size_t id;
+
+	shape = m_gc_alloc_obj(M_GC_OBJ_SHAPE, &id);
+	m_assert_alloc(shape);
+
+	shape->parent = NULL;
+	shape->key.quark = NULL;
+	shape->key.flags = 0;
+	shape->props  = NULL;
+	shape->nprop  = 0;
+	shape->nslot  = 0;
+	shape->flags  = flags;
+
+	m_hash_init(&shape->trans_hash);
+	m_hash_init(&shape->prop_hash);
+
+	m_gc_add_obj(id);
+
+	return shape;
+}
+
+/**Insert a property into the shape's lookup table.*/
+static void
+shape_hash_prop (M_Shape *shape, M_Property *prop, const M_HashOps *ops)
+{
+	if (m_hash_resize_incr(&shape->prop_hash, ops) != M_OK)
+		m_assert_alloc(NULL);
+
+	m_hash_insert(&shape->prop_hash, &prop->node, ops);
+}
+
+/**Get the child shape with a new property added.*/
+static M_Shape*
+shape_transition (M_Shape *shape, M_Quark quark, uint16_t flags)
+{
+	M_ShapeKey key;
+	M_HashNode *node;
+	M_Shape *child;
+	M_Property *prop;
+	uint32_t kv, i;
+
+	key.quark = quark;
+	key.flags = flags;
+
+	pthread_mutex_lock(&shape_lock);
+	node = m_hash_lookup(&shape->trans_hash, &key, &trans_hash_ops);
+	pthread_mutex_unlock(&shape_lock);
+
+	if (node)
+		return m_node_value(node, M_Shape, trans_node);
+
+	/* Allocating a GC object may pause this thread, so the child is created
+	 * without holding the lock. If another thread adds the same transition
+	 * in the meantime, this child is dropped and collected.*/
+	child = shape_alloc(0);
+
+	child->parent = shape;
+	child->key    = key;
+	child->nprop  = shape->nprop + 1;
+	child->nslot  = child->nprop;
+	child->props  = shape_alloc_buf(sizeof(M_Property) * child->nprop);
+	m_assert_alloc(child->props);
+
+	if (shape->nprop)
+		memcpy(child->props, shape->props, sizeof(M_Property) * shape->nprop);
+
+	prop = &child->props[shape->nprop];
+	prop->quark = quark;
+	prop->id    = shape->nprop;
+	prop->flags = flags;
+
+	if (child->nprop > M_SHAPE_LINEAR_MAX) {
+		for (i = 0; i < child->nprop; i ++)
+			shape_hash_prop(child, &child->props[i], &prop_hash_ops);
+	}
+
+	pthread_mutex_lock(&shape_lock);
+
+	node = m_hash_lookup_with_kv(&shape->trans_hash, &key, &trans_hash_ops,
+				&kv);
+	if (node) {
+		/*The dropped child is not in the table.*/
+		child->parent = NULL;
+		child = m_node_value(node, M_Shape, trans_node);
+	} else {
+		if (m_hash_resize(&shape->trans_hash, &trans_hash_ops) != M_OK)
+			m_assert_alloc(NULL);
+
+		m_hash_insert_with_kv(&shape->trans_hash, &child->trans_node, kv,
+					&trans_hash_ops);
+	}
+
+	pthread_mutex_unlock(&shape_lock);
+
+	return child;
+}
+
+/**Make sure the object has enough value slots.*/
+static void
+object_ensure_slots (M_Object *obj, uint32_t nv)
+{
+	uint32_t ocap, ncap;
+
+	if (nv <= obj->nv)
+		return;
+
+	ocap = m_object_value_cap(obj->nv);
+	ncap = m_object_value_cap(nv);
+
+	if (ncap > ocap) {
+		M_Value *buf;
+
+		buf = m_gc_realloc_buf(obj->v, sizeof(M_Value) * ocap,
+					sizeof(M_Value) * ncap, M_GC_OBJBUF_FLAGS);
+		m_assert_alloc(buf);
+
+		obj->v = buf;
+	}
+
+	memset(obj->v + obj->nv, 0, sizeof(M_Value) * (nv - obj->nv));
+	obj->nv = nv;
+}
+
+/**Change the object to dictionary mode.*/
+static M_Shape*
+object_to_dict (M_Object *obj)
+{
+	M_Shape *shape, *dict;
+	M_Property *prop;
+	uint32_t i;
+
+	shape = obj->shape;
+	if (shape->flags & M_SHAPE_FL_DICT)
+		return shape;
+
+	dict = shape_alloc(M_SHAPE_FL_DICT);
+
+	for (i = 0; i < shape->nprop; i ++) {
+		prop = shape_alloc_buf(sizeof(M_Property));
+		m_assert_alloc(prop);
+
+		*prop = shape->props[i];
+		shape_hash_prop(dict, prop, &dict_hash_ops);
+	}
+
+	dict->nprop = shape->nprop;
+	dict->nslot = obj->nv;
+
+	obj->shape = dict;
+
+	M_DEBUG("object %p changed to dictionary mode", obj);
+
+	return dict;
+}
+
+/**Add a new property to the object.*/
+static void
+object_add_prop (M_Object *obj, M_Quark quark, uint16_t flags, M_Value v)
+{
+	M_Shape *shape = obj->shape;
+	M_Property *prop;
+
+	if (!(shape->flags & M_SHAPE_FL_DICT) && (shape->nprop >= M_SHAPE_PROP_MAX))
+		shape = object_to_dict(obj);
+
+	if (shape->flags & M_SHAPE_FL_DICT) {
+		prop = shape_alloc_buf(sizeof(M_Property));
+		m_assert_alloc(prop);
+
+		prop->quark = quark;
+		prop->id    = shape->nslot ++;
+		prop->flags = flags;
+
+		object_ensure_slots(obj, shape->nslot);
+		obj->v[prop->id] = v;
+
+		shape_hash_prop(shape, prop, &dict_hash_ops);
+		shape->nprop ++;
+	} else {
+		shape = shape_transition(shape, quark, flags);
+
+		object_ensure_slots(obj, shape->nprop);
+		obj->v[shape->nprop - 1] = v;
+		obj->shape = shape;
+	}
+}
+
+void
+m_object_startup (void)
+{
+	root_shape = shape_alloc(0);
+	m_gc_add_root(root_shape);
+}
+
+void
+m_object_shutdown (void)
+{
+	m_gc_remove_root(root_shape);
+}
+
+void
+m_shape_release (M_Shape *shape)
+{
+	assert(shape);
+
+	if (shape->flags & M_SHAPE_FL_DICT) {
+		m_hash_deinit(&shape->prop_hash, &dict_hash_ops);
+	} else {
+		M_HashNode *node, **pnode;
+		M_Shape *child;
+		uint32_t pos;
+
+		m_atomic_int32_inc(&m_shape_epoch);
+
+		/* Remove the shape from its parent's transition table.
+		 * When the parent is dead, its children are dead too. The one
+		 * released first breaks the link, so the other one does not
+		 * touch it.*/
+		pthread_mutex_lock(&shape_lock);
+
+		if (shape->parent) {
+			node = m_hash_lookup_with_prev(&shape->parent->trans_hash,
+						&shape->key, &trans_hash_ops, &pnode);
+			if (node == &shape->trans_node)
+				m_hash_remove_from_prev(&shape->parent->trans_hash, pnode);
+		}
+
+		m_hash_foreach_value(child, pos, &shape->trans_hash, trans_node) {
+			child->parent = NULL;
+		}
+
+		pthread_mutex_unlock(&shape_lock);
+
+		m_hash_deinit(&shape->prop_hash, &prop_hash_ops);
+
+		if (shape->props)
+			shape_free_buf(shape->props, sizeof(M_Property) * shape->nprop);
+	}
+
+	m_hash_deinit(&shape->trans_hash, &trans_hash_ops);
+}
+
+void
+m_object_release (M_Object *obj)
+{
+	assert(obj);
+
+	if (obj->v)
+		m_gc_free_buf(obj->v, sizeof(M_Value) * m_object_value_cap(obj->nv),
+					M_GC_OBJBUF_FLAGS);
+}
+
+const M_Property*
+m_shape_lookup (M_Shape *shape, M_Quark quark)
+{
+	M_HashNode *node;
+	uint32_t i;
+
+	assert(shape);
+
+	if ((shape->flags & M_SHAPE_FL_DICT) || (shape->nprop > M_SHAPE_LINEAR_MAX)) {
+		node = prop_hash_lookup(&shape->prop_hash, quark);
+
+		return m_node_value(node, M_Property, node);
+	}
+
+	for (i = 0; i < shape->nprop; i ++) {
+		if (shape->props[i].quark == quark)
+			return &shape->props[i];
+	}
+
+	return NULL;
+}
+
+M_Object*
+m_object_new (M_Value protov)
+{
+	M_Object *obj;
+	size_t id;
+
+	obj = m_gc_alloc_obj(M_GC_OBJ_OBJECT, &id);
+	m_assert_alloc(obj);
+
+	obj->shape  = root_shape;
+	obj->protov = protov;
+	obj->v      = NULL;
+	obj->nv     = 0;
+	obj->flags  = M_OBJ_FL_CONFIGURABLE | M_OBJ_FL_MUTABLE;
+
+	m_gc_add_obj(id);
+
+	return obj;
+}
+
+M_Bool
+m_object_get (M_Object *obj, M_Quark quark, M_Value *pv)
+{
+	const M_Property *prop;
+
+	assert(obj && quark && pv);
+
+	while (1) {
+		prop = m_object_lookup(obj, quark);
+		if (prop) {
+			*pv = obj->v[prop->id];
+			return M_TRUE;
+		}
+
+		if (!m_value_is_object(obj->protov))
+			break;
+
+		obj = m_value_get_object(obj->protov);
+	}
+
+	return M_FALSE;
+}
+
+M_Result
+m_object_define (M_Object *obj, M_Quark quark, uint16_t flags, M_Value v)
+{
+	const M_Property *prop;
+	M_Shape *shape;
+
+	assert(obj && quark);
+
+	if (!(obj->flags & M_OBJ_FL_MUTABLE))
+		return M_FAILED;
+
+	prop = m_object_lookup(obj, quark);
+	if (!prop) {
+		object_add_prop(obj, quark, flags, v);
+		return M_OK;
+	}
+
+	if (prop->flags != flags) {
+		/*Shared shapes are immutable.*/
+		shape = object_to_dict(obj);
+		prop  = m_shape_lookup(shape, quark);
+
+		((M_Property*)prop)->flags = flags;
+	}
+
+	obj->v[prop->id] = v;
+
+	return M_OK;
+}
+
+M_Result
+m_object_set (M_Object *obj, M_Quark quark, M_Value v)
+{
+	const M_Property *prop;
+
+	assert(obj && quark);
+
+	if (!(obj->flags & M_OBJ_FL_MUTABLE))
+		return M_FAILED;
+
+	prop = m_object_lookup(obj, quark);
+	if (!prop) {
+		object_add_prop(obj, quark, M_PROP_FL_DEFAULT, v);
+		return M_OK;
+	}
+
+	if (!(prop->flags & M_PROP_FL_WRITABLE))
+		return M_FAILED;
+
+	obj->v[prop->id] = v;
+
+	return M_OK;
+}
+
+M_Result
+m_object_remove (M_Object *obj, M_Quark quark)
+{
+	M_Shape *shape;
+	M_HashNode *node;
+	M_Property *prop;
+
+	assert(obj && quark);
+
+	if (!(obj->flags & M_OBJ_FL_CONFIGURABLE) ||
+				!(obj->flags & M_OBJ_FL_MUTABLE))
+		return M_FAILED;
+
+	if (!m_object_lookup(obj, quark))
+		return M_NONE;
+
+	shape = object_to_dict(obj);
+
+	node = m_hash_remove(&shape->prop_hash, quark, &dict_hash_ops);
+	prop = m_node_value(node, M_Property, node);
+
+	obj->v[prop->id] = 0;
+	shape->nprop --;
+
+	prop_free_node(node);
+
+	return M_OK;
+}
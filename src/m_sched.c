@@ -0,0 +1,509 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "sched"
+
+#include <sched.h>
+
+#include <m_log.h>
+#include <m_malloc.h>
+#include <m_atomic.h>
+#include <m_gc.h>
+#include <m_thread.h>
+#include <m_value.h>
+#include <m_actor.h>
+#include <m_interp.h>
+#include <m_sched.h>
+
+#define M_GC_RUNQ_FLAGS M_GC_BUF_FL_PERMANENT
+
+/**Ticks between two global run queue checks, keep the global actors alive.*/
+#define SCHED_GLOBAL_TICKS 61
+
+/**Scheduler data.*/
+static struct {
+	pthread_mutex_t lock;     /**< Global run queue and parking lock.*/
+	pthread_cond_t  cond;     /**< Parked threads wait on it.*/
+	M_Actor        *gq_head;  /**< The global run queue's head.*/
+	M_Actor        *gq_tail;  /**< The global run queue's tail.*/
+	uint32_t        gq_len;   /**< Actors in the global run queue.*/
+	M_RunQueue     *runqs[M_SCHED_MAX_WORKERS]; /**< Workers' run queues.*/
+	uint32_t        nrunq;    /**< Number of workers.*/
+	uint32_t        nidle;    /**< Number of parked threads.*/
+	uint32_t        nbusy;    /**< Actors in run queues or running.*/
+	M_Bool          exit;     /**< The workers should exit.*/
+} sched;
+
+/**Put a list of actors to the global run queue's tail.*/
+static void
+gq_put (M_Actor *head, M_Actor *tail, uint32_t n)
+{
+	tail->rq_next = NULL;
+
+	pthread_mutex_lock(&sched.lock);
+
+	if (sched.gq_tail)
+		sched.gq_tail->rq_next = head;
+	else
+		sched.gq_head = head;
+	sched.gq_tail = tail;
+
+	m_atomic_store_relaxed(&sched.gq_len, sched.gq_len + n);
+
+	pthread_mutex_unlock(&sched.lock);
+}
+
+/**
+ * Get an actor from the global run queue.
+ * A worker moves a part of the other actors to its local run queue.
+ */
+static M_Actor*
+gq_get (M_RunQueue *rq)
+{
+	M_Actor *actor, *next;
+	uint32_t n, t;
+
+	if (!m_atomic_load_relaxed(&sched.gq_len))
+		return NULL;
+
+	pthread_mutex_lock(&sched.lock);
+
+	actor = sched.gq_head;
+	if (actor) {
+		n = 1;
+		next = actor->rq_next;
+
+		/*Only the owner puts actors, so the free slots stay free.*/
+		if (rq) {
+			uint32_t max;
+
+			t   = rq->tail;
+			max = M_SCHED_RUNQ_SIZE - (t - m_atomic_load_acquire(&rq->head));
+			max = M_MIN(max, sched.gq_len / m_atomic_load_relaxed(&sched.nrunq));
+
+			while (next && (max --)) {
+				m_atomic_store_relaxed(&rq->buf[t % M_SCHED_RUNQ_SIZE], next);
+				next = next->rq_next;
+				t ++;
+				n ++;
+			}
+
+			m_atomic_store_release(&rq->tail, t);
+		}
+
+		sched.gq_head = next;
+		if (!next)
+			sched.gq_tail = NULL;
+
+		m_atomic_store_relaxed(&sched.gq_len, sched.gq_len - n);
+	}
+
+	pthread_mutex_unlock(&sched.lock);
+
+	return actor;
+}
+
+/**
+ * Move the first half of the full local run queue and the actor
+ * to the global run queue.
+ */
+static M_Bool
+runq_put_slow (M_RunQueue *rq, M_Actor *actor, uint32_t h, uint32_t t)
+{
+	M_Actor *batch[M_SCHED_RUNQ_SIZE / 2 + 1];
+	uint32_t i, n;
+
+	n = (t - h) / 2;
+
+	for (i = 0; i < n; i ++)
+		batch[i] = m_atomic_load_relaxed(&rq->buf[(h + i) % M_SCHED_RUNQ_SIZE]);
+
+	/*The actors are stolen, retry the fast path.*/
+	if (!m_atomic_cas_strong(&rq->head, &h, h + n, M_ATOMIC_RELEASE))
+		return M_FALSE;
+
+	batch[n] = actor;
+	for (i = 0; i < n; i ++)
+		batch[i]->rq_next = batch[i + 1];
+
+	gq_put(batch[0], batch[n], n + 1);
+
+	return M_TRUE;
+}
+
+/**Put an actor to the local run queue's tail. Only the owner invokes it.*/
+static void
+runq_put (M_RunQueue *rq, M_Actor *actor)
+{
+	uint32_t h, t;
+
+	while (1) {
+		/*Acquire the stealers' reads of the slots before reusing them.*/
+		h = m_atomic_load_acquire(&rq->head);
+		t = rq->tail;
+
+		if (t - h < M_SCHED_RUNQ_SIZE) {
+			m_atomic_store_relaxed(&rq->buf[t % M_SCHED_RUNQ_SIZE], actor);
+			m_atomic_store_release(&rq->tail, t + 1);
+			return;
+		}
+
+		if (runq_put_slow(rq, actor, h, t))
+			return;
+	}
+}
+
+/**Get an actor from the run queue's head.*/
+static M_Actor*
+runq_get (M_RunQueue *rq)
+{
+	M_Actor *actor;
+	uint32_t h, t;
+
+	while (1) {
+		h = m_atomic_load_acquire(&rq->head);
+		t = m_atomic_load_acquire(&rq->tail);
+
+		if (t == h)
+			return NULL;
+
+		actor = m_atomic_load_relaxed(&rq->buf[h % M_SCHED_RUNQ_SIZE]);
+
+		if (m_atomic_cas_strong(&rq->head, &h, h + 1, M_ATOMIC_RELEASE))
+			return actor;
+	}
+}
+
+/**
+ * Steal the first half of the victim's actors to the empty run queue.
+ * Return the last stolen actor.
+ */
+static M_Actor*
+runq_steal (M_RunQueue *rq, M_RunQueue *victim)
+{
+	uint32_t h, t, n, i, rt;
+
+	rt = rq->tail;
+
+	while (1) {
+		h = m_atomic_load_acquire(&victim->head);
+		t = m_atomic_load_acquire(&victim->tail);
+		n = t - h;
+		n = n - n / 2;
+
+		if (!n)
+			return NULL;
+
+		/*The head and tail are read at different time, retry.*/
+		if (n > M_SCHED_RUNQ_SIZE / 2)
+			continue;
+
+		for (i = 0; i < n; i ++) {
+			M_Actor *a;
+
+			a = m_atomic_load_relaxed(&victim->buf[(h + i) % M_SCHED_RUNQ_SIZE]);
+			m_atomic_store_relaxed(&rq->buf[(rt + i) % M_SCHED_RUNQ_SIZE], a);
+		}
+
+		if (m_atomic_cas_strong(&victim->head, &h, h + n, M_ATOMIC_RELEASE))
+			break;
+	}
+
+	n --;
+	if (n)
+		m_atomic_store_release(&rq->tail, rt + n);
+
+	return rq->buf[(rt + n) % M_SCHED_RUNQ_SIZE];
+}
+
+/**Check if any actor is waiting in the run queues.*/
+static M_Bool
+sched_has_work (void)
+{
+	uint32_t i, n;
+
+	if (m_atomic_load_relaxed(&sched.gq_len))
+		return M_TRUE;
+
+	n = m_atomic_load_acquire(&sched.nrunq);
+	for (i = 0; i < n; i ++) {
+		M_RunQueue *rq = sched.runqs[i];
+
+		if (m_atomic_load_relaxed(&rq->tail) != m_atomic_load_relaxed(&rq->head))
+			return M_TRUE;
+	}
+
+	return M_FALSE;
+}
+
+/**Wake up a parked thread.*/
+static void
+sched_wake (void)
+{
+	/*
+	 * Order the put before the load, a parking thread increases "nidle"
+	 * before checking the run queues.
+	 */
+	m_atomic_fence(M_ATOMIC_SEQ_CST);
+	if (!m_atomic_load_relaxed(&sched.nidle))
+		return;
+
+	pthread_mutex_lock(&sched.lock);
+	pthread_cond_signal(&sched.cond);
+	pthread_mutex_unlock(&sched.lock);
+}
+
+/**Put a runnable actor to the current thread's run queue.*/
+static void
+sched_put (M_Thread *th, M_Actor *actor)
+{
+	if (th && th->runq)
+		runq_put(th->runq, actor);
+	else
+		gq_put(actor, actor, 1);
+
+	sched_wake();
+}
+
+/**Find the next actor to run.*/
+static M_Actor*
+sched_next (M_Thread *th, uint32_t *tick)
+{
+	M_RunQueue *rq = th->runq;
+	M_Actor *actor;
+	uint32_t i, n, start;
+
+	/*Check the global run queue sometimes, or its actors may starve.*/
+	if (rq && !(++ *tick % SCHED_GLOBAL_TICKS) && (actor = gq_get(NULL)))
+		return actor;
+
+	if (rq && (actor = runq_get(rq)))
+		return actor;
+
+	if ((actor = gq_get(rq)))
+		return actor;
+
+	/*Steal from the other workers.*/
+	n = m_atomic_load_acquire(&sched.nrunq);
+	if (!n)
+		return NULL;
+
+	start = (M_PTR_TO_SIZE(th) >> 4) + *tick;
+	for (i = 0; i < n; i ++) {
+		M_RunQueue *victim = sched.runqs[(start + i) % n];
+
+		if (victim == rq)
+			continue;
+
+		actor = rq ? runq_steal(rq, victim) : runq_get(victim);
+		if (actor)
+			return actor;
+	}
+
+	return NULL;
+}
+
+/**Park the thread until actors are scheduled.*/
+static void
+sched_park (M_Bool until_idle)
+{
+	/*A parked thread does not block the GC.*/
+	m_thread_leave();
+
+	pthread_mutex_lock(&sched.lock);
+
+	m_atomic_int32_inc(&sched.nidle);
+
+	if (!m_atomic_load_relaxed(&sched.exit) && !sched_has_work() &&
+				!(until_idle && !m_atomic_load_relaxed(&sched.nbusy)))
+		pthread_cond_wait(&sched.cond, &sched.lock);
+
+	m_atomic_int32_dec(&sched.nidle);
+
+	pthread_mutex_unlock(&sched.lock);
+
+	m_thread_enter();
+}
+
+/**The actor becomes idle.*/
+static void
+sched_done (void)
+{
+	/*The last busy actor, wake up the threads waiting for all idle.*/
+	if (m_atomic_int32_dec(&sched.nbusy) == 1) {
+		pthread_mutex_lock(&sched.lock);
+		pthread_cond_broadcast(&sched.cond);
+		pthread_mutex_unlock(&sched.lock);
+	}
+}
+
+/**Run the actor's messages until its quantum is used up.*/
+static void
+sched_run_actor (M_Thread *th, M_Actor *actor)
+{
+	M_Actor *old = th->actor;
+	M_Value msg;
+	M_Result r;
+	int n;
+
+	th->actor = actor;
+
+	for (n = 0; n < M_SCHED_BATCH; n ++) {
+		if (m_slist_empty(&actor->stack)) {
+			r = m_actor_fetch(actor, &msg);
+			if (r == M_NONE) {
+				th->actor = old;
+				sched_done();
+				return;
+			}
+
+			/*The message is being sent, run the others first.*/
+			if (r != M_OK)
+				break;
+
+			if (m_actor_call(actor, actor->behav, 1, &msg) != M_OK)
+				continue;
+		}
+
+		r = m_interp_run(actor, M_SCHED_QUANTUM);
+		if (r == M_NONE)
+			break;
+		if (r != M_OK)
+			M_DEBUG("actor %p message error %d", actor, r);
+	}
+
+	th->actor = old;
+
+	/*Preempted or a message is being sent, run it again after the others.*/
+	sched_put(th, actor);
+}
+
+/**Run actors until exit, or until all the actors are idle.*/
+static void
+sched_loop (M_Thread *th, M_Bool until_idle)
+{
+	M_Actor *actor;
+	uint32_t tick = 0, spin = 0;
+
+	while (!m_atomic_load_relaxed(&sched.exit)) {
+		if (until_idle && !m_atomic_load_acquire(&sched.nbusy))
+			break;
+
+		m_thread_poll();
+
+		actor = sched_next(th, &tick);
+		if (actor) {
+			sched_run_actor(th, actor);
+			spin = 0;
+		} else if (++ spin < M_SCHED_SPIN) {
+			sched_yield();
+		} else {
+			sched_park(until_idle);
+			spin = 0;
+		}
+	}
+}
+
+void
+m_sched_startup (void)
+{
+	pthread_mutex_init(&sched.lock, NULL);
+	pthread_cond_init(&sched.cond, NULL);
+
+	sched.gq_head = NULL;
+	sched.gq_tail = NULL;
+	sched.gq_len  = 0;
+	sched.nrunq   = 0;
+	sched.nidle   = 0;
+	sched.nbusy   = 0;
+	sched.exit    = M_FALSE;
+}
+
+void
+m_sched_stop (void)
+{
+	pthread_mutex_lock(&sched.lock);
+
+	m_atomic_store_relaxed(&sched.exit, M_TRUE);
+	pthread_cond_broadcast(&sched.cond);
+
+	pthread_mutex_unlock(&sched.lock);
+}
+
+void
+m_sched_shutdown (void)
+{
+	uint32_t i;
+
+	/*The workers have exited.*/
+	for (i = 0; i < sched.nrunq; i ++)
+		m_gc_free_buf(sched.runqs[i], sizeof(M_RunQueue), M_GC_RUNQ_FLAGS);
+
+	pthread_mutex_destroy(&sched.lock);
+	pthread_cond_destroy(&sched.cond);
+}
+
+void
+m_sched_worker (void)
+{
+	M_Thread *th = m_thread_self();
+	M_RunQueue *rq;
+
+	rq = m_gc_alloc_buf(sizeof(M_RunQueue), M_GC_RUNQ_FLAGS);
+	m_assert_alloc(rq);
+
+	rq->head = 0;
+	rq->tail = 0;
+
+	pthread_mutex_lock(&sched.lock);
+
+	if (sched.nrunq == M_SCHED_MAX_WORKERS) {
+		pthread_mutex_unlock(&sched.lock);
+		m_gc_free_buf(rq, sizeof(M_RunQueue), M_GC_RUNQ_FLAGS);
+		M_ERROR("too many worker threads");
+		return;
+	}
+
+	sched.runqs[sched.nrunq] = rq;
+	m_atomic_store_release(&sched.nrunq, sched.nrunq + 1);
+
+	pthread_mutex_unlock(&sched.lock);
+
+	th->runq = rq;
+
+	M_DEBUG("worker %p begin", th);
+
+	sched_loop(th, M_FALSE);
+
+	M_DEBUG("worker %p end", th);
+}
+
+void
+m_sched_add (M_Actor *actor)
+{
+	m_atomic_int32_inc(&sched.nbusy);
+
+	sched_put(pthread_getspecific(m_thread_key), actor);
+}
+
+void
+m_sched_run (void)
+{
+	sched_loop(m_thread_self(), M_TRUE);
+}
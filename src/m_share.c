@@ -0,0 +1,471 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "share"
+
+#include <m_log.h>
+#include <m_malloc.h>
+#include <m_gc.h>
+#include <m_hash.h>
+#include <m_function.h>
+#include <m_share.h>
+
+/**Values waiting to be traversed.*/
+typedef struct {
+	M_Value  *v;    /**< The values buffer.*/
+	uint32_t  top;  /**< Number of the values.*/
+	uint32_t  size; /**< The buffer's size.*/
+} ValueStack;
+
+/**Flags of a value before it is frozen.*/
+typedef struct {
+	M_Value  v;     /**< The value.*/
+	uint16_t flags; /**< The old flags.*/
+} FreezeRecord;
+
+/**Copied object.*/
+typedef struct {
+	M_HashNode node; /**< Hash table node.*/
+	void      *src;  /**< The origin object, array, closure or box.*/
+	void      *dst;  /**< The copy.*/
+} CopyNode;
+
+/**Copy state.*/
+typedef struct {
+	M_Hash     map;     /**< The copied objects.*/
+	ValueStack pending; /**< Copies created but not filled, in pairs.*/
+} CopyState;
+
+/**Push a value to the stack.*/
+static void
+value_stack_push (ValueStack *s, M_Value v)
+{
+	if (s->top == s->size) {
+		uint32_t nsize = M_MAX(s->size * 2, 64);
+
+		s->v = m_realloc(s->v, sizeof(M_Value) * nsize);
+		m_assert_alloc(s->v);
+
+		s->size = nsize;
+	}
+
+	s->v[s->top ++] = v;
+}
+
+/**Push a value needing freezing.*/
+static inline void
+freeze_push (ValueStack *s, M_Value v)
+{
+	if (!m_value_is_frozen(v))
+		value_stack_push(s, v);
+}
+
+/**Record the value's flags before it is frozen.*/
+static void
+freeze_record (FreezeRecord **precs, uint32_t *pn, uint32_t *psize,
+			M_Value v, uint16_t flags)
+{
+	if (*pn == *psize) {
+		uint32_t nsize = M_MAX(*psize * 2, 64);
+
+		*precs = m_realloc(*precs, sizeof(FreezeRecord) * nsize);
+		m_assert_alloc(*precs);
+
+		*psize = nsize;
+	}
+
+	(*precs)[*pn].v     = v;
+	(*precs)[*pn].flags = flags;
+	(*pn) ++;
+}
+
+/**Check if the closure has boxed variables.*/
+static M_Bool
+closure_has_box (M_Closure *clos)
+{
+	uint8_t i;
+
+	for (i = 0; i < clos->nupv; i ++) {
+		if (clos->func->f.bc.upvs[i].flags & M_UPV_FL_BOX)
+			return M_TRUE;
+	}
+
+	return M_FALSE;
+}
+
+M_Result
+m_value_freeze (M_Value v)
+{
+	ValueStack s = {NULL, 0, 0};
+	FreezeRecord *recs = NULL;
+	uint32_t nrec = 0, rsize = 0, i, pos;
+	M_Result r = M_OK;
+
+	freeze_push(&s, v);
+
+	while (s.top) {
+		v = s.v[-- s.top];
+
+		if (m_value_is_frozen(v))
+			continue;
+
+		if (m_value_is_string(v)) {
+			m_string_flatten(m_value_get_string(v));
+		} else if (m_value_is_object(v)) {
+			M_Object *obj = m_value_get_object(v);
+
+			freeze_record(&recs, &nrec, &rsize, v, obj->flags);
+			obj->flags &= ~(M_OBJ_FL_MUTABLE | M_OBJ_FL_CONFIGURABLE);
+			obj->flags |= M_OBJ_FL_FROZEN;
+
+			freeze_push(&s, obj->protov);
+			for (i = 0; i < obj->nv; i ++)
+				freeze_push(&s, obj->v[i]);
+		} else if (m_value_is_array(v)) {
+			M_Array *arr = m_value_get_array(v);
+			M_ArrayElem *elem;
+
+			freeze_record(&recs, &nrec, &rsize, v, arr->flags);
+			arr->flags |= M_ARRAY_FL_FROZEN;
+
+			if (arr->kind == M_ARRAY_KIND_VALUE) {
+				for (i = 0; i < arr->len; i ++)
+					freeze_push(&s, arr->e.values[i]);
+			} else if (arr->kind == M_ARRAY_KIND_SPARSE) {
+				m_hash_foreach_value(elem, pos, &arr->e.hash, node)
+					freeze_push(&s, elem->v);
+			}
+		} else {
+			M_Closure *clos = m_value_get_closure(v);
+
+			/*The boxed variables can be modified.*/
+			if (closure_has_box(clos)) {
+				r = M_FAILED;
+				break;
+			}
+
+			freeze_record(&recs, &nrec, &rsize, v, clos->flags);
+			clos->flags |= M_CLOS_FL_FROZEN;
+
+			for (i = 0; i < clos->nupv; i ++)
+				freeze_push(&s, clos->upvs[i].v);
+		}
+	}
+
+	/*Restore the values' flags.*/
+	if (r != M_OK) {
+		M_DEBUG("cannot freeze the closure with boxed variables");
+
+		for (i = 0; i < nrec; i ++) {
+			v = recs[i].v;
+
+			if (m_value_is_object(v))
+				m_value_get_object(v)->flags = recs[i].flags;
+			else if (m_value_is_array(v))
+				m_value_get_array(v)->flags = recs[i].flags;
+			else
+				m_value_get_closure(v)->flags = recs[i].flags;
+		}
+	}
+
+	if (s.v)
+		m_free(s.v);
+	if (recs)
+		m_free(recs);
+
+	return r;
+}
+
+static void*
+copy_get_key (const M_HashNode *node)
+{
+	CopyNode *cn = (CopyNode*)node;
+
+	return cn->src;
+}
+
+static void
+copy_free_node (void *node)
+{
+	m_free(node);
+}
+
+static void*
+copy_alloc_buf (size_t size)
+{
+	return m_malloc(size);
+}
+
+static void
+copy_free_buf (void *ptr, size_t size)
+{
+	m_free(ptr);
+}
+
+/**Copied objects hash table functions.*/
+static const M_HashOps
+copy_hash_ops = {
+get_key:   copy_get_key,
+kv:        m_ptr_hash_kv_func,
+equal:     m_ptr_hash_equal_func,
+free_node: copy_free_node,
+alloc_buf: copy_alloc_buf,
+free_buf:  copy_free_buf
+};
+
+/**Lookup the copy of the object.*/
+static inline void*
+copy_lookup (CopyState *s, void *src)
+{
+	M_HashNode *node;
+
+	node = m_hash_lookup(&s->map, src, &copy_hash_ops);
+
+	return node ? ((CopyNode*)node)->dst : NULL;
+}
+
+/**Add the copy of the object.*/
+static void
+copy_add (CopyState *s, void *src, void *dst)
+{
+	CopyNode *cn;
+
+	cn = m_malloc(sizeof(CopyNode));
+	m_assert_alloc(cn);
+
+	cn->src = src;
+	cn->dst = dst;
+
+	if (m_hash_resize(&s->map, &copy_hash_ops) != M_OK)
+		m_assert_alloc(NULL);
+
+	m_hash_insert(&s->map, &cn->node, &copy_hash_ops);
+}
+
+/**Create an empty closure with the same function and flags.*/
+static M_Closure*
+closure_alloc (M_Closure *src)
+{
+	M_Closure *clos;
+	size_t id;
+
+	clos = m_gc_alloc_obj(M_GC_OBJ_CLOSURE, &id);
+	m_assert_alloc(clos);
+
+	clos->func  = src->func;
+	clos->flags = src->flags & ~M_CLOS_FL_FROZEN;
+	clos->nupv  = src->nupv;
+	clos->upvs  = m_gc_alloc_buf(sizeof(M_UpVal) * src->nupv,
+				M_GC_CLOSBUF_FLAGS);
+	m_assert_alloc(clos->upvs);
+
+	memset(clos->upvs, 0, sizeof(M_UpVal) * src->nupv);
+
+	m_gc_add_obj(id);
+
+	return clos;
+}
+
+/**
+ * Get the copy of the value.
+ * The copy is created empty and filled later, so the cycles are copied.
+ */
+static M_Value
+copy_value (CopyState *s, M_Value v)
+{
+	void *src, *dst;
+	M_Value dv;
+
+	if (m_value_is_string(v)) {
+		m_string_flatten(m_value_get_string(v));
+		return v;
+	}
+
+	if (m_value_is_frozen(v))
+		return v;
+
+	src = m_value_get_ptr(v);
+	dst = copy_lookup(s, src);
+
+	if (dst) {
+		if (m_value_is_object(v))
+			return m_value_from_object(dst);
+		if (m_value_is_array(v))
+			return m_value_from_array(dst);
+		return m_value_from_closure(dst);
+	}
+
+	if (m_value_is_object(v)) {
+		dst = m_object_new(0);
+		dv  = m_value_from_object(dst);
+	} else if (m_value_is_array(v)) {
+		M_Array *arr = src;
+
+		dst = m_array_new((arr->kind == M_ARRAY_KIND_SPARSE) ? 0 : arr->len);
+		dv  = m_value_from_array(dst);
+	} else {
+		dst = closure_alloc(src);
+		dv  = m_value_from_closure(dst);
+	}
+
+	copy_add(s, src, dst);
+
+	value_stack_push(&s->pending, v);
+	value_stack_push(&s->pending, dv);
+
+	return dv;
+}
+
+/**Get the copy of the box.*/
+static M_Box*
+copy_box (CopyState *s, M_Box *src)
+{
+	M_Box *box;
+	size_t id;
+
+	box = copy_lookup(s, src);
+	if (box)
+		return box;
+
+	box = m_gc_alloc_obj(M_GC_OBJ_BOX, &id);
+	m_assert_alloc(box);
+
+	box->pv   = &box->v;
+	box->v    = 0;
+	box->next = NULL;
+
+	m_gc_add_obj(id);
+
+	copy_add(s, src, box);
+
+	box->v = copy_value(s, *src->pv);
+
+	return box;
+}
+
+/**Copy the object's prototype and properties.*/
+static void
+copy_object (CopyState *s, M_Object *src, M_Object *dst)
+{
+	M_Shape *shape = src->shape;
+	M_Property *prop;
+	uint32_t i, pos;
+
+	dst->protov = copy_value(s, src->protov);
+
+	if (shape->flags & M_SHAPE_FL_DICT) {
+		m_hash_foreach_value(prop, pos, &shape->prop_hash, node) {
+			m_object_define(dst, prop->quark, prop->flags,
+						copy_value(s, src->v[prop->id]));
+		}
+	} else {
+		for (i = 0; i < shape->nprop; i ++) {
+			prop = &shape->props[i];
+
+			m_object_define(dst, prop->quark, prop->flags,
+						copy_value(s, src->v[prop->id]));
+		}
+	}
+
+	dst->flags = src->flags;
+}
+
+/**Copy the array's elements.*/
+static void
+copy_array (CopyState *s, M_Array *src, M_Array *dst)
+{
+	M_ArrayElem *elem;
+	uint32_t i, pos;
+
+	switch (src->kind) {
+		case M_ARRAY_KIND_SMI:
+			for (i = 0; i < src->len; i ++)
+				m_array_push_number(dst, src->e.ints[i]);
+			break;
+		case M_ARRAY_KIND_DOUBLE:
+			for (i = 0; i < src->len; i ++)
+				m_array_push_number(dst, src->e.doubles[i]);
+			break;
+		case M_ARRAY_KIND_VALUE:
+			for (i = 0; i < src->len; i ++)
+				m_array_push(dst, copy_value(s, src->e.values[i]));
+			break;
+		default:
+			m_hash_foreach_value(elem, pos, &src->e.hash, node) {
+				m_array_set(dst, elem->index, copy_value(s, elem->v));
+			}
+			m_array_set_length(dst, src->len);
+			break;
+	}
+}
+
+/**Copy the closure's captured variables.*/
+static void
+copy_closure (CopyState *s, M_Closure *src, M_Closure *dst)
+{
+	uint8_t i;
+
+	for (i = 0; i < src->nupv; i ++) {
+		if (src->func->f.bc.upvs[i].flags & M_UPV_FL_BOX)
+			dst->upvs[i].box = copy_box(s, src->upvs[i].box);
+		else
+			dst->upvs[i].v = copy_value(s, src->upvs[i].v);
+	}
+}
+
+M_Value
+m_value_share (M_Value v)
+{
+	CopyState s;
+	M_Value sv, dv, r;
+
+	if (m_value_is_string(v)) {
+		m_string_flatten(m_value_get_string(v));
+		return v;
+	}
+
+	if (m_value_is_frozen(v))
+		return v;
+
+	m_hash_init(&s.map);
+	s.pending.v    = NULL;
+	s.pending.top  = 0;
+	s.pending.size = 0;
+
+	r = copy_value(&s, v);
+
+	while (s.pending.top) {
+		dv = s.pending.v[-- s.pending.top];
+		sv = s.pending.v[-- s.pending.top];
+
+		if (m_value_is_object(sv))
+			copy_object(&s, m_value_get_object(sv), m_value_get_object(dv));
+		else if (m_value_is_array(sv))
+			copy_array(&s, m_value_get_array(sv), m_value_get_array(dv));
+		else
+			copy_closure(&s, m_value_get_closure(sv), m_value_get_closure(dv));
+	}
+
+	m_hash_deinit(&s.map, &copy_hash_ops);
+
+	if (s.pending.v)
+		m_free(s.pending.v);
+
+	return r;
+}
@@ -21,16 +21,24 @@
 
 #include <m_log.h>
 #include <m_startup.h>
+#include <m_epoch.h>
 #include <m_gc.h>
 #include <m_thread.h>
+#include <m_object.h>
+#include <m_actor.h>
+#include <m_sched.h>
 
 static pthread_once_t once = PTHREAD_ONCE_INIT;
 
 static void
 shutdown (void)
 {
+	m_actor_shutdown();
+	m_object_shutdown();
 	m_thread_shutdown();
+	m_sched_shutdown();
 	m_gc_shutdown();
+	m_epoch_shutdown();
 
 	M_INFO("ming shutdown");
 
@@ -44,8 +52,12 @@ startup (void)
 
 	M_INFO("ming startup");
 
+	m_epoch_startup();
 	m_gc_startup();
 	m_thread_startup();
+	m_object_startup();
+	m_actor_startup();
+	m_sched_startup();
 
 	atexit(shutdown);
 }
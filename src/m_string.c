@@ -0,0 +1,573 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "string"
+
+#include <m_log.h>
+#include <m_malloc.h>
+#include <m_gc.h>
+#include <m_string.h>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+/**Traverse stack size, a rope walk never holds more than depth + 1 nodes.*/
+#define STRING_STACK_SIZE (M_STRING_ROPE_MAX_DEPTH + 1)
+
+/**Check if all the characters are in Latin-1 range.*/
+static M_Bool
+uchars_is_latin1 (const M_UChar *c, size_t len)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+
+	while (i + 64 <= len) {
+		__m128i acc = zero;
+		size_t end = i + 64;
+
+		for (; i < end; i += 8)
+			acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i*)(c + i)));
+
+		/*Any high byte is not 0.*/
+		acc = _mm_srli_epi16(acc, 8);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xFFFF)
+			return M_FALSE;
+	}
+#endif
+
+	for (; i < len; i ++) {
+		if (c[i] > 0xFF)
+			return M_FALSE;
+	}
+
+	return M_TRUE;
+}
+
+/**Narrow Latin-1 range characters to bytes.*/
+static void
+uchars_to_latin1 (uint8_t *dst, const M_UChar *src, size_t len)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	for (; i + 16 <= len; i += 16) {
+		__m128i v1 = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i v2 = _mm_loadu_si128((const __m128i*)(src + i + 8));
+
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(v1, v2));
+	}
+#endif
+
+	for (; i < len; i ++)
+		dst[i] = (uint8_t)src[i];
+}
+
+/**Widen Latin-1 bytes to characters.*/
+static void
+latin1_to_uchars (M_UChar *dst, const uint8_t *src, size_t len)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi8(v, zero));
+		_mm_storeu_si128((__m128i*)(dst + i + 8), _mm_unpackhi_epi8(v, zero));
+	}
+#endif
+
+	for (; i < len; i ++)
+		dst[i] = src[i];
+}
+
+/**Get the length of the first equal part of Latin-1 bytes and characters.*/
+static size_t
+latin1_uchars_prefix (const uint8_t *l, const M_UChar *c, size_t len)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i v  = _mm_loadu_si128((const __m128i*)(l + i));
+		__m128i c1 = _mm_loadu_si128((const __m128i*)(c + i));
+		__m128i c2 = _mm_loadu_si128((const __m128i*)(c + i + 8));
+		__m128i e1 = _mm_cmpeq_epi16(_mm_unpacklo_epi8(v, zero), c1);
+		__m128i e2 = _mm_cmpeq_epi16(_mm_unpackhi_epi8(v, zero), c2);
+
+		if (_mm_movemask_epi8(_mm_and_si128(e1, e2)) != 0xFFFF)
+			break;
+	}
+#endif
+
+	for (; i < len; i ++) {
+		if (l[i] != c[i])
+			break;
+	}
+
+	return i;
+}
+
+/**Copy characters between buffers of any storage.*/
+static void
+chars_copy (void *dst, M_Bool dst_latin1, const void *src, M_Bool src_latin1,
+			size_t len)
+{
+	if (dst_latin1 == src_latin1) {
+		memcpy(dst, src, dst_latin1 ? len : len * sizeof(M_UChar));
+	} else if (dst_latin1) {
+		uchars_to_latin1(dst, src, len);
+	} else {
+		latin1_to_uchars(dst, src, len);
+	}
+}
+
+/**Allocate a new string object.*/
+static M_String*
+string_alloc (size_t len, uint32_t flags, size_t *oid)
+{
+	M_String *str;
+
+	str = m_gc_alloc_obj(M_GC_OBJ_STRING, oid);
+	m_assert_alloc(str);
+
+	if ((flags & M_STRING_TYPE_MASK) != M_STRING_TYPE_ROPE)
+		flags |= M_STRING_FL_FROZEN;
+
+	str->len   = len;
+	str->flags = flags;
+	str->depth = 0;
+	str->chars = NULL;
+
+	return str;
+}
+
+/**Allocate a characters buffer.*/
+static void*
+string_alloc_chars (size_t len, M_Bool latin1)
+{
+	void *buf;
+
+	if (!len)
+		return NULL;
+
+	buf = m_gc_alloc_buf(latin1 ? len : len * sizeof(M_UChar),
+				M_GC_STRBUF_FLAGS);
+	m_assert_alloc(buf);
+
+	return buf;
+}
+
+/**
+ * Get the children of a rope node.
+ * The node may be flattened by another thread at the same time,
+ * the children are only returned if the node did not change while reading.
+ * \retval M_TRUE The node is a rope.
+ * \retval M_FALSE The node is a flat string or a slice.
+ */
+static M_Bool
+string_rope_children (M_String *str, M_String **left, M_String **right)
+{
+	uint32_t flags;
+
+	for (;;) {
+		flags = m_atomic_load_acquire(&str->flags);
+
+		if ((flags & M_STRING_TYPE_MASK) != M_STRING_TYPE_ROPE)
+			return M_FALSE;
+
+		if (flags & M_STRING_FL_BUSY) {
+			sched_yield();
+			continue;
+		}
+
+		*left  = m_atomic_load_relaxed(&str->left);
+		*right = m_atomic_load_relaxed(&str->right);
+
+		m_atomic_fence(M_ATOMIC_ACQUIRE);
+		if (m_atomic_load_relaxed(&str->flags) == flags)
+			return M_TRUE;
+	}
+}
+
+/**Copy all the characters in the string to the buffer without recursion.*/
+static void
+string_write_chars (M_String *str, void *buf, M_Bool latin1)
+{
+	M_String *stack[STRING_STACK_SIZE];
+	M_String **top, *s, *left, *right;
+	uint8_t *dst = buf;
+
+	top = stack;
+	*top ++ = str;
+
+	while (top > stack) {
+		s = *(-- top);
+
+		if (string_rope_children(s, &left, &right)) {
+			assert(top + 2 <= stack + STRING_STACK_SIZE);
+
+			*top ++ = right;
+			*top ++ = left;
+		} else {
+			chars_copy(dst, latin1, m_string_buffer(s),
+						m_string_is_latin1(s), s->len);
+			dst += latin1 ? s->len : s->len * sizeof(M_UChar);
+		}
+	}
+}
+
+void
+m_string_flatten (M_String *str)
+{
+	uint32_t flags;
+	M_Bool latin1;
+	void *buf;
+
+	assert(str);
+
+	flags = m_atomic_load_acquire(&str->flags);
+	if ((flags & M_STRING_TYPE_MASK) != M_STRING_TYPE_ROPE)
+		return;
+
+	latin1 = m_string_is_latin1(str);
+	buf    = string_alloc_chars(str->len, latin1);
+	string_write_chars(str, buf, latin1);
+
+	/*
+	 * Only one thread replaces the children with its buffer. The readers
+	 * wait while the node is busy, and the other flattening threads wait
+	 * until the node is flat and drop their buffers.
+	 */
+	flags &= ~M_STRING_FL_BUSY;
+	if (!m_atomic_cas_strong(&str->flags, &flags, flags | M_STRING_FL_BUSY,
+				M_ATOMIC_ACQ_REL)) {
+		while (m_string_type(str) == M_STRING_TYPE_ROPE)
+			sched_yield();
+
+		if (buf)
+			m_gc_free_buf(buf, latin1 ? str->len :
+						str->len * sizeof(M_UChar), M_GC_STRBUF_FLAGS);
+		return;
+	}
+
+	/*The children are released and will be collected by GC.*/
+	m_atomic_store_relaxed(&str->chars, (M_UChar*)buf);
+	m_atomic_store_relaxed(&str->depth, 0);
+	m_atomic_store_release(&str->flags, (flags & ~M_STRING_TYPE_MASK) |
+				M_STRING_TYPE_FLAT | M_STRING_FL_FROZEN);
+
+	M_DEBUG("flatten rope string %p length %zu", str, str->len);
+}
+
+/**Create a new flat string from a characters buffer of any storage.*/
+static M_String*
+string_from_buffer (const void *buf, M_Bool buf_latin1, size_t len)
+{
+	M_String *str;
+	M_Bool latin1;
+	size_t id;
+
+	latin1 = buf_latin1 || uchars_is_latin1(buf, len);
+
+	str = string_alloc(len, M_STRING_TYPE_FLAT |
+				(latin1 ? M_STRING_FL_LATIN1 : 0), &id);
+	str->chars = string_alloc_chars(len, latin1);
+
+	if (len)
+		chars_copy(str->chars, latin1, buf, buf_latin1, len);
+
+	m_gc_add_obj(id);
+
+	return str;
+}
+
+M_String*
+m_string_from_uchars (const M_UChar *chars, size_t len)
+{
+	assert(chars || !len);
+
+	return string_from_buffer(chars, M_FALSE, len);
+}
+
+M_String*
+m_string_from_cstr (const char *cstr)
+{
+	M_String *str;
+	size_t id, len;
+
+	assert(cstr);
+
+	len = strlen(cstr);
+	str = string_alloc(len, M_STRING_TYPE_FLAT | M_STRING_FL_LATIN1, &id);
+	str->lchars = string_alloc_chars(len, M_TRUE);
+
+	if (len)
+		memcpy(str->lchars, cstr, len);
+
+	m_gc_add_obj(id);
+
+	return str;
+}
+
+/**Copy the concatenation of 2 strings to a new flat string.*/
+static M_String*
+string_concat_flat (M_String *s1, M_String *s2)
+{
+	M_String *str;
+	M_Bool latin1;
+	size_t id, len;
+
+	len    = s1->len + s2->len;
+	latin1 = m_string_is_latin1(s1) && m_string_is_latin1(s2);
+
+	str = string_alloc(len, M_STRING_TYPE_FLAT |
+				(latin1 ? M_STRING_FL_LATIN1 : 0), &id);
+	str->chars = string_alloc_chars(len, latin1);
+
+	string_write_chars(s1, str->chars, latin1);
+	string_write_chars(s2, latin1 ? (void*)(str->lchars + s1->len) :
+				(void*)(str->chars + s1->len), latin1);
+
+	m_gc_add_obj(id);
+
+	return str;
+}
+
+M_String*
+m_string_concat (M_String *s1, M_String *s2)
+{
+	M_String *str, *left, *right;
+	uint32_t flags, depth;
+	size_t id, len;
+
+	assert(s1 && s2);
+
+	if (!s1->len)
+		return s2;
+	if (!s2->len)
+		return s1;
+
+	/*
+	 * Merge the flat piece with the flat end of the rope if the end is not
+	 * much longer than the piece. Repeated appends or prepends then work
+	 * like a binary counter: the pieces along the rope's spine at least
+	 * double in length, so the depth and the times a character is copied
+	 * are O(log n).
+	 */
+	for (;;) {
+		if ((m_string_type(s2) != M_STRING_TYPE_ROPE)
+					&& string_rope_children(s1, &left, &right)
+					&& (m_string_type(right) != M_STRING_TYPE_ROPE)
+					&& (right->len <= s2->len * 2)) {
+			s2 = string_concat_flat(right, s2);
+			s1 = left;
+		} else if ((m_string_type(s1) != M_STRING_TYPE_ROPE)
+					&& string_rope_children(s2, &left, &right)
+					&& (m_string_type(left) != M_STRING_TYPE_ROPE)
+					&& (left->len <= s1->len * 2)) {
+			s1 = string_concat_flat(s1, left);
+			s2 = right;
+		} else {
+			break;
+		}
+	}
+
+	len   = s1->len + s2->len;
+	flags = (m_string_is_latin1(s1) && m_string_is_latin1(s2)) ?
+				M_STRING_FL_LATIN1 : 0;
+	depth = M_MAX(m_atomic_load_relaxed(&s1->depth),
+				m_atomic_load_relaxed(&s2->depth)) + 1;
+
+	/*Short results and too deep ropes are copied to a flat string.*/
+	if ((len < M_STRING_ROPE_MIN_LEN) || (depth > M_STRING_ROPE_MAX_DEPTH))
+		return string_concat_flat(s1, s2);
+
+	str = string_alloc(len, M_STRING_TYPE_ROPE | flags, &id);
+	str->depth = depth;
+	str->left  = s1;
+	str->right = s2;
+
+	m_gc_add_obj(id);
+
+	return str;
+}
+
+M_String*
+m_string_slice (M_String *str, size_t start, size_t len)
+{
+	M_String *sub;
+	size_t id;
+
+	assert(str && (start <= str->len) && (len <= str->len - start));
+
+	if ((start == 0) && (len == str->len))
+		return str;
+
+	if (len < M_STRING_SLICE_MIN_LEN) {
+		const uint8_t *buf = m_string_buffer(str);
+
+		if (m_string_is_latin1(str))
+			return string_from_buffer(buf + start, M_TRUE, len);
+		else
+			return string_from_buffer(buf + start * sizeof(M_UChar),
+						M_FALSE, len);
+	}
+
+	/*Slicing is a random access, the rope is flattened.*/
+	m_string_flatten(str);
+
+	sub = string_alloc(len, M_STRING_TYPE_SLICE |
+				(str->flags & M_STRING_FL_LATIN1), &id);
+
+	if (m_string_type(str) == M_STRING_TYPE_SLICE) {
+		sub->parent = str->parent;
+		sub->offset = str->offset + start;
+	} else {
+		sub->parent = str;
+		sub->offset = start;
+	}
+
+	m_gc_add_obj(id);
+
+	return sub;
+}
+
+void
+m_string_get_uchars (M_String *str, M_UChar *buf)
+{
+	assert(str && (buf || !str->len));
+
+	string_write_chars(str, buf, M_FALSE);
+}
+
+M_Bool
+m_string_equal (M_String *s1, M_String *s2)
+{
+	const void *b1, *b2;
+	M_Bool l1, l2;
+
+	assert(s1 && s2);
+
+	if (s1 == s2)
+		return M_TRUE;
+
+	if (s1->len != s2->len)
+		return M_FALSE;
+
+	b1 = m_string_buffer(s1);
+	b2 = m_string_buffer(s2);
+	l1 = m_string_is_latin1(s1);
+	l2 = m_string_is_latin1(s2);
+
+	if (l1 == l2)
+		return memcmp(b1, b2, l1 ? s1->len : s1->len * sizeof(M_UChar)) ?
+					M_FALSE : M_TRUE;
+
+	if (l1)
+		return latin1_uchars_prefix(b1, b2, s1->len) == s1->len;
+	else
+		return latin1_uchars_prefix(b2, b1, s1->len) == s1->len;
+}
+
+int
+m_string_cmp (M_String *s1, M_String *s2)
+{
+	const void *b1, *b2;
+	M_Bool l1, l2;
+	size_t i, len;
+	int r = 0;
+
+	assert(s1 && s2);
+
+	if (s1 == s2)
+		return 0;
+
+	b1  = m_string_buffer(s1);
+	b2  = m_string_buffer(s2);
+	l1  = m_string_is_latin1(s1);
+	l2  = m_string_is_latin1(s2);
+	len = M_MIN(s1->len, s2->len);
+
+	if (l1 && l2) {
+		r = memcmp(b1, b2, len);
+	} else {
+		const uint8_t *lc;
+		const M_UChar *c1, *c2;
+
+		if (l1 != l2) {
+			lc = l1 ? b1 : b2;
+			c2 = l1 ? b2 : b1;
+			i  = latin1_uchars_prefix(lc, c2, len);
+
+			if (i < len)
+				r = l1 ? (int)lc[i] - (int)c2[i] : (int)c2[i] - (int)lc[i];
+		} else {
+			c1 = b1;
+			c2 = b2;
+
+			for (i = 0; i < len; i ++) {
+				if (c1[i] != c2[i]) {
+					r = (int)c1[i] - (int)c2[i];
+					break;
+				}
+			}
+		}
+	}
+
+	if (r || (s1->len == s2->len))
+		return r;
+
+	return (s1->len < s2->len) ? -1 : 1;
+}
+
+uint32_t
+m_string_hash (M_String *str)
+{
+	uint32_t kv = 2166136261u;
+	size_t i;
+
+	assert(str);
+
+	/*FNV-1a on the characters, so the value does not depend on the storage.*/
+	if (m_string_is_latin1(str)) {
+		const uint8_t *c = m_string_latin1_chars(str);
+
+		for (i = 0; i < str->len; i ++) {
+			kv ^= c[i];
+			kv *= 16777619u;
+		}
+	} else {
+		const M_UChar *c = m_string_chars(str);
+
+		for (i = 0; i < str->len; i ++) {
+			kv ^= c[i];
+			kv *= 16777619u;
+		}
+	}
+
+	return kv;
+}
@@ -19,11 +19,26 @@
 
 #define M_LOG_TAG "ming"
 
+/*REG_RIP and REG_RSP of ucontext_t.*/
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE
+#endif
+
 #include <m_log.h>
 #include <m_thread.h>
 #include <m_gc.h>
 #include <m_list.h>
 #include <m_malloc.h>
+#include <m_atomic.h>
+#include <m_sched.h>
+
+#include <signal.h>
+#include <errno.h>
+
+#ifdef M_THREAD_POLL_PAGE
+#include <ucontext.h>
+#include <cpuid.h>
+#endif
 
 #define M_GC_THREAD_FLAGS (M_GC_BUF_FL_PERMANENT | M_GC_BUF_FL_PTR)
 #define M_GC_ATH_FLAGS    M_GC_BUF_FL_PERMANENT
@@ -39,13 +54,103 @@ pthread_key_t   m_thread_key;
 pthread_mutex_t m_thread_lock;
 uint32_t        m_thread_num;
 uint32_t        m_paused_thread_num;
+M_Bool          m_thread_pause_flag;
+volatile uint32_t *m_thread_poll_page;
 
 static M_SList actor_thread_list;
-static M_Bool  thread_pause_flag;
 static M_Bool  thread_exit_flag;
 static pthread_cond_t thread_pause_cond;
 static pthread_cond_t thread_resume_cond;
-static pthread_cond_t thread_active_cond;
+
+#ifdef M_THREAD_POLL_PAGE
+static size_t         thread_poll_size;
+static struct sigaction thread_old_segv;
+
+/**The red zone below the stack pointer the interrupted code may use,
+ * m_thread_poll_stub skips it with "ret $128".*/
+#define THREAD_RED_ZONE 128
+
+/**XSAVE area size, 0 means the stub uses FXSAVE.*/
+uint32_t m_thread_xsave_size __attribute__((visibility("hidden")));
+
+void m_thread_poll_stub (void) __attribute__((visibility("hidden")));
+void m_thread_poll_wait (void) __attribute__((visibility("hidden")));
+
+/*
+ * The SIGSEGV handler makes a faulting poll return into this stub. On entry
+ * the interrupted instruction's address is on the top of the stack, below
+ * the interrupted code's red zone. The stub saves the registers the C code
+ * may clobber, waits in m_thread_poll_wait() and returns to the poll, which
+ * loads from the page again.
+ */
+__asm__ (
+	".text\n"
+	".p2align 4\n"
+	".globl m_thread_poll_stub\n"
+	".hidden m_thread_poll_stub\n"
+	".type m_thread_poll_stub, @function\n"
+	"m_thread_poll_stub:\n"
+	"	pushfq\n"
+	"	cld\n"
+	"	pushq %rax\n"
+	"	pushq %rcx\n"
+	"	pushq %rdx\n"
+	"	pushq %rsi\n"
+	"	pushq %rdi\n"
+	"	pushq %r8\n"
+	"	pushq %r9\n"
+	"	pushq %r10\n"
+	"	pushq %r11\n"
+	"	pushq %rbp\n"
+	"	movq %rsp, %rbp\n"
+	"	movl m_thread_xsave_size(%rip), %eax\n"
+	"	testl %eax, %eax\n"
+	"	jz 1f\n"
+	"	subq %rax, %rsp\n"
+	"	andq $-64, %rsp\n"
+	/*XRSTOR needs the reserved bytes of the XSAVE header cleared.
+	 *0xE7 saves the x87, SSE, AVX and AVX-512 states.*/
+	"	xorl %eax, %eax\n"
+	"	movq %rax, 512(%rsp)\n"
+	"	movq %rax, 520(%rsp)\n"
+	"	movq %rax, 528(%rsp)\n"
+	"	movq %rax, 536(%rsp)\n"
+	"	movq %rax, 544(%rsp)\n"
+	"	movq %rax, 552(%rsp)\n"
+	"	movq %rax, 560(%rsp)\n"
+	"	movq %rax, 568(%rsp)\n"
+	"	movl $0xE7, %eax\n"
+	"	xorl %edx, %edx\n"
+	"	xsave64 (%rsp)\n"
+	"	call m_thread_poll_wait\n"
+	"	movl $0xE7, %eax\n"
+	"	xorl %edx, %edx\n"
+	"	xrstor64 (%rsp)\n"
+	"	jmp 2f\n"
+	"1:\n"
+	"	subq $512, %rsp\n"
+	"	andq $-16, %rsp\n"
+	"	fxsave64 (%rsp)\n"
+	"	call m_thread_poll_wait\n"
+	"	fxrstor64 (%rsp)\n"
+	"2:\n"
+	"	movq %rbp, %rsp\n"
+	"	popq %rbp\n"
+	"	popq %r11\n"
+	"	popq %r10\n"
+	"	popq %r9\n"
+	"	popq %r8\n"
+	"	popq %rdi\n"
+	"	popq %rsi\n"
+	"	popq %rdx\n"
+	"	popq %rcx\n"
+	"	popq %rax\n"
+	"	popfq\n"
+	/*Pop the return address and skip the red zone.*/
+	"	ret $128\n"
+	".size m_thread_poll_stub, .-m_thread_poll_stub\n"
+);
+#endif /*M_THREAD_POLL_PAGE*/
 
 /**Thread data desctructor.*/
 static void
@@ -72,6 +177,9 @@ thread_key_destructor (void *ptr)
 						M_GC_NBSTK_FLAGS);
 		}
 
+		if (th->gc_worker)
+			m_free(th->gc_worker);
+
 		m_gc_free_buf(th, sizeof(M_Thread), M_GC_THREAD_FLAGS);
 	}
 }
@@ -86,11 +194,14 @@ thread_register (void)
 	th = m_gc_alloc_buf(sizeof(M_Thread), M_GC_THREAD_FLAGS);
 	m_assert_alloc(th);
 
-	th->actor    = NULL;
-	th->nb_stack = NULL;
-	th->nb_size  = 0;
-	th->nb_top   = 0;
-	th->flags    = 0;
+	th->actor     = NULL;
+	th->runq      = NULL;
+	th->nb_stack  = NULL;
+	th->nb_size   = 0;
+	th->nb_top    = 0;
+	th->flags     = 0;
+	th->gc_claim  = 0;
+	th->gc_worker = NULL;
 
 	pthread_setspecific(m_thread_key, th);
 
@@ -109,17 +220,121 @@ thread_register (void)
 	return th;
 }
 
+#ifdef M_THREAD_POLL_PAGE
+/**Pause the thread from the poll stub, out of the signal context.*/
+void
+m_thread_poll_wait (void)
+{
+	int err = errno;
+
+	/*The page is readable again when the thread is resumed.*/
+	m_thread_check();
+
+	errno = err;
+}
+
+/**
+ * SIGSEGV handler, the safe point polls fault here when pausing.
+ * Only the saved context is changed here, the thread returns from the
+ * handler into m_thread_poll_stub which does the pausing.
+ */
+static void
+thread_segv_handler (int sig, siginfo_t *info, void *ctx)
+{
+	uint8_t *page = (uint8_t*)m_thread_poll_page;
+	uint8_t *addr = (uint8_t*)info->si_addr;
+
+	if ((addr >= page) && (addr < page + thread_poll_size)) {
+		greg_t *regs = ((ucontext_t*)ctx)->uc_mcontext.gregs;
+		greg_t *sp;
+
+		sp  = (greg_t*)(regs[REG_RSP] - THREAD_RED_ZONE);
+		*-- sp = regs[REG_RIP];
+
+		regs[REG_RSP] = (greg_t)sp;
+		regs[REG_RIP] = (greg_t)m_thread_poll_stub;
+		return;
+	}
+
+	/*Not a safe point, pass it to the old handler.*/
+	if (thread_old_segv.sa_flags & SA_SIGINFO) {
+		thread_old_segv.sa_sigaction(sig, info, ctx);
+	} else if ((thread_old_segv.sa_handler == SIG_DFL) ||
+				(thread_old_segv.sa_handler == SIG_IGN)) {
+		/*Fault again with the default action.*/
+		sigaction(SIGSEGV, &thread_old_segv, NULL);
+	} else {
+		thread_old_segv.sa_handler(sig);
+	}
+}
+
+/**Map the polling page and install the SIGSEGV handler.*/
+static void
+thread_poll_init (void)
+{
+	struct sigaction sa;
+	unsigned int eax, ebx, ecx, edx;
+	void *page;
+
+	/*Use XSAVE if the OS enabled it, it covers the AVX registers.*/
+	m_thread_xsave_size = 0;
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_OSXSAVE) &&
+				__get_cpuid_count(0xD, 0, &eax, &ebx, &ecx, &edx))
+		m_thread_xsave_size = ebx + 64;
+
+	thread_poll_size = sysconf(_SC_PAGESIZE);
+
+	page = mmap(NULL, thread_poll_size, PROT_READ, MAP_PRIVATE|MAP_ANON,
+				-1, 0);
+	if (page == MAP_FAILED)
+		M_FATAL("map the polling page failed");
+
+	m_thread_poll_page = (volatile uint32_t*)page;
+
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sa.sa_sigaction = thread_segv_handler;
+	sa.sa_flags     = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+
+	if (sigaction(SIGSEGV, &sa, &thread_old_segv) == -1)
+		M_FATAL("install the SIGSEGV handler failed");
+}
+
+/**Restore the SIGSEGV handler and unmap the polling page.*/
+static void
+thread_poll_deinit (void)
+{
+	sigaction(SIGSEGV, &thread_old_segv, NULL);
+
+	munmap((void*)m_thread_poll_page, thread_poll_size);
+	m_thread_poll_page = NULL;
+}
+
+/**Set the polling page's protection.*/
+static void
+thread_poll_protect (int prot)
+{
+	if (mprotect((void*)m_thread_poll_page, thread_poll_size, prot) == -1)
+		M_FATAL("protect the polling page failed");
+}
+#else /*!M_THREAD_POLL_PAGE*/
+	#define thread_poll_init()
+	#define thread_poll_deinit()
+	#define thread_poll_protect(prot)
+#endif /*M_THREAD_POLL_PAGE*/
+
 /**Thread entry function.*/
 static void*
 thread_entry (void *arg)
 {
-	pthread_mutex_lock(&m_thread_lock);
+	thread_register();
 
-	while (!thread_exit_flag) {
-		pthread_cond_wait(&thread_active_cond, &m_thread_lock);
-	}
+	/*Wait if the GC is running.*/
+	m_thread_check();
 
-	pthread_mutex_unlock(&m_thread_lock);
+	m_sched_worker();
+
+	return NULL;
 }
 
 void
@@ -133,17 +348,18 @@ m_thread_startup (void)
 
 	pthread_cond_init(&thread_pause_cond, NULL);
 	pthread_cond_init(&thread_resume_cond, NULL);
-	pthread_cond_init(&thread_active_cond, NULL);
 
 	m_thread_num = 0;
 	m_paused_thread_num = 0;
 
-	thread_pause_flag = M_FALSE;
+	m_thread_pause_flag = M_FALSE;
 	thread_exit_flag  = M_FALSE;
 
 	m_list_init(&m_thread_list);
 	m_slist_init(&actor_thread_list);
 
+	thread_poll_init();
+
 	mth = thread_register();
 }
 
@@ -160,13 +376,18 @@ m_thread_shutdown (void)
 
 	pthread_mutex_unlock(&m_thread_lock);
 
-	pthread_cond_broadcast(&thread_active_cond);
+	m_sched_stop();
+
+	/*The exiting threads may run the GC.*/
+	m_thread_leave();
 
 	m_slist_foreach_value_safe(node, nnode, &actor_thread_list, node) {
 		pthread_join(node->thread, NULL);
 		m_gc_free_buf(node, sizeof(ActorThread), M_GC_ATH_FLAGS);
 	}
 
+	m_thread_enter();
+
 	/*Free thread data.*/
 	mth = m_thread_self();
 	if (mth) {
@@ -178,7 +399,8 @@ m_thread_shutdown (void)
 	pthread_mutex_destroy(&m_thread_lock);
 	pthread_cond_destroy(&thread_pause_cond);
 	pthread_cond_destroy(&thread_resume_cond);
-	pthread_cond_destroy(&thread_active_cond);
+
+	thread_poll_deinit();
 }
 
 void
@@ -188,7 +410,10 @@ m_thread_pause_all (void)
 
 	assert(!(th->flags & M_THREAD_FL_PAUSED));
 
-	thread_pause_flag = M_TRUE;
+	m_atomic_store_release(&m_thread_pause_flag, M_TRUE);
+
+	/*The running threads stop at their next safe point polls.*/
+	thread_poll_protect(PROT_NONE);
 
 	m_paused_thread_num ++;
 	th->flags |= M_THREAD_FL_PAUSED;
@@ -208,7 +433,10 @@ m_thread_resume_all (void)
 
 	assert(th->flags & M_THREAD_FL_PAUSED);
 
-	thread_pause_flag = M_FALSE;
+	/*Unprotect first, a poll faulted now sees the flag and returns.*/
+	thread_poll_protect(PROT_READ);
+
+	m_atomic_store_release(&m_thread_pause_flag, M_FALSE);
 
 	m_paused_thread_num --;
 	th->flags &= ~M_THREAD_FL_PAUSED;
@@ -240,7 +468,7 @@ m_thread_enter (void)
 
 	pthread_mutex_lock(&m_gc_lock);
 
-	while (thread_pause_flag) {
+	while (m_atomic_load_relaxed(&m_thread_pause_flag)) {
 		pthread_cond_wait(&thread_resume_cond, &m_gc_lock);
 	}
 
@@ -269,13 +497,17 @@ m_thread_check_nl (void)
 
 	assert(!(th->flags & M_THREAD_FL_PAUSED));
 
-	if (thread_pause_flag) {
+	if (m_atomic_load_relaxed(&m_thread_pause_flag)) {
 		m_paused_thread_num ++;
 		th->flags |= M_THREAD_FL_PAUSED;
 
 		pthread_cond_signal(&thread_pause_cond);
 
-		while (thread_pause_flag) {
+		while (m_atomic_load_relaxed(&m_thread_pause_flag)) {
+			/*Help the GC thread while waiting.*/
+			if (m_gc_help())
+				continue;
+
 			pthread_cond_wait(&thread_resume_cond, &m_gc_lock);
 		}
 
@@ -284,9 +516,20 @@ m_thread_check_nl (void)
 	}
 }
 
+void
+m_thread_wake_paused (uint32_t n)
+{
+	while (n --)
+		pthread_cond_signal(&thread_resume_cond);
+}
+
 void
 m_thread_check (void)
 {
+	/*Polling the flag costs no lock or fence when no pause is requested.*/
+	if (!m_atomic_load_acquire(&m_thread_pause_flag))
+		return;
+
 	pthread_mutex_lock(&m_gc_lock);
 
 	m_thread_check_nl();
@@ -0,0 +1,266 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "arrtest"
+
+#include <ming.h>
+
+static long
+time_diff (struct timespec *begin, struct timespec *end)
+{
+	return (end->tv_sec - begin->tv_sec) * 1000000 +
+				(end->tv_nsec - begin->tv_nsec) / 1000;
+}
+
+static void
+kind_test (void)
+{
+	M_Array *arr;
+	M_Value v;
+	double d;
+	int i;
+
+	M_INFO("kind test begin");
+
+	arr = m_array_new(0);
+
+	for (i = 0; i < 100; i ++)
+		m_array_push(arr, m_value_from_int(i));
+
+	if (m_array_kind(arr) != M_ARRAY_KIND_SMI)
+		M_ERROR("kind is not SMI");
+
+	/*Integral doubles stay in SMI kind.*/
+	m_array_push(arr, m_value_from_double(100.0));
+	if (m_array_kind(arr) != M_ARRAY_KIND_SMI)
+		M_ERROR("kind is not SMI");
+
+	m_array_push_number(arr, 100.5);
+	if (m_array_kind(arr) != M_ARRAY_KIND_DOUBLE)
+		M_ERROR("kind is not DOUBLE");
+
+	for (i = 0; i < 101; i ++) {
+		if (!m_array_get(arr, i, &v) || (m_value_get_int(v) != i))
+			M_ERROR("get %d error", i);
+	}
+	if (!m_array_get_number(arr, 101, &d) || (d != 100.5))
+		M_ERROR("get number error");
+
+	m_array_set(arr, 5, m_value_from_string(m_string_from_cstr("five")));
+	if (m_array_kind(arr) != M_ARRAY_KIND_VALUE)
+		M_ERROR("kind is not VALUE");
+	if (!m_array_get(arr, 5, &v) || !m_value_is_string(v))
+		M_ERROR("get string error");
+	if (!m_array_get(arr, 101, &v) || (m_value_get_double(v) != 100.5))
+		M_ERROR("get boxed double error");
+	if (!m_array_get(arr, 6, &v) || (m_value_get_int(v) != 6))
+		M_ERROR("get int error");
+
+	if (m_array_length(arr) != 102)
+		M_ERROR("length error");
+
+	M_INFO("kind test end");
+}
+
+static void
+sparse_test (void)
+{
+	M_Array *arr;
+	M_Value v;
+	double d;
+	int i;
+
+	M_INFO("sparse test begin");
+
+	arr = m_array_new(16);
+	for (i = 0; i < 10; i ++)
+		m_array_push_number(arr, i + 0.5);
+
+	/*Make a hole.*/
+	m_array_set(arr, 1000, m_value_from_int(1000));
+	if (m_array_kind(arr) != M_ARRAY_KIND_SPARSE)
+		M_ERROR("kind is not SPARSE");
+	if (m_array_length(arr) != 1001)
+		M_ERROR("length error");
+
+	for (i = 0; i < 10; i ++) {
+		if (!m_array_get_number(arr, i, &d) || (d != i + 0.5))
+			M_ERROR("get %d error", i);
+	}
+	if (m_array_get(arr, 500, &v))
+		M_ERROR("get hole");
+	if (!m_array_get(arr, 1000, &v) || (m_value_get_int(v) != 1000))
+		M_ERROR("get 1000 error");
+
+	m_array_set_length(arr, 5);
+	if (m_array_get(arr, 1000, &v) || m_array_get(arr, 5, &v))
+		M_ERROR("get removed element");
+	if (!m_array_get(arr, 4, &v))
+		M_ERROR("get 4 error");
+
+	arr = m_array_new(0);
+	m_array_set_length(arr, 10);
+	if ((m_array_kind(arr) != M_ARRAY_KIND_SPARSE) || m_array_get(arr, 0, &v))
+		M_ERROR("grow length error");
+
+	/*Filling the holes packs the array again.*/
+	for (i = 9; i >= 0; i --)
+		m_array_set_number(arr, i, i * 2);
+	if (m_array_kind(arr) != M_ARRAY_KIND_SMI)
+		M_ERROR("filled array is not packed");
+	for (i = 0; i < 10; i ++) {
+		if (!m_array_get(arr, i, &v) || (m_value_get_int(v) != i * 2))
+			M_ERROR("get %d error after packing", i);
+	}
+	m_array_push(arr, m_value_from_int(20));
+	if ((m_array_kind(arr) != M_ARRAY_KIND_SMI) || (m_array_length(arr) != 11))
+		M_ERROR("push error after packing");
+
+	/*The last index would wrap the length.*/
+	if (m_array_set(arr, M_ARRAY_MAX_LEN, m_value_from_int(1)) != M_FAILED)
+		M_ERROR("index %u is set", M_ARRAY_MAX_LEN);
+	if (m_array_set_number(arr, M_ARRAY_MAX_LEN, 1.5) != M_FAILED)
+		M_ERROR("index %u is set", M_ARRAY_MAX_LEN);
+	if (m_array_length(arr) != 11)
+		M_ERROR("length error");
+	if (m_array_set(arr, M_ARRAY_MAX_LEN - 1, m_value_from_int(1)) != M_OK)
+		M_ERROR("set last index error");
+	if (m_array_length(arr) != M_ARRAY_MAX_LEN)
+		M_ERROR("max length error");
+
+	M_INFO("sparse test end");
+}
+
+static void
+gc_test (void)
+{
+	M_Array *varr, *sarr;
+	M_Value v;
+	size_t level;
+	int i;
+
+	M_INFO("gc test begin");
+
+	level = m_gc_get_nb_level();
+
+	varr = m_array_new(0);
+	sarr = m_array_new(0);
+	m_gc_add_root(varr);
+	m_gc_add_root(sarr);
+	m_gc_set_nb_level(level);
+
+	for (i = 0; i < 1000; i ++) {
+		m_array_push_number(varr, i + 0.25);
+		m_array_set(sarr, i * 2, m_value_from_double(i + 0.75));
+	}
+	m_array_push(varr, m_value_from_object(m_object_new(0)));
+
+	m_gc_set_nb_level(level);
+	m_gc_run(0);
+
+	for (i = 0; i < 1000; i ++) {
+		if (!m_array_get(varr, i, &v) || (m_value_get_double(v) != i + 0.25))
+			M_ERROR("get %d error", i);
+		if (!m_array_get(sarr, i * 2, &v) || (m_value_get_double(v) != i + 0.75))
+			M_ERROR("get sparse %d error", i);
+	}
+	if (!m_array_get(varr, 1000, &v) || !m_value_is_object(v))
+		M_ERROR("get object error");
+
+	m_gc_remove_root(varr);
+	m_gc_remove_root(sarr);
+
+	M_INFO("gc test end");
+}
+
+static void
+bench (void)
+{
+#define BENCH_COUNT (8*1024*1024)
+	M_Array *darr, *varr;
+	struct timespec begin, end;
+	double *d, sum, expect;
+	M_Value v;
+	size_t level;
+	uint32_t i, n;
+
+	M_INFO("bench begin");
+
+	level = m_gc_get_nb_level();
+
+	darr = m_array_new(BENCH_COUNT);
+	for (i = 0; i < BENCH_COUNT; i ++)
+		m_array_push_number(darr, i + 0.5);
+
+	expect = (double)BENCH_COUNT * BENCH_COUNT / 2;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	d   = m_array_doubles(darr);
+	n   = m_array_length(darr);
+	sum = 0;
+	for (i = 0; i < n; i ++)
+		sum += d[i];
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	M_INFO("sum %d unboxed doubles: %ldus, %.1fMB/s", BENCH_COUNT,
+				time_diff(&begin, &end),
+				(double)BENCH_COUNT * sizeof(double) /
+				M_MAX(time_diff(&begin, &end), 1));
+	if (sum != expect)
+		M_ERROR("sum error");
+
+	m_gc_add_root(darr);
+	m_gc_set_nb_level(level);
+
+	varr = m_array_new(BENCH_COUNT);
+	m_array_push(varr, m_value_from_string(m_string_from_cstr("")));
+	m_array_set_length(varr, 0);
+	for (i = 0; i < BENCH_COUNT; i ++)
+		m_array_push(varr, m_value_from_double(i + 0.5));
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	sum = 0;
+	for (i = 0; i < BENCH_COUNT; i ++) {
+		m_array_get(varr, i, &v);
+		sum += m_value_get_double(v);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	M_INFO("sum %d boxed doubles: %ldus", BENCH_COUNT, time_diff(&begin, &end));
+	if (sum != expect)
+		M_ERROR("sum error");
+
+	m_gc_remove_root(darr);
+	m_gc_set_nb_level(level);
+
+	M_INFO("bench end");
+}
+
+int
+main (int argc, char **argv)
+{
+	m_startup();
+
+	kind_test();
+	sparse_test();
+	gc_test();
+	bench();
+
+	return 0;
+}
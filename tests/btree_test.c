@@ -0,0 +1,475 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "btreetest"
+
+#include <ming.h>
+
+static long
+time_diff (struct timespec *begin, struct timespec *end)
+{
+	return (end->tv_sec - begin->tv_sec) * 1000000 +
+				(end->tv_nsec - begin->tv_nsec) / 1000;
+}
+
+/*Report a benchmark, the B+ tree time first.*/
+static void
+bench_report (const char *name, long btree_us, long rbt_us)
+{
+	double ratio = (double)rbt_us / M_MAX(btree_us, 1);
+
+	if (ratio >= 1)
+		M_INFO("%s: btree %ldus, rbtree %ldus, btree %.2fx faster", name,
+					btree_us, rbt_us, ratio);
+	else
+		M_WARNING("%s: btree %ldus, rbtree %ldus, btree %.2fx slower", name,
+					btree_us, rbt_us, 1 / ratio);
+}
+
+/*Check the node's keys are in range [lo, hi) and return the leaf depth.*/
+static int
+check_node (M_BTreeNode *node, M_BTreeKey lo, M_BTreeKey hi, M_Bool root)
+{
+	uint32_t i, min;
+	int depth = -1;
+
+	min = node->leaf ? M_BTREE_ORDER / 2 : M_BTREE_ORDER / 2 - 1;
+	if (!root && (node->n < min))
+		M_ERROR("node underflow");
+	if (!node->leaf && !node->n)
+		M_ERROR("empty internal node");
+
+	for (i = 0; i < node->n; i ++) {
+		if ((node->keys[i] < lo) || (node->keys[i] >= hi))
+			M_ERROR("key out of range");
+		if (i && (node->keys[i - 1] >= node->keys[i]))
+			M_ERROR("keys not sorted");
+	}
+	for (; i < M_BTREE_ORDER; i ++) {
+		if (node->keys[i] != UINT64_MAX)
+			M_ERROR("unused key not padded");
+	}
+
+	if (node->leaf)
+		return 1;
+
+	for (i = 0; i <= node->n; i ++) {
+		M_BTreeKey clo = i ? node->keys[i - 1] : lo;
+		M_BTreeKey chi = (i < node->n) ? node->keys[i] : hi;
+		int d = check_node(((M_BTreeInner*)node)->children[i], clo, chi,
+					M_FALSE);
+
+		if ((depth != -1) && (d != depth))
+			M_ERROR("unbalanced tree");
+		depth = d;
+	}
+
+	return depth + 1;
+}
+
+static void
+check_tree (M_BTree *tree)
+{
+	M_BTreeIter iter;
+	M_BTreeKey prev = 0;
+	size_t n = 0;
+
+	if (!tree->root)
+		return;
+
+	if (check_node(tree->root, 0, UINT64_MAX, M_TRUE) != (int)tree->height)
+		M_ERROR("height error");
+
+	m_btree_foreach(&iter, tree) {
+		if (n && (m_btree_iter_key(&iter) <= prev))
+			M_ERROR("leaf list not sorted");
+		prev = m_btree_iter_key(&iter);
+		n ++;
+	}
+
+	if (n != m_btree_size(tree))
+		M_ERROR("size error");
+}
+
+static void
+insert_remove_test (void)
+{
+#define NUM_COUNT  10000
+#define LOOP_COUNT 20
+	M_BTree tree;
+	M_BTreeKey nums[NUM_COUNT];
+	void *v;
+	int i, loop;
+
+	M_INFO("insert remove test begin");
+
+	m_btree_init(&tree);
+
+	for (i = 0; i < NUM_COUNT; i ++)
+		nums[i] = i * 3;
+
+	for (loop = 0; loop < LOOP_COUNT; loop ++) {
+		for (i = 0; i < NUM_COUNT; i ++) {
+			int x = rand() % NUM_COUNT;
+
+			M_EXCHANGE(nums[i], nums[x]);
+		}
+
+		for (i = 0; i < NUM_COUNT; i ++) {
+			if (m_btree_insert(&tree, nums[i], M_SIZE_TO_PTR(nums[i] + 1))
+						!= M_OK)
+				M_ERROR("insert error");
+		}
+
+		if (m_btree_insert(&tree, nums[0], NULL) != M_NONE)
+			M_ERROR("duplicate insert error");
+
+		check_tree(&tree);
+
+		for (i = 0; i < NUM_COUNT * 3; i ++) {
+			M_Bool r = m_btree_lookup(&tree, i, &v);
+
+			if (r != ((i % 3) == 0))
+				M_ERROR("lookup error");
+			if (r && (M_PTR_TO_SIZE(v) != (size_t)i + 1))
+				M_ERROR("lookup value error");
+		}
+
+		/*Remove half of the keys and check the tree in the middle.*/
+		for (i = 0; i < NUM_COUNT; i ++) {
+			int x = rand() % NUM_COUNT;
+
+			M_EXCHANGE(nums[i], nums[x]);
+		}
+
+		for (i = 0; i < NUM_COUNT / 2; i ++) {
+			if (m_btree_remove(&tree, nums[i], &v) != M_OK)
+				M_ERROR("remove error");
+			if (M_PTR_TO_SIZE(v) != nums[i] + 1)
+				M_ERROR("remove value error");
+		}
+
+		if (m_btree_remove(&tree, nums[0], NULL) != M_NONE)
+			M_ERROR("duplicate remove error");
+
+		check_tree(&tree);
+
+		for (i = 0; i < NUM_COUNT; i ++) {
+			if (m_btree_lookup(&tree, nums[i], NULL) != (i >= NUM_COUNT / 2))
+				M_ERROR("lookup error");
+		}
+
+		for (i = NUM_COUNT / 2; i < NUM_COUNT; i ++) {
+			if (m_btree_remove(&tree, nums[i], NULL) != M_OK)
+				M_ERROR("remove error");
+		}
+
+		check_tree(&tree);
+
+		if (m_btree_size(&tree) || (tree.height != 1))
+			M_ERROR("remove all error");
+	}
+
+	m_btree_deinit(&tree, NULL);
+
+	M_INFO("insert remove test end");
+}
+
+static void
+range_test (void)
+{
+	M_BTree tree;
+	M_BTreeIter iter;
+	M_BTreeKey k;
+	int i, n;
+
+	M_INFO("range test begin");
+
+	m_btree_init(&tree);
+
+	m_btree_foreach(&iter, &tree) {
+		M_ERROR("traverse error");
+	}
+
+	for (i = NUM_COUNT - 1; i >= 0; i --)
+		m_btree_insert(&tree, i * 2, M_SIZE_TO_PTR(i));
+
+	i = 0;
+	m_btree_foreach(&iter, &tree) {
+		if ((m_btree_iter_key(&iter) != (M_BTreeKey)i * 2) ||
+					(M_PTR_TO_SIZE(m_btree_iter_value(&iter)) != (size_t)i))
+			M_ERROR("traverse error");
+		i ++;
+	}
+	if (i != NUM_COUNT)
+		M_ERROR("traverse error");
+
+	/*Odd bounds fall between the keys.*/
+	n = 0;
+	k = 101;
+	m_btree_foreach_range(&iter, &tree, 101, 1001) {
+		if (m_btree_iter_key(&iter) != k + 1)
+			M_ERROR("range error");
+		k += 2;
+		n ++;
+	}
+	if (n != 450)
+		M_ERROR("range error");
+
+	n = 0;
+	m_btree_foreach_range(&iter, &tree, 100, 1000) {
+		n ++;
+	}
+	if (n != 450)
+		M_ERROR("range error");
+
+	m_btree_seek(&tree, NUM_COUNT * 2, &iter);
+	if (m_btree_iter_valid(&iter))
+		M_ERROR("seek error");
+
+	m_btree_seek(&tree, NUM_COUNT * 2 - 3, &iter);
+	if (!m_btree_iter_valid(&iter) ||
+				(m_btree_iter_key(&iter) != NUM_COUNT * 2 - 2))
+		M_ERROR("seek error");
+
+	m_btree_deinit(&tree, NULL);
+
+	M_INFO("range test end");
+}
+
+static void
+build_test (void)
+{
+	M_BTree tree;
+	M_BTreeIter iter;
+	M_BTreeKey *keys;
+	size_t counts[] = {1, 15, 16, 17, 272, 273, 4913, 100000};
+	size_t i, j, n;
+
+	M_INFO("build test begin");
+
+	keys = M_NEW(M_BTreeKey, 100000);
+
+	for (i = 0; i < M_N_ELEMENT(counts); i ++) {
+		n = counts[i];
+
+		for (j = 0; j < n; j ++)
+			keys[j] = j * 5 + 1;
+
+		m_btree_init(&tree);
+
+		if (m_btree_build(&tree, keys, NULL, n) != M_OK)
+			M_ERROR("build error");
+
+		check_tree(&tree);
+
+		j = 0;
+		m_btree_foreach(&iter, &tree) {
+			if (m_btree_iter_key(&iter) != keys[j])
+				M_ERROR("traverse error");
+			j ++;
+		}
+
+		/*The built tree must stay valid under updates.*/
+		for (j = 0; j < n; j ++) {
+			m_btree_insert(&tree, j * 5 + 3, NULL);
+		}
+		for (j = 0; j < n; j += 2) {
+			m_btree_remove(&tree, keys[j], NULL);
+		}
+
+		check_tree(&tree);
+
+		if (m_btree_size(&tree) != n + n / 2)
+			M_ERROR("size error");
+
+		m_btree_deinit(&tree, NULL);
+	}
+
+	m_free(keys);
+
+	M_INFO("build test end");
+}
+
+typedef struct {
+	M_RBNode node;
+	size_t   k;
+} IntNode;
+
+static inline size_t
+int_node_key (const M_RBNode *node)
+{
+	return m_node_value(node, IntNode, node)->k;
+}
+
+static inline int
+int_cmp (size_t k1, size_t k2)
+{
+	return (k1 < k2) ? -1 : (k1 > k2);
+}
+
+M_DEFINE_RBTREE(int_tree, size_t, int_node_key, int_cmp)
+
+static void
+bench_test (void)
+{
+#define BENCH_COUNT 1000000
+	M_BTree btree;
+	M_BTreeIter iter;
+	M_BTreeKey *keys;
+	M_RBTree rbt;
+	M_RBNode *node, *parent, **pos;
+	IntNode *ins;
+	struct timespec begin, end;
+	long rbt_us, btree_us;
+	size_t sum, i;
+
+	M_INFO("bench test begin, %d keys", BENCH_COUNT);
+
+	keys = M_NEW(M_BTreeKey, BENCH_COUNT);
+	ins  = M_NEW(IntNode, BENCH_COUNT);
+
+	for (i = 0; i < BENCH_COUNT; i ++)
+		keys[i] = i;
+	for (i = 0; i < BENCH_COUNT; i ++) {
+		size_t x = (size_t)rand() % BENCH_COUNT;
+
+		M_EXCHANGE(keys[i], keys[x]);
+	}
+
+	m_rbt_init(&rbt);
+	m_btree_init(&btree);
+
+	/*Random order insert.*/
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < BENCH_COUNT; i ++) {
+		ins[i].k = keys[i];
+		node = int_tree_lookup_insert(&rbt, keys[i], &parent, &pos);
+		m_rbt_insert(&rbt, parent, pos, &ins[i].node);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	rbt_us = time_diff(&begin, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < BENCH_COUNT; i ++)
+		m_btree_insert(&btree, keys[i], &ins[i]);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	btree_us = time_diff(&begin, &end);
+
+	bench_report("random inserts", btree_us, rbt_us);
+
+	/*Random order lookup.*/
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < BENCH_COUNT; i ++) {
+		if (!int_tree_lookup(&rbt, keys[BENCH_COUNT - 1 - i]))
+			M_ERROR("lookup error");
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	rbt_us = time_diff(&begin, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < BENCH_COUNT; i ++) {
+		if (!m_btree_lookup(&btree, keys[BENCH_COUNT - 1 - i], NULL))
+			M_ERROR("lookup error");
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	btree_us = time_diff(&begin, &end);
+
+	bench_report("random lookups", btree_us, rbt_us);
+
+	/*In order traverse.*/
+	sum = 0;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	m_rbt_foreach(node, &rbt) {
+		sum += int_node_key(node);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	rbt_us = time_diff(&begin, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	m_btree_foreach(&iter, &btree) {
+		sum -= m_btree_iter_key(&iter);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	btree_us = time_diff(&begin, &end);
+
+	if (sum)
+		M_ERROR("traverse error");
+
+	bench_report("traverse", btree_us, rbt_us);
+
+	/*Random order remove.*/
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < BENCH_COUNT; i ++) {
+		node = int_tree_lookup(&rbt, keys[i]);
+		m_rbt_remove(&rbt, node);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	rbt_us = time_diff(&begin, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < BENCH_COUNT; i ++)
+		m_btree_remove(&btree, keys[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	btree_us = time_diff(&begin, &end);
+
+	bench_report("random removes", btree_us, rbt_us);
+
+	m_btree_deinit(&btree, NULL);
+
+	/*Bulk load against inserting the sorted keys one by one.*/
+	for (i = 0; i < BENCH_COUNT; i ++)
+		keys[i] = i;
+
+	m_btree_init(&btree);
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < BENCH_COUNT; i ++)
+		m_btree_insert(&btree, keys[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	rbt_us = time_diff(&begin, &end);
+	m_btree_deinit(&btree, NULL);
+
+	m_btree_init(&btree);
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	m_btree_build(&btree, keys, NULL, BENCH_COUNT);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	btree_us = time_diff(&begin, &end);
+	m_btree_deinit(&btree, NULL);
+
+	M_INFO("sorted %d: inserts %ldus, bulk load %ldus", BENCH_COUNT, rbt_us,
+				btree_us);
+
+	m_free(ins);
+	m_free(keys);
+
+	M_INFO("bench test end");
+}
+
+int
+main (int argc, char **argv)
+{
+	m_startup();
+
+	insert_remove_test();
+	range_test();
+	build_test();
+	bench_test();
+
+	return 0;
+}
@@ -0,0 +1,332 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "ming"
+
+#include <ming.h>
+
+#define INT_COUNT    65536
+#define THREADS      4
+#define VOLATILE     1024
+#define WRITE_LOOPS  64
+#define BENCH_COUNT  1000000
+#define BENCH_THREADS 8
+
+static long
+time_diff (struct timespec *begin, struct timespec *end)
+{
+	return (end->tv_sec - begin->tv_sec) * 1000000 +
+				(end->tv_nsec - begin->tv_nsec) / 1000;
+}
+
+typedef struct {
+	M_HashNode node;
+	int        i;
+} IntHashNode;
+
+static inline void*
+int_get_key(const M_HashNode *node)
+{
+	return M_SIZE_TO_PTR(M_CONTAINER_OF(node, IntHashNode, node)->i);
+}
+
+static const M_HashOps int_ops = {
+get_key:   int_get_key,
+kv:        m_int_hash_kv_func,
+equal:     m_int_hash_equal_func,
+free_node: m_free,
+alloc_buf: m_malloc,
+free_buf:  (void*)m_free
+};
+
+static IntHashNode*
+int_node (int i)
+{
+	IntHashNode *in = M_NEW(IntHashNode, 1);
+
+	in->i = i;
+
+	return in;
+}
+
+static void
+basic_test (void)
+{
+	M_CHash hash;
+	M_HashNode *node, *old;
+	IntHashNode *in;
+	int i, count = INT_COUNT;
+
+	M_INFO("basic test begin");
+
+	m_chash_init(&hash);
+
+	if (m_chash_lookup(&hash, M_SIZE_TO_PTR(0), &int_ops))
+		M_ERROR("lookup in empty hash table");
+
+	for (i = 0; i < count; i ++) {
+		in = int_node(i);
+
+		if (m_chash_insert(&hash, &in->node, &int_ops, NULL) != M_OK)
+			M_ERROR("insert error");
+
+		if (m_chash_size(&hash) != i + 1)
+			M_ERROR("hash size error");
+	}
+
+	in = int_node(count / 2);
+	if ((m_chash_insert(&hash, &in->node, &int_ops, &old) != M_NONE)
+				|| (M_CONTAINER_OF(old, IntHashNode, node)->i != count / 2))
+		M_ERROR("duplicated key is inserted");
+	m_free(in);
+
+	for (i = 0; i < count; i ++) {
+		node = m_chash_lookup(&hash, M_SIZE_TO_PTR(i), &int_ops);
+		if (!node || (M_CONTAINER_OF(node, IntHashNode, node)->i != i))
+			M_ERROR("cannot find inserted node");
+	}
+
+	for (i = 1; i < count; i += 2) {
+		node = m_chash_remove(&hash, M_SIZE_TO_PTR(i), &int_ops);
+		if (!node)
+			M_ERROR("cannot remove entry");
+
+		m_epoch_retire(M_CONTAINER_OF(node, IntHashNode, node), m_free);
+	}
+
+	if (m_chash_size(&hash) != count / 2)
+		M_ERROR("hash size error");
+
+	for (i = 0; i < count; i ++) {
+		node = m_chash_lookup(&hash, M_SIZE_TO_PTR(i), &int_ops);
+		if ((i & 1) ? (node != NULL) : (node == NULL))
+			M_ERROR("hash error after remove");
+	}
+
+	m_chash_deinit(&hash, &int_ops);
+
+	M_INFO("basic test end");
+}
+
+static M_CHash  con_hash;
+static uint32_t con_count;
+static uint32_t con_done;
+
+/*Look up the inserted keys and the keys being removed.*/
+static void*
+reader (void *arg)
+{
+	uint32_t seed = M_PTR_TO_SIZE(arg);
+
+	while (!m_atomic_load_acquire(&con_done)) {
+		uint32_t n = m_atomic_load_acquire(&con_count);
+		M_HashNode *node;
+		int i;
+
+		if (n) {
+			i = rand_r(&seed) % n;
+
+			node = m_chash_lookup(&con_hash, M_SIZE_TO_PTR(i), &int_ops);
+			if (!node || (M_CONTAINER_OF(node, IntHashNode, node)->i != i))
+				M_ERROR("cannot find inserted node");
+		}
+
+		i = INT_COUNT + rand_r(&seed) % VOLATILE;
+
+		m_epoch_enter();
+		node = m_chash_lookup(&con_hash, M_SIZE_TO_PTR(i), &int_ops);
+		if (node && (M_CONTAINER_OF(node, IntHashNode, node)->i != i))
+			M_ERROR("removed node is changed");
+		m_epoch_leave();
+	}
+
+	return NULL;
+}
+
+static void
+concurrent_test (void)
+{
+	pthread_t th[THREADS];
+	IntHashNode *in;
+	M_HashNode *node;
+	int i, j;
+
+	M_INFO("concurrent test begin");
+
+	m_chash_init(&con_hash);
+	con_count = 0;
+	con_done  = 0;
+
+	for (i = 0; i < THREADS; i ++)
+		pthread_create(&th[i], NULL, reader, M_SIZE_TO_PTR(i + 1));
+
+	for (i = 0; i < INT_COUNT; i ++) {
+		in = int_node(i);
+
+		if (m_chash_insert(&con_hash, &in->node, &int_ops, NULL) != M_OK)
+			M_ERROR("insert error");
+
+		m_atomic_store_release(&con_count, i + 1);
+
+		/*Add and remove the volatile keys.*/
+		if (!(i % (INT_COUNT / WRITE_LOOPS))) {
+			for (j = 0; j < VOLATILE; j ++) {
+				in = int_node(INT_COUNT + j);
+
+				if (m_chash_insert(&con_hash, &in->node, &int_ops, NULL)
+							!= M_OK)
+					M_ERROR("insert error");
+			}
+
+			for (j = 0; j < VOLATILE; j ++) {
+				node = m_chash_remove(&con_hash,
+							M_SIZE_TO_PTR(INT_COUNT + j), &int_ops);
+				if (!node)
+					M_ERROR("cannot remove entry");
+
+				m_epoch_retire(M_CONTAINER_OF(node, IntHashNode, node),
+							m_free);
+			}
+		}
+
+		if (!(i % 64))
+			sched_yield();
+	}
+
+	m_atomic_store_release(&con_done, 1);
+
+	for (i = 0; i < THREADS; i ++)
+		pthread_join(th[i], NULL);
+
+	if (m_chash_size(&con_hash) != INT_COUNT)
+		M_ERROR("hash size error");
+
+	m_chash_deinit(&con_hash, &int_ops);
+
+	M_INFO("concurrent test end");
+}
+
+static M_Hash          bench_hash;
+static pthread_mutex_t bench_lock = PTHREAD_MUTEX_INITIALIZER;
+static int             bench_nthread;
+
+static void*
+hash_reader (void *arg)
+{
+	uint32_t seed = M_PTR_TO_SIZE(arg);
+	int i;
+
+	for (i = 0; i < BENCH_COUNT / bench_nthread; i ++) {
+		int k = rand_r(&seed) % INT_COUNT;
+		M_HashNode *node;
+
+		pthread_mutex_lock(&bench_lock);
+		node = m_hash_lookup(&bench_hash, M_SIZE_TO_PTR(k), &int_ops);
+		pthread_mutex_unlock(&bench_lock);
+
+		if (!node)
+			M_ERROR("lookup error");
+	}
+
+	return NULL;
+}
+
+static void*
+chash_reader (void *arg)
+{
+	uint32_t seed = M_PTR_TO_SIZE(arg);
+	int i;
+
+	for (i = 0; i < BENCH_COUNT / bench_nthread; i ++) {
+		int k = rand_r(&seed) % INT_COUNT;
+
+		if (!m_chash_lookup(&con_hash, M_SIZE_TO_PTR(k), &int_ops))
+			M_ERROR("lookup error");
+	}
+
+	return NULL;
+}
+
+static long
+run_readers (void* (*fn)(void *arg))
+{
+	pthread_t th[BENCH_THREADS];
+	struct timespec begin, end;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	for (i = 0; i < bench_nthread; i ++)
+		pthread_create(&th[i], NULL, fn, M_SIZE_TO_PTR(i + 1));
+	for (i = 0; i < bench_nthread; i ++)
+		pthread_join(th[i], NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return time_diff(&begin, &end);
+}
+
+static void
+bench_test (void)
+{
+	long hash_us, chash_us;
+	int i;
+
+	M_INFO("read benchmark begin");
+
+	m_hash_init(&bench_hash);
+	m_chash_init(&con_hash);
+
+	for (i = 0; i < INT_COUNT; i ++) {
+		IntHashNode *in = int_node(i);
+
+		m_hash_resize(&bench_hash, &int_ops);
+		m_hash_insert(&bench_hash, &in->node, &int_ops);
+
+		in = int_node(i);
+		m_chash_insert(&con_hash, &in->node, &int_ops, NULL);
+	}
+
+	/*The stripe locks only help when the threads run on several cores.*/
+	for (bench_nthread = 1; bench_nthread <= BENCH_THREADS;
+				bench_nthread *= 2) {
+		hash_us  = run_readers(hash_reader);
+		chash_us = run_readers(chash_reader);
+
+		M_INFO("%d lookups in %d threads: locked M_Hash %ldus, M_CHash %ldus",
+					BENCH_COUNT, bench_nthread, hash_us, chash_us);
+	}
+
+	m_hash_deinit(&bench_hash, &int_ops);
+	m_chash_deinit(&con_hash, &int_ops);
+
+	M_INFO("read benchmark end");
+}
+
+int
+main (int argc, char **argv)
+{
+	m_startup();
+
+	basic_test();
+	concurrent_test();
+	bench_test();
+
+	return 0;
+}
@@ -108,13 +108,90 @@ multithread_test (void)
 	M_INFO("multithread test end");
 }
 
+static M_Quark next_name;
+
+static void*
+parallel_entry (void *arg)
+{
+#define CHAIN_LEN   20000
+#define CHAIN_LOOPS 20
+	M_Object *head, *obj;
+	M_Value v;
+	size_t level;
+	int i, l;
+
+	m_thread_enter();
+
+	for (l = 0; l < CHAIN_LOOPS; l ++) {
+		level = m_gc_get_nb_level();
+
+		/*Build a long chain, so the gray objects are shared.*/
+		head = NULL;
+		for (i = 0; i < CHAIN_LEN; i ++) {
+			obj = m_object_new(0);
+			m_object_set(obj, next_name, head ?
+						m_value_from_object(head) : m_value_from_int(i));
+			head = obj;
+		}
+
+		m_gc_run(0);
+
+		for (i = 0, obj = head; i < CHAIN_LEN - 1; i ++) {
+			if (!m_object_get(obj, next_name, &v) || !m_value_is_object(v)) {
+				M_ERROR("chain is broken at %d", i);
+				break;
+			}
+			obj = m_value_get_object(v);
+		}
+
+		m_gc_set_nb_level(level);
+	}
+
+	m_thread_leave();
+
+	return NULL;
+}
+
+static void
+parallel_test (void)
+{
+#define PARALLEL_COUNT 4
+	pthread_t th[PARALLEL_COUNT];
+	int i;
+
+	M_INFO("parallel test begin");
+
+	next_name = m_string_from_cstr("next");
+	m_gc_add_root(next_name);
+
+	for (i = 0; i < PARALLEL_COUNT; i ++) {
+		pthread_create(&th[i], NULL, parallel_entry, NULL);
+	}
+
+	m_thread_leave();
+
+	for (i = 0; i < PARALLEL_COUNT; i ++) {
+		pthread_join(th[i], NULL);
+	}
+
+	m_thread_enter();
+
+	m_gc_remove_root(next_name);
+
+	M_INFO("parallel test end");
+}
+
 int
 main (int argc, char **argv)
 {
+	/*Let the paused threads join the collection even with one CPU.*/
+	setenv("M_GC_WORKERS", "4", 0);
+
 	m_startup();
 
 	gc_test();
 	multithread_test();
+	parallel_test();
 
 	return 0;
 }
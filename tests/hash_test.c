@@ -21,6 +21,13 @@
 
 #include <ming.h>
 
+static long
+time_diff (struct timespec *begin, struct timespec *end)
+{
+	return (end->tv_sec - begin->tv_sec) * 1000000 +
+				(end->tv_nsec - begin->tv_nsec) / 1000;
+}
+
 static void
 hash_info (M_Hash *hash)
 {
@@ -237,6 +244,46 @@ alloc_buf: m_malloc,
 free_buf:  (void*)m_free
 };
 
+static inline int
+int_node_key (const M_HashNode *node)
+{
+	return M_CONTAINER_OF(node, IntHashNode, node)->i;
+}
+
+static inline uint32_t
+int_kv (int key)
+{
+	return key;
+}
+
+static inline M_Bool
+int_equal (int k1, int k2)
+{
+	return k1 == k2;
+}
+
+M_DEFINE_HASH(int_hash, int, int_node_key, int_kv, int_equal)
+
+static inline void*
+ptr_node_key (const M_HashNode *node)
+{
+	return M_CONTAINER_OF(node, PtrHashNode, node)->ptr;
+}
+
+static inline uint32_t
+ptr_kv (void *key)
+{
+	return M_PTR_TO_SIZE(key);
+}
+
+static inline M_Bool
+ptr_equal (void *k1, void *k2)
+{
+	return k1 == k2;
+}
+
+M_DEFINE_HASH(ptr_hash, void*, ptr_node_key, ptr_kv, ptr_equal)
+
 static void
 ptr_hash_test (void)
 {
@@ -307,6 +354,549 @@ ptr_hash_test (void)
 	M_INFO("ptr hash test end");
 }
 
+static void
+incr_hash_test (void)
+{
+	M_Hash hash;
+	M_HashNode *node;
+	IntHashNode *in, *nin;
+	uint32_t pos, n;
+	int i, count = INT_COUNT;
+	M_Bool migrated = M_FALSE;
+
+	M_INFO("incremental hash test begin");
+
+	m_hash_init(&hash);
+
+	for (i = 0; i < count; i ++) {
+		uint32_t kv;
+
+		node = m_hash_lookup_with_kv(&hash, M_SIZE_TO_PTR(i), &int_ops, &kv);
+		if (node) {
+			M_ERROR("lookup error");
+		}
+
+		m_hash_resize_incr(&hash, &int_ops);
+
+		in = M_NEW(IntHashNode, 1);
+		in->i = i;
+
+		m_hash_insert_with_kv(&hash, &in->node, kv, &int_ops);
+
+		/*Check the table while the old lists are being migrated.*/
+		if (hash.olists && !(i % 997)) {
+			int j;
+
+			migrated = M_TRUE;
+
+			for (j = 0; j <= i; j += 31) {
+				node = m_hash_lookup(&hash, M_SIZE_TO_PTR(j), &int_ops);
+				if (!node || (M_CONTAINER_OF(node, IntHashNode, node)->i != j))
+					M_ERROR("lookup error in migration");
+			}
+
+			n = 0;
+			m_hash_foreach(node, pos, &hash) {
+				n ++;
+			}
+
+			if (n != m_hash_size(&hash))
+				M_ERROR("traverse error in migration");
+
+			node = m_hash_remove(&hash, M_SIZE_TO_PTR(i / 2), &int_ops);
+			if (!node)
+				M_ERROR("remove error in migration");
+
+			m_hash_insert(&hash, node, &int_ops);
+		}
+	}
+
+	if (!migrated)
+		M_ERROR("migration is not checked");
+
+	for (i = 0; i < count; i ++) {
+		node = m_hash_lookup(&hash, M_SIZE_TO_PTR(i), &int_ops);
+		if (!node || (M_CONTAINER_OF(node, IntHashNode, node)->i != i)) {
+			M_ERROR("cannot find inserted node");
+		}
+	}
+
+	m_hash_foreach_value_safe(in, nin, pos, &hash, node) {
+		m_hash_remove(&hash, M_SIZE_TO_PTR(in->i), &int_ops);
+		m_free(in);
+	}
+
+	if (m_hash_size(&hash))
+		M_ERROR("hash size error");
+
+	m_hash_deinit(&hash, &int_ops);
+
+	M_INFO("incremental hash test end");
+}
+
+static int
+latency_cmp (const void *p1, const void *p2)
+{
+	long l1 = *(const long*)p1;
+	long l2 = *(const long*)p2;
+
+	return (l1 > l2) - (l1 < l2);
+}
+
+/*Insert the nodes and sort the insertion latencies in nanoseconds.*/
+static void
+insert_latency (M_HashNode **nodes, long *lat, int count, M_Bool incr)
+{
+	M_Hash hash;
+	struct timespec begin, end;
+	int i;
+
+	m_hash_init(&hash);
+
+	for (i = 0; i < count; i ++) {
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+
+		if (incr)
+			m_hash_resize_incr(&hash, &int_ops);
+		else
+			m_hash_resize(&hash, &int_ops);
+
+		m_hash_insert(&hash, nodes[i], &int_ops);
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		lat[i] = (end.tv_sec - begin.tv_sec) * 1000000000 +
+					(end.tv_nsec - begin.tv_nsec);
+	}
+
+	for (i = 0; i < count; i ++) {
+		if (!m_hash_remove(&hash, M_SIZE_TO_PTR(i), &int_ops))
+			M_ERROR("remove error");
+	}
+
+	m_hash_deinit(&hash, &int_ops);
+
+	qsort(lat, count, sizeof(long), latency_cmp);
+}
+
+static void
+latency_test (void)
+{
+	static M_HashNode *nodes[INT_COUNT];
+	static long lat[INT_COUNT], ilat[INT_COUNT];
+	IntHashNode *ins;
+	int i, count = INT_COUNT;
+
+	M_INFO("insert latency test begin");
+
+	ins = M_NEW(IntHashNode, count);
+	for (i = 0; i < count; i ++) {
+		ins[i].i = i;
+		nodes[i] = &ins[i].node;
+	}
+
+	insert_latency(nodes, lat, count, M_FALSE);
+	insert_latency(nodes, ilat, count, M_TRUE);
+
+	M_INFO("%d inserts (oneshot/incremental): p50 %ldns/%ldns "
+				"p99 %ldns/%ldns p99.99 %ldns/%ldns max %ldns/%ldns", count,
+				lat[count / 2], ilat[count / 2],
+				lat[count / 100 * 99], ilat[count / 100 * 99],
+				lat[count / 10000 * 9999], ilat[count / 10000 * 9999],
+				lat[count - 1], ilat[count - 1]);
+
+	m_free(ins);
+
+	M_INFO("insert latency test end");
+}
+
+static void
+ohash_test (void)
+{
+	M_OHash hash;
+	M_HashNode *node;
+	IntHashNode *in;
+	uint32_t pos;
+	int i, count = INT_COUNT;
+	static M_Bool flags[INT_COUNT];
+
+	M_INFO("open addressing hash test begin");
+
+	m_ohash_init(&hash);
+
+	for (i = 0; i < count; i ++) {
+		uint32_t kv;
+
+		node = m_ohash_lookup_with_kv(&hash, M_SIZE_TO_PTR(i), &int_ops, &kv);
+		if (node) {
+			M_ERROR("lookup error");
+		}
+
+		m_ohash_resize(&hash, &int_ops);
+
+		in = M_NEW(IntHashNode, 1);
+		in->i = i;
+
+		m_ohash_insert_with_kv(&hash, &in->node, kv, &int_ops);
+
+		if (m_ohash_size(&hash) != i + 1) {
+			M_ERROR("hash size error");
+		}
+	}
+
+	for (i = 0; i < count; i ++) {
+		node = m_ohash_lookup(&hash, M_SIZE_TO_PTR(i), &int_ops);
+		if (!node || (M_CONTAINER_OF(node, IntHashNode, node)->i != i)) {
+			M_ERROR("cannot find inserted node");
+		}
+	}
+
+	memset(flags, 0, sizeof(flags));
+	m_ohash_foreach(node, pos, &hash) {
+		i = M_CONTAINER_OF(node, IntHashNode, node)->i;
+		if (flags[i]) {
+			M_ERROR("traverse error");
+		}
+
+		flags[i] = M_TRUE;
+	}
+
+	for (i = 0; i < count; i ++) {
+		if (!flags[i])
+			M_ERROR("traverse error");
+	}
+
+	m_ohash_foreach_value(in, pos, &hash, node) {
+		if (in->i & 1) {
+			if (m_ohash_remove(&hash, M_SIZE_TO_PTR(in->i), &int_ops)
+						!= &in->node)
+				M_ERROR("cannot remove entry");
+			m_free(in);
+		}
+	}
+
+	if (m_ohash_size(&hash) != count / 2) {
+		M_ERROR("hash size error");
+	}
+
+	/*Reuse the deleted slots.*/
+	for (i = 1; i < count; i += 2) {
+		if (m_ohash_lookup(&hash, M_SIZE_TO_PTR(i), &int_ops))
+			M_ERROR("hash error after remove");
+
+		m_ohash_resize(&hash, &int_ops);
+
+		in = M_NEW(IntHashNode, 1);
+		in->i = i;
+
+		m_ohash_insert(&hash, &in->node, &int_ops);
+	}
+
+	for (i = 0; i < count; i ++) {
+		node = m_ohash_lookup(&hash, M_SIZE_TO_PTR(i), &int_ops);
+		if (!node || (M_CONTAINER_OF(node, IntHashNode, node)->i != i)) {
+			M_ERROR("hash error after reinsert");
+		}
+	}
+
+	m_ohash_deinit(&hash, &int_ops);
+
+	M_INFO("open addressing hash test end");
+}
+
+static void
+hash_bench (const char *name, const M_HashOps *ops, M_HashNode **nodes,
+			int *order, int count)
+{
+	M_Hash hash;
+	M_OHash ohash;
+	struct timespec begin, end;
+	long insert_us, lookup_us, rlookup_us, remove_us;
+	long oinsert_us, olookup_us, orlookup_us, oremove_us;
+	uint32_t kv;
+	int i;
+
+	m_hash_init(&hash);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < count; i ++) {
+		if (!m_hash_lookup_with_kv(&hash, ops->get_key(nodes[i]), ops, &kv)) {
+			m_hash_resize(&hash, ops);
+			m_hash_insert_with_kv(&hash, nodes[i], kv, ops);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	insert_us = time_diff(&begin, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < count; i ++) {
+		if (m_hash_lookup(&hash, ops->get_key(nodes[i]), ops) != nodes[i])
+			M_ERROR("lookup error");
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	lookup_us = time_diff(&begin, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < count; i ++) {
+		M_HashNode *node = nodes[order[i]];
+
+		if (m_hash_lookup(&hash, ops->get_key(node), ops) != node)
+			M_ERROR("lookup error");
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	rlookup_us = time_diff(&begin, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < count; i ++) {
+		if (m_hash_remove(&hash, ops->get_key(nodes[i]), ops) != nodes[i])
+			M_ERROR("remove error");
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	remove_us = time_diff(&begin, &end);
+
+	m_ohash_init(&ohash);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < count; i ++) {
+		if (!m_ohash_lookup_with_kv(&ohash, ops->get_key(nodes[i]), ops, &kv)) {
+			m_ohash_resize(&ohash, ops);
+			m_ohash_insert_with_kv(&ohash, nodes[i], kv, ops);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	oinsert_us = time_diff(&begin, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < count; i ++) {
+		if (m_ohash_lookup(&ohash, ops->get_key(nodes[i]), ops) != nodes[i])
+			M_ERROR("lookup error");
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	olookup_us = time_diff(&begin, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < count; i ++) {
+		M_HashNode *node = nodes[order[i]];
+
+		if (m_ohash_lookup(&ohash, ops->get_key(node), ops) != node)
+			M_ERROR("lookup error");
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	orlookup_us = time_diff(&begin, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < count; i ++) {
+		if (m_ohash_remove(&ohash, ops->get_key(nodes[i]), ops) != nodes[i])
+			M_ERROR("remove error");
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	oremove_us = time_diff(&begin, &end);
+
+	M_INFO("%s %d (chained/open): insert %ldus/%ldus lookup %ldus/%ldus "
+				"random lookup %ldus/%ldus remove %ldus/%ldus", name, count,
+				insert_us, oinsert_us, lookup_us, olookup_us,
+				rlookup_us, orlookup_us, remove_us, oremove_us);
+
+	m_hash_deinit(&hash, ops);
+	m_ohash_deinit(&ohash, ops);
+}
+
+/*Operation functions only known at runtime, like a shared library's.*/
+static const M_HashOps *volatile runtime_int_ops = &int_ops;
+static const M_HashOps *volatile runtime_ptr_ops = &ptr_ops;
+
+static void
+typed_test (void)
+{
+#define TYPED_COUNT 65536
+#define TYPED_LOOPS 64
+	M_Hash hash;
+	const M_HashOps *ops;
+	M_HashNode *node;
+	IntHashNode *ins;
+	PtrHashNode *pns;
+	struct timespec begin, end;
+	long const_us, runtime_us, typed_us;
+	int i, j;
+
+	M_INFO("typed hash test begin");
+
+	/*Integer keys.*/
+	ins = M_NEW(IntHashNode, TYPED_COUNT);
+	m_hash_init(&hash);
+
+	for (i = 0; i < TYPED_COUNT; i ++) {
+		ins[i].i = i;
+
+		if (int_hash_lookup(&hash, i))
+			M_ERROR("lookup error");
+
+		m_hash_resize(&hash, &int_ops);
+		int_hash_insert(&hash, &ins[i].node);
+	}
+
+	for (i = 0; i < TYPED_COUNT; i ++) {
+		if (int_hash_lookup(&hash, i) != &ins[i].node)
+			M_ERROR("typed lookup error");
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (j = 0; j < TYPED_LOOPS; j ++) {
+		for (i = 0; i < TYPED_COUNT; i ++) {
+			if (!m_hash_lookup(&hash, M_SIZE_TO_PTR(i), &int_ops))
+				M_ERROR("lookup error");
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	const_us = time_diff(&begin, &end);
+
+	ops = runtime_int_ops;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (j = 0; j < TYPED_LOOPS; j ++) {
+		for (i = 0; i < TYPED_COUNT; i ++) {
+			if (!m_hash_lookup(&hash, M_SIZE_TO_PTR(i), ops))
+				M_ERROR("lookup error");
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	runtime_us = time_diff(&begin, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (j = 0; j < TYPED_LOOPS; j ++) {
+		for (i = 0; i < TYPED_COUNT; i ++) {
+			if (!int_hash_lookup(&hash, i))
+				M_ERROR("lookup error");
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	typed_us = time_diff(&begin, &end);
+
+	M_INFO("int %d lookups: const ops %ldus, runtime ops %ldus, typed %ldus",
+				TYPED_COUNT * TYPED_LOOPS, const_us, runtime_us, typed_us);
+
+	for (i = 0; i < TYPED_COUNT; i ++) {
+		node = int_hash_remove(&hash, i);
+		if (node != &ins[i].node)
+			M_ERROR("typed remove error");
+	}
+
+	if (m_hash_size(&hash))
+		M_ERROR("hash size error");
+
+	m_hash_deinit(&hash, &int_ops);
+	m_free(ins);
+
+	/*Pointer keys.*/
+	pns = M_NEW(PtrHashNode, TYPED_COUNT);
+	m_hash_init(&hash);
+
+	for (i = 0; i < TYPED_COUNT; i ++) {
+		uint32_t kv;
+
+		pns[i].ptr = &pns[i];
+		pns[i].v   = i;
+
+		if (ptr_hash_lookup_with_kv(&hash, pns[i].ptr, &kv))
+			M_ERROR("lookup error");
+
+		m_hash_resize_incr(&hash, &ptr_ops);
+		ptr_hash_insert_with_kv(&hash, &pns[i].node, kv);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (j = 0; j < TYPED_LOOPS; j ++) {
+		for (i = 0; i < TYPED_COUNT; i ++) {
+			if (!m_hash_lookup(&hash, pns[i].ptr, &ptr_ops))
+				M_ERROR("lookup error");
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	const_us = time_diff(&begin, &end);
+
+	ops = runtime_ptr_ops;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (j = 0; j < TYPED_LOOPS; j ++) {
+		for (i = 0; i < TYPED_COUNT; i ++) {
+			if (!m_hash_lookup(&hash, pns[i].ptr, ops))
+				M_ERROR("lookup error");
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	runtime_us = time_diff(&begin, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (j = 0; j < TYPED_LOOPS; j ++) {
+		for (i = 0; i < TYPED_COUNT; i ++) {
+			if (!ptr_hash_lookup(&hash, pns[i].ptr))
+				M_ERROR("lookup error");
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	typed_us = time_diff(&begin, &end);
+
+	M_INFO("ptr %d lookups: const ops %ldus, runtime ops %ldus, typed %ldus",
+				TYPED_COUNT * TYPED_LOOPS, const_us, runtime_us, typed_us);
+
+	for (i = 0; i < TYPED_COUNT; i ++) {
+		if (ptr_hash_remove(&hash, pns[i].ptr) != &pns[i].node)
+			M_ERROR("typed remove error");
+	}
+
+	m_hash_deinit(&hash, &ptr_ops);
+	m_free(pns);
+
+	M_INFO("typed hash test end");
+}
+
+static void
+bench_test (void)
+{
+	static M_HashNode *nodes[INT_COUNT];
+	static int order[INT_COUNT];
+	IntHashNode *ins;
+	PtrHashNode *pns;
+	int i;
+
+	M_INFO("hash benchmark begin");
+
+	for (i = 0; i < INT_COUNT; i ++)
+		order[i] = i;
+
+	srand(1);
+	for (i = INT_COUNT - 1; i > 0; i --) {
+		int j = rand() % (i + 1);
+		int t = order[i];
+
+		order[i] = order[j];
+		order[j] = t;
+	}
+
+	ins = M_NEW(IntHashNode, INT_COUNT);
+	for (i = 0; i < INT_COUNT; i ++) {
+		ins[i].i = i;
+		nodes[i] = &ins[i].node;
+	}
+
+	hash_bench("int", &int_ops, nodes, order, INT_COUNT);
+
+	m_free(ins);
+
+	pns = M_NEW(PtrHashNode, PTR_COUNT);
+	for (i = 0; i < PTR_COUNT; i ++) {
+		pns[i].ptr = m_malloc(16);
+		pns[i].v   = i;
+		nodes[i]   = &pns[i].node;
+	}
+
+	hash_bench("ptr", &ptr_ops, nodes, order, PTR_COUNT);
+
+	for (i = 0; i < PTR_COUNT; i ++)
+		m_free(pns[i].ptr);
+	m_free(pns);
+
+	M_INFO("hash benchmark end");
+}
+
 int
 main (int argc, char **argv)
 {
@@ -314,6 +904,11 @@ main (int argc, char **argv)
 
 	int_hash_test();
 	ptr_hash_test();
+	incr_hash_test();
+	latency_test();
+	ohash_test();
+	typed_test();
+	bench_test();
 
 	return 0;
 }
@@ -0,0 +1,319 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "ictest"
+
+#include <ming.h>
+
+#define READ_COUNT (16*1024*1024)
+
+static M_Quark qx, qy, qz;
+
+static long
+time_diff (struct timespec *begin, struct timespec *end)
+{
+	return (end->tv_sec - begin->tv_sec) * 1000000 +
+				(end->tv_nsec - begin->tv_nsec) / 1000;
+}
+
+static void
+ic_state_test (void)
+{
+	M_InlineCache ic;
+	M_Object *objs[M_IC_WAYS + 1];
+	M_Value v;
+	int i;
+
+	M_INFO("ic state test begin");
+
+	m_ic_init(&ic);
+
+	/*Each object has a different shape, "x" is in a different slot.*/
+	for (i = 0; i < M_IC_WAYS + 1; i ++) {
+		int j;
+
+		objs[i] = m_object_new(0);
+
+		for (j = 0; j < i; j ++) {
+			char buf[16];
+
+			snprintf(buf, sizeof(buf), "f%d", j);
+			m_object_set(objs[i], m_string_from_cstr(buf), m_value_from_int(j));
+		}
+
+		m_object_set(objs[i], qx, m_value_from_int(i));
+	}
+
+	if (!m_ic_get(&ic, objs[0], qx, &v) || (m_value_get_int(v) != 0))
+		M_ERROR("get error");
+	if (ic.state != M_IC_MONO)
+		M_ERROR("state is not monomorphic");
+
+	for (i = 1; i < M_IC_WAYS; i ++)
+		m_ic_get(&ic, objs[i], qx, &v);
+	if (ic.state != M_IC_POLY)
+		M_ERROR("state is not polymorphic");
+
+	for (i = 0; i < M_IC_WAYS; i ++) {
+		uint16_t id;
+
+		if (!m_ic_lookup(&ic, objs[i]->shape, &id))
+			M_ERROR("shape %d is not cached", i);
+		if (!m_ic_get(&ic, objs[i], qx, &v) || (m_value_get_int(v) != i))
+			M_ERROR("get %d error", i);
+	}
+
+	m_ic_get(&ic, objs[M_IC_WAYS], qx, &v);
+	if (ic.state != M_IC_MEGA)
+		M_ERROR("state is not megamorphic");
+	if (m_value_get_int(v) != M_IC_WAYS)
+		M_ERROR("get error");
+
+	M_INFO("ic state test end");
+}
+
+#define RACE_THREADS 4
+#define RACE_ROUNDS  256
+#define RACE_READS   1024
+
+static M_InlineCache race_ic;
+static M_Object     *race_objs[M_IC_WAYS];
+
+static void*
+ic_race_entry (void *arg)
+{
+	int i, k = M_PTR_TO_SIZE(arg);
+	M_Value v;
+
+	m_thread_enter();
+
+	for (i = 0; i < RACE_READS; i ++, k ++) {
+		M_Object *obj = race_objs[k % M_IC_WAYS];
+
+		if (!m_ic_get(&race_ic, obj, qx, &v)
+					|| (m_value_get_int(v) != k % M_IC_WAYS)) {
+			M_ERROR("concurrent update error");
+			break;
+		}
+	}
+
+	m_thread_leave();
+
+	return NULL;
+}
+
+static void
+ic_race_test (void)
+{
+	pthread_t th[RACE_THREADS];
+	size_t level;
+	int i, r;
+
+	M_INFO("ic race test begin");
+
+	level = m_gc_get_nb_level();
+
+	/*Each object has a different shape, "x" is in a different slot.*/
+	for (i = 0; i < M_IC_WAYS; i ++) {
+		int j;
+
+		race_objs[i] = m_object_new(0);
+
+		for (j = 0; j < i; j ++) {
+			char buf[16];
+
+			snprintf(buf, sizeof(buf), "f%d", j);
+			m_object_set(race_objs[i], m_string_from_cstr(buf),
+						m_value_from_int(j));
+		}
+
+		m_object_set(race_objs[i], qx, m_value_from_int(i));
+	}
+
+	/*The threads fill an empty cache at the same time.*/
+	for (r = 0; r < RACE_ROUNDS; r ++) {
+		m_ic_init(&race_ic);
+
+		for (i = 0; i < RACE_THREADS; i ++)
+			pthread_create(&th[i], NULL, ic_race_entry, M_SIZE_TO_PTR(i));
+
+		for (i = 0; i < RACE_THREADS; i ++) {
+			m_thread_leave();
+
+			pthread_join(th[i], NULL);
+
+			m_thread_enter();
+		}
+
+		if (race_ic.n > M_IC_WAYS)
+			M_ERROR("cache is left busy");
+	}
+
+	m_gc_set_nb_level(level);
+
+	M_INFO("ic race test end");
+}
+
+static void
+ic_layout_test (void)
+{
+	M_InlineCache gic, sic;
+	M_Object *obj;
+	M_Shape *shape;
+	M_Value v;
+	uint16_t id;
+	size_t level;
+
+	M_INFO("ic layout test begin");
+
+	m_ic_init(&gic);
+	m_ic_init(&sic);
+
+	obj = m_object_new(0);
+	m_object_set(obj, qx, m_value_from_int(1));
+	m_object_set(obj, qy, m_value_from_int(2));
+
+	m_ic_get(&gic, obj, qy, &v);
+	m_ic_set(&sic, obj, qy, m_value_from_int(3));
+	if (!m_ic_get(&gic, obj, qy, &v) || (m_value_get_int(v) != 3))
+		M_ERROR("get error");
+
+	/*Removing a property changes the layout.*/
+	shape = obj->shape;
+	m_object_remove(obj, qx);
+	if (m_ic_lookup(&gic, obj->shape, &id))
+		M_ERROR("dictionary shape is cached");
+	if (!m_ic_get(&gic, obj, qy, &v) || (m_value_get_int(v) != 3))
+		M_ERROR("get error after layout change");
+	if (m_ic_get(&gic, obj, qx, &v))
+		M_ERROR("get removed property");
+
+	/*Readonly property is not cached by the set cache.*/
+	m_ic_init(&sic);
+	obj = m_object_new(0);
+	m_object_define(obj, qz, M_PROP_FL_ENUMERABLE, m_value_from_int(1));
+	if (m_ic_set(&sic, obj, qz, m_value_from_int(2)) != M_FAILED)
+		M_ERROR("set readonly property");
+	if (sic.n)
+		M_ERROR("readonly property is cached");
+
+	/*Dictionary shapes freed by GC do not drop the cache.*/
+	level = m_gc_get_nb_level();
+	obj = m_object_new(0);
+	m_object_set(obj, qx, m_value_from_int(4));
+	m_object_set(obj, qy, m_value_from_int(5));
+	m_gc_add_root(obj);
+	m_gc_set_nb_level(level);
+	m_gc_run(0);
+
+	if (!m_ic_lookup(&gic, shape, &id))
+		M_ERROR("cache is dropped after GC");
+	if (obj->shape != shape)
+		M_ERROR("shape is not shared");
+	if (!m_ic_get(&gic, obj, qy, &v) || (m_value_get_int(v) != 5))
+		M_ERROR("get error after GC");
+
+	m_gc_remove_root(obj);
+
+	M_INFO("ic layout test end");
+}
+
+static void
+ic_bench (void)
+{
+	M_InlineCache ic;
+	M_Object *objs[M_IC_WAYS];
+	M_Value v;
+	struct timespec begin, end;
+	long sum;
+	int i, n;
+
+	M_INFO("ic bench begin");
+
+	for (n = 0; n < M_IC_WAYS; n ++) {
+		objs[n] = m_object_new(0);
+
+		/*Put "x" behind other properties to make the lookup longer.*/
+		for (i = 0; i < 6; i ++) {
+			char buf[16];
+
+			snprintf(buf, sizeof(buf), "b%d_%d", n, i);
+			m_object_set(objs[n], m_string_from_cstr(buf), m_value_from_int(i));
+		}
+
+		m_object_set(objs[n], qx, m_value_from_int(n + 1));
+	}
+
+	sum = 0;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < READ_COUNT; i ++) {
+		m_object_get(objs[0], qx, &v);
+		sum += m_value_get_int(v);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	M_INFO("%d obj.x reads without cache: %ldus", READ_COUNT,
+				time_diff(&begin, &end));
+	if (sum != READ_COUNT)
+		M_ERROR("sum error");
+
+	m_ic_init(&ic);
+	sum = 0;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < READ_COUNT; i ++) {
+		m_ic_get(&ic, objs[0], qx, &v);
+		sum += m_value_get_int(v);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	M_INFO("%d obj.x reads with monomorphic cache: %ldus", READ_COUNT,
+				time_diff(&begin, &end));
+	if (sum != READ_COUNT)
+		M_ERROR("sum error");
+
+	m_ic_init(&ic);
+	sum = 0;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < READ_COUNT; i ++) {
+		m_ic_get(&ic, objs[i % M_IC_WAYS], qx, &v);
+		sum += m_value_get_int(v);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	M_INFO("%d obj.x reads with polymorphic cache: %ldus", READ_COUNT,
+				time_diff(&begin, &end));
+	if (sum != READ_COUNT / M_IC_WAYS * (M_IC_WAYS * (M_IC_WAYS + 1) / 2))
+		M_ERROR("sum error");
+
+	M_INFO("ic bench end");
+}
+
+int
+main (int argc, char **argv)
+{
+	m_startup();
+
+	qx = m_string_from_cstr("x");
+	qy = m_string_from_cstr("y");
+	qz = m_string_from_cstr("z");
+
+	ic_state_test();
+	ic_layout_test();
+	ic_race_test();
+	ic_bench();
+
+	return 0;
+}
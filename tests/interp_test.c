@@ -0,0 +1,689 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "interptest"
+
+#include "test_module.h"
+
+#define LOOP_COUNT  (20*1024*1024)
+#define CALL_COUNT  (4*1024*1024)
+#define PROP_COUNT  (20*1024*1024)
+#define FIB_N       27
+#define OBJ_COUNT   (100*1024)
+
+/*Const values.*/
+enum {
+	K_LOOP_COUNT,
+	K_CALL_COUNT,
+	K_PROP_COUNT,
+	K_OBJ_COUNT,
+	K_X,
+	K_HELLO,
+	K_WORLD,
+	K_COUNT
+};
+
+/*Functions.*/
+enum {
+	F_LOOP,
+	F_ADD1,
+	F_CALL,
+	F_FIB_MAIN,
+	F_FIB,
+	F_PROP,
+	F_OBJS,
+	F_STR,
+	F_ERROR,
+	F_TWICE,
+	F_COUNTER,
+	F_INC,
+	F_NEST,
+	F_MID,
+	F_INNER,
+	F_SUM_MAIN,
+	F_SUM,
+	F_COUNT
+};
+
+/*sum = 0; for (i = 0; i < n; i ++) sum += i % 7; return sum;*/
+static uint8_t loop_bc[] = {
+	/* 0*/ M_OP_LOADI, 1, M_BC_16(0),
+	/* 4*/ M_OP_LOADI, 2, M_BC_16(0),
+	/* 8*/ M_OP_LOADI, 5, M_BC_16(7),
+	/*12*/ M_OP_LT, 3, 2, 0,
+	/*16*/ M_OP_JMPF, 3, M_BC_16(19),
+	/*20*/ M_OP_MOD, 4, 2, 5,
+	/*24*/ M_OP_ADD, 1, 1, 4,
+	/*28*/ M_OP_ADDI, 2, 2, 1,
+	/*32*/ M_OP_JMP, M_BC_16(-20),
+	/*35*/ M_OP_RET, 1
+};
+#define LOOP_INSTS(n) (3 + (n) * 6 + 3)
+
+/*return x + 1;*/
+static uint8_t add1_bc[] = {
+	/* 0*/ M_OP_ADDI, 0, 0, 1,
+	/* 4*/ M_OP_RET, 0
+};
+
+/*f = add1; v = 0; for (i = 0; i < n; i ++) v = f(v); return v;*/
+static uint8_t call_bc[] = {
+	/* 0*/ M_OP_CLOSURE, 4, M_BC_16(F_ADD1),
+	/* 4*/ M_OP_LOADI, 1, M_BC_16(0),
+	/* 8*/ M_OP_LOADI, 2, M_BC_16(0),
+	/*12*/ M_OP_LT, 3, 2, 0,
+	/*16*/ M_OP_JMPF, 3, M_BC_16(18),
+	/*20*/ M_OP_MOVE, 5, 1,
+	/*23*/ M_OP_CALL, 1, 4, 1,
+	/*27*/ M_OP_ADDI, 2, 2, 1,
+	/*31*/ M_OP_JMP, M_BC_16(-19),
+	/*34*/ M_OP_RET, 1
+};
+#define CALL_INSTS(n) (3 + (n) * 8 + 3)
+
+/*fib = function (n) {...}; return fib(n);*/
+static uint8_t fib_main_bc[] = {
+	/* 0*/ M_OP_CLOSURE, 1, M_BC_16(F_FIB),
+	/* 4*/ M_OP_MOVE, 2, 0,
+	/* 7*/ M_OP_CALL, 1, 1, 1,
+	/*11*/ M_OP_RET, 1
+};
+
+/*if (n < 2) return n; return fib(n - 1) + fib(n - 2);*/
+static uint8_t fib_bc[] = {
+	/* 0*/ M_OP_LOADI, 1, M_BC_16(2),
+	/* 4*/ M_OP_LT, 1, 0, 1,
+	/* 8*/ M_OP_JMPF, 1, M_BC_16(6),
+	/*12*/ M_OP_RET, 0,
+	/*14*/ M_OP_GETUP, 2, 0, 1,
+	/*18*/ M_OP_ADDI, 3, 0, -1,
+	/*22*/ M_OP_CALL, 4, 2, 1,
+	/*26*/ M_OP_ADDI, 3, 0, -2,
+	/*30*/ M_OP_CALL, 3, 2, 1,
+	/*34*/ M_OP_ADD, 4, 4, 3,
+	/*38*/ M_OP_RET, 4
+};
+
+/*o = {x: 3}; sum = 0; for (i = 0; i < n; i ++) sum += o.x; return sum;*/
+static uint8_t prop_bc[] = {
+	/* 0*/ M_OP_NEWOBJ, 4,
+	/* 2*/ M_OP_LOADI, 5, M_BC_16(3),
+	/* 6*/ M_OP_SETPROP, 4, M_BC_16(K_X), 5, M_BC_16(0),
+	/*13*/ M_OP_LOADI, 1, M_BC_16(0),
+	/*17*/ M_OP_LOADI, 2, M_BC_16(0),
+	/*21*/ M_OP_LT, 3, 2, 0,
+	/*25*/ M_OP_JMPF, 3, M_BC_16(22),
+	/*29*/ M_OP_GETPROP, 5, 4, M_BC_16(K_X), M_BC_16(1),
+	/*36*/ M_OP_ADD, 1, 1, 5,
+	/*40*/ M_OP_ADDI, 2, 2, 1,
+	/*44*/ M_OP_JMP, M_BC_16(-23),
+	/*47*/ M_OP_RET, 1
+};
+#define PROP_INSTS(n) (5 + (n) * 6 + 3)
+
+/*a = []; for (i = 0; i < n; i ++) {o = {}; o.x = i; a[i] = o;}
+ *sum = 0; for (i = 0; i < n; i ++) sum += a[i].x; return sum;*/
+static uint8_t objs_bc[] = {
+	/* 0*/ M_OP_NEWARR, 1,
+	/* 2*/ M_OP_LOADI, 2, M_BC_16(0),
+	/* 6*/ M_OP_LT, 3, 2, 0,
+	/*10*/ M_OP_JMPF, 3, M_BC_16(24),
+	/*14*/ M_OP_NEWOBJ, 4,
+	/*16*/ M_OP_SETPROP, 4, M_BC_16(K_X), 2, M_BC_16(0),
+	/*23*/ M_OP_SETELEM, 1, 2, 4,
+	/*27*/ M_OP_ADDI, 2, 2, 1,
+	/*31*/ M_OP_JMP, M_BC_16(-25),
+	/*34*/ M_OP_LOADI, 5, M_BC_16(0),
+	/*38*/ M_OP_LOADI, 2, M_BC_16(0),
+	/*42*/ M_OP_LT, 3, 2, 0,
+	/*46*/ M_OP_JMPF, 3, M_BC_16(26),
+	/*50*/ M_OP_GETELEM, 4, 1, 2,
+	/*54*/ M_OP_GETPROP, 4, 4, M_BC_16(K_X), M_BC_16(1),
+	/*61*/ M_OP_ADD, 5, 5, 4,
+	/*65*/ M_OP_ADDI, 2, 2, 1,
+	/*69*/ M_OP_JMP, M_BC_16(-27),
+	/*72*/ M_OP_RET, 5
+};
+
+/*s = "hello" + "world"; return s == "helloworld" ? s : null;*/
+static uint8_t str_bc[] = {
+	/* 0*/ M_OP_LOADK, 0, M_BC_16(K_HELLO),
+	/* 4*/ M_OP_LOADK, 1, M_BC_16(K_WORLD),
+	/* 8*/ M_OP_ADD, 2, 0, 1,
+	/*12*/ M_OP_ADD, 3, 1, 0,
+	/*16*/ M_OP_LT, 4, 2, 3,
+	/*20*/ M_OP_JMPF, 4, M_BC_16(6),
+	/*24*/ M_OP_RET, 2,
+	/*26*/ M_OP_LOADNULL, 2,
+	/*28*/ M_OP_RET, 2
+};
+
+/*o = {}; return o + 1;*/
+static uint8_t error_bc[] = {
+	/* 0*/ M_OP_NEWOBJ, 0,
+	/* 2*/ M_OP_LOADI, 1, M_BC_16(1),
+	/* 6*/ M_OP_ADD, 2, 0, 1,
+	/*10*/ M_OP_RET, 2
+};
+
+/*Opcodes outside the opcode table.*/
+static uint8_t illegal_bcs[][4] = {
+	{M_OP_COUNT, 0, M_OP_RET, 0},
+	{0xFF, 0, M_OP_RET, 0}
+};
+
+/*return x + x;*/
+static uint8_t twice_bc[] = {
+	/* 0*/ M_OP_ADD, 1, 0, 0,
+	/* 4*/ M_OP_RET, 1
+};
+
+/*c = 0; inc = function () {return ++ c;};
+ *for (i = 0; i < n; i ++) inc(); return (c == n) ? inc : null;*/
+static uint8_t counter_bc[] = {
+	/* 0*/ M_OP_LOADI, 1, M_BC_16(0),
+	/* 4*/ M_OP_CLOSURE, 2, M_BC_16(F_INC),
+	/* 8*/ M_OP_LOADI, 3, M_BC_16(0),
+	/*12*/ M_OP_LT, 4, 3, 0,
+	/*16*/ M_OP_JMPF, 4, M_BC_16(15),
+	/*20*/ M_OP_CALL, 5, 2, 0,
+	/*24*/ M_OP_ADDI, 3, 3, 1,
+	/*28*/ M_OP_JMP, M_BC_16(-16),
+	/*31*/ M_OP_EQ, 4, 1, 0,
+	/*35*/ M_OP_JMPF, 4, M_BC_16(6),
+	/*39*/ M_OP_RET, 2,
+	/*41*/ M_OP_LOADNULL, 2,
+	/*43*/ M_OP_RET, 2
+};
+
+/*return ++ c;*/
+static uint8_t inc_bc[] = {
+	/* 0*/ M_OP_GETUP, 0, 0, 1,
+	/* 4*/ M_OP_ADDI, 0, 0, 1,
+	/* 8*/ M_OP_SETUP, 0, 1, 0,
+	/*12*/ M_OP_RET, 0
+};
+
+/*x = 5; mid = function () {return function (y) {return x + y;};};
+ *return mid()(n);*/
+static uint8_t nest_bc[] = {
+	/* 0*/ M_OP_LOADI, 1, M_BC_16(5),
+	/* 4*/ M_OP_CLOSURE, 2, M_BC_16(F_MID),
+	/* 8*/ M_OP_CALL, 3, 2, 0,
+	/*12*/ M_OP_MOVE, 4, 0,
+	/*15*/ M_OP_CALL, 4, 3, 1,
+	/*19*/ M_OP_RET, 4
+};
+
+static uint8_t mid_bc[] = {
+	/* 0*/ M_OP_CLOSURE, 0, M_BC_16(F_INNER),
+	/* 4*/ M_OP_RET, 0
+};
+
+static uint8_t inner_bc[] = {
+	/* 0*/ M_OP_GETUP, 1, 1, 1,
+	/* 4*/ M_OP_ADD, 2, 0, 1,
+	/* 8*/ M_OP_RET, 2
+};
+
+/*sum = function (n) {...}; return sum(n);*/
+static uint8_t sum_main_bc[] = {
+	/* 0*/ M_OP_CLOSURE, 1, M_BC_16(F_SUM),
+	/* 4*/ M_OP_MOVE, 2, 0,
+	/* 7*/ M_OP_CALL, 1, 1, 1,
+	/*11*/ M_OP_RET, 1
+};
+
+/*if (n <= 0) return 0; return sum(n - 1) + n;*/
+static uint8_t sum_bc[] = {
+	/* 0*/ M_OP_LOADI, 1, M_BC_16(0),
+	/* 4*/ M_OP_LE, 2, 0, 1,
+	/* 8*/ M_OP_JMPF, 2, M_BC_16(6),
+	/*12*/ M_OP_RET, 1,
+	/*14*/ M_OP_GETUP, 2, 0, 1,
+	/*18*/ M_OP_ADDI, 3, 0, -1,
+	/*22*/ M_OP_CALL, 3, 2, 1,
+	/*26*/ M_OP_ADD, 3, 3, 0,
+	/*30*/ M_OP_RET, 3
+};
+
+static M_Value     consts[K_COUNT];
+static M_Function  funcs[F_COUNT];
+static M_Function *func_ptrs[F_COUNT];
+
+static const TestFunc func_defs[F_COUNT] = {
+	[F_LOOP]     = TEST_FUNC(loop_bc, 1, 6),
+	[F_ADD1]     = TEST_FUNC(add1_bc, 1, 1),
+	[F_CALL]     = TEST_FUNC(call_bc, 1, 6),
+	[F_FIB_MAIN] = TEST_FUNC(fib_main_bc, 1, 3),
+	[F_FIB]      = TEST_FUNC(fib_bc, 1, 5),
+	[F_PROP]     = TEST_FUNC_IC(prop_bc, 1, 6, 2),
+	[F_OBJS]     = TEST_FUNC_IC(objs_bc, 1, 6, 2),
+	[F_STR]      = TEST_FUNC(str_bc, 0, 5),
+	[F_ERROR]    = TEST_FUNC(error_bc, 0, 3),
+	[F_TWICE]    = TEST_FUNC(twice_bc, 1, 2),
+	[F_COUNTER]  = TEST_FUNC(counter_bc, 1, 6),
+	[F_INC]      = TEST_FUNC(inc_bc, 0, 1),
+	[F_NEST]     = TEST_FUNC(nest_bc, 1, 5),
+	[F_MID]      = TEST_FUNC(mid_bc, 0, 1),
+	[F_INNER]    = TEST_FUNC(inner_bc, 1, 3),
+	[F_SUM_MAIN] = TEST_FUNC(sum_main_bc, 1, 3),
+	[F_SUM]      = TEST_FUNC(sum_bc, 1, 4)
+};
+
+static void
+module_init (void)
+{
+	int i;
+
+	consts[K_LOOP_COUNT] = m_value_from_int(LOOP_COUNT);
+	consts[K_CALL_COUNT] = m_value_from_int(CALL_COUNT);
+	consts[K_PROP_COUNT] = m_value_from_int(PROP_COUNT);
+	consts[K_OBJ_COUNT]  = m_value_from_int(OBJ_COUNT);
+	consts[K_X]          = m_value_from_string(m_string_from_cstr("x"));
+	consts[K_HELLO]      = m_value_from_string(m_string_from_cstr("hello"));
+	consts[K_WORLD]      = m_value_from_string(m_string_from_cstr("world"));
+
+	test_module_init(consts, K_COUNT, funcs, func_ptrs, func_defs, F_COUNT);
+
+	/*Keep the functions interpreted.*/
+	for (i = 0; i < F_COUNT; i ++)
+		funcs[i].f.bc.hot = M_JIT_THRESHOLD;
+}
+
+static long
+time_diff (struct timespec *begin, struct timespec *end)
+{
+	return (end->tv_sec - begin->tv_sec) * 1000000 +
+				(end->tv_nsec - begin->tv_nsec) / 1000;
+}
+
+static void
+bench (M_Actor *actor, const char *name, int id, M_Value arg, M_Value expect,
+			double insts)
+{
+	struct timespec begin, end;
+	M_Value r;
+	long us;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	if (run(actor, id, arg, 0xFFFFFFFF, &r, NULL) != M_OK)
+		M_ERROR("%s run error", name);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	us = M_MAX(time_diff(&begin, &end), 1);
+
+	if (r != expect)
+		M_ERROR("%s result error", name);
+
+	if (insts)
+		M_INFO("%s: %.0f instructions in %ldus, %.1fM inst/s", name, insts,
+					us, insts / us);
+	else
+		M_INFO("%s: %ldus", name, us);
+}
+
+static void
+interp_test (M_Actor *actor)
+{
+	M_Value r;
+	uint32_t yields;
+	int64_t sum;
+	int i;
+
+	M_INFO("interp test begin");
+
+	for (sum = 0, i = 0; i < 100000; i ++)
+		sum += i % 7;
+
+	if ((run(actor, F_LOOP, m_value_from_int(100000), 1000, &r, &yields) != M_OK)
+				|| (m_value_get_int(r) != sum))
+		M_ERROR("loop error");
+	if (yields < 99)
+		M_ERROR("budget error");
+
+	if ((run(actor, F_FIB_MAIN, m_value_from_int(20), 7, &r, &yields) != M_OK)
+				|| (m_value_get_int(r) != 6765))
+		M_ERROR("fib error");
+	if (!yields)
+		M_ERROR("budget error");
+
+	if ((run(actor, F_OBJS, m_value_from_int(OBJ_COUNT), 0xFFFFFFFF, &r, NULL)
+				!= M_OK) ||
+				(m_value_get_number(r) != (double)OBJ_COUNT * (OBJ_COUNT - 1) / 2))
+		M_ERROR("objects error");
+
+	/*All the objects have the same shape when "x" is read.*/
+	if (funcs[F_OBJS].f.bc.ics[1].state != M_IC_MONO)
+		M_ERROR("objects inline cache is not monomorphic");
+
+	if ((run(actor, F_STR, 0, 0xFFFFFFFF, &r, NULL) != M_OK) ||
+				!m_value_is_string(r) ||
+				!m_string_equal(m_value_get_string(r),
+				m_string_from_cstr("helloworld")))
+		M_ERROR("string error");
+
+	if (run(actor, F_ERROR, 0, 0xFFFFFFFF, &r, NULL) != M_ERR_TYPE)
+		M_ERROR("type error is not reported");
+	if (!m_slist_empty(&actor->stack))
+		M_ERROR("call stack is not empty after error");
+
+	/*Bypass the loader check and feed the opcodes to the interpreter.*/
+	for (i = 0; i < M_N_ELEMENT(illegal_bcs); i ++) {
+		uint8_t *bc = funcs[F_ERROR].f.bc.bc;
+
+		funcs[F_ERROR].f.bc.bc = illegal_bcs[i];
+		if (run(actor, F_ERROR, 0, 0xFFFFFFFF, &r, NULL) != M_ERR_TYPE)
+			M_ERROR("illegal opcode %d is not reported", illegal_bcs[i][0]);
+		if (!m_slist_empty(&actor->stack))
+			M_ERROR("call stack is not empty after illegal opcode");
+		funcs[F_ERROR].f.bc.bc = bc;
+	}
+
+	M_INFO("interp test end");
+}
+
+static void
+closure_test (M_Actor *actor)
+{
+	M_Value r, inc;
+	int i;
+
+	M_INFO("closure test begin");
+
+	/*Captured and modified variables are boxed.*/
+	if ((fib_bc[14] != M_OP_GETBOX) || (inc_bc[0] != M_OP_GETBOX) ||
+				(inc_bc[8] != M_OP_SETBOX))
+		M_ERROR("modified variables are not boxed");
+	if ((funcs[F_INC].f.bc.nupv != 1) ||
+				(funcs[F_INC].f.bc.upvs[0].flags !=
+				(M_UPV_FL_REG | M_UPV_FL_BOX)))
+		M_ERROR("inc captured variables error");
+
+	/*A constant variable is copied through the middle closure.*/
+	if (inner_bc[0] != M_OP_GETUPV)
+		M_ERROR("constant variable is boxed");
+	if ((funcs[F_MID].f.bc.nupv != 1) ||
+				(funcs[F_MID].f.bc.upvs[0].flags != M_UPV_FL_REG) ||
+				(funcs[F_MID].f.bc.upvs[0].id != 1) ||
+				(funcs[F_INNER].f.bc.nupv != 1) ||
+				(funcs[F_INNER].f.bc.upvs[0].flags != 0) ||
+				(funcs[F_INNER].f.bc.upvs[0].id != 0))
+		M_ERROR("nested captured variables error");
+	if (funcs[F_NEST].f.bc.nupv || funcs[F_LOOP].f.bc.nupv)
+		M_ERROR("functions capture nothing");
+
+	if ((run(actor, F_NEST, m_value_from_int(37), 0xFFFFFFFF, &r, NULL)
+				!= M_OK) || (m_value_get_int(r) != 42))
+		M_ERROR("nested closure error");
+
+	/*The owner sees the modification through the open box.*/
+	if ((run(actor, F_COUNTER, m_value_from_int(100), 0xFFFFFFFF, &inc, NULL)
+				!= M_OK) || !m_value_is_closure(inc))
+		M_ERROR("counter error");
+
+	m_gc_add_root((void*)inc);
+	m_gc_run(0);
+
+	/*The box is closed after the counter returned.*/
+	for (i = 1; i <= 3; i ++) {
+		if ((m_actor_call(actor, inc, 0, NULL) != M_OK) ||
+					(m_interp_run(actor, 0xFFFFFFFF) != M_OK) ||
+					(m_value_get_int(actor->retv) != 100 + i))
+			M_ERROR("closed box error");
+	}
+
+	m_gc_remove_root((void*)inc);
+
+	M_INFO("closure test end");
+}
+
+static void
+stack_test (M_Actor *actor)
+{
+	M_Value fv, arg;
+	M_Result r;
+	int n = 20000;
+
+	M_INFO("stack test begin");
+
+	/*The recursion spans several value stack chunks.*/
+	fv  = m_value_from_closure(m_closure_new(&funcs[F_SUM_MAIN], NULL, NULL));
+	arg = m_value_from_int(n);
+
+	if (m_actor_call(actor, fv, 1, &arg) != M_OK)
+		M_ERROR("call error");
+
+	/*Collect with the frames in the stack.*/
+	while ((r = m_interp_run(actor, 1000)) == M_NONE)
+		m_gc_run(0);
+
+	if ((r != M_OK) || (m_value_get_int(actor->retv) != n * (n + 1) / 2))
+		M_ERROR("recursion error");
+	if (!m_slist_empty(&actor->stack) || actor->chunk->prev ||
+				(actor->chunk->top != (uint8_t*)(actor->chunk + 1)))
+		M_ERROR("value stack is not empty");
+	if (!actor->spare)
+		M_ERROR("no spare chunk");
+
+	M_INFO("stack test end");
+}
+
+static void
+quicken_test (M_Actor *actor)
+{
+	M_Value r;
+
+	M_INFO("quicken test begin");
+
+	m_interp_unquicken(&funcs[F_LOOP]);
+	if ((run(actor, F_LOOP, m_value_from_int(100), 0xFFFFFFFF, &r, NULL)
+				!= M_OK) || (m_value_get_int(r) != 295))
+		M_ERROR("loop error");
+	if ((loop_bc[12] != M_OP_LTJF_II) || (loop_bc[24] != M_OP_ADD_II))
+		M_ERROR("loop is not quickened");
+
+	if ((run(actor, F_FIB_MAIN, m_value_from_int(10), 0xFFFFFFFF, &r, NULL)
+				!= M_OK) || (m_value_get_int(r) != 55))
+		M_ERROR("fib error");
+	if ((fib_bc[4] != M_OP_LTJF_II) || (fib_bc[34] != M_OP_ADD_II))
+		M_ERROR("fib is not quickened");
+
+	if ((run(actor, F_TWICE, m_value_from_int(3), 0xFFFFFFFF, &r, NULL) != M_OK)
+				|| (m_value_get_int(r) != 6))
+		M_ERROR("twice int error");
+	if (twice_bc[0] != M_OP_ADD_II)
+		M_ERROR("ADD is not quickened to ADD_II");
+
+	if ((run(actor, F_TWICE, m_value_from_double(1.5), 0xFFFFFFFF, &r, NULL)
+				!= M_OK) || (m_value_get_number(r) != 3.0))
+		M_ERROR("twice double error");
+	if (twice_bc[0] != M_OP_ADD_G)
+		M_ERROR("ADD_II is not deoptimized");
+
+	if ((run(actor, F_TWICE, m_value_from_int(4), 0xFFFFFFFF, &r, NULL) != M_OK)
+				|| (m_value_get_int(r) != 8))
+		M_ERROR("twice generic error");
+
+	m_interp_unquicken(&funcs[F_TWICE]);
+	if (twice_bc[0] != M_OP_ADD)
+		M_ERROR("ADD is not unquickened");
+
+	if ((run(actor, F_TWICE, m_value_from_double(0.25), 0xFFFFFFFF, &r, NULL)
+				!= M_OK) || (m_value_get_number(r) != 0.5))
+		M_ERROR("twice double error");
+	if (twice_bc[0] != M_OP_ADD_DD)
+		M_ERROR("ADD is not quickened to ADD_DD");
+
+	if ((run(actor, F_TWICE, m_value_from_string(m_string_from_cstr("ab")),
+				0xFFFFFFFF, &r, NULL) != M_OK) ||
+				!m_value_is_string(r) ||
+				!m_string_equal(m_value_get_string(r),
+				m_string_from_cstr("abab")))
+		M_ERROR("twice string error");
+	if (twice_bc[0] != M_OP_ADD_G)
+		M_ERROR("ADD_DD is not deoptimized");
+
+	M_INFO("quicken test end");
+}
+
+#define RACE_THREADS 4
+#define RACE_ROUNDS  64
+#define RACE_CALLS   256
+
+static void*
+quicken_race_entry (void *arg)
+{
+	int i, id = M_PTR_TO_SIZE(arg);
+	M_Actor *actor;
+	M_Value r;
+
+	m_thread_enter();
+
+	actor = m_actor_new();
+
+	/*The threads rewrite the same opcodes with different variants.*/
+	for (i = 0; i < RACE_CALLS; i ++) {
+		if ((i + id) & 1) {
+			if ((run(actor, F_TWICE, m_value_from_int(i), 0xFFFFFFFF, &r, NULL)
+						!= M_OK) || (m_value_get_int(r) != i * 2)) {
+				M_ERROR("concurrent twice int error");
+				break;
+			}
+		} else {
+			if ((run(actor, F_TWICE, m_value_from_double(i + 0.5), 0xFFFFFFFF,
+						&r, NULL) != M_OK) ||
+						(m_value_get_number(r) != i * 2 + 1.0)) {
+				M_ERROR("concurrent twice double error");
+				break;
+			}
+		}
+
+		if ((run(actor, F_LOOP, m_value_from_int(i), 0xFFFFFFFF, &r, NULL)
+					!= M_OK) || !m_value_is_int(r)) {
+			M_ERROR("concurrent loop error");
+			break;
+		}
+	}
+
+	m_actor_free(actor);
+
+	m_thread_leave();
+
+	return NULL;
+}
+
+static void
+quicken_race_test (void)
+{
+	pthread_t th[RACE_THREADS];
+	int i, r;
+
+	M_INFO("quicken race test begin");
+
+	for (r = 0; r < RACE_ROUNDS; r ++) {
+		m_interp_unquicken(&funcs[F_TWICE]);
+		m_interp_unquicken(&funcs[F_LOOP]);
+
+		for (i = 0; i < RACE_THREADS; i ++)
+			pthread_create(&th[i], NULL, quicken_race_entry, M_SIZE_TO_PTR(i));
+
+		for (i = 0; i < RACE_THREADS; i ++) {
+			m_thread_leave();
+
+			pthread_join(th[i], NULL);
+
+			m_thread_enter();
+		}
+
+		if (m_opcode_generics[twice_bc[0]] != M_OP_ADD)
+			M_ERROR("ADD is rewritten to %s", m_opcode_names[twice_bc[0]]);
+	}
+
+	M_INFO("quicken race test end");
+}
+
+static int
+fib (int n)
+{
+	return (n < 2) ? n : fib(n - 1) + fib(n - 2);
+}
+
+static void
+interp_bench (M_Actor *actor)
+{
+	int64_t sum;
+	double fib_calls;
+	int i;
+
+	M_INFO("interp bench begin");
+
+	for (sum = 0, i = 0; i < LOOP_COUNT; i ++)
+		sum += i % 7;
+
+	bench(actor, "arith loop", F_LOOP, consts[K_LOOP_COUNT],
+				m_value_from_int(sum), LOOP_INSTS((double)LOOP_COUNT));
+
+	/*Run the same loop with the generic instructions pinned.*/
+	m_interp_unquicken(&funcs[F_LOOP]);
+	loop_bc[12] = M_OP_LT_G;
+	loop_bc[24] = M_OP_ADD_G;
+	bench(actor, "arith loop (generic)", F_LOOP, consts[K_LOOP_COUNT],
+				m_value_from_int(sum), LOOP_INSTS((double)LOOP_COUNT));
+	bench(actor, "calls", F_CALL, consts[K_CALL_COUNT],
+				m_value_from_int(CALL_COUNT), CALL_INSTS((double)CALL_COUNT));
+
+	/*fib(n) makes 2 * fib(n + 1) - 1 calls.*/
+	fib_calls = 2.0 * fib(FIB_N + 1) - 1;
+	bench(actor, "fib", F_FIB_MAIN, m_value_from_int(FIB_N),
+				m_value_from_int(fib(FIB_N)), 0);
+	M_INFO("fib(%d): %.0f calls", FIB_N, fib_calls);
+
+	bench(actor, "property access", F_PROP, consts[K_PROP_COUNT],
+				m_value_from_int(PROP_COUNT * 3), PROP_INSTS((double)PROP_COUNT));
+
+	M_INFO("interp bench end");
+}
+
+int
+main (int argc, char **argv)
+{
+	M_Actor *actor;
+
+	m_startup();
+
+	module_init();
+
+	actor = m_actor_new();
+
+	interp_test(actor);
+	closure_test(actor);
+	stack_test(actor);
+	quicken_test(actor);
+	quicken_race_test();
+	interp_bench(actor);
+
+	m_actor_free(actor);
+
+	test_module_deinit();
+
+	return 0;
+}
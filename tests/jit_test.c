@@ -0,0 +1,329 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "jittest"
+
+#include "test_module.h"
+
+#define LOOP_COUNT  (20*1024*1024)
+#define MIX_COUNT   100000
+#define BOOL_COUNT  100001
+#define HALF_COUNT  5000
+#define MOD         1000003
+
+/*Const values.*/
+enum {
+	K_LOOP_COUNT,
+	K_MOD,
+	K_HALF,
+	K_COUNT
+};
+
+/*Functions.*/
+enum {
+	F_LOOP,
+	F_MIX,
+	F_BOOL,
+	F_HALF,
+	F_TWICE,
+	F_FIB_MAIN,
+	F_FIB,
+	F_COUNT
+};
+
+/*sum = 0; for (i = 0; i < n; i ++) sum += i % 7; return sum;*/
+static uint8_t loop_bc[] = {
+	/* 0*/ M_OP_LOADI, 1, M_BC_16(0),
+	/* 4*/ M_OP_LOADI, 2, M_BC_16(0),
+	/* 8*/ M_OP_LOADI, 5, M_BC_16(7),
+	/*12*/ M_OP_LT, 3, 2, 0,
+	/*16*/ M_OP_JMPF, 3, M_BC_16(19),
+	/*20*/ M_OP_MOD, 4, 2, 5,
+	/*24*/ M_OP_ADD, 1, 1, 4,
+	/*28*/ M_OP_ADDI, 2, 2, 1,
+	/*32*/ M_OP_JMP, M_BC_16(-20),
+	/*35*/ M_OP_RET, 1
+};
+#define LOOP_INSTS(n) (3 + (n) * 6 + 3)
+
+/*x = 1; for (i = 0; i <= n; i ++) x = (x * 3 - i) % MOD; return x;*/
+static uint8_t mix_bc[] = {
+	/* 0*/ M_OP_LOADI, 1, M_BC_16(1),
+	/* 4*/ M_OP_LOADI, 2, M_BC_16(0),
+	/* 8*/ M_OP_LOADI, 4, M_BC_16(3),
+	/*12*/ M_OP_LOADK, 6, M_BC_16(K_MOD),
+	/*16*/ M_OP_LE, 3, 2, 0,
+	/*20*/ M_OP_JMPF, 3, M_BC_16(23),
+	/*24*/ M_OP_MUL, 5, 1, 4,
+	/*28*/ M_OP_SUB, 1, 5, 2,
+	/*32*/ M_OP_MOD, 1, 1, 6,
+	/*36*/ M_OP_ADDI, 2, 2, 1,
+	/*40*/ M_OP_JMP, M_BC_16(-24),
+	/*43*/ M_OP_RET, 1
+};
+
+/*c = 0; b = false; for (i = 0; i < n; i ++) {b = !b; if (b) c ++;}
+ *r = c; c = null; return r;*/
+static uint8_t bool_bc[] = {
+	/* 0*/ M_OP_LOADI, 1, M_BC_16(0),
+	/* 4*/ M_OP_LOADBOOL, 5, 0,
+	/* 7*/ M_OP_LOADI, 2, M_BC_16(0),
+	/*11*/ M_OP_LT, 3, 2, 0,
+	/*15*/ M_OP_JMPF, 3, M_BC_16(25),
+	/*19*/ M_OP_NOT, 5, 5,
+	/*22*/ M_OP_JMPT, 5, M_BC_16(7),
+	/*26*/ M_OP_JMP, M_BC_16(7),
+	/*29*/ M_OP_ADDI, 1, 1, 1,
+	/*33*/ M_OP_ADDI, 2, 2, 1,
+	/*37*/ M_OP_JMP, M_BC_16(-26),
+	/*40*/ M_OP_MOVE, 4, 1,
+	/*43*/ M_OP_LOADNULL, 1,
+	/*45*/ M_OP_RET, 4
+};
+
+/*sum = 0.5; for (i = 0; i < n; i ++) sum += i; return sum;*/
+static uint8_t half_bc[] = {
+	/* 0*/ M_OP_LOADK, 1, M_BC_16(K_HALF),
+	/* 4*/ M_OP_LOADI, 2, M_BC_16(0),
+	/* 8*/ M_OP_LT, 3, 2, 0,
+	/*12*/ M_OP_JMPF, 3, M_BC_16(15),
+	/*16*/ M_OP_ADD, 1, 1, 2,
+	/*20*/ M_OP_ADDI, 2, 2, 1,
+	/*24*/ M_OP_JMP, M_BC_16(-16),
+	/*27*/ M_OP_RET, 1
+};
+
+/*return x + x;*/
+static uint8_t twice_bc[] = {
+	/* 0*/ M_OP_ADD, 1, 0, 0,
+	/* 4*/ M_OP_RET, 1
+};
+
+/*fib = function (n) {...}; return fib(n);*/
+static uint8_t fib_main_bc[] = {
+	/* 0*/ M_OP_CLOSURE, 1, M_BC_16(F_FIB),
+	/* 4*/ M_OP_MOVE, 2, 0,
+	/* 7*/ M_OP_CALL, 1, 1, 1,
+	/*11*/ M_OP_RET, 1
+};
+
+/*if (n < 2) return n; return fib(n - 1) + fib(n - 2);*/
+static uint8_t fib_bc[] = {
+	/* 0*/ M_OP_LOADI, 1, M_BC_16(2),
+	/* 4*/ M_OP_LT, 1, 0, 1,
+	/* 8*/ M_OP_JMPF, 1, M_BC_16(6),
+	/*12*/ M_OP_RET, 0,
+	/*14*/ M_OP_GETUP, 2, 0, 1,
+	/*18*/ M_OP_ADDI, 3, 0, -1,
+	/*22*/ M_OP_CALL, 4, 2, 1,
+	/*26*/ M_OP_ADDI, 3, 0, -2,
+	/*30*/ M_OP_CALL, 3, 2, 1,
+	/*34*/ M_OP_ADD, 4, 4, 3,
+	/*38*/ M_OP_RET, 4
+};
+
+static M_Value     consts[K_COUNT];
+static M_Function  funcs[F_COUNT];
+static M_Function *func_ptrs[F_COUNT];
+
+static const TestFunc func_defs[F_COUNT] = {
+	[F_LOOP]     = TEST_FUNC(loop_bc, 1, 6),
+	[F_MIX]      = TEST_FUNC(mix_bc, 1, 7),
+	[F_BOOL]     = TEST_FUNC(bool_bc, 1, 6),
+	[F_HALF]     = TEST_FUNC(half_bc, 1, 4),
+	[F_TWICE]    = TEST_FUNC(twice_bc, 1, 2),
+	[F_FIB_MAIN] = TEST_FUNC(fib_main_bc, 1, 3),
+	[F_FIB]      = TEST_FUNC(fib_bc, 1, 5)
+};
+
+/*Keep the function interpreted.*/
+static void
+func_interp (int id)
+{
+	m_jit_release(&funcs[id]);
+	funcs[id].f.bc.hot = M_JIT_THRESHOLD;
+}
+
+static void
+module_init (void)
+{
+	consts[K_LOOP_COUNT] = m_value_from_int(LOOP_COUNT);
+	consts[K_MOD]        = m_value_from_int(MOD);
+	consts[K_HALF]       = m_value_from_double(0.5);
+
+	test_module_init(consts, K_COUNT, funcs, func_ptrs, func_defs, F_COUNT);
+}
+
+static long
+time_diff (struct timespec *begin, struct timespec *end)
+{
+	return (end->tv_sec - begin->tv_sec) * 1000000 +
+				(end->tv_nsec - begin->tv_nsec) / 1000;
+}
+
+static void
+jit_test (M_Actor *actor)
+{
+	M_Value r;
+	uint32_t yields;
+	int64_t x, sum;
+	double d;
+	int i;
+
+	M_INFO("jit test begin");
+
+	if (m_jit_compile(&funcs[F_LOOP]) != M_OK)
+		M_ERROR("compile loop failed");
+
+	for (sum = 0, i = 0; i < 100000; i ++)
+		sum += i % 7;
+
+	if ((run(actor, F_LOOP, m_value_from_int(100000), 0xFFFFFFFF, &r, NULL)
+				!= M_OK) || (m_value_get_int(r) != sum))
+		M_ERROR("loop error");
+	if ((run(actor, F_LOOP, m_value_from_int(100000), 1000, &r, &yields)
+				!= M_OK) || (m_value_get_int(r) != sum))
+		M_ERROR("loop with budget error");
+	if (yields < 99)
+		M_ERROR("budget error");
+	if (funcs[F_LOOP].f.bc.jit->bails)
+		M_ERROR("integer loop bails out");
+
+	if (m_jit_compile(&funcs[F_MIX]) != M_OK)
+		M_ERROR("compile mix failed");
+
+	for (x = 1, i = 0; i <= MIX_COUNT; i ++)
+		x = (x * 3 - i) % MOD;
+
+	if ((run(actor, F_MIX, m_value_from_int(MIX_COUNT), 0xFFFFFFFF, &r, NULL)
+				!= M_OK) || (m_value_get_int(r) != x))
+		M_ERROR("mix error");
+
+	if (m_jit_compile(&funcs[F_BOOL]) != M_OK)
+		M_ERROR("compile bool failed");
+	if ((run(actor, F_BOOL, m_value_from_int(BOOL_COUNT), 0xFFFFFFFF, &r, NULL)
+				!= M_OK) || (m_value_get_int(r) != (BOOL_COUNT + 1) / 2))
+		M_ERROR("bool error");
+
+	/*Guards fail in every iteration, the code is not entered any more.*/
+	if (m_jit_compile(&funcs[F_HALF]) != M_OK)
+		M_ERROR("compile half failed");
+
+	for (d = 0.5, i = 0; i < HALF_COUNT; i ++)
+		d += i;
+
+	if ((run(actor, F_HALF, m_value_from_int(HALF_COUNT), 0xFFFFFFFF, &r, NULL)
+				!= M_OK) || (m_value_get_number(r) != d))
+		M_ERROR("half error");
+	if (funcs[F_HALF].f.bc.jit->bails != M_JIT_MAX_BAILS)
+		M_ERROR("bails %d", funcs[F_HALF].f.bc.jit->bails);
+	if (m_jit_addr(funcs[F_HALF].f.bc.jit, 8))
+		M_ERROR("the code is still entered after too many bails");
+
+	/*Integer overflow falls back to the interpreter.*/
+	if (m_jit_compile(&funcs[F_TWICE]) != M_OK)
+		M_ERROR("compile twice failed");
+	if ((run(actor, F_TWICE, m_value_from_int(INT_MAX), 0xFFFFFFFF, &r, NULL)
+				!= M_OK) || (m_value_get_number(r) != 2.0 * INT_MAX))
+		M_ERROR("overflow error");
+	if ((run(actor, F_TWICE, m_value_from_int(-21), 0xFFFFFFFF, &r, NULL)
+				!= M_OK) || (m_value_get_int(r) != -42))
+		M_ERROR("twice error");
+
+	/*fib is compiled when it is called often.*/
+	if ((run(actor, F_FIB_MAIN, m_value_from_int(20), 0xFFFFFFFF, &r, NULL)
+				!= M_OK) || (m_value_get_int(r) != 6765))
+		M_ERROR("fib error");
+	if (!funcs[F_FIB].f.bc.jit)
+		M_ERROR("fib is not compiled");
+	if (funcs[F_FIB_MAIN].f.bc.jit)
+		M_ERROR("fib main is compiled");
+
+	M_INFO("jit test end");
+}
+
+static void
+bench (M_Actor *actor, const char *name, int id, M_Value arg, M_Value expect,
+			double insts)
+{
+	struct timespec begin, end;
+	M_Value r;
+	long us;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	if (run(actor, id, arg, 0xFFFFFFFF, &r, NULL) != M_OK)
+		M_ERROR("%s run error", name);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	us = M_MAX(time_diff(&begin, &end), 1);
+
+	if (r != expect)
+		M_ERROR("%s result error", name);
+
+	M_INFO("%s: %.0f instructions in %ldus, %.1fM inst/s", name, insts,
+				us, insts / us);
+}
+
+static void
+jit_bench (M_Actor *actor)
+{
+	int64_t sum;
+	int i;
+
+	M_INFO("jit bench begin");
+
+	for (sum = 0, i = 0; i < LOOP_COUNT; i ++)
+		sum += i % 7;
+
+	func_interp(F_LOOP);
+	bench(actor, "interpreted loop", F_LOOP, consts[K_LOOP_COUNT],
+				m_value_from_int(sum), LOOP_INSTS((double)LOOP_COUNT));
+
+	if (m_jit_compile(&funcs[F_LOOP]) != M_OK)
+		M_ERROR("compile loop failed");
+	bench(actor, "compiled loop", F_LOOP, consts[K_LOOP_COUNT],
+				m_value_from_int(sum), LOOP_INSTS((double)LOOP_COUNT));
+
+	M_INFO("jit bench end");
+}
+
+int
+main (int argc, char **argv)
+{
+	M_Actor *actor;
+
+	m_startup();
+
+	module_init();
+
+	actor = m_actor_new();
+
+#ifdef M_JIT_ENABLE
+	jit_test(actor);
+	jit_bench(actor);
+#endif
+
+	m_actor_free(actor);
+
+	test_module_deinit();
+
+	return 0;
+}
@@ -262,6 +262,277 @@ slist_test (void)
 	M_INFO("slist test end");
 }
 
+static long
+time_diff (struct timespec *begin, struct timespec *end)
+{
+	return (end->tv_sec - begin->tv_sec) * 1000000 +
+				(end->tv_nsec - begin->tv_nsec) / 1000;
+}
+
+#define LF_THREADS 4
+#define LF_NODES   64
+#define LF_LOOPS   200000
+
+typedef struct {
+	M_SList node;
+	int     i;
+	int     cnt;
+	int     seen;
+} LFNode;
+
+static LFNode          lf_nodes[LF_NODES];
+static M_LFStack       lf_stack;
+static M_SList         lock_stack;
+static pthread_mutex_t lock_stack_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void*
+lfstack_entry (void *arg)
+{
+	M_SList *node;
+	int i;
+
+	for (i = 0; i < LF_LOOPS; i ++) {
+		node = m_lfstack_pop(&lf_stack);
+		if (!node)
+			continue;
+
+		/*The popped node is owned by this thread.*/
+		m_node_value(node, LFNode, node)->cnt ++;
+
+		m_lfstack_push(&lf_stack, node);
+	}
+
+	return NULL;
+}
+
+static void*
+lock_stack_entry (void *arg)
+{
+	M_SList *node;
+	int i;
+
+	for (i = 0; i < LF_LOOPS; i ++) {
+		pthread_mutex_lock(&lock_stack_lock);
+		node = m_slist_pop(&lock_stack);
+		pthread_mutex_unlock(&lock_stack_lock);
+
+		if (!node)
+			continue;
+
+		m_node_value(node, LFNode, node)->cnt ++;
+
+		pthread_mutex_lock(&lock_stack_lock);
+		m_slist_push(&lock_stack, node);
+		pthread_mutex_unlock(&lock_stack_lock);
+	}
+
+	return NULL;
+}
+
+static void
+lfstack_test (void)
+{
+	pthread_t threads[LF_THREADS];
+	struct timespec begin, end;
+	M_SList *node, *first, *last;
+	LFNode *ln;
+	long lf_us, lock_us;
+	int i, n, cnt;
+
+	M_INFO("lfstack test begin");
+
+	m_lfstack_init(&lf_stack);
+	if (!m_lfstack_empty(&lf_stack) || m_lfstack_pop(&lf_stack))
+		M_ERROR("empty stack error");
+
+	for (i = 0; i < LF_NODES; i ++) {
+		lf_nodes[i].i = i;
+		m_lfstack_push(&lf_stack, &lf_nodes[i].node);
+	}
+
+	for (i = LF_NODES - 1; i >= 0; i --) {
+		node = m_lfstack_pop(&lf_stack);
+		if (node != &lf_nodes[i].node)
+			M_ERROR("pop order error");
+	}
+
+	/*Push a linked list at once.*/
+	m_slist_init(&lock_stack);
+	for (i = 0; i < LF_NODES; i ++)
+		m_slist_push(&lock_stack, &lf_nodes[i].node);
+
+	first = lock_stack.next;
+	last  = &lf_nodes[0].node;
+	m_lfstack_push_list(&lf_stack, first, last);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < LF_THREADS; i ++)
+		pthread_create(&threads[i], NULL, lfstack_entry, NULL);
+	for (i = 0; i < LF_THREADS; i ++)
+		pthread_join(threads[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	lf_us = time_diff(&begin, &end);
+
+	/*Every node must be in the stack once.*/
+	n   = 0;
+	cnt = 0;
+	node = m_lfstack_pop_all(&lf_stack);
+	while (node) {
+		ln = m_node_value(node, LFNode, node);
+		if (ln->seen ++)
+			M_ERROR("node %d is duplicated", ln->i);
+
+		cnt += ln->cnt;
+		ln->cnt = 0;
+		n ++;
+		node = node->next;
+	}
+
+	if (n != LF_NODES)
+		M_ERROR("nodes lost, %d left", n);
+	if (cnt != LF_THREADS * LF_LOOPS)
+		M_ERROR("operations lost, %d done", cnt);
+	if (!m_lfstack_empty(&lf_stack))
+		M_ERROR("pop all error");
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < LF_THREADS; i ++)
+		pthread_create(&threads[i], NULL, lock_stack_entry, NULL);
+	for (i = 0; i < LF_THREADS; i ++)
+		pthread_join(threads[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	lock_us = time_diff(&begin, &end);
+
+	M_INFO("%d pop/push pairs: lock-free %ldus, mutex %ldus",
+				LF_THREADS * LF_LOOPS, lf_us, lock_us);
+
+	M_INFO("lfstack test end");
+}
+
+#define MPMC_PRODUCERS 2
+#define MPMC_CONSUMERS 2
+#define MPMC_COUNT     200000
+#define MPMC_SIZE      256
+
+typedef struct {
+	M_SList node;
+	int     i;
+} MpmcNode;
+
+static M_MpmcQueue mpmc_queue;
+static MpmcNode    mpmc_nodes[MPMC_PRODUCERS][MPMC_COUNT];
+static int64_t     mpmc_sums[MPMC_CONSUMERS];
+static int         mpmc_done;
+
+static void*
+mpmc_producer (void *arg)
+{
+	MpmcNode *nodes = arg;
+	int i;
+
+	for (i = 0; i < MPMC_COUNT; i ++) {
+		nodes[i].i = i + 1;
+
+		while (!m_mpmc_push(&mpmc_queue, &nodes[i].node))
+			sched_yield();
+	}
+
+	return NULL;
+}
+
+static void*
+mpmc_consumer (void *arg)
+{
+	int64_t *sum = arg;
+	M_SList *node;
+	int last[MPMC_PRODUCERS] = {0};
+
+	while (1) {
+		node = m_mpmc_pop(&mpmc_queue);
+		if (!node) {
+			if (__atomic_load_n(&mpmc_done, __ATOMIC_ACQUIRE) &&
+						!m_mpmc_size(&mpmc_queue))
+				break;
+
+			sched_yield();
+			continue;
+		}
+
+		/*The nodes from a producer are popped in order.*/
+		{
+			MpmcNode *mn = m_node_value(node, MpmcNode, node);
+			int p = (mn - mpmc_nodes[0]) / MPMC_COUNT;
+
+			if (mn->i <= last[p])
+				M_ERROR("mpmc order error");
+			last[p] = mn->i;
+
+			*sum += mn->i;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+mpmc_test (void)
+{
+	pthread_t producers[MPMC_PRODUCERS], consumers[MPMC_CONSUMERS];
+	struct timespec begin, end;
+	MpmcNode n1, n2;
+	int64_t sum = 0;
+	long us;
+	int i;
+
+	M_INFO("mpmc test begin");
+
+	if (m_mpmc_init(&mpmc_queue, 2) != M_OK)
+		M_ERROR("mpmc init error");
+
+	if (!m_mpmc_push(&mpmc_queue, &n1.node) ||
+				!m_mpmc_push(&mpmc_queue, &n2.node) ||
+				m_mpmc_push(&mpmc_queue, &n1.node))
+		M_ERROR("mpmc full error");
+	if ((m_mpmc_pop(&mpmc_queue) != &n1.node) ||
+				(m_mpmc_pop(&mpmc_queue) != &n2.node) ||
+				m_mpmc_pop(&mpmc_queue))
+		M_ERROR("mpmc pop error");
+
+	m_mpmc_deinit(&mpmc_queue);
+
+	if (m_mpmc_init(&mpmc_queue, MPMC_SIZE) != M_OK)
+		M_ERROR("mpmc init error");
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	for (i = 0; i < MPMC_CONSUMERS; i ++)
+		pthread_create(&consumers[i], NULL, mpmc_consumer, &mpmc_sums[i]);
+	for (i = 0; i < MPMC_PRODUCERS; i ++)
+		pthread_create(&producers[i], NULL, mpmc_producer, mpmc_nodes[i]);
+
+	for (i = 0; i < MPMC_PRODUCERS; i ++)
+		pthread_join(producers[i], NULL);
+
+	__atomic_store_n(&mpmc_done, 1, __ATOMIC_RELEASE);
+
+	for (i = 0; i < MPMC_CONSUMERS; i ++) {
+		pthread_join(consumers[i], NULL);
+		sum += mpmc_sums[i];
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	us = M_MAX(time_diff(&begin, &end), 1);
+
+	if (sum != (int64_t)MPMC_PRODUCERS * MPMC_COUNT * (MPMC_COUNT + 1) / 2)
+		M_ERROR("mpmc sum error");
+
+	M_INFO("mpmc: %d nodes in %ldus", MPMC_PRODUCERS * MPMC_COUNT, us);
+
+	m_mpmc_deinit(&mpmc_queue);
+
+	M_INFO("mpmc test end");
+}
+
 int
 main (int argc, char **argv)
 {
@@ -270,6 +541,8 @@ main (int argc, char **argv)
 	add_remove_test();
 	traverse_test();
 	slist_test();
+	lfstack_test();
+	mpmc_test();
 
 	return 0;
 }
@@ -19,8 +19,31 @@
 
 #define M_LOG_TAG "log_test"
 
+#include <errno.h>
+#include <stddef.h>
 #include <ming.h>
 
+static char log_path[] = "/tmp/log_testXXXXXX";
+
+/**Read the log file from "off", return the new offset.*/
+static size_t
+log_read (size_t off, char *buf, size_t size)
+{
+	FILE *fp;
+	size_t n;
+
+	m_log_flush();
+
+	fp = fopen(log_path, "rb");
+	assert(fp);
+	fseek(fp, off, SEEK_SET);
+	n = fread(buf, 1, size - 1, fp);
+	buf[n] = 0;
+	fclose(fp);
+
+	return off + n;
+}
+
 static void
 log_test (void)
 {
@@ -31,6 +54,87 @@ log_test (void)
 	M_FATAL("fatal");
 }
 
+static void
+format_test (void)
+{
+	static char expect[4096], out[4096];
+	size_t elen = 0, off;
+	long double ld = 2.5;
+	char *tag, *file, *func, *fmt;
+
+	off = log_read(0, out, sizeof(out));
+
+#define CHECK(a...)\
+	M_INFO(a);\
+	elen += snprintf(expect + elen, sizeof(expect) - elen, a);\
+	elen += snprintf(expect + elen, sizeof(expect) - elen, "\n");
+
+	CHECK("plain text");
+	CHECK("%d %i %u %x %X %o %c %%", -1, 2, 3u, 0xab, 0xcd, 8, 'z');
+	CHECK("%hhd %hd %ld %lld %jd %zu %td", 300, 70000, -5L, 1LL << 40,
+			(intmax_t)-7, (size_t)9, (ptrdiff_t)-3);
+	CHECK("%f %.3e %g %10.2f %-8.1f| %Lf", 1.5, 12345.678, 0.25, 3.14159,
+			-2.0, ld);
+	CHECK("%s|%10s|%-6s|%.2s", "abc", "right", "left", "truncate");
+	CHECK("%*d|%-*d|%.*f|%*.*s|%.*d", 6, 42, 6, 42, 2, 1.23456, 8, 3,
+			"stars", -1, 7);
+	CHECK("%p %p", (void*)&elen, NULL);
+	errno = ENOENT;
+	CHECK("errno: %m");
+	CHECK("%s %d %s", "mixed", 1, "end");
+
+	/*The strings are freed before the writer thread formats the message.*/
+	tag  = strdup(M_LOG_TAG);
+	file = strdup(__FILE__);
+	func = strdup(__FUNCTION__);
+	fmt  = strdup("heap %s %d");
+	m_log(M_LOG_LEVEL_INFO, tag, file, func, __LINE__, fmt, "format", 5);
+	elen += snprintf(expect + elen, sizeof(expect) - elen, "heap format 5\n");
+	memset(fmt, 'x', strlen(fmt));
+	free(tag);
+	free(file);
+	free(func);
+	free(fmt);
+
+	off = log_read(off, out, sizeof(out));
+	if (strcmp(out, expect)) {
+		M_ERROR("format mismatch:\n%s\nexpected:\n%s", out, expect);
+		exit(1);
+	}
+}
+
+static void
+tag_test (void)
+{
+	char out[1024];
+	size_t off;
+
+	off = log_read(0, out, sizeof(out));
+
+	m_log_set_level(M_LOG_TAG, M_LOG_LEVEL_WARNING);
+	if (M_LOG_ENABLED(M_LOG_LEVEL_INFO) || !M_LOG_ENABLED(M_LOG_LEVEL_WARNING)) {
+		M_ERROR("tag level is not applied");
+		exit(1);
+	}
+
+	M_INFO("hidden");
+	M_WARNING("shown");
+
+	/*Other tags and the default level do not change this tag.*/
+	m_log_set_level("other", M_LOG_LEVEL_NONE);
+	m_log_set_level(NULL, M_LOG_LEVEL_NONE);
+	M_WARNING("shown");
+
+	m_log_set_level(NULL, M_LOG_LEVEL_ALL);
+	m_log_set_level(M_LOG_TAG, M_LOG_LEVEL_ALL);
+
+	log_read(off, out, sizeof(out));
+	if (strcmp(out, "shown\nshown\n")) {
+		M_ERROR("tag filter error:\n%s", out);
+		exit(1);
+	}
+}
+
 static void*
 thread_entry (void *arg)
 {
@@ -49,8 +153,15 @@ multithread_test (void)
 {
 	int count = 32;
 	pthread_t threads[count];
+	static char out[1024 * 1024];
+	M_LogStats s1, s2;
+	size_t off, n;
+	char *p;
 	int i;
 
+	off = log_read(0, out, sizeof(out));
+	m_log_get_stats(&s1);
+
 	for (i = 0; i < count; i ++) {
 		pthread_create(&threads[i], NULL, thread_entry, M_SIZE_TO_PTR(i));
 	}
@@ -58,16 +169,51 @@ multithread_test (void)
 	for (i = 0; i < count; i ++) {
 		pthread_join(threads[i], NULL);
 	}
+
+	log_read(off, out, sizeof(out));
+	m_log_get_stats(&s2);
+
+	/*Every message is either written or counted as dropped.*/
+	n = 0;
+	for (p = out; (p = strstr(p, "from thread")); p ++)
+		n ++;
+
+	M_INFO("written: %"PRIu64" dropped: %"PRIu64" blocked: %"PRIu64,
+			s2.written - s1.written, s2.dropped - s1.dropped,
+			s2.blocked - s1.blocked);
+
+	if (n + s2.dropped - s1.dropped != count * 100) {
+		M_ERROR("messages lost: written %d dropped %d",
+				(int)n, (int)(s2.dropped - s1.dropped));
+		exit(1);
+	}
 }
 
 int
 main (int argc, char **argv)
 {
+	int fd;
+
+	/*Log to a temporary file through the asynchronous backend
+	 *with a small ring, so messages may be dropped.*/
+	fd = mkstemp(log_path);
+	assert(fd != -1);
+	close(fd);
+
+	setenv("M_LOG_FILE", log_path, 1);
+	setenv("M_LOG_LEVEL", "ALL", 1);
+	setenv("M_LOG_PATTERN", "", 1);
+	setenv("M_LOG_ASYNC", "drop", 1);
+	setenv("M_LOG_ASYNC_SIZE", "4096", 1);
+
 	m_startup();
 
 	log_test();
+	format_test();
+	tag_test();
 	multithread_test();
 
+	unlink(log_path);
+
 	return 0;
 }
-
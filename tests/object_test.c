@@ -0,0 +1,289 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "objtest"
+
+#include <ming.h>
+
+#define NAME_COUNT 256
+
+static M_Quark names[NAME_COUNT];
+
+static void
+names_init (void)
+{
+	char buf[32];
+	int i;
+
+	for (i = 0; i < NAME_COUNT; i ++) {
+		snprintf(buf, sizeof(buf), "p%d", i);
+		names[i] = m_string_from_cstr(buf);
+	}
+}
+
+static void
+shape_test (void)
+{
+	M_Object *o1, *o2;
+	M_Value v;
+	int i;
+
+	M_INFO("shape test begin");
+
+	o1 = m_object_new(0);
+	o2 = m_object_new(0);
+
+	for (i = 0; i < 4; i ++) {
+		m_object_set(o1, names[i], m_value_from_int(i));
+		m_object_set(o2, names[i], m_value_from_int(i + 100));
+	}
+
+	if (o1->shape != o2->shape)
+		M_ERROR("shape is not shared");
+
+	m_object_set(o2, names[4], m_value_from_int(4));
+	if (o1->shape == o2->shape)
+		M_ERROR("shape is not changed");
+	if (o2->shape->parent != o1->shape)
+		M_ERROR("shape parent error");
+
+	/*Set an existed property does not change the shape.*/
+	m_object_set(o1, names[0], m_value_from_int(1000));
+	if (o1->shape != o2->shape->parent)
+		M_ERROR("shape changed by set");
+
+	if (!m_object_get(o1, names[0], &v) || (m_value_get_int(v) != 1000))
+		M_ERROR("get error");
+	if (!m_object_get(o2, names[3], &v) || (m_value_get_int(v) != 103))
+		M_ERROR("get error");
+	if (m_object_get(o1, names[4], &v))
+		M_ERROR("get not existed property");
+
+	M_INFO("shape test end");
+}
+
+static void
+proto_test (void)
+{
+	M_Object *proto, *obj;
+	M_Value v;
+
+	M_INFO("proto test begin");
+
+	proto = m_object_new(0);
+	m_object_set(proto, names[0], m_value_from_int(1));
+	m_object_define(proto, names[1], M_PROP_FL_ENUMERABLE, m_value_from_int(2));
+
+	obj = m_object_new(m_value_from_object(proto));
+	m_object_set(obj, names[2], m_value_from_int(3));
+
+	if (!m_object_get(obj, names[0], &v) || (m_value_get_int(v) != 1))
+		M_ERROR("get prototype's property error");
+	if (!m_object_get(obj, names[2], &v) || (m_value_get_int(v) != 3))
+		M_ERROR("get own property error");
+	if (m_object_lookup(obj, names[0]))
+		M_ERROR("prototype's property is own property");
+
+	if (m_object_set(proto, names[1], m_value_from_int(3)) != M_FAILED)
+		M_ERROR("set readonly property");
+
+	proto->flags &= ~M_OBJ_FL_MUTABLE;
+	if (m_object_set(proto, names[0], m_value_from_int(3)) != M_FAILED)
+		M_ERROR("set immutable object");
+
+	M_INFO("proto test end");
+}
+
+static void
+dict_test (void)
+{
+	M_Object *o1, *o2;
+	M_Shape *shape;
+	M_Value v;
+	int i;
+
+	M_INFO("dict test begin");
+
+	o1 = m_object_new(0);
+	o2 = m_object_new(0);
+
+	for (i = 0; i < 16; i ++) {
+		m_object_set(o1, names[i], m_value_from_int(i));
+		m_object_set(o2, names[i], m_value_from_int(i));
+	}
+
+	/*More than M_SHAPE_LINEAR_MAX properties are looked up by hash.*/
+	for (i = 0; i < 16; i ++) {
+		if (!m_object_get(o1, names[i], &v) || (m_value_get_int(v) != i))
+			M_ERROR("get %d error", i);
+	}
+
+	shape = o2->shape;
+
+	if (m_object_remove(o1, names[3]) != M_OK)
+		M_ERROR("remove error");
+	if (m_object_remove(o1, names[3]) != M_NONE)
+		M_ERROR("remove again error");
+	if (!(o1->shape->flags & M_SHAPE_FL_DICT))
+		M_ERROR("not dictionary mode");
+	if (o2->shape != shape)
+		M_ERROR("shared shape changed");
+	if (m_object_get(o1, names[3], &v))
+		M_ERROR("get removed property");
+
+	for (i = 16; i < 32; i ++)
+		m_object_set(o1, names[i], m_value_from_int(i));
+
+	for (i = 0; i < 32; i ++) {
+		if (i == 3)
+			continue;
+		if (!m_object_get(o1, names[i], &v) || (m_value_get_int(v) != i))
+			M_ERROR("get %d error", i);
+	}
+
+	/*Too many properties change the object to dictionary mode.*/
+	for (i = 16; i < NAME_COUNT; i ++)
+		m_object_set(o2, names[i], m_value_from_int(i));
+
+	if (!(o2->shape->flags & M_SHAPE_FL_DICT))
+		M_ERROR("not dictionary mode");
+
+	for (i = 0; i < NAME_COUNT; i ++) {
+		if (!m_object_get(o2, names[i], &v) || (m_value_get_int(v) != i))
+			M_ERROR("get %d error", i);
+	}
+
+	M_INFO("dict test end");
+}
+
+static void
+gc_test (void)
+{
+	M_Object *obj, *dict;
+	M_Value v;
+	size_t level;
+	int i;
+
+	M_INFO("gc test begin");
+
+	level = m_gc_get_nb_level();
+
+	obj  = m_object_new(0);
+	dict = m_object_new(0);
+	m_gc_add_root(obj);
+	m_gc_add_root(dict);
+
+	m_gc_set_nb_level(level);
+
+	for (i = 0; i < 12; i ++) {
+		m_object_set(obj, names[i], m_value_from_double(i + 0.5));
+		m_object_set(dict, names[i], m_value_from_object(m_object_new(0)));
+	}
+	m_object_remove(dict, names[0]);
+
+	m_gc_set_nb_level(level);
+	m_gc_run(0);
+
+	for (i = 0; i < 12; i ++) {
+		if (!m_object_get(obj, names[i], &v) ||
+					(m_value_get_double(v) != i + 0.5))
+			M_ERROR("get %d error", i);
+		if ((i != 0) && (!m_object_get(dict, names[i], &v) ||
+					!m_value_is_object(v)))
+			M_ERROR("get %d error", i);
+	}
+
+	m_gc_remove_root(obj);
+	m_gc_remove_root(dict);
+
+	M_INFO("gc test end");
+}
+
+static void
+shape_gc_test (void)
+{
+	M_Object *base, *obj;
+	M_Shape *shape;
+	uint32_t epoch;
+	size_t level;
+	int i, j;
+
+	M_INFO("shape gc test begin");
+
+	level = m_gc_get_nb_level();
+
+	base = m_object_new(0);
+	m_gc_add_root(base);
+	m_object_set(base, names[100], m_value_from_int(0));
+
+	m_gc_set_nb_level(level);
+
+	shape = base->shape;
+
+	/*The shapes after "shape" are only used by the temporary objects.*/
+	for (i = 0; i < 8; i ++) {
+		obj = m_object_new(0);
+
+		for (j = 0; j < 5; j ++)
+			m_object_set(obj, names[100 + j], m_value_from_int(j));
+	}
+
+	m_gc_set_nb_level(level);
+
+	if (m_hash_size(&shape->trans_hash) != 1)
+		M_ERROR("transition is not added");
+
+	epoch = m_shape_epoch;
+	m_gc_run(0);
+
+	if (m_hash_size(&shape->trans_hash))
+		M_ERROR("temporary shapes are not collected");
+	if (m_shape_epoch == epoch)
+		M_ERROR("shape epoch is not changed");
+
+	/*The collected transition is created again.*/
+	obj = m_object_new(0);
+	for (j = 0; j < 5; j ++)
+		m_object_set(obj, names[100 + j], m_value_from_int(j));
+
+	if ((obj->shape->nprop != 5) || (obj->shape->parent->parent->parent
+				->parent != shape))
+		M_ERROR("shape chain error");
+
+	m_gc_set_nb_level(level);
+	m_gc_remove_root(base);
+
+	M_INFO("shape gc test end");
+}
+
+int
+main (int argc, char **argv)
+{
+	m_startup();
+
+	names_init();
+
+	shape_test();
+	proto_test();
+	dict_test();
+	gc_test();
+	shape_gc_test();
+
+	return 0;
+}
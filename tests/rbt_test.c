@@ -21,6 +21,13 @@
 
 #include <ming.h>
 
+static long
+time_diff (struct timespec *begin, struct timespec *end)
+{
+	return (end->tv_sec - begin->tv_sec) * 1000000 +
+				(end->tv_nsec - begin->tv_nsec) / 1000;
+}
+
 typedef struct {
 	M_RBNode node;
 	int      i;
@@ -39,6 +46,23 @@ cmp:       m_int_cmp_func,
 free_node: m_free
 };
 
+static inline int
+int_node_key (const M_RBNode *node)
+{
+	return m_node_value(node, IntNode, node)->i;
+}
+
+static inline int
+int_cmp (int k1, int k2)
+{
+	return k1 - k2;
+}
+
+M_DEFINE_RBTREE(int_tree, int, int_node_key, int_cmp)
+
+/*Operation functions only known at runtime, like a shared library's.*/
+static const M_RBTreeOps *volatile runtime_ops = &int_ops;
+
 static void
 insert_remove_test (void)
 {
@@ -219,6 +243,276 @@ traverse_test (void)
 	M_INFO("traverse test end");
 }
 
+static void
+typed_test (void)
+{
+#define TYPED_COUNT 65536
+#define TYPED_LOOPS 16
+	M_RBTree tree;
+	M_RBNode *node, *parent, **pos;
+	const M_RBTreeOps *ops;
+	IntNode *ins, *in;
+	struct timespec begin, end;
+	long runtime_us, typed_us;
+	int i, j;
+
+	M_INFO("typed tree test begin");
+
+	ins = M_NEW(IntNode, TYPED_COUNT);
+	m_rbt_init(&tree);
+
+	for (i = 0; i < TYPED_COUNT; i ++) {
+		int k = ((uint32_t)i * 40503) % TYPED_COUNT;
+
+		ins[i].i = k;
+
+		node = int_tree_lookup_insert(&tree, k, &parent, &pos);
+		if (node)
+			M_ERROR("lookup error");
+
+		m_rbt_insert(&tree, parent, pos, &ins[i].node);
+	}
+
+	i = 0;
+	m_rbt_foreach_value(in, &tree, node) {
+		if (in->i != i)
+			M_ERROR("traverse error");
+		i ++;
+	}
+
+	ops = runtime_ops;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (j = 0; j < TYPED_LOOPS; j ++) {
+		for (i = 0; i < TYPED_COUNT; i ++) {
+			node = m_rbt_lookup(&tree, M_SIZE_TO_PTR(i), ops);
+			if (!node || (int_node_key(node) != i))
+				M_ERROR("lookup error");
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	runtime_us = time_diff(&begin, &end);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (j = 0; j < TYPED_LOOPS; j ++) {
+		for (i = 0; i < TYPED_COUNT; i ++) {
+			node = int_tree_lookup(&tree, i);
+			if (!node || (int_node_key(node) != i))
+				M_ERROR("lookup error");
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	typed_us = time_diff(&begin, &end);
+
+	M_INFO("%d lookups: runtime ops %ldus, typed %ldus",
+				TYPED_COUNT * TYPED_LOOPS, runtime_us, typed_us);
+
+	m_free(ins);
+
+	M_INFO("typed tree test end");
+}
+
+/*Check the RB tree properties and return the black height.*/
+static int
+check_rbt_node (M_RBNode *node, M_RBNode *parent)
+{
+	int lh, rh;
+
+	if (!node)
+		return 1;
+
+	if (m_rbt_parent(node) != parent)
+		M_ERROR("parent error");
+	if ((m_rbt_color(node) == M_RB_RED) &&
+				((m_rbt_color(node->left) == M_RB_RED) ||
+				(m_rbt_color(node->right) == M_RB_RED)))
+		M_ERROR("red node has red child");
+	if (node->left && (int_node_key(node->left) >= int_node_key(node)))
+		M_ERROR("order error");
+	if (node->right && (int_node_key(node->right) <= int_node_key(node)))
+		M_ERROR("order error");
+
+	lh = check_rbt_node(node->left, node);
+	rh = check_rbt_node(node->right, node);
+	if (lh != rh)
+		M_ERROR("black height error");
+
+	return lh + (m_rbt_color(node) == M_RB_BLACK);
+}
+
+static int
+check_rbt (M_RBTree *tree, int count)
+{
+	M_RBNode *node;
+	int n = 0;
+
+	if (m_rbt_color(*tree) != M_RB_BLACK)
+		M_ERROR("root is red");
+
+	check_rbt_node(*tree, NULL);
+
+	m_rbt_foreach(node, tree) {
+		n ++;
+	}
+
+	if ((count >= 0) && (n != count))
+		M_ERROR("count error");
+
+	return n;
+}
+
+static void
+bulk_test (void)
+{
+#define BULK_COUNT 1000000
+	M_RBTree tree, tree2;
+	M_RBNode **nodes, *node, *parent, **pos;
+	IntNode *ins;
+	struct timespec begin, end;
+	long insert_us, build_us;
+	int counts[] = {0, 1, 2, 3, 4, 7, 8, 100, 1023, 1024, 1025};
+	int i, j;
+
+	M_INFO("bulk test begin");
+
+	ins   = M_NEW(IntNode, BULK_COUNT);
+	nodes = M_NEW(M_RBNode*, BULK_COUNT);
+
+	for (i = 0; i < BULK_COUNT; i ++) {
+		ins[i].i = i;
+		nodes[i] = &ins[i].node;
+	}
+
+	for (j = 0; j < (int)M_N_ELEMENT(counts); j ++) {
+		m_rbt_init(&tree);
+		m_rbt_build(&tree, nodes, counts[j]);
+		check_rbt(&tree, counts[j]);
+
+		/*The built tree must stay valid under updates.*/
+		for (i = 0; i < counts[j]; i += 2)
+			m_rbt_remove(&tree, &ins[i].node);
+		check_rbt(&tree, counts[j] / 2);
+	}
+
+	/*Build against inserting the sorted nodes one by one.*/
+	m_rbt_init(&tree);
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < BULK_COUNT; i ++) {
+		node = int_tree_lookup_insert(&tree, i, &parent, &pos);
+		m_rbt_insert(&tree, parent, pos, nodes[i]);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	insert_us = time_diff(&begin, &end);
+
+	m_rbt_init(&tree);
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	m_rbt_build(&tree, nodes, BULK_COUNT);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	build_us = time_diff(&begin, &end);
+
+	M_INFO("sorted %d: inserts %ldus, build %ldus", BULK_COUNT, insert_us,
+				build_us);
+
+	check_rbt(&tree, BULK_COUNT);
+
+	/*Split and merge back.*/
+	m_rbt_init(&tree2);
+	m_rbt_split(&tree, M_SIZE_TO_PTR(BULK_COUNT / 3), &int_ops, &tree2);
+	check_rbt(&tree, BULK_COUNT / 3);
+	check_rbt(&tree2, BULK_COUNT - BULK_COUNT / 3);
+	if ((int_node_key(m_rbt_last_node(&tree)) != BULK_COUNT / 3 - 1) ||
+				(int_node_key(m_rbt_first_node(&tree2)) != BULK_COUNT / 3))
+		M_ERROR("split error");
+
+	m_rbt_merge(&tree, &tree2, &int_ops);
+	check_rbt(&tree, BULK_COUNT);
+	if (tree2)
+		M_ERROR("merge error");
+
+	/*Merge interleaved trees, the duplicated keys stay in the source.*/
+	m_rbt_init(&tree2);
+	m_rbt_split(&tree, M_SIZE_TO_PTR(0), &int_ops, &tree2);
+	if (tree)
+		M_ERROR("split error");
+	m_rbt_init(&tree2);
+
+	for (i = 0, j = 0; i < 1000; i ++) {
+		if (i % 2)
+			nodes[j ++] = &ins[i].node;
+	}
+	m_rbt_build(&tree, nodes, j);
+
+	for (i = 0, j = 0; i < 1000; i ++) {
+		if (!(i % 2) || !(i % 3))
+			nodes[j ++] = &ins[i].node;
+	}
+	/*Use copies for the duplicated keys.*/
+	for (i = 0; i < j; i ++) {
+		IntNode *in = m_node_value(nodes[i], IntNode, node);
+
+		if (in->i % 2) {
+			IntNode *dup = &ins[BULK_COUNT - 1 - i];
+
+			dup->i = in->i;
+			nodes[i] = &dup->node;
+		}
+	}
+	m_rbt_build(&tree2, nodes, j);
+
+	m_rbt_merge(&tree, &tree2, &int_ops);
+	check_rbt(&tree, 1000);
+	check_rbt(&tree2, 167);
+
+	m_rbt_foreach(node, &tree2) {
+		if (int_node_key(node) % 2 != 1)
+			M_ERROR("merge error");
+		if (m_rbt_lookup(&tree, M_SIZE_TO_PTR(int_node_key(node)), &int_ops)
+					== node)
+			M_ERROR("merge error");
+	}
+
+	m_free(nodes);
+	m_free(ins);
+
+	M_INFO("bulk test end");
+}
+
+static void
+deinit_test (void)
+{
+	M_RBTree tree;
+	IntNode **ins;
+	M_RBNode *node, *parent, **pos;
+	struct timespec begin, end;
+	int i;
+
+	M_INFO("deinit test begin");
+
+	ins = M_NEW(IntNode*, BULK_COUNT);
+	m_rbt_init(&tree);
+
+	for (i = 0; i < BULK_COUNT; i ++) {
+		int k = ((uint64_t)i * 40503) % BULK_COUNT;
+
+		ins[i] = M_NEW(IntNode, 1);
+		ins[i]->i = k;
+
+		node = int_tree_lookup_insert(&tree, k, &parent, &pos);
+		if (node)
+			M_ERROR("lookup error");
+		m_rbt_insert(&tree, parent, pos, &ins[i]->node);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	m_rbt_deinit(&tree, &int_ops);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	M_INFO("deinit %d nodes: %ldus", BULK_COUNT, time_diff(&begin, &end));
+
+	m_free(ins);
+
+	M_INFO("deinit test end");
+}
+
 int
 main (int argc, char **argv)
 {
@@ -226,6 +520,9 @@ main (int argc, char **argv)
 
 	insert_remove_test();
 	traverse_test();
+	typed_test();
+	bulk_test();
+	deinit_test();
 
 	return 0;
 }
@@ -0,0 +1,388 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "schedtest"
+
+#include "test_module.h"
+
+#define ACTOR_COUNT 10000
+#define MSG_COUNT   16
+#define LOOP_ACTORS 16
+#define LOOP_COUNT  200000
+#define MAX_THREADS 8
+#define MOD         1000003
+#define SENDERS     4
+#define SEND_ACTORS 4
+#define SEND_COUNT  20000
+#define PAUSE_COUNT 16
+#define POLL_COUNT  (100*1024*1024)
+
+/*Const values.*/
+enum {
+	K_MOD,
+	K_COUNT
+};
+
+/*Functions.*/
+enum {
+	F_MAKE,
+	F_ACC,
+	F_LOOP,
+	F_MAKE_SUM,
+	F_SUM,
+	F_COUNT
+};
+
+/*acc = 0; return function (m) {...};*/
+static uint8_t make_bc[] = {
+	/* 0*/ M_OP_LOADI, 0, M_BC_16(0),
+	/* 4*/ M_OP_CLOSURE, 1, M_BC_16(F_ACC),
+	/* 8*/ M_OP_RET, 1
+};
+
+/*acc = (acc * 31 + m) % MOD; return acc;*/
+static uint8_t acc_bc[] = {
+	/* 0*/ M_OP_GETUP, 1, 0, 0,
+	/* 4*/ M_OP_LOADI, 2, M_BC_16(31),
+	/* 8*/ M_OP_MUL, 1, 1, 2,
+	/*12*/ M_OP_ADD, 1, 1, 0,
+	/*16*/ M_OP_LOADK, 2, M_BC_16(K_MOD),
+	/*20*/ M_OP_MOD, 1, 1, 2,
+	/*24*/ M_OP_SETUP, 0, 0, 1,
+	/*28*/ M_OP_RET, 1
+};
+
+/*sum = 0; for (i = 0; i < n; i ++) sum += i % 7; return sum;*/
+static uint8_t loop_bc[] = {
+	/* 0*/ M_OP_LOADI, 1, M_BC_16(0),
+	/* 4*/ M_OP_LOADI, 2, M_BC_16(0),
+	/* 8*/ M_OP_LOADI, 5, M_BC_16(7),
+	/*12*/ M_OP_LT, 3, 2, 0,
+	/*16*/ M_OP_JMPF, 3, M_BC_16(19),
+	/*20*/ M_OP_MOD, 4, 2, 5,
+	/*24*/ M_OP_ADD, 1, 1, 4,
+	/*28*/ M_OP_ADDI, 2, 2, 1,
+	/*32*/ M_OP_JMP, M_BC_16(-20),
+	/*35*/ M_OP_RET, 1
+};
+
+/*sum = 0; return function (m) {sum = sum + m; return sum;};*/
+static uint8_t make_sum_bc[] = {
+	/* 0*/ M_OP_LOADI, 0, M_BC_16(0),
+	/* 4*/ M_OP_CLOSURE, 1, M_BC_16(F_SUM),
+	/* 8*/ M_OP_RET, 1
+};
+
+static uint8_t sum_bc[] = {
+	/* 0*/ M_OP_GETUP, 1, 0, 0,
+	/* 4*/ M_OP_ADD, 1, 1, 0,
+	/* 8*/ M_OP_SETUP, 0, 0, 1,
+	/*12*/ M_OP_RET, 1
+};
+
+static M_Value     consts[K_COUNT];
+static M_Function  funcs[F_COUNT];
+static M_Function *func_ptrs[F_COUNT];
+static M_Actor    *actors[ACTOR_COUNT];
+static M_Actor    *loop_actors[LOOP_ACTORS];
+static M_Actor    *send_actors[SEND_ACTORS];
+
+static const TestFunc func_defs[F_COUNT] = {
+	[F_MAKE]     = TEST_FUNC(make_bc, 0, 2),
+	[F_ACC]      = TEST_FUNC(acc_bc, 1, 3),
+	[F_LOOP]     = TEST_FUNC(loop_bc, 1, 6),
+	[F_MAKE_SUM] = TEST_FUNC(make_sum_bc, 0, 2),
+	[F_SUM]      = TEST_FUNC(sum_bc, 1, 2)
+};
+
+static void
+module_init (void)
+{
+	consts[K_MOD] = m_value_from_int(MOD);
+
+	test_module_init(consts, K_COUNT, funcs, func_ptrs, func_defs, F_COUNT);
+}
+
+static long
+time_diff (struct timespec *begin, struct timespec *end)
+{
+	return (end->tv_sec - begin->tv_sec) * 1000000 +
+				(end->tv_nsec - begin->tv_nsec) / 1000;
+}
+
+/*Create an accumulator behaviour closure.*/
+static M_Value
+make_acc (M_Actor *helper, int id)
+{
+	M_Value fv;
+
+	fv = m_value_from_closure(m_closure_new(&funcs[id], NULL, NULL));
+
+	if ((m_actor_call(helper, fv, 0, NULL) != M_OK) ||
+				(m_interp_run(helper, 0xFFFFFFFF) != M_OK))
+		M_ERROR("make accumulator failed");
+
+	return helper->retv;
+}
+
+static void
+sched_test (const char *name, M_Bool gc)
+{
+	M_Actor *helper;
+	M_Value lv;
+	struct timespec begin, end;
+	int64_t expect, sum;
+	long us;
+	int i, m;
+
+	M_INFO("%s test begin", name);
+
+	/*Spawn the actors.*/
+	helper = m_actor_new();
+
+	for (i = 0; i < ACTOR_COUNT; i ++)
+		actors[i] = m_actor_spawn(make_acc(helper, F_MAKE));
+
+	m_actor_free(helper);
+
+	lv = m_value_from_closure(m_closure_new(&funcs[F_LOOP], NULL, NULL));
+	for (i = 0; i < LOOP_ACTORS; i ++)
+		loop_actors[i] = m_actor_spawn(lv);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	/*The long loops are preempted by the short messages.*/
+	for (i = 0; i < LOOP_ACTORS; i ++)
+		m_actor_send(loop_actors[i], m_value_from_int(LOOP_COUNT));
+
+	for (m = 1; m <= MSG_COUNT; m ++) {
+		for (i = 0; i < ACTOR_COUNT; i ++)
+			m_actor_send(actors[i], m_value_from_int(m));
+
+		/*Collect while the workers are running.*/
+		if (gc)
+			m_gc_run(0);
+	}
+
+	m_sched_run();
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	us = M_MAX(time_diff(&begin, &end), 1);
+
+	/*Check the results.*/
+	for (expect = 0, m = 1; m <= MSG_COUNT; m ++)
+		expect = (expect * 31 + m) % MOD;
+
+	for (i = 0; i < ACTOR_COUNT; i ++) {
+		if (actors[i]->mbox.sched || !m_slist_empty(&actors[i]->mbox.batch) ||
+					!m_mpsc_empty(&actors[i]->mbox.queue) ||
+					(m_value_get_int(actors[i]->retv) != expect)) {
+			M_ERROR("actor %d result error", i);
+			break;
+		}
+	}
+
+	for (sum = 0, i = 0; i < LOOP_COUNT; i ++)
+		sum += i % 7;
+
+	for (i = 0; i < LOOP_ACTORS; i ++) {
+		if (m_value_get_int(loop_actors[i]->retv) != sum)
+			M_ERROR("loop actor %d result error", i);
+	}
+
+	M_INFO("%s: %d messages in %ldus, %.2fM msg/s", name,
+				ACTOR_COUNT * MSG_COUNT + LOOP_ACTORS, us,
+				(double)(ACTOR_COUNT * MSG_COUNT + LOOP_ACTORS) / us);
+
+	for (i = 0; i < ACTOR_COUNT; i ++)
+		m_actor_free(actors[i]);
+	for (i = 0; i < LOOP_ACTORS; i ++)
+		m_actor_free(loop_actors[i]);
+
+	M_INFO("%s test end", name);
+}
+
+/*Sender thread out of the ming environment.*/
+static void*
+sender_entry (void *arg)
+{
+	int i, j;
+
+	for (i = 1; i <= SEND_COUNT; i ++) {
+		for (j = 0; j < SEND_ACTORS; j ++)
+			m_actor_send(send_actors[j], m_value_from_int(i));
+	}
+
+	return NULL;
+}
+
+static void
+mpsc_test (void)
+{
+	M_Actor *helper;
+	pthread_t senders[SENDERS];
+	struct timespec begin, end;
+	int64_t sum;
+	long us;
+	int i;
+
+	M_INFO("mpsc test begin");
+
+	helper = m_actor_new();
+
+	for (i = 0; i < SEND_ACTORS; i ++)
+		send_actors[i] = m_actor_spawn(make_acc(helper, F_MAKE_SUM));
+
+	m_actor_free(helper);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	for (i = 0; i < SENDERS; i ++)
+		pthread_create(&senders[i], NULL, sender_entry, NULL);
+
+	/*Run the actors while the messages are being sent.*/
+	m_sched_run();
+
+	for (i = 0; i < SENDERS; i ++)
+		pthread_join(senders[i], NULL);
+
+	m_sched_run();
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	us = M_MAX(time_diff(&begin, &end), 1);
+
+	sum = (int64_t)SENDERS * SEND_COUNT * (SEND_COUNT + 1) / 2;
+
+	for (i = 0; i < SEND_ACTORS; i ++) {
+		if (send_actors[i]->mbox.sched ||
+					(m_value_get_int(send_actors[i]->retv) != sum))
+			M_ERROR("actor %d received messages error", i);
+
+		m_actor_free(send_actors[i]);
+	}
+
+	M_INFO("mpsc: %d messages in %ldus, %.2fM msg/s",
+				SENDERS * SEND_ACTORS * SEND_COUNT, us,
+				(double)SENDERS * SEND_ACTORS * SEND_COUNT / us);
+
+	M_INFO("mpsc test end");
+}
+
+/*Pause the workers running the long loops.*/
+static void
+safepoint_test (void)
+{
+	M_Value lv;
+	struct timespec begin, end;
+	long us, max_us = 0, total_us = 0;
+	int64_t sum;
+	int i;
+
+	M_INFO("safepoint test begin");
+
+	lv = m_value_from_closure(m_closure_new(&funcs[F_LOOP], NULL, NULL));
+	for (i = 0; i < LOOP_ACTORS; i ++) {
+		loop_actors[i] = m_actor_spawn(lv);
+		m_actor_send(loop_actors[i], m_value_from_int(LOOP_COUNT * 10));
+	}
+
+	for (i = 0; i < PAUSE_COUNT; i ++) {
+		usleep(1000);
+
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		m_gc_run(0);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		us = time_diff(&begin, &end);
+		max_us = M_MAX(max_us, us);
+		total_us += us;
+	}
+
+	m_sched_run();
+
+	for (sum = 0, i = 0; i < LOOP_COUNT * 10; i ++)
+		sum += i % 7;
+
+	for (i = 0; i < LOOP_ACTORS; i ++) {
+		if (m_value_get_int(loop_actors[i]->retv) != sum)
+			M_ERROR("loop actor %d result error", i);
+
+		m_actor_free(loop_actors[i]);
+	}
+
+	M_INFO("safepoint: %d pauses, average %ldus, max %ldus", PAUSE_COUNT,
+				total_us / PAUSE_COUNT, max_us);
+
+	M_INFO("safepoint test end");
+}
+
+/*Safe point cost when no pause is requested: the page load against the
+ *flag test it replaced.*/
+static void
+poll_bench (void)
+{
+	struct timespec begin, end;
+	long poll_us, check_us;
+	int i;
+
+	M_INFO("poll bench begin");
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < POLL_COUNT; i ++)
+		m_thread_poll();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	poll_us = M_MAX(time_diff(&begin, &end), 1);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < POLL_COUNT; i ++)
+		m_thread_check();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	check_us = M_MAX(time_diff(&begin, &end), 1);
+
+	M_INFO("poll: %.2fns, flag check: %.2fns",
+				poll_us * 1000.0 / POLL_COUNT, check_us * 1000.0 / POLL_COUNT);
+
+	M_INFO("poll bench end");
+}
+
+int
+main (int argc, char **argv)
+{
+	int i, n;
+
+	m_startup();
+
+	module_init();
+
+	/*Only the main thread runs the actors.*/
+	sched_test("single thread", M_FALSE);
+
+	n = M_MIN(M_MAX(sysconf(_SC_NPROCESSORS_ONLN), 2), MAX_THREADS);
+	for (i = 0; i < n; i ++)
+		m_thread_create();
+
+	sched_test("workers", M_TRUE);
+	mpsc_test();
+	safepoint_test();
+	poll_bench();
+
+	test_module_deinit();
+
+	return 0;
+}
@@ -0,0 +1,384 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "sharetest"
+
+#include "test_module.h"
+
+#define NAME_COUNT  8
+#define BENCH_LEN   100
+#define BENCH_COUNT 1000
+
+/*Functions.*/
+enum {
+	F_MAKE,
+	F_ADD,
+	F_ECHO,
+	F_COUNT
+};
+
+/*n = 0; return function (m) {n = n + m; return n;};*/
+static uint8_t make_bc[] = {
+	/* 0*/ M_OP_LOADI, 0, M_BC_16(0),
+	/* 4*/ M_OP_CLOSURE, 1, M_BC_16(F_ADD),
+	/* 8*/ M_OP_RET, 1
+};
+
+static uint8_t add_bc[] = {
+	/* 0*/ M_OP_GETUP, 1, 0, 0,
+	/* 4*/ M_OP_ADD, 1, 1, 0,
+	/* 8*/ M_OP_SETUP, 0, 0, 1,
+	/*12*/ M_OP_RET, 1
+};
+
+/*return m;*/
+static uint8_t echo_bc[] = {
+	/* 0*/ M_OP_RET, 0
+};
+
+static M_Function  funcs[F_COUNT];
+static M_Function *func_ptrs[F_COUNT];
+static M_Quark     names[NAME_COUNT];
+
+static const TestFunc func_defs[F_COUNT] = {
+	[F_MAKE] = TEST_FUNC(make_bc, 0, 2),
+	[F_ADD]  = TEST_FUNC(add_bc, 1, 2),
+	[F_ECHO] = TEST_FUNC(echo_bc, 1, 1)
+};
+
+static void
+module_init (void)
+{
+	char buf[32];
+	int i;
+
+	test_module_init(NULL, 0, funcs, func_ptrs, func_defs, F_COUNT);
+
+	for (i = 0; i < NAME_COUNT; i ++) {
+		snprintf(buf, sizeof(buf), "p%d", i);
+		names[i] = m_string_from_cstr(buf);
+	}
+}
+
+static long
+time_diff (struct timespec *begin, struct timespec *end)
+{
+	return (end->tv_sec - begin->tv_sec) * 1000000 +
+				(end->tv_nsec - begin->tv_nsec) / 1000;
+}
+
+/*Create a closure with a boxed variable.*/
+static M_Value
+make_adder (M_Actor *actor)
+{
+	M_Value fv;
+
+	fv = m_value_from_closure(m_closure_new(&funcs[F_MAKE], NULL, NULL));
+
+	if ((m_actor_call(actor, fv, 0, NULL) != M_OK) ||
+				(m_interp_run(actor, 0xFFFFFFFF) != M_OK))
+		M_ERROR("make adder failed");
+
+	return actor->retv;
+}
+
+/*Call the adder closure.*/
+static int
+call_adder (M_Actor *actor, M_Value fv, int n)
+{
+	M_Value arg = m_value_from_int(n);
+
+	if ((m_actor_call(actor, fv, 1, &arg) != M_OK) ||
+				(m_interp_run(actor, 0xFFFFFFFF) != M_OK))
+		M_ERROR("call adder failed");
+
+	return m_value_get_int(actor->retv);
+}
+
+/*o = {p0: [0, 1.5, rope, o], p1: {p0: 1}}, o.p1 is frozen.*/
+static M_Value
+make_graph (void)
+{
+	M_Object *o, *child;
+	M_Array *arr;
+	M_String *rope;
+	M_Value ov;
+
+	o   = m_object_new(0);
+	ov  = m_value_from_object(o);
+	arr = m_array_new(0);
+
+	rope = m_string_concat(m_string_from_cstr("a rope string is flattened "),
+				m_string_from_cstr("when it is frozen"));
+
+	m_array_push_number(arr, 0);
+	m_array_push_number(arr, 1.5);
+	m_array_push(arr, m_value_from_string(rope));
+	m_array_push(arr, ov);
+
+	child = m_object_new(0);
+	m_object_set(child, names[0], m_value_from_int(1));
+
+	m_object_set(o, names[0], m_value_from_array(arr));
+	m_object_set(o, names[1], m_value_from_object(child));
+
+	if (m_value_freeze(m_value_from_object(child)) != M_OK)
+		M_ERROR("freeze child failed");
+
+	return ov;
+}
+
+static void
+freeze_test (void)
+{
+	M_Value ov, av, sv, cv;
+	M_Object *o;
+	M_Array *arr;
+
+	M_INFO("freeze test begin");
+
+	ov = make_graph();
+	o  = m_value_get_object(ov);
+
+	m_object_get(o, names[0], &av);
+	arr = m_value_get_array(av);
+	m_array_get(arr, 2, &sv);
+
+	if (m_value_is_frozen(ov) || m_value_is_frozen(av) ||
+				m_value_is_frozen(sv))
+		M_ERROR("mutable value is frozen");
+
+	if (m_value_freeze(ov) != M_OK)
+		M_ERROR("freeze failed");
+
+	if (!m_value_is_frozen(ov) || !m_value_is_frozen(av) ||
+				!m_value_is_frozen(sv))
+		M_ERROR("value is not frozen");
+	if (m_string_type(m_value_get_string(sv)) == M_STRING_TYPE_ROPE)
+		M_ERROR("rope is not flattened");
+
+	/*The frozen values cannot be modified.*/
+	if (m_object_set(o, names[2], m_value_from_int(1)) == M_OK)
+		M_ERROR("set property of frozen object");
+	if (m_object_set(o, names[0], m_value_from_int(1)) == M_OK)
+		M_ERROR("modify property of frozen object");
+	if (m_array_set(arr, 0, m_value_from_int(1)) == M_OK)
+		M_ERROR("set element of frozen array");
+	if (m_array_push_number(arr, 1) == M_OK)
+		M_ERROR("push to frozen array");
+	if (m_array_set_length(arr, 0) == M_OK)
+		M_ERROR("set length of frozen array");
+
+	m_object_get(o, names[1], &cv);
+	if (m_object_set(m_value_get_object(cv), names[0], m_value_from_int(2))
+				== M_OK)
+		M_ERROR("set property of frozen child");
+
+	/*Freezing again does nothing.*/
+	if (m_value_freeze(ov) != M_OK)
+		M_ERROR("freeze again failed");
+	if (m_value_freeze(m_value_from_int(1)) != M_OK)
+		M_ERROR("freeze number failed");
+
+	M_INFO("freeze test end");
+}
+
+static void
+share_test (void)
+{
+	M_Value ov, cv, av, cav, v, sv, child, cchild;
+	M_Object *o, *c;
+	M_Array *ca;
+	double d;
+
+	M_INFO("share test begin");
+
+	ov = make_graph();
+	o  = m_value_get_object(ov);
+
+	cv = m_value_share(ov);
+	if (cv == ov)
+		M_ERROR("mutable value is not copied");
+
+	c = m_value_get_object(cv);
+	if (c == o)
+		M_ERROR("object is not copied");
+
+	/*The copy has the same structure.*/
+	if (!m_object_get(c, names[0], &cav) || !m_value_is_array(cav))
+		M_ERROR("copied property error");
+
+	m_object_get(o, names[0], &av);
+	ca = m_value_get_array(cav);
+	if ((ca == m_value_get_array(av)) || (ca->len != 4))
+		M_ERROR("array is not copied");
+
+	if (!m_array_get_number(ca, 0, &d) || (d != 0))
+		M_ERROR("copied element 0 error");
+	if (!m_array_get_number(ca, 1, &d) || (d != 1.5))
+		M_ERROR("copied element 1 error");
+	m_array_get(m_value_get_array(av), 2, &sv);
+	if (!m_array_get(ca, 2, &v) || !m_value_is_string(v) ||
+				!m_string_equal(m_value_get_string(v),
+				m_value_get_string(sv)))
+		M_ERROR("copied element 2 error");
+
+	/*The cycle is kept in the copy.*/
+	if (!m_array_get(ca, 3, &v) || (m_value_get_object(v) != c))
+		M_ERROR("copied cycle error");
+
+	/*The frozen child is shared.*/
+	m_object_get(o, names[1], &child);
+	m_object_get(c, names[1], &cchild);
+	if (m_value_get_object(child) != m_value_get_object(cchild))
+		M_ERROR("frozen child is copied");
+
+	/*The copy is mutable and independent.*/
+	if (m_object_set(c, names[2], m_value_from_int(2)) != M_OK)
+		M_ERROR("set property of copy failed");
+	if (m_object_get(o, names[2], &v))
+		M_ERROR("copy changes the origin");
+
+	/*A frozen value is shared directly.*/
+	m_value_freeze(ov);
+	if (m_value_share(ov) != ov)
+		M_ERROR("frozen value is copied");
+
+	M_INFO("share test end");
+}
+
+static void
+closure_test (void)
+{
+	M_Actor *actor;
+	M_Value fv, cv, ov;
+	M_Object *o;
+
+	M_INFO("closure test begin");
+
+	actor = m_actor_new();
+
+	fv = make_adder(actor);
+	call_adder(actor, fv, 10);
+
+	/*The closure with boxed variables cannot be frozen.*/
+	o  = m_object_new(0);
+	ov = m_value_from_object(o);
+	m_object_set(o, names[0], m_value_from_int(1));
+	m_object_set(o, names[1], fv);
+
+	if (m_value_freeze(ov) == M_OK)
+		M_ERROR("freeze closure with boxes");
+	if (m_value_is_frozen(ov) || (m_object_set(o, names[2], fv) != M_OK))
+		M_ERROR("freeze is not rolled back");
+
+	/*The copy takes a snapshot of the box.*/
+	cv = m_value_share(fv);
+	if (m_value_get_closure(cv) == m_value_get_closure(fv))
+		M_ERROR("closure is not copied");
+
+	if (call_adder(actor, cv, 1) != 11)
+		M_ERROR("copied box value error");
+	if (call_adder(actor, fv, 5) != 15)
+		M_ERROR("copied box changes the origin");
+	if (call_adder(actor, cv, 1) != 12)
+		M_ERROR("copied box is not independent");
+
+	m_actor_free(actor);
+
+	M_INFO("closure test end");
+}
+
+/*Send the array to an echo actor and get it back.*/
+static M_Value
+echo (M_Actor *actor, M_Value v)
+{
+	m_actor_send(actor, v);
+	m_sched_run();
+
+	return actor->retv;
+}
+
+static void
+send_test (void)
+{
+	M_Actor *actor;
+	M_Array *arr;
+	M_Value av, rv, ev;
+	struct timespec begin, end;
+	long copy_us, frozen_us;
+	int i;
+
+	M_INFO("send test begin");
+
+	ev    = m_value_from_closure(m_closure_new(&funcs[F_ECHO], NULL, NULL));
+	actor = m_actor_spawn(ev);
+
+	arr = m_array_new(BENCH_LEN);
+	av  = m_value_from_array(arr);
+	for (i = 0; i < BENCH_LEN; i ++)
+		m_array_push(arr, m_value_from_object(m_object_new(0)));
+
+	rv = echo(actor, av);
+	if (!m_value_is_array(rv) || (m_value_get_array(rv) == arr) ||
+				(m_value_get_array(rv)->len != BENCH_LEN))
+		M_ERROR("mutable message is not copied");
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < BENCH_COUNT; i ++)
+		echo(actor, av);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	copy_us = M_MAX(time_diff(&begin, &end), 1);
+
+	m_value_freeze(av);
+
+	rv = echo(actor, av);
+	if (rv != av)
+		M_ERROR("frozen message is copied");
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < BENCH_COUNT; i ++)
+		echo(actor, av);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	frozen_us = M_MAX(time_diff(&begin, &end), 1);
+
+	M_INFO("%d messages of %d objects: copy %ldus, frozen %ldus",
+				BENCH_COUNT, BENCH_LEN, copy_us, frozen_us);
+
+	m_actor_free(actor);
+
+	M_INFO("send test end");
+}
+
+int
+main (int argc, char **argv)
+{
+	m_startup();
+
+	module_init();
+
+	freeze_test();
+	share_test();
+	closure_test();
+	send_test();
+
+	test_module_deinit();
+
+	return 0;
+}
@@ -0,0 +1,368 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+#define M_LOG_TAG "strtest"
+
+#include <ming.h>
+
+static void
+concat_test (void)
+{
+#define CONCAT_COUNT (256*1024)
+	M_String *str, *piece;
+	size_t level;
+	struct timespec begin, end;
+	int i, count = CONCAT_COUNT;
+
+	M_INFO("concat test begin");
+
+	level = m_gc_get_nb_level();
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	str = m_string_from_cstr("");
+	for (i = 0; i < count; i ++) {
+		char buf[2] = {'a' + (i % 26), 0};
+
+		piece = m_string_from_cstr(buf);
+		str   = m_string_concat(str, piece);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	M_INFO("concat %d pieces in %ldus", count,
+				(end.tv_sec - begin.tv_sec) * 1000000 +
+				(end.tv_nsec - begin.tv_nsec) / 1000);
+
+	if (m_string_length(str) != count)
+		M_ERROR("length error");
+
+	if (m_string_type(str) != M_STRING_TYPE_ROPE)
+		M_ERROR("type error");
+
+	if (str->depth > M_STRING_ROPE_MAX_DEPTH)
+		M_ERROR("rope depth %u is too big", str->depth);
+
+	/*Collect with the rope alive.*/
+	m_gc_run(0);
+
+	for (i = 0; i < count; i ++) {
+		if (m_string_char_at(str, i) != 'a' + (i % 26))
+			M_ERROR("character error");
+	}
+
+	if (m_string_type(str) != M_STRING_TYPE_FLAT)
+		M_ERROR("flatten error");
+
+	m_gc_set_nb_level(level);
+	m_gc_run(0);
+
+	M_INFO("concat test end");
+}
+
+static void
+prepend_test (void)
+{
+#define PREPEND_COUNT (64*1024)
+	M_String *str, *piece;
+	size_t level;
+	int i;
+
+	M_INFO("prepend test begin");
+
+	level = m_gc_get_nb_level();
+
+	str = m_string_from_cstr("");
+	for (i = 0; i < PREPEND_COUNT; i ++) {
+		char buf[2] = {'a' + (i % 26), 0};
+
+		piece = m_string_from_cstr(buf);
+		str   = m_string_concat(piece, str);
+	}
+
+	if (str->depth > M_STRING_ROPE_MAX_DEPTH)
+		M_ERROR("rope depth %u is too big", str->depth);
+
+	for (i = 0; i < PREPEND_COUNT; i ++) {
+		if (m_string_char_at(str, PREPEND_COUNT - 1 - i) != 'a' + (i % 26))
+			M_ERROR("character error");
+	}
+
+	m_gc_set_nb_level(level);
+	m_gc_run(0);
+
+	M_INFO("prepend test end");
+}
+
+#define FLATTEN_ROPES   64
+#define FLATTEN_PIECES  256
+#define FLATTEN_THREADS 4
+
+static M_String *flatten_ropes[FLATTEN_ROPES];
+
+static void*
+flatten_entry (void *arg)
+{
+	int r, i;
+
+	m_thread_enter();
+
+	for (r = 0; r < FLATTEN_ROPES; r ++) {
+		M_String *str = flatten_ropes[r];
+		M_UChar buf[FLATTEN_PIECES * 4];
+
+		/*Walk the rope while other threads flatten it.*/
+		m_string_get_uchars(str, buf);
+
+		for (i = 0; i < FLATTEN_PIECES * 4; i ++) {
+			if ((buf[i] != 'a' + (i / 4 + r) % 26)
+						|| (m_string_char_at(str, i) != buf[i])) {
+				M_ERROR("concurrent flatten error");
+				break;
+			}
+		}
+	}
+
+	m_thread_leave();
+
+	return NULL;
+}
+
+static void
+flatten_test (void)
+{
+	pthread_t th[FLATTEN_THREADS];
+	size_t level;
+	int r, i;
+
+	M_INFO("flatten test begin");
+
+	level = m_gc_get_nb_level();
+
+	for (r = 0; r < FLATTEN_ROPES; r ++) {
+		M_String *str = m_string_from_cstr("");
+
+		for (i = 0; i < FLATTEN_PIECES; i ++) {
+			char ch = 'a' + (i + r) % 26;
+			char buf[5] = {ch, ch, ch, ch, 0};
+
+			str = m_string_concat(str, m_string_from_cstr(buf));
+		}
+
+		flatten_ropes[r] = str;
+	}
+
+	for (i = 0; i < FLATTEN_THREADS; i ++)
+		pthread_create(&th[i], NULL, flatten_entry, NULL);
+
+	for (i = 0; i < FLATTEN_THREADS; i ++) {
+		m_thread_leave();
+
+		pthread_join(th[i], NULL);
+
+		m_thread_enter();
+	}
+
+	m_gc_set_nb_level(level);
+	m_gc_run(0);
+
+	M_INFO("flatten test end");
+}
+
+static void
+slice_test (void)
+{
+	M_String *str, *s1, *s2, *s3, *r;
+	M_UChar buf[64];
+	size_t level;
+	int i;
+
+	M_INFO("slice test begin");
+
+	level = m_gc_get_nb_level();
+
+	str = m_string_from_cstr("0123456789abcdefghijklmnopqrstuvwxyz");
+
+	s1 = m_string_slice(str, 10, 26);
+	if (m_string_type(s1) != M_STRING_TYPE_SLICE)
+		M_ERROR("slice type error");
+
+	s2 = m_string_slice(s1, 2, 20);
+	if ((m_string_type(s2) != M_STRING_TYPE_SLICE) || (s2->parent != str))
+		M_ERROR("slice of slice error");
+
+	for (i = 0; i < 20; i ++) {
+		if (m_string_char_at(s2, i) != 'c' + i)
+			M_ERROR("slice character error");
+	}
+
+	s3 = m_string_slice(s2, 0, 3);
+	if ((m_string_type(s3) != M_STRING_TYPE_FLAT) || (m_string_char_at(s3, 2) != 'e'))
+		M_ERROR("short slice error");
+
+	/*Slice of a rope.*/
+	r  = m_string_concat(str, str);
+	s1 = m_string_slice(r, 30, 20);
+	if (m_string_type(r) != M_STRING_TYPE_FLAT)
+		M_ERROR("rope is not flattened");
+
+	m_string_get_uchars(s1, buf);
+	if ((buf[0] != 'u') || (buf[6] != '0') || (buf[19] != 'd'))
+		M_ERROR("rope slice error");
+
+	m_gc_run(0);
+
+	if (m_string_char_at(s1, 19) != 'd')
+		M_ERROR("slice error after gc");
+
+	m_gc_set_nb_level(level);
+
+	M_INFO("slice test end");
+}
+
+static void
+compare_test (void)
+{
+	M_String *s1, *s2, *r1, *r2, *sl;
+	size_t level;
+
+	M_INFO("compare test begin");
+
+	level = m_gc_get_nb_level();
+
+	s1 = m_string_from_cstr("hello, world! hello, world! hello, world!");
+	r1 = m_string_concat(m_string_from_cstr("hello, world! hello, "),
+				m_string_from_cstr("world! hello, world!"));
+	sl = m_string_slice(m_string_concat(m_string_from_cstr("++"), s1), 2,
+				m_string_length(s1));
+
+	if (!m_string_equal(s1, r1) || !m_string_equal(s1, sl))
+		M_ERROR("equal error");
+
+	if ((m_string_hash(s1) != m_string_hash(r1)) ||
+				(m_string_hash(s1) != m_string_hash(sl)))
+		M_ERROR("hash error");
+
+	s2 = m_string_from_cstr("hello, world? hello, world! hello, world!");
+	r2 = m_string_concat(r1, m_string_from_cstr("!"));
+
+	if (m_string_equal(s1, s2) || m_string_equal(s1, r2))
+		M_ERROR("not equal error");
+
+	if ((m_string_cmp(s1, s2) >= 0) || (m_string_cmp(s2, s1) <= 0) ||
+				(m_string_cmp(s1, r2) >= 0) || m_string_cmp(s1, sl))
+		M_ERROR("compare error");
+
+	m_gc_set_nb_level(level);
+
+	M_INFO("compare test end");
+}
+
+static void
+latin1_test (void)
+{
+#define WIDE_LEN 1000
+	M_String *l1, *w1, *w2, *sl, *r, *f;
+	M_UChar chars[WIDE_LEN], buf[WIDE_LEN * 2];
+	size_t level;
+	int i;
+
+	M_INFO("latin1 test begin");
+
+	level = m_gc_get_nb_level();
+
+	for (i = 0; i < WIDE_LEN; i ++)
+		chars[i] = 0x20 + (i % 0xD0);
+
+	l1 = m_string_from_uchars(chars, WIDE_LEN);
+	if (!m_string_is_latin1(l1))
+		M_ERROR("latin1 detect error");
+
+	/*A wide character at the end must be found by the SIMD kernel.*/
+	chars[WIDE_LEN - 1] = 0x4E2D;
+	w1 = m_string_from_uchars(chars, WIDE_LEN);
+	chars[WIDE_LEN - 1] = 0x20 + ((WIDE_LEN - 1) % 0xD0);
+
+	chars[37] = 0x100;
+	w2 = m_string_from_uchars(chars, WIDE_LEN);
+	chars[37] = 0x20 + 37;
+
+	if (m_string_is_latin1(w1) || m_string_is_latin1(w2))
+		M_ERROR("wide detect error");
+
+	for (i = 0; i < WIDE_LEN - 1; i ++) {
+		if (m_string_char_at(l1, i) != chars[i])
+			M_ERROR("latin1 character error");
+		if (m_string_char_at(w1, i) != chars[i])
+			M_ERROR("wide character error");
+	}
+
+	/*Compare across storages.*/
+	sl = m_string_slice(w1, 0, WIDE_LEN - 1);
+	f  = m_string_slice(l1, 0, WIDE_LEN - 1);
+	if (!m_string_equal(sl, f) || m_string_cmp(sl, f) ||
+				(m_string_hash(sl) != m_string_hash(f)))
+		M_ERROR("cross storage equal error");
+
+	if ((m_string_cmp(l1, w1) >= 0) || (m_string_cmp(w1, l1) <= 0) ||
+				(m_string_cmp(w2, l1) <= 0) || (m_string_cmp(l1, w2) >= 0) ||
+				m_string_equal(l1, w2))
+		M_ERROR("cross storage compare error");
+
+	/*Rope of Latin-1 strings stays Latin-1, mixed rope is widened.*/
+	r = m_string_concat(l1, l1);
+	if (!m_string_is_latin1(r))
+		M_ERROR("latin1 rope error");
+	m_string_flatten(r);
+	if (!m_string_is_latin1(r) || (m_string_char_at(r, WIDE_LEN + 5) != chars[5]))
+		M_ERROR("latin1 flatten error");
+
+	r = m_string_concat(l1, w1);
+	if (m_string_is_latin1(r))
+		M_ERROR("mixed rope error");
+
+	m_string_get_uchars(r, buf);
+	for (i = 0; i < WIDE_LEN * 2 - 1; i ++) {
+		if (buf[i] != chars[i % WIDE_LEN])
+			M_ERROR("widen error");
+	}
+
+	if ((buf[WIDE_LEN * 2 - 1] != 0x4E2D) ||
+				(m_string_char_at(r, WIDE_LEN * 2 - 1) != 0x4E2D))
+		M_ERROR("mixed flatten error");
+
+	m_gc_set_nb_level(level);
+
+	M_INFO("latin1 test end");
+}
+
+int
+main (int argc, char **argv)
+{
+	m_startup();
+
+	concat_test();
+	prepend_test();
+	flatten_test();
+	slice_test();
+	compare_test();
+	latin1_test();
+
+	return 0;
+}
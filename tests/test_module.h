@@ -0,0 +1,138 @@
+/******************************************************************************
+ * Ming: a free scripting language running platform                           *
+ *----------------------------------------------------------------------------*
+ * Copyright (C) 2016  L+#= +0=1 <gkmail@sina.com>                            *
+ *                                                                            *
+ * This program is free software: you can redistribute it and/or modify       *
+ * it under the terms of the GNU General Public License as published by       *
+ * the Free Software Foundation, either version 3 of the License, or          *
+ * (at your option) any later version.                                        *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.      *
+ *****************************************************************************/
+
+/*
+ * Byte code module built by the tests.
+ * The functions are defined by an array of TestFunc indexed by the
+ * function ID.
+ */
+
+#ifndef _TEST_MODULE_H_
+#define _TEST_MODULE_H_
+
+#include <ming.h>
+
+/*Test function definition.*/
+typedef struct {
+	uint8_t  *bc;   /*Byte code.*/
+	uint16_t  len;  /*Byte code length.*/
+	uint8_t   narg; /*Number of arguments.*/
+	uint8_t   nreg; /*Number of registers.*/
+	uint16_t  nic;  /*Number of inline caches.*/
+} TestFunc;
+
+/*Define a function without inline caches.*/
+#define TEST_FUNC(bc, narg, nreg) {bc, sizeof(bc), narg, nreg, 0}
+
+/*Define a function accessing properties.*/
+#define TEST_FUNC_IC(bc, narg, nreg, nic) {bc, sizeof(bc), narg, nreg, nic}
+
+/*The test module.*/
+static M_Module test_module;
+
+/*Initialize the test module and convert its closures.*/
+static inline void
+test_module_init (M_Value *cv, int nconst, M_Function *funcs,
+			M_Function **func_ptrs, const TestFunc *defs, int nfunc)
+{
+	M_Function *func;
+	int i, j;
+
+	test_module.cv     = cv;
+	test_module.nconst = nconst;
+	test_module.funcs  = func_ptrs;
+	test_module.nfunc  = nfunc;
+	test_module.globv  = 0;
+
+	for (i = 0; i < nfunc; i ++) {
+		func = &funcs[i];
+
+		func->module = &test_module;
+		func->flags  = 0;
+
+		m_hash_init(&func->f.bc.var_hash);
+		func->f.bc.narg   = defs[i].narg;
+		func->f.bc.nreg   = defs[i].nreg;
+		func->f.bc.bc_len = defs[i].len;
+		func->f.bc.bc     = defs[i].bc;
+		func->f.bc.nic    = defs[i].nic;
+		func->f.bc.ics    = NULL;
+
+		if (defs[i].nic) {
+			func->f.bc.ics = m_malloc(sizeof(M_InlineCache) * defs[i].nic);
+			m_assert_alloc(func->f.bc.ics);
+
+			for (j = 0; j < defs[i].nic; j ++)
+				m_ic_init(&func->f.bc.ics[j]);
+		}
+
+		func_ptrs[i] = func;
+	}
+
+	if (m_closure_convert(&test_module) != M_OK)
+		M_ERROR("closure conversion failed");
+}
+
+/*Release the functions of the test module.*/
+static inline void
+test_module_deinit (void)
+{
+	M_Function *func;
+	int i;
+
+	for (i = 0; i < test_module.nfunc; i ++) {
+		func = test_module.funcs[i];
+
+		m_function_deinit(func);
+
+		if (func->f.bc.ics) {
+			m_free(func->f.bc.ics);
+			func->f.bc.ics = NULL;
+		}
+	}
+}
+
+/*Run the function "id" with one argument and return the result.*/
+static inline M_Result
+run (M_Actor *actor, int id, M_Value arg, uint32_t budget, M_Value *pr,
+			uint32_t *pyields)
+{
+	M_Value fv;
+	M_Result r;
+	uint32_t yields = 0;
+
+	fv = m_value_from_closure(m_closure_new(test_module.funcs[id], NULL,
+				NULL));
+
+	r = m_actor_call(actor, fv, 1, &arg);
+	if (r != M_OK)
+		return r;
+
+	while ((r = m_interp_run(actor, budget)) == M_NONE)
+		yields ++;
+
+	*pr = actor->retv;
+
+	if (pyields)
+		*pyields = yields;
+
+	return r;
+}
+
+#endif